@@ -0,0 +1,122 @@
+/*
+ *  adaptive.ino - Motion-triggered adaptive sampling rate.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "SpresenseIMU.h"
+#include "SpresenseAhrs.h"
+#include "ImuAdaptive.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+// IMU設定
+#define ACTIVE_RATE   (960)  // Hz, while moving
+#define ACTIVE_FIFO   (4)
+#define IDLE_RATE     (15)   // Hz, while static
+#define IDLE_FIFO     (4)    // 3.75 wake-ups per second
+#define HOLD_SECONDS  (2.0f) // static this long before dropping the rate
+#define HEARTBEAT     (15)   // one idle sample per second handed out
+#define ADRANGE       (4)    // G
+#define GDRANGE (    500)    // dps
+
+#define REPORT_SECONDS (10)
+
+ImuAdaptive   adaptive;
+SpresenseAhrs ahrs(SpresenseAhrs::MADGWICK);
+
+/****************************************************************************
+ * Setup
+ ****************************************************************************/
+void setup(void)
+{
+  int ret;
+  ret = SpresenseIMU.begin();
+  if (ret < 0)
+    {
+      printf("Spresense IMU begin.\n");
+      return;
+    }
+
+  ret = SpresenseIMU.initialize(ACTIVE_RATE, ADRANGE, GDRANGE, ACTIVE_FIFO);
+  if (!ret)
+    {
+      SpresenseIMU.end();
+      return;
+    }
+
+  ret = SpresenseIMU.start();
+  if (!ret)
+    {
+      SpresenseIMU.finalize();
+      SpresenseIMU.end();
+      return;
+    }
+
+  // Thresholds of the position example's ZUPT, with 2x hysteresis.
+  adaptive.detector().setThresholds(IMU_STATIC_GYRO, IMU_STATIC_ACCEL, 2.0f);
+  adaptive.setActive(ACTIVE_RATE, ACTIVE_FIFO);
+  adaptive.setIdle(IDLE_RATE, IDLE_FIFO, HOLD_SECONDS, HEARTBEAT);
+  if (!adaptive.begin(SpresenseIMU))
+    {
+      printf("Adaptive begin error.\n");
+      return;
+    }
+
+  ahrs.begin(ACTIVE_RATE);
+}
+
+/****************************************************************************
+ * Loop
+ ****************************************************************************/
+void loop()
+{
+  static uint32_t samples = 0;
+  static uint32_t last_report = 0;
+  cxd5602pwbimu_data_t batch[32];
+
+  size_t n = adaptive.read(batch, 32);
+  if (n == 0) return;
+
+  // Markers switch the filter's nominal rate; print them as they come.
+  for (size_t i = 0; i < n; i++)
+    {
+      ImuReconfig c;
+      if (imuMarkerConfig(batch[i], c))
+        {
+          printf("-> %d Hz, FIFO %d (blackout %lu us)\n",
+                 c.rate, c.nfifos, (unsigned long)c.blackout_us);
+        }
+      else
+        {
+          samples++;
+        }
+    }
+  ahrs.update(batch, n);
+
+  uint32_t now = millis() / 1000;
+  if (now - last_report >= REPORT_SECONDS)
+    {
+      last_report = now;
+      pwbEulerData e = ahrs.getQuaternion().toEuler();
+      printf("%s, %lu samples handed out, roll %F pitch %F yaw %F\n",
+             adaptive.active() ? "active" : "idle", (unsigned long)samples,
+             e.roll, e.pitch, e.yaw);
+      adaptive.stats().print();
+      samples = 0;
+    }
+}
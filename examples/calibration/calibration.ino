@@ -0,0 +1,178 @@
+/*
+ *  calibration.ino - Six-position accel / gyro calibration stored in flash.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "SpresenseIMU.h"
+#include "ImuCalibration.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+// IMU設定 (use the ranges of the application: the scale depends on them)
+#define SAMPLINGRATE  (960)  // Hz
+#define ADRANGE       (4)    // G
+#define GDRANGE       (500)  // dps
+#define FIFO_DEPTH    (4)
+
+#define POSE_SECONDS     (5)
+#define POSE_NUMBER      (6)
+#define ROTATION_NUMBER  (3)
+#define ROTATION_DEGREES (360.0f)
+
+// SPI flash; "/mnt/sd0/imucal.dat" for SD.
+#define CALIBRATION_PATH "/mnt/spif/imucal.dat"
+
+ImuCalibrator  calibrator;
+ImuCalibration calibration;
+
+static const char* pose_name[POSE_NUMBER] = {
+  "Z up", "Z down", "X up", "X down", "Y up", "Y down"
+};
+static const char* axis_name[ROTATION_NUMBER] = { "Z", "X", "Y" };
+
+/****************************************************************************
+ * Key input
+ ****************************************************************************/
+int waitKey()
+{
+  while (Serial.available() <= 0);
+  int c = Serial.read();
+  while (Serial.available() > 0) Serial.read();
+  return c;
+}
+
+/****************************************************************************
+ * One static pose
+ ****************************************************************************/
+bool recordPose(int i)
+{
+  printf("Pose %d/%d: lay the board %s and keep it still, then press Enter.\n",
+         i + 1, POSE_NUMBER, pose_name[i]);
+  waitKey();
+  sleep(1);
+
+  cxd5602pwbimu_data_t batch[FIFO_DEPTH];
+  size_t total = 0;
+
+  calibrator.beginPose();
+  while (total < (size_t)POSE_SECONDS * SAMPLINGRATE)
+    {
+      size_t n = SpresenseIMU.read(batch, FIFO_DEPTH);
+      if (n == 0) return false;
+      calibrator.addPose(batch, n);
+      total += n;
+    }
+  return calibrator.endPose();
+}
+
+/****************************************************************************
+ * One rotation of ROTATION_DEGREES on the table
+ ****************************************************************************/
+bool recordRotation(int i)
+{
+  printf("Rotation %d/%d: press Enter, turn the board %.0f degrees about %s, "
+         "stop and press Enter.\n", i + 1, ROTATION_NUMBER, ROTATION_DEGREES, axis_name[i]);
+  waitKey();
+
+  cxd5602pwbimu_data_t batch[FIFO_DEPTH];
+
+  calibrator.beginRotation();
+  while (Serial.available() <= 0)
+    {
+      size_t n = SpresenseIMU.read(batch, FIFO_DEPTH);
+      if (n == 0) return false;
+      calibrator.addRotation(batch, n);
+    }
+  waitKey();
+  return calibrator.endRotation(ROTATION_DEGREES);
+}
+
+/****************************************************************************
+ * Setup
+ ****************************************************************************/
+void setup(void)
+{
+  Serial.begin(115200);
+
+  int ret;
+  ret = SpresenseIMU.begin();
+  if (ret < 0)
+    {
+      printf("Spresense IMU begin.\n");
+      return;
+    }
+
+  ret = SpresenseIMU.initialize(SAMPLINGRATE, ADRANGE, GDRANGE, FIFO_DEPTH);
+  if (!ret)
+    {
+      SpresenseIMU.end();
+      return;
+    }
+
+  ret = SpresenseIMU.start();
+  if (!ret)
+    {
+      SpresenseIMU.finalize();
+      SpresenseIMU.end();
+      return;
+    }
+
+  for (int i = 0; i < POSE_NUMBER; )
+    {
+      if (recordPose(i)) i++;
+    }
+
+  printf("Rotate about each axis? (y/n)\n");
+  if (waitKey() == 'y')
+    {
+      for (int i = 0; i < ROTATION_NUMBER; )
+        {
+          if (recordRotation(i)) i++;
+        }
+    }
+
+  if (!calibrator.solve(calibration))
+    {
+      printf("Calibration failed.\n");
+      return;
+    }
+  calibration.print();
+
+  if (calibration.save(CALIBRATION_PATH))
+    {
+      printf("Saved to %s\n", CALIBRATION_PATH);
+    }
+
+  // From here on every sample is corrected.
+  SpresenseIMU.setCalibration(&calibration);
+}
+
+/****************************************************************************
+ * Loop
+ ****************************************************************************/
+void loop()
+{
+  pwbImuData avg;
+
+  if (SpresenseIMU.getAverage(avg, SAMPLINGRATE))
+    {
+      const cxd5602pwbimu_data_t& d = avg.data;
+      float g = sqrtf(d.ax * d.ax + d.ay * d.ay + d.az * d.az);
+      printf("|accel| %.4f m/s^2, gyro %.5f %.5f %.5f rad/s\n", g, d.gx, d.gy, d.gz);
+    }
+}
@@ -0,0 +1,151 @@
+/*
+ *  capture.ino - Event-triggered capture with pre- and post-trigger samples.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "SpresenseIMU.h"
+#include "ImuCapture.h"
+#include <SDHCI.h>
+
+SDClass SD;  /**< SDClass object */
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+// IMU設定
+#define SAMPLINGRATE  (1920)
+#define ADRANGE       (16)   // G, shocks above 4 G would clip
+#define GDRANGE       (2000) // dps
+#define FIFO_DEPTH    (4)
+
+// トリガー
+#define SHOCK_THRESHOLD (2.0f * IMU_GRAVITY)  // m/s^2 around 1 G
+#define RATE_THRESHOLD  (6.0f)                 // rad/s
+#define TRIGGER_PIN     (PIN_D02)              // falling edge
+
+// 窓: 0.5 s before, 1 s after, up to 5 s after while retriggered
+#define PRE_SAMPLES   (SAMPLINGRATE / 2)
+#define POST_SAMPLES  (SAMPLINGRATE)
+#define MAX_POST      (SAMPLINGRATE * 5)
+
+// Recorder buffers: one SD cluster each. The file is preallocated for
+// the longest event.
+#define REC_BUFFER_SIZE   (32768)
+#define REC_BUFFER_NUMBER (4)
+#define MAX_EVENT_SIZE    ((PRE_SAMPLES + MAX_POST) * sizeof(cxd5602pwbimu_data_t) + 4096)
+
+ImuRecorder recorder;
+ImuCapture  capture;
+ImuCaptureLog* output;
+
+/****************************************************************************
+ * External trigger
+ ****************************************************************************/
+void onTrigger()
+{
+  capture.trigger();
+}
+
+/****************************************************************************
+ * Setup
+ ****************************************************************************/
+void setup(void)
+{
+  int ret;
+
+  while (!SD.begin())
+    {
+      printf("Insert SD card.\n");
+      delay(1000);
+    }
+
+  if (!recorder.begin(REC_BUFFER_SIZE, REC_BUFFER_NUMBER))
+    {
+      printf("Recorder begin error.\n");
+      return;
+    }
+
+  ImuLogConfig config;
+  config.rate          = SAMPLINGRATE;
+  config.adrange       = ADRANGE;
+  config.gdrange       = GDRANGE;
+  config.nfifos        = FIFO_DEPTH;
+  config.encoding      = IMU_LOG_RAW;
+  config.block_samples = SAMPLINGRATE / 4;
+  output = new ImuCaptureLog(recorder, config, "/mnt/sd0/evt%03lu.dat", MAX_EVENT_SIZE);
+
+  capture.setWindow(PRE_SAMPLES, POST_SAMPLES, MAX_POST);
+  capture.setShock(SHOCK_THRESHOLD);
+  capture.setRate(RATE_THRESHOLD);
+  if (!capture.begin(*output))
+    {
+      printf("Capture begin error.\n");
+      return;
+    }
+
+  pinMode(TRIGGER_PIN, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(TRIGGER_PIN), onTrigger, FALLING);
+
+  ret = SpresenseIMU.begin();
+  if (ret < 0)
+    {
+      printf("Spresense IMU begin.\n");
+      return;
+    }
+
+  ret = SpresenseIMU.initialize(SAMPLINGRATE, ADRANGE, GDRANGE, FIFO_DEPTH);
+  if (!ret)
+    {
+      SpresenseIMU.end();
+      return;
+    }
+
+  ret = SpresenseIMU.start();
+  if (!ret)
+    {
+      SpresenseIMU.finalize();
+      SpresenseIMU.end();
+      return;
+    }
+}
+
+/****************************************************************************
+ * Loop
+ ****************************************************************************/
+void loop()
+{
+  static uint32_t last_event = 0;
+  cxd5602pwbimu_data_t batch[FIFO_DEPTH * 4];
+
+  size_t n = SpresenseIMU.read(batch, FIFO_DEPTH * 4);
+  if (n == 0) return;
+
+  // Only queues: the files are opened, written and closed on the
+  // recorder thread, so reading keeps up at 1920 Hz.
+  capture.process(batch, n);
+
+  const ImuCaptureEvent& e = capture.lastEvent();
+  if (!capture.capturing() && e.id != last_event)
+    {
+      last_event = e.id;
+      printf("event %lu (%s): %lu + %lu samples, peak %F m/s^2, %F rad/s\n",
+             (unsigned long)e.id,
+             e.source == IMU_TRIG_SHOCK ? "shock" : e.source == IMU_TRIG_RATE ? "rate" : "external",
+             (unsigned long)e.pre, (unsigned long)e.post, e.peak_accel, e.peak_gyro);
+      capture.stats().print();
+    }
+}
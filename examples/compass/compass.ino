@@ -18,7 +18,7 @@
  */
 
 #include "SpresenseIMU.h"
-#include <MadgwickAHRS.h>
+#include "SpresenseAhrs.h"
 
 /****************************************************************************
  * Pre-processor Definitions
@@ -36,7 +36,7 @@
 pwbGyroData dataArray[MAX_CALIBRATION];
 pwbGyroData bias_vec;
 
-Madgwick MadgwickFilter;
+SpresenseAhrs ahrs;
 
 /****************************************************************************
  * calibration
@@ -128,7 +128,7 @@ void setup(void)
       return;
     }
 
-  MadgwickFilter.begin(SAMPLINGRATE);
+  ahrs.begin(SAMPLINGRATE);
 
   ret = SpresenseIMU.start();
   if (!ret)
@@ -144,8 +144,8 @@ void setup(void)
 
   pwbImuData imuData;
   if (SpresenseIMU.get(imuData)) {
-    MadgwickFilter.updateIMU(imuData.data.gx*180/PI, imuData.data.gy*180/PI, imuData.data.gz*180/PI, imuData.data.ax, imuData.data.ay, imuData.data.az);
-    baseAngle -= MadgwickFilter.getYaw();
+    ahrs.update(imuData.data);
+    baseAngle -= ahrs.getYaw();
   printf("baseAngle = %F\n",baseAngle);
   }
 
@@ -158,8 +158,8 @@ void loop()
 {
   pwbImuData imuData;
   if (SpresenseIMU.get(imuData)) {
-    MadgwickFilter.updateIMU(imuData.data.gx*180/PI, imuData.data.gy*180/PI, imuData.data.gz*180/PI, imuData.data.ax, imuData.data.ay, imuData.data.az);
-    float angle  = MadgwickFilter.getYaw() - baseAngle;
+    ahrs.update(imuData.data);
+    float angle  = ahrs.getYaw() - baseAngle;
     if(angle<0) angle += 360.0;
     printf("angle = %F\n", angle);
   }  
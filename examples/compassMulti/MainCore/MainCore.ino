@@ -22,7 +22,8 @@
 #endif
 
 #include "SpresenseIMU.h"
-#include <MadgwickAHRS.h>
+#include "SpresenseAhrs.h"
+#include "GyroCompass.h"
 
 #include <MP.h>
 
@@ -35,14 +36,16 @@
 #define GDRANGE (    500)    // dps
 #define FIFO_DEPTH    (1)    // FIFO
 
-#define MAX_CALIBRATION  (20)
 #define MIM_CALIBRATION  (3)
-#define CALIBRATION_TIME (10)
+#define POSE_STDERR      (2.0e-6)  // rad/s, 姿勢ごとの平均値の標準誤差
+#define POSE_MIN_TIME    (2)       // sec
+#define POSE_MAX_TIME    (30)      // sec
 
-pwbGyroData dataArray[MAX_CALIBRATION];
+GyroCompass compass;
+pwbGyroData lastPose;
 pwbGyroData bias_vec;
 
-Madgwick MadgwickFilter;
+SpresenseAhrs ahrs;
 
 const int disp_core = 1;
 
@@ -52,35 +55,59 @@ const int disp_core = 1;
 int calibration()
 {
 
+  compass.setConvergence(POSE_STDERR, POSE_MIN_TIME*SAMPLINGRATE, POSE_MAX_TIME*SAMPLINGRATE);
+
   Serial.println("Press 'c' key with the Spresense board stationary.");
   ledOn(LED0);
 
-  for(int i=0;i<MAX_CALIBRATION;){
+  for(int i=0;;){
 
     while(Serial.available() <= 0);
 
     switch (Serial.read()) {
       case 'c': {
-        Serial.println("Calibration No."+i);
+        printf("Calibration No.%d\n", i);
         Serial.print("Count Down to start T :");
         for(int count_down_time = 3;count_down_time>=0;count_down_time--){
           Serial.print(count_down_time);
           Serial.print(". ");
           sleep(1);
         }
-        Serial.print("\nStart Calibration for ");
-        Serial.print(CALIBRATION_TIME);
-        Serial.println(" seconds");
+        Serial.println("\nStart Calibration until the average settles");
         ledOff(LED0);
         ledOn(LED1);
-        pwbImuData data;
-        if (SpresenseIMU.getAverage(data,(CALIBRATION_TIME*SAMPLINGRATE))) {
-          Serial.println("Calibration done!");
-          dataArray[i] = data;
-          i++;
-          ledOff(LED1);
-        } else {
+
+        bool ok = true;
+        compass.beginPose();
+        while (!compass.poseConverged()) {
+          cxd5602pwbimu_data_t data;
+          if (!SpresenseIMU.get(data)) {
+            ok = false;
+            break;
+          }
+          compass.addSample(data);
+          if (compass.poseSamples() % SAMPLINGRATE == 0) {
+            printf("  %u s : stderr = %.3e rad/s\n",
+                   (unsigned)(compass.poseSamples() / SAMPLINGRATE), compass.poseStdErr());
+          }
+        }
+        ledOff(LED1);
+
+        if (!ok) {
           Serial.println("Device read error!");
+          break;
+        }
+
+        // endPose() starts the next pose: take the count first.
+        uint32_t samples = compass.poseSamples();
+        compass.endPose(&lastPose);
+        i++;
+        printf("Calibration done! (%u samples)\n", (unsigned)samples);
+
+        double radius, residual;
+        if (compass.fit(&bias_vec, &radius, &residual)) {
+          printf("  bias = %.4e, %.4e  earth rate = %.4e  residual = %.2e rad/s\n",
+                 bias_vec.x, bias_vec.y, radius, residual);
         }
         break;
       }
@@ -111,13 +138,7 @@ int calibration()
       default:
         break;
     }
-  }  
-  
-  Serial.print("Calibration completed ");
-  Serial.print(MAX_CALIBRATION);
-  Serial.println(" times.");
-
-  return MAX_CALIBRATION;
+  }
 
 }
 
@@ -148,7 +169,7 @@ void setup(void)
       return;
     }
 
-  MadgwickFilter.begin(SAMPLINGRATE);
+  ahrs.begin(SAMPLINGRATE);
 
   ret = SpresenseIMU.start();
   if (!ret)
@@ -158,14 +179,16 @@ void setup(void)
       return;
     }
 
-  int num = calibration();
-  SpresenseIMU.calcEarthsRotation(dataArray, num, &bias_vec);
-  baseAngle  = SpresenseIMU.calcAngleFrX(dataArray[num],bias_vec);
+  calibration();
+  if (!compass.fit(&bias_vec)) {
+    printf("Gyrocompass fit failed.\n");
+  }
+  baseAngle  = SpresenseIMU.calcAngleFrX(lastPose,bias_vec);
 
   pwbImuData imuData;
   if (SpresenseIMU.get(imuData)) {
-    MadgwickFilter.updateIMU(imuData.data.gx*180/PI, imuData.data.gy*180/PI, imuData.data.gz*180/PI, imuData.data.ax, imuData.data.ay, imuData.data.az);
-    baseAngle -= MadgwickFilter.getYaw();
+    ahrs.update(imuData.data);
+    baseAngle -= ahrs.getYaw();
     printf("baseAngle = %F\n",baseAngle);
   }
 
@@ -187,8 +210,8 @@ void loop()
   static int i=0;
   pwbImuData imuData;
   if (SpresenseIMU.get(imuData)) {
-    MadgwickFilter.updateIMU(imuData.data.gx*180/PI, imuData.data.gy*180/PI, imuData.data.gz*180/PI, imuData.data.ax, imuData.data.ay, imuData.data.az);
-    float angle  = MadgwickFilter.getYaw() - baseAngle;
+    ahrs.update(imuData.data);
+    float angle  = ahrs.getYaw() - baseAngle;
     if(angle<0) angle += 360.0;
 //    printf("angle = %F\n", angle);
 
@@ -18,19 +18,20 @@
  */
 
 #include "SpresenseIMU.h"
+#include "ImuAllan.h"
 
 // ====== Settings ======
 #define SAMPLINGRATE   (1920)   // Hz
 #define ADRANGE        (4)      // [G]
 #define GDRANGE        (500)    // [dps]
-#define FIFO_DEPTH     (1)      // FIFO depth
+#define FIFO_DEPTH     (4)      // FIFO depth (samples per wakeup)
 
-#define RECORD_SEC     (3)
-#define MAX_SAMPLES    (SAMPLINGRATE * RECORD_SEC)
+#define RECORD_SEC     (3 * 3600)  // total measurement time
+#define REPORT_SEC     (600)       // interim report interval
 
-// ====== Buffer ======
-static pwbImuData g_buf[MAX_SAMPLES];
-static int g_count = 0;
+// ====== Allan deviation ======
+static ImuAllan g_allan;
+static uint64_t g_next_report = (uint64_t)SAMPLINGRATE * REPORT_SEC;
 static bool g_done = false;
 
 void setup(void)
@@ -50,6 +51,8 @@ void setup(void)
     return;
   }
 
+  g_allan.begin(SAMPLINGRATE);
+
   ret = SpresenseIMU.start();
   if (!ret) {
     printf("[FATAL] SpresenseIMU.start() failed\n");
@@ -59,14 +62,23 @@ void setup(void)
   }
 
   printf("=== eval_sample ===\n");
-  printf("Capture: %d Hz x %d sec => %d samples\n", SAMPLINGRATE, RECORD_SEC, MAX_SAMPLES);
-  printf("Start capture...\n");
+  printf("Allan deviation: %d Hz x %d sec, keep the board still\n", SAMPLINGRATE, RECORD_SEC);
+  printf("Start measurement...\n");
 }
 
-static void dump_buffer(void)
+static void report(void)
 {
-  for (int i = 0; i < g_count; i++) {
-    g_buf[i].print();
+  static const char* axis[IMU_ALLAN_AXES] = { "gx", "gy", "gz", "ax", "ay", "az" };
+
+  printf("--- %lu sec ---\n", (unsigned long)(g_allan.samples() / SAMPLINGRATE));
+  g_allan.print();
+
+  for (int a = 0; a < IMU_ALLAN_AXES; a++) {
+    ImuAllanNoise n;
+    if (g_allan.noise(a, n)) {
+      printf("%s: RW=%.3e BI=%.3e (tau=%.1f s) RRW=%.3e\n",
+             axis[a], n.random_walk, n.bias_instability, n.tau_bias, n.rate_random_walk);
+    }
   }
 }
 
@@ -77,22 +89,23 @@ void loop(void)
     return;
   }
 
-  pwbImuData imuData;
+  cxd5602pwbimu_data_t buf[FIFO_DEPTH];
+  size_t n = SpresenseIMU.read(buf, FIFO_DEPTH);
+
+  if (n > 0) {
+    g_allan.add(buf, n);
 
-  if (SpresenseIMU.get(imuData)) {
-    if (g_count < MAX_SAMPLES) {
-      g_buf[g_count] = imuData;
-      g_count++;
+    if (g_allan.samples() >= g_next_report) {
+      report();
+      g_next_report += (uint64_t)SAMPLINGRATE * REPORT_SEC;
     }
 
-    if (g_count >= MAX_SAMPLES) {
+    if (g_allan.samples() >= (uint64_t)SAMPLINGRATE * RECORD_SEC) {
 
       SpresenseIMU.stop();
 
-      printf("Capture done: %d samples\n", g_count);
-      printf("Dump start...\n");
-      dump_buffer();
-      printf("Dump end.\n");
+      printf("Measurement done: %lu samples\n", (unsigned long)g_allan.samples());
+      report();
 
       SpresenseIMU.finalize();
       SpresenseIMU.end();
@@ -101,4 +114,3 @@ void loop(void)
     }
   }
 }
-
@@ -0,0 +1,153 @@
+/*
+ *  hotPathBench.ino - Cycle counts of the hot paths on the board.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "SpresenseIMU.h"
+#include "ImuCycles.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+// IMU設定
+#define SAMPLINGRATE (1920)  // Hz
+#define ADRANGE       (4)    // G
+#define GDRANGE (    500)    // dps
+#define FIFO_DEPTH    (4)    // FIFO
+
+#define SAMPLE_NUMBER (1920) // 1 second
+#define AVERAGE_COUNT (64)
+#define POSES         (8)
+
+#define CPU_HZ        (156000000)
+
+static cxd5602pwbimu_data_t samples[SAMPLE_NUMBER];
+static volatile float sink;
+
+/****************************************************************************
+ * One row: cycles per call and per sample, and the share of one sample
+ * period at SAMPLINGRATE
+ ****************************************************************************/
+static void row(const char* name, uint32_t cycles, uint32_t calls, uint32_t n)
+{
+  uint32_t per_sample = cycles / n;
+  printf("%-28s %10lu %10lu %7.2f%%\n", name, (unsigned long)(cycles / calls),
+         (unsigned long)per_sample, 100.0f * per_sample * SAMPLINGRATE / CPU_HZ);
+}
+
+/****************************************************************************
+ * Setup
+ ****************************************************************************/
+void setup(void)
+{
+  int ret;
+  ret = SpresenseIMU.begin();
+  if (ret < 0)
+    {
+      printf("Spresense IMU begin.\n");
+      return;
+    }
+
+  ret = SpresenseIMU.initialize(SAMPLINGRATE, ADRANGE, GDRANGE, FIFO_DEPTH);
+  if (!ret)
+    {
+      SpresenseIMU.end();
+      return;
+    }
+
+  ret = SpresenseIMU.start();
+  if (!ret)
+    {
+      SpresenseIMU.finalize();
+      SpresenseIMU.end();
+      return;
+    }
+
+  imuCyclesBegin();
+}
+
+/****************************************************************************
+ * Loop
+ ****************************************************************************/
+void loop()
+{
+  /* get() and getAverage() wait for the sensor, so their cycles are
+   * mostly idle time; the read path's own cost is the latency from the
+   * poll() wake-up to the end of each watermark read. */
+  SpresenseIMU.resetStats();
+  if (!SpresenseIMU.get(samples, SAMPLE_NUMBER)) return;
+  ImuStats s = SpresenseIMU.stats();
+
+  pwbImuData avg;
+  uint32_t start = DWT_CYCCNT;
+  if (!SpresenseIMU.getAverage(avg, AVERAGE_COUNT)) return;
+  uint32_t average_cycles = DWT_CYCCNT - start;
+
+  printf("function                        cycles/call cycles/smp  period\n");
+  printf("%-28s %10lu us per watermark (max %lu us)\n", "get (read path)",
+         (unsigned long)(s.reads ? s.latency_us_total / s.reads : 0),
+         (unsigned long)s.latency_us_max);
+  row("getAverage(64), with waits", average_cycles, 1, AVERAGE_COUNT);
+
+  start = DWT_CYCCNT;
+  for (int i = 1; i < SAMPLE_NUMBER; i++) {
+    pwbQuaternionData d;
+    SpresenseIMU.convQuaternion(d, samples[i], samples[i - 1]);
+    sink = d.q1;
+  }
+  row("convQuaternion", DWT_CYCCNT - start, SAMPLE_NUMBER - 1, SAMPLE_NUMBER - 1);
+
+  pwbQuaternionData q, d;
+  SpresenseIMU.convQuaternion(d, samples[1], samples[0]);
+  start = DWT_CYCCNT;
+  for (int i = 0; i < SAMPLE_NUMBER; i++) q = q * d;
+  row("pwbQuaternionData::operator*", DWT_CYCCNT - start, SAMPLE_NUMBER, SAMPLE_NUMBER);
+  sink = q.q0;
+
+  start = DWT_CYCCNT;
+  for (int i = 0; i < SAMPLE_NUMBER; i++) {
+    q.q1 = samples[i].gx * 0.1f;
+    pwbEulerData e = q.toEuler();
+    sink = e.yaw;
+  }
+  row("pwbQuaternionData::toEuler", DWT_CYCCNT - start, SAMPLE_NUMBER, SAMPLE_NUMBER);
+
+  pwbQuaternionData b;
+  start = DWT_CYCCNT;
+  for (int i = 0; i < SAMPLE_NUMBER; i += FIFO_DEPTH) {
+    SpresenseIMU.integrateGyro(&samples[i], FIFO_DEPTH, b);
+  }
+  row("integrateGyro(FIFO)", DWT_CYCCNT - start, SAMPLE_NUMBER / FIFO_DEPTH, SAMPLE_NUMBER);
+  sink = b.q0;
+
+  /* Circle fit of pose means: horizontal earth rate plus a bias */
+  pwbGyroData poses[POSES];
+  for (int p = 0; p < POSES; p++) {
+    float a = 2 * (float)M_PI * p / POSES;
+    poses[p].x = 1e-4f + 6e-5f * cosf(a);
+    poses[p].y = -2e-4f - 6e-5f * sinf(a);
+    poses[p].z = 3.4e-4f;
+  }
+  pwbGyroData bias;
+  start = DWT_CYCCNT;
+  SpresenseIMU.calcEarthsRotation(poses, POSES, &bias);
+  row("calcEarthsRotation(8 poses)", DWT_CYCCNT - start, 1, POSES);
+
+  printf("(period: share of one sample period at %d Hz, %d MHz)\n\n",
+         SAMPLINGRATE, CPU_HZ / 1000000);
+  sleep(1);
+}
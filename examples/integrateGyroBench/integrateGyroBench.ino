@@ -0,0 +1,109 @@
+/*
+ *  integrateGyroBench.ino - integrateGyro() accuracy and cycle count.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "SpresenseIMU.h"
+#include "ImuCycles.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+// IMU設定
+#define SAMPLINGRATE (1920)  // Hz
+#define ADRANGE       (4)    // G
+#define GDRANGE (    500)    // dps
+#define FIFO_DEPTH    (4)    // FIFO
+
+#define SAMPLE_NUMBER (1920) // 1 second of rotation
+#define BATCH_SIZE    (FIFO_DEPTH)
+
+static cxd5602pwbimu_data_t samples[SAMPLE_NUMBER];
+
+/****************************************************************************
+ * Setup
+ ****************************************************************************/
+void setup(void)
+{
+  int ret;
+  ret = SpresenseIMU.begin();
+  if (ret < 0)
+    {
+      printf("Spresense IMU begin.\n");
+      return;
+    }
+
+  ret = SpresenseIMU.initialize(SAMPLINGRATE, ADRANGE, GDRANGE, FIFO_DEPTH);
+  if (!ret)
+    {
+      SpresenseIMU.end();
+      return;
+    }
+
+  ret = SpresenseIMU.start();
+  if (!ret)
+    {
+      SpresenseIMU.finalize();
+      SpresenseIMU.end();
+      return;
+    }
+
+  imuCyclesBegin();
+}
+
+/****************************************************************************
+ * Loop
+ ****************************************************************************/
+void loop()
+{
+  printf("Rotate the board...\n");
+  if (!SpresenseIMU.get(samples, SAMPLE_NUMBER)) {
+    return;
+  }
+
+  double r[4];
+  imuReferenceQuaternion(samples, SAMPLE_NUMBER, 1.0 / SAMPLINGRATE, r);
+
+  /* Per-sample path */
+  pwbQuaternionData a;
+  cxd5602pwbimu_data_t last = samples[0];
+  last.timestamp -= 19200000 / SAMPLINGRATE;
+  uint32_t start = DWT_CYCCNT;
+  for (int i = 0; i < SAMPLE_NUMBER; i++) {
+    pwbQuaternionData d;
+    SpresenseIMU.convQuaternion(d, samples[i], last);
+    a = a * d;
+    last = samples[i];
+  }
+  uint32_t conv_cycles = DWT_CYCCNT - start;
+
+  /* Batch kernel, one FIFO watermark per call */
+  pwbQuaternionData b;
+  start = DWT_CYCCNT;
+  for (int i = 0; i < SAMPLE_NUMBER; i += BATCH_SIZE) {
+    SpresenseIMU.integrateGyro(&samples[i], BATCH_SIZE, b);
+  }
+  uint32_t batch_cycles = DWT_CYCCNT - start;
+
+  printf("path                        cycles/sample  error(deg)\n");
+  printf("convQuaternion + operator*  %13lu  %10.6f\n",
+         (unsigned long)(conv_cycles / SAMPLE_NUMBER), imuErrorDeg(r, a));
+  printf("integrateGyro               %13lu  %10.6f\n",
+         (unsigned long)(batch_cycles / SAMPLE_NUMBER), imuErrorDeg(r, b));
+
+  sleep(1);
+}
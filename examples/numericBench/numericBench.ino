@@ -0,0 +1,195 @@
+/*
+ *  numericBench.ino - Kernels under the float / double / Q16.16 policies.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "SpresenseIMU.h"
+#include "ImuCycles.h"
+#include "ImuKernels.h"
+#include "GyroCompass.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+// IMU設定
+#define SAMPLINGRATE (1920)  // Hz
+#define ADRANGE       (4)    // G
+#define GDRANGE (    500)    // dps
+#define FIFO_DEPTH    (4)    // FIFO
+
+#define SAMPLE_NUMBER (1920) // 1 second of rotation
+#define AVERAGE_BLOCK (64)
+#define FIR_RATIO     (8)
+#define FIR_TAPS      (8 * FIR_RATIO)
+
+static cxd5602pwbimu_data_t samples[SAMPLE_NUMBER];
+static float coef[FIR_TAPS];
+
+/****************************************************************************
+ * Reference (double)
+ ****************************************************************************/
+struct Reference {
+  double q[4];
+  double az;       // mean of the first AVERAGE_BLOCK samples
+  double fir;      // gx of the first FIR output
+  double mean[3];  // gyro mean of all samples
+};
+
+static void reference(Reference& ref)
+{
+  imuReferenceQuaternion(samples, SAMPLE_NUMBER, 1.0 / SAMPLINGRATE, ref.q);
+
+  ref.az = 0;
+  for (int i = 0; i < AVERAGE_BLOCK; i++) ref.az += samples[i].az;
+  ref.az /= AVERAGE_BLOCK;
+
+  ref.fir = 0;
+  for (int k = 0; k < FIR_TAPS; k++) ref.fir += (double)coef[k] * samples[k].gx;
+
+  ref.mean[0] = ref.mean[1] = ref.mean[2] = 0;
+  for (int i = 0; i < SAMPLE_NUMBER; i++) {
+    ref.mean[0] += samples[i].gx;
+    ref.mean[1] += samples[i].gy;
+    ref.mean[2] += samples[i].gz;
+  }
+  for (int k = 0; k < 3; k++) ref.mean[k] /= SAMPLE_NUMBER;
+}
+
+/****************************************************************************
+ * One policy: cycles/sample and error of each kernel
+ ****************************************************************************/
+template<typename T>
+static void run(const Reference& ref)
+{
+  typedef ImuNumeric<T> N;
+  static pwbImuDataT<T> s[SAMPLE_NUMBER];
+  uint32_t cycles[4];
+  double   err[4];
+
+  imuConvert(samples, SAMPLE_NUMBER, s);
+
+  /* Average */
+  pwbImuDataT<T> avg;
+  uint32_t start = DWT_CYCCNT;
+  for (int i = 0; i < SAMPLE_NUMBER; i += AVERAGE_BLOCK) imuAverage(&s[i], AVERAGE_BLOCK, avg);
+  cycles[0] = DWT_CYCCNT - start;
+  imuAverage(s, AVERAGE_BLOCK, avg);
+  err[0] = fabs(N::toDouble(avg.az) - ref.az);
+
+  /* Quaternion update, one FIFO watermark per call */
+  pwbQuaternionT<T> q;
+  start = DWT_CYCCNT;
+  for (int i = 0; i < SAMPLE_NUMBER; i += FIFO_DEPTH) imuIntegrateGyro(&s[i], FIFO_DEPTH, q, 1.0f / SAMPLINGRATE);
+  cycles[1] = DWT_CYCCNT - start;
+  pwbQuaternionData qf;
+  q.to(qf);
+  err[1] = imuErrorDeg(ref.q, qf);
+
+  /* FIR, one output per FIR_RATIO inputs */
+  T h[FIR_TAPS];
+  for (int k = 0; k < FIR_TAPS; k++) h[k] = N::from(coef[k]);
+  typename N::Acc acc[6] = {};
+  int outs = 0;
+  start = DWT_CYCCNT;
+  for (int i = 0; i + FIR_TAPS <= SAMPLE_NUMBER; i += FIR_RATIO, outs++) {
+    typename N::Acc a[6] = {};
+    imuFirDot(h, &s[i], FIR_TAPS, a);
+    if (i == 0) memcpy(acc, a, sizeof(acc));
+  }
+  cycles[2] = DWT_CYCCNT - start;
+  err[2] = fabs(N::toDouble(N::fromProd(acc[0])) - ref.fir);
+
+  /* Gyrocompass pose accumulation */
+  GyroCompassT<T> gc;
+  gc.setConvergence(0, SAMPLE_NUMBER, SAMPLE_NUMBER);
+  start = DWT_CYCCNT;
+  for (int i = 0; i < SAMPLE_NUMBER; i++) gc.addSample(s[i]);
+  cycles[3] = DWT_CYCCNT - start;
+  pwbGyroData m = gc.poseMean();
+  err[3] = fabs(m.x - ref.mean[0]);
+  if (fabs(m.y - ref.mean[1]) > err[3]) err[3] = fabs(m.y - ref.mean[1]);
+
+  printf("%-8s %7lu %9.2e %7lu %9.2e %7lu %9.2e %7lu %9.2e\n", N::name(),
+         (unsigned long)(cycles[0] / SAMPLE_NUMBER), err[0],
+         (unsigned long)(cycles[1] / SAMPLE_NUMBER), err[1],
+         (unsigned long)(cycles[2] / (outs * FIR_RATIO)), err[2],
+         (unsigned long)(cycles[3] / SAMPLE_NUMBER), err[3]);
+}
+
+/****************************************************************************
+ * Setup
+ ****************************************************************************/
+void setup(void)
+{
+  int ret;
+  ret = SpresenseIMU.begin();
+  if (ret < 0)
+    {
+      printf("Spresense IMU begin.\n");
+      return;
+    }
+
+  ret = SpresenseIMU.initialize(SAMPLINGRATE, ADRANGE, GDRANGE, FIFO_DEPTH);
+  if (!ret)
+    {
+      SpresenseIMU.end();
+      return;
+    }
+
+  ret = SpresenseIMU.start();
+  if (!ret)
+    {
+      SpresenseIMU.finalize();
+      SpresenseIMU.end();
+      return;
+    }
+
+  /* Windowed-sinc low pass, as a decimator tap set */
+  float sum = 0;
+  for (int k = 0; k < FIR_TAPS; k++) {
+    float x  = k - 0.5f * (FIR_TAPS - 1);
+    float fc = 0.45f / FIR_RATIO;
+    float w  = 2 * M_PI * k / (FIR_TAPS - 1);
+    coef[k] = sinf(2 * M_PI * fc * x) / (M_PI * x) * (0.42f - 0.5f * cosf(w) + 0.08f * cosf(2 * w));
+    sum += coef[k];
+  }
+  for (int k = 0; k < FIR_TAPS; k++) coef[k] /= sum;
+
+  imuCyclesBegin();
+}
+
+/****************************************************************************
+ * Loop
+ ****************************************************************************/
+void loop()
+{
+  printf("Rotate the board...\n");
+  if (!SpresenseIMU.get(samples, SAMPLE_NUMBER)) {
+    return;
+  }
+
+  Reference ref;
+  reference(ref);
+
+  printf("policy   average   |az|err    quat  err(deg)     fir   |gx|err compass  |mean|err\n");
+  run<float>(ref);
+  run<double>(ref);
+  run<ImuQ16>(ref);
+  printf("(cycles/sample, error against the double reference)\n");
+
+  sleep(1);
+}
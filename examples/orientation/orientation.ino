@@ -18,13 +18,19 @@
  */
 
 #include "SpresenseIMU.h"
+#include "SpresenseAhrs.h"
 
 #define USE_QUATERNION
-#define USE_MADGWICK
+#define USE_AHRS
+//#define USE_ESKF      // attitude + online gyro bias (takes precedence over USE_AHRS)
 
-#ifdef USE_MADGWICK
-#include <MadgwickAHRS.h>
-Madgwick MadgwickFilter;
+#ifdef USE_AHRS
+SpresenseAhrs ahrs(SpresenseAhrs::MADGWICK);   // or SpresenseAhrs::MAHONY
+#endif
+
+#ifdef USE_ESKF
+#include "SpresenseEskf.h"
+SpresenseEskf eskf;
 #endif
 
 /****************************************************************************
@@ -35,14 +41,15 @@ Madgwick MadgwickFilter;
 #define ADRANGE      (4)    // G
 #define GDRANGE      (500)  // dps
 #define FIFO_DEPTH   (1)    // FIFO
+#define STREAM_SIZE  (256)  // samples buffered by the acquisition thread
+#define BATCH_SIZE   (16)   // samples processed per loop
+#define STATS_INTERVAL (60) // s, read-path stats dump (0: off)
 
 /****************************************************************************
  * Calibrate
  ****************************************************************************/
-float gyroBias[3] = {0, 0, 0};
+float gyroBias[3] = {0, 0, 0};  // rad/s
 float trueRate = 0;
-float trueDelta = 0;
-float maxDelta = 0;
 
 void calibrateGyroBias(int ms = 2000) {
   printf("Please Stop for Caribration(%d ms)...\n", ms);
@@ -50,20 +57,15 @@ void calibrateGyroBias(int ms = 2000) {
   cxd5602pwbimu_data_t raw;
   double sum[3] = {0, 0, 0};
   int count = 0;
-  float first_ts = 0;
-  float last_ts = 0;
   unsigned long start = millis();
 
+  SpresenseIMU.resetStats();
+
   while (millis() - start < (unsigned)ms) {
     if (SpresenseIMU.get(raw)) {
-      sum[0] += raw.gx * 180 / PI;
-      sum[1] += raw.gy * 180 / PI;
-      sum[2] += raw.gz * 180 / PI;
-      if(count==0) {
-        first_ts = (raw.timestamp  / 19200000.0f);
-      }else{
-        last_ts = (raw.timestamp  / 19200000.0f);
-      }
+      sum[0] += raw.gx;
+      sum[1] += raw.gy;
+      sum[2] += raw.gz;
       count++;
     }
   }
@@ -72,12 +74,15 @@ void calibrateGyroBias(int ms = 2000) {
     gyroBias[0] = sum[0] / count;
     gyroBias[1] = sum[1] / count;
     gyroBias[2] = sum[2] / count;
-    trueRate = 1.0f / ( (last_ts - first_ts) / count);
-    trueDelta = 1.0f / trueRate;
-    maxDelta = trueDelta * 1.2;
   }
 
-  printf("Gyro Bias (deg/s): %f, %f, %f\n", gyroBias[0], gyroBias[1], gyroBias[2]);
+  // Rate measured from the timestamps, with gaps and jitter of the window
+  ImuStats stats = SpresenseIMU.stats();
+  trueRate = (stats.rate() > 0) ? stats.rate() : SAMPLINGRATE;
+  stats.print();
+
+  printf("Gyro Bias (deg/s): %f, %f, %f\n",
+         gyroBias[0] * 180 / PI, gyroBias[1] * 180 / PI, gyroBias[2] * 180 / PI);
   printf("Sampling Rate: %f\n", trueRate);
 }
 
@@ -114,83 +119,89 @@ void setup(void)
   calibrateGyroBias(2000);
   ledOff(LED0); ledOff(LED1); ledOff(LED2); ledOff(LED3);
 
-#ifdef USE_MADGWICK
-  MadgwickFilter.begin(trueRate);
+#ifdef USE_AHRS
+  // dt is taken from the timestamps; the rate only covers the first sample.
+  ahrs.begin(trueRate);
+  ahrs.setGyroBias(gyroBias[0], gyroBias[1], gyroBias[2]);
 #endif
 
+#ifdef USE_ESKF
+  // The static estimate is only the starting point; the filter keeps tracking it.
+  eskf.begin(trueRate);
+  eskf.setInitialBias(gyroBias[0], gyroBias[1], gyroBias[2], 0.002f);
+#endif
+
+  // Acquisition keeps running in the background while loop() prints.
+  SpresenseIMU.setStatsInterval(STATS_INTERVAL);
+  if (!SpresenseIMU.startStreaming(STREAM_SIZE)) {
+    printf("Spresense IMU streaming error!.\n");
+  }
+
 }
 
 /****************************************************************************
- * Loop
+ * Update
  ****************************************************************************/
-void loop()
+void update(const cxd5602pwbimu_data_t* data, size_t n)
 {
-  cxd5602pwbimu_data_t data;
-  pwbQuaternionData result;
+  const cxd5602pwbimu_data_t& last = data[n - 1];
+  float timestamp = last.timestamp / 19200000.0f;
+
+#if defined(USE_ESKF)
+  eskf.update(data, n);
+  pwbQuaternionData attitude = eskf.getQuaternion();
+#elif defined(USE_AHRS)
+  ahrs.update(data, n);
+  pwbQuaternionData attitude = ahrs.getQuaternion();
+#else
   static pwbQuaternionData attitude;
-  static float last_timestamp = 0;
-
-  if (SpresenseIMU.get(data)) {
-
-    float timestamp = data.timestamp / 19200000.0f;
-
-    float delta = trueDelta;
-    if (last_timestamp > 0) {
-      delta = timestamp - last_timestamp;
-      if (delta <= 0 || delta > maxDelta ) delta = trueDelta;
-    }
-
-#ifdef USE_MADGWICK
-    MadgwickFilter.updateIMU(
-      (data.gx * 180/PI) - gyroBias[0],
-      (data.gy * 180/PI) - gyroBias[1],
-      (data.gz * 180/PI) - gyroBias[2],
-      data.ax, data.ay, data.az,
-      delta
-    );
+  SpresenseIMU.integrateGyro(data, n, attitude);
 #endif
 
 #ifdef USE_QUATERNION
-#ifdef USE_MADGWICK
-    // --- Quaternion ---
-    float q0 = MadgwickFilter.getQ0();
-    float q1 = MadgwickFilter.getQ1();
-    float q2 = MadgwickFilter.getQ2();
-    float q3 = MadgwickFilter.getQ3();
-
-    printf("%4.2F,%4.2F,%F,%F,%F,%F\n",timestamp, data.temp, q0, q1, q2, q3);
-
+  // --- Quaternion ---
+  printf("%4.2F,%4.2F,%F,%F,%F,%F\n",timestamp, last.temp, attitude.q0, attitude.q1, attitude.q2, attitude.q3);
 #else
-
-    SpresenseIMU.convQuaternion(result,data,last_timestamp);
-    attitude = attitude * result;
-
-    printf("%4.2F,%4.2F,%F,%F,%F,%F\n",timestamp, attitude.temp, attitude.q0, attitude.q1, attitude.q2, attitude.q3);
-
+  // --- Euler ---
+  pwbEulerData euler = attitude.toEuler();
+  printf("%4.2F,%4.2F,%F,%F,%F\n",
+         timestamp, last.temp, euler.roll, euler.pitch, euler.yaw);
 #endif
 
-#else
-#ifdef USE_MADGWICK
-    // --- Euler ---
-    float roll  = MadgwickFilter.getRoll();
-    float pitch = MadgwickFilter.getPitch();
-    float yaw   = MadgwickFilter.getYaw();
-
-    printf("%4.2F,%4.2F,%F,%F,%F\n",
-           timestamp, data.temp, roll, pitch, yaw);
-#else
-    SpresenseIMU.convQuaternion(result,data,last_timestamp);
-    attitude = attitude * result;
-
-    pwbEulerData euler = attitude.toEuler();
+#ifdef USE_ESKF
+  // Online gyro bias estimate, every 10 seconds. Unsigned tick
+  // differences keep working across the 32-bit wrap (every 223.7 s).
+  static bool     reported    = false;
+  static uint32_t last_report = 0;
+  if (!reported || (uint32_t)(last.timestamp - last_report) >= 10 * IMU_TICKS_PER_SEC) {
+    float b[3];
+    eskf.getGyroBias(b);
+    printf("Gyro Bias (deg/s): %f, %f, %f\n", b[0] * 180 / PI, b[1] * 180 / PI, b[2] * 180 / PI);
+    reported    = true;
+    last_report = last.timestamp;
+  }
+#endif
+}
 
-    printf("%4.2F,%4.2F,%F,%F,%F\n",
-           timestamp, data.temp, euler.roll, euler.pitch, euler.yaw);
+/****************************************************************************
+ * Loop
+ ****************************************************************************/
+void loop()
+{
+  static cxd5602pwbimu_data_t batch[BATCH_SIZE];
+  static uint32_t reported_overruns = 0;
 
-#endif
-#endif
+  size_t n = SpresenseIMU.popBatch(batch, BATCH_SIZE);
+  if (n == 0) {
+    usleep(1000);
+    return;
+  }
 
-    last_timestamp = timestamp;
+  // The whole batch goes through the filter; the latest attitude is printed.
+  update(batch, n);
 
+  if (SpresenseIMU.overruns() != reported_overruns) {
+    reported_overruns = SpresenseIMU.overruns();
+    printf("Overruns: %u\n", (unsigned)reported_overruns);
   }
 }
@@ -0,0 +1,143 @@
+/*
+ *  publisher.ino - One device reader, several consumers with their own rates.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <pthread.h>
+
+#include "SpresenseIMU.h"
+#include "SpresenseAhrs.h"
+#include "ImuPublisher.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+// IMU設定
+#define SAMPLINGRATE (960)   // Hz
+#define ADRANGE       (4)    // G
+#define GDRANGE (    500)    // dps
+#define FIFO_DEPTH    (4)    // FIFO
+
+#define AHRS_QUEUE    (256)  // samples (0.27 s at 960 Hz)
+#define DISPLAY_DECIM (96)   // 960 Hz -> 10 Hz
+#define DISPLAY_QUEUE (4)
+#define REPORT_EVERY  (100)  // display samples between subscriber reports
+
+ImuPublisher  publisher;
+ImuSubscriber ahrs_sub;      // every sample, for the filter
+ImuSubscriber display_sub;   // every DISPLAY_DECIM-th sample, latest wins
+
+SpresenseAhrs ahrs(SpresenseAhrs::MADGWICK);
+pthread_mutex_t attitude_lock = PTHREAD_MUTEX_INITIALIZER;
+pwbQuaternionData attitude;
+
+/****************************************************************************
+ * AHRS consumer (own thread, never waits for the display)
+ ****************************************************************************/
+void* ahrsThread(void*)
+{
+  static cxd5602pwbimu_data_t batch[32];
+
+  while (true) {
+    size_t n = ahrs_sub.read(batch, 32, -1);
+    if (n == 0) continue;
+
+    ahrs.update(batch, n);
+
+    pthread_mutex_lock(&attitude_lock);
+    attitude = ahrs.getQuaternion();
+    pthread_mutex_unlock(&attitude_lock);
+  }
+
+  return NULL;
+}
+
+/****************************************************************************
+ * Setup
+ ****************************************************************************/
+void setup(void)
+{
+  int ret;
+  ret = SpresenseIMU.begin();
+  if (ret < 0)
+    {
+      printf("Spresense IMU begin.\n");
+      return;
+    }
+
+  ret = SpresenseIMU.initialize(SAMPLINGRATE, ADRANGE, GDRANGE, FIFO_DEPTH);
+  if (!ret)
+    {
+      SpresenseIMU.end();
+      return;
+    }
+
+  ret = SpresenseIMU.start();
+  if (!ret)
+    {
+      SpresenseIMU.finalize();
+      SpresenseIMU.end();
+      return;
+    }
+
+  ahrs.begin(SAMPLINGRATE);
+
+  // The filter drops its oldest samples if it ever falls behind; the
+  // display only wants the latest ones.
+  ahrs_sub.begin(AHRS_QUEUE, 1, IMU_OVERFLOW_DROP_OLDEST);
+  display_sub.begin(DISPLAY_QUEUE, DISPLAY_DECIM, IMU_OVERFLOW_DROP_OLDEST);
+
+  publisher.subscribe(ahrs_sub);
+  publisher.subscribe(display_sub);
+
+  pthread_t tid;
+  pthread_create(&tid, NULL, ahrsThread, NULL);
+
+  if (!publisher.begin())
+    {
+      printf("Publisher begin error.\n");
+    }
+}
+
+/****************************************************************************
+ * Loop
+ ****************************************************************************/
+void loop()
+{
+  static int count = 0;
+  cxd5602pwbimu_data_t s;
+
+  // Blocks until the next 10 Hz sample
+  if (display_sub.read(&s, 1, -1) != 1) return;
+
+  pthread_mutex_lock(&attitude_lock);
+  pwbEulerData e = attitude.toEuler();
+  pthread_mutex_unlock(&attitude_lock);
+
+  printf("%.3f,%F,%F,%F,%F,%F,%F\n",
+         ImuClock::toSeconds(s.timestamp),
+         s.ax, s.ay, s.az, e.roll, e.pitch, e.yaw);
+
+  if (++count % REPORT_EVERY == 0) {
+    ImuSinkStats a = ahrs_sub.stats();
+    ImuSinkStats d = display_sub.stats();
+    printf("published %lu, ahrs %lu (dropped %lu), display %lu (dropped %lu)\n",
+           (unsigned long)publisher.published(),
+           (unsigned long)a.delivered, (unsigned long)a.dropped,
+           (unsigned long)d.delivered, (unsigned long)d.dropped);
+  }
+}
@@ -18,6 +18,7 @@
  */
 #include <MP.h> 
 #include "SpresenseIMU.h"
+#include "ImuBlockChannel.h"
 
 //#define SUBCORE_PRINT
 
@@ -32,7 +33,14 @@
 #define SAMPLINGRATE (1920)  // Hz
 #define ADRANGE       (4)    // G
 #define GDRANGE (    500)    // dps
-#define FIFO_DEPTH    (1)    // FIFO
+#define FIFO_DEPTH    (4)    // FIFO (samples per wakeup)
+
+#define BUFFER_NUMBER (4)
+#define DATA_NUMBER   (SAMPLINGRATE/4)
+
+#define MSGID_DROPPED (1)    // to MainCore: dropped block count so far
+
+const int main_core = 0;
 
 #ifdef SUBCORE
 USER_HEAP_SIZE(64 * 1024); 
@@ -43,9 +51,13 @@ enum error_no {
   INIT_ERROR,
   STRAT_ERROR,
   GET_ERROR,
-  SEND_ERROR
+  SEND_ERROR,
+  ALLOC_ERROR
 };
 
+ImuMpTransport transport(main_core);
+ImuBlockChannel<cxd5602pwbimu_data_t, BUFFER_NUMBER, DATA_NUMBER> channel(transport);
+
 /****************************************************************************
  * Setup
  ****************************************************************************/
@@ -53,6 +65,12 @@ void setup(void)
 {
   MP.begin(); 
 
+  static cxd5602pwbimu_data_t pool[BUFFER_NUMBER * DATA_NUMBER];
+  if (!channel.beginProducer(pool))
+    {
+      errorLoop(ALLOC_ERROR);
+    }
+
   int ret;
   ret = SpresenseIMU.begin();
   if (ret < 0)
@@ -79,26 +97,33 @@ void setup(void)
   sleep(1);
 }
 
-static int buffer_index = 0;
 /****************************************************************************
  * Loop
  ****************************************************************************/
 void loop()
 {
-  const  int buffer_number = 4;
-  const  int data_number = SAMPLINGRATE/4;
-  static cxd5602pwbimu_data_t buffer[buffer_number][data_number];
+  ImuSpan<cxd5602pwbimu_data_t> block = channel.acquire(0);
+
+  if (block.empty()) {
+    // No free block: keep draining the sensor, but drop the data.
+    static cxd5602pwbimu_data_t scratch[FIFO_DEPTH];
+    for (int i = 0; i < DATA_NUMBER; i += FIFO_DEPTH) {
+      if (!SpresenseIMU.get(scratch, FIFO_DEPTH)) {
+        errorLoop(GET_ERROR); 
+      }
+    }
+    printf("Dropped blocks: %u\n", (unsigned)channel.stats().dropped);
+    transport.send(MSGID_DROPPED, channel.stats().dropped);
+    return;
+  }
 
-  if (!SpresenseIMU.get(&buffer[buffer_index][0], data_number)) {
+  if (!SpresenseIMU.get(block.data, DATA_NUMBER)) {
     errorLoop(GET_ERROR); 
   }
 
-  int8_t msgid = 10;
-  int ret = MP.Send(msgid, (void*)MP.Virt2Phys(&buffer[buffer_index][0]));
-  if (ret < 0) {
+  if (!channel.publish(block)) {
     errorLoop(SEND_ERROR);
   }
-  buffer_index = (buffer_index+1) % buffer_number;
 
 }
 
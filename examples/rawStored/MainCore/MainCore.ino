@@ -22,6 +22,9 @@
 #endif
 
 #include "SpresenseIMU.h"
+#include "ImuBlockChannel.h"
+#include "ImuLog.h"
+#include "ImuRecorder.h"
 #include <SDHCI.h>
 #include <MP.h>
 
@@ -29,6 +32,39 @@ SDClass SD;  /**< SDClass object */
 
 const int imu_core = 1;
 
+#define BUFFER_NUMBER (4)
+#define DATA_NUMBER   (1920/4)
+
+#define MSGID_DROPPED (1)    // from ImuCore: dropped block count so far
+
+ImuMpTransport transport(imu_core);
+ImuBlockChannel<cxd5602pwbimu_data_t, BUFFER_NUMBER, DATA_NUMBER> channel(transport);
+
+/* Blocks are dropped by the producer (ImuCore), which reports its count. */
+static uint32_t imu_dropped = 0;
+
+void onMessage(int8_t msgid, uintptr_t value)
+{
+  if (msgid == MSGID_DROPPED) imu_dropped = (uint32_t)value;
+}
+
+/* Must match the settings of ImuCore. */
+#define SAMPLINGRATE  (1920)
+#define ADRANGE       (4)
+#define GDRANGE       (500)
+#define FIFO_DEPTH    (4)
+
+/* IMU_LOG_RAW keeps the samples bit exact, IMU_LOG_PACKED16 halves the size. */
+#define LOG_ENCODING  (IMU_LOG_RAW)
+
+/* Recorder buffers: one SD cluster each. */
+#define REC_BUFFER_SIZE   (32768)
+#define REC_BUFFER_NUMBER (4)
+#define MAX_FILE_SIZE     (1*1000*1000)
+
+ImuLogWriter writer;
+ImuRecorder  recorder;
+
 enum error_no {
   SETUP_ERROR = 0,
   SAVE_ERROR
@@ -49,36 +85,58 @@ void setup()
     Serial.println("Insert SD card.");
   }
 
+  if (!recorder.begin(REC_BUFFER_SIZE, REC_BUFFER_NUMBER)) {
+    errorLoop(SETUP_ERROR);
+  }
+
+  channel.setOtherHandler(onMessage);
+
   ret = MP.begin(imu_core);
   if (ret < 0) {
     MPLog("MP.begin(%d) error = %d\n", imu_core, ret);
     errorLoop(SETUP_ERROR);
   }
 
-  MP.RecvTimeout(MP_RECV_BLOCKING);
-
 }
 
 /****************************************************************************
  * Save
  ****************************************************************************/
-bool fsave(File fp)
+bool fsave()
 {
-  int8_t msgid = 0;
-  char* data;
-  const int data_number = 1920/4;
-  const int max_fsize = 1*1000*1000;
-  int fsize = 0;
+  ImuLogConfig config;
+  config.rate          = SAMPLINGRATE;
+  config.adrange       = ADRANGE;
+  config.gdrange       = GDRANGE;
+  config.nfifos        = FIFO_DEPTH;
+  config.encoding      = LOG_ENCODING;
+  config.block_samples = DATA_NUMBER;
+
+  if (!writer.begin(recorder, config)) return false;
 
+  /* Blocks go back to ImuCore as soon as they are copied to the recorder. */
   do{
-    int ret = MP.Recv(&msgid, &data, imu_core);
-    if (ret < 0) {puts("koko?");return false;}
-    ret = fp.write(data, data_number*sizeof(cxd5602pwbimu_data_t));
-    if (ret != data_number*sizeof(cxd5602pwbimu_data_t)) {puts("write error!");return false;}
-    fsize += data_number*sizeof(cxd5602pwbimu_data_t);
-  } while (fsize < max_fsize);
-
-  return true;
+    ImuSpan<cxd5602pwbimu_data_t> block = channel.receive();
+    if (block.empty()) {puts("receive error!");return false;}
+    bool ret = writer.write(block.data, block.size);
+    channel.release(block);
+    if (!ret) {puts("write error!");return false;}
+  } while (writer.bytesWritten() < MAX_FILE_SIZE);
+
+  return writer.end();
+}
+
+void printStats()
+{
+  ImuRecorderStats s = recorder.stats();
+  printf("write max %u us (avg %u us), open %u us, close %u us\n",
+         (unsigned)s.write_us_max,
+         (unsigned)(s.writes ? s.write_us_total / s.writes : 0),
+         (unsigned)s.open_us_max, (unsigned)s.close_us_max);
+  printf("queue high %u/%u, stalls %u (max %u us), dropped blocks %u\n",
+         (unsigned)s.queue_high, (unsigned)s.queue_capacity,
+         (unsigned)s.stalls, (unsigned)s.stall_us_max,
+         (unsigned)imu_dropped);
 }
 
 /****************************************************************************
@@ -86,28 +144,27 @@ bool fsave(File fp)
  ****************************************************************************/
 void loop()
 {
+  char fname[32];
+  static int fnumber = 0;
 
-  char fname[16];
-  static char fnumber = 0;
-
+  /* SD.remove() runs here; open, preallocation and close on the writer thread. */
   sprintf(fname, "imu%03d.dat", fnumber);
   printf("%s\n", fname);
   if (SD.exists(fname)) SD.remove(fname);
 
-  File fp = SD.open(fname, FILE_WRITE);
-  if (!fp) {
-    Serial.println(String(fname) + ": Open error!" );
-    return;
+  char path[48];
+  sprintf(path, "/mnt/sd0/%s", fname);
+  if (!recorder.open(path, MAX_FILE_SIZE + REC_BUFFER_SIZE)) {
+    errorLoop(SAVE_ERROR);
   }
-  
-  if (!fsave(fp)){
-    fp.close();
+
+  if (!fsave() || !recorder.close()) {
+    recorder.end();
     errorLoop(SAVE_ERROR);
-  } 
+  }
 
-  fp.close();
+  printStats();
   fnumber++;
-  
 }
 
 /****************************************************************************
@@ -23,9 +23,13 @@
 
 #include <MP.h>
 #include "SpresenseIMU.h"
+#include "ImuBlockChannel.h"
 
 const int imu_core = 1;
 
+ImuMpTransport transport(imu_core);
+ImuBlockChannel<cxd5602pwbimu_data_t, 4, 1> channel(transport);
+
 void setup()
 {
   int ret = 0;
@@ -41,13 +45,12 @@ void setup()
 
 void loop()
 {
-  int8_t   msgid = 0;
-  cxd5602pwbimu_data_t* data;
-
-  int ret = MP.Recv(&msgid, &data, imu_core);
-  if (ret >= 0) {
+  ImuSpan<cxd5602pwbimu_data_t> block = channel.receive();
+  if (!block.empty()) {
+    cxd5602pwbimu_data_t* data = block.data;
     float timestamp = data->timestamp / 19200000.0f;
     printf("%4.2F,%4.2F,%F,%F,%F,%F,%F,%F\n", timestamp, data->temp, data->ax, data->ay, data->az, data->gx, data->gy, data->gz);
+    channel.release(block);
   }
 }
 
@@ -18,6 +18,7 @@
  */
 
 #include "SpresenseIMU.h"
+#include "ImuBusArbiter.h"
 #include "BMI160Gen.h"
 
 /****************************************************************************
@@ -29,7 +30,29 @@
 #define GDRANGE (    500)    // dps
 #define FIFO_DEPTH    (1)    // FIFO
 
-#define RESET_INTERVAL 20    // restart every N samples
+#define BMI_INTERVAL  (20)   // read the BMI160 every N samples
+#define STATS_INTERVAL (600) // print the bus statistics every N samples
+
+/****************************************************************************
+ * Variables
+ ****************************************************************************/
+// The IMU keeps sampling; the BMI160 is read in the gap after a FIFO
+// watermark, on the thread that reads the IMU.
+ImuBusArbiter bus;
+
+struct BmiRead {
+  float ax, ay, az;
+  volatile bool done;
+};
+
+static BmiRead bmi;
+
+static void readBmi160(void* arg)
+{
+  BmiRead* r = (BmiRead*)arg;
+  BMI160.readAccelerometerScaled(r->ax, r->ay, r->az);
+  r->done = true;
+}
 
 /****************************************************************************
  * Setup
@@ -52,23 +75,15 @@ void setup(void)
   // Set the accelerometer range to 2G
   BMI160.setAccelerometerRange(2);
 
-}
-
-
-/****************************************************************************
- * Loop
- ****************************************************************************/
-void loop()
-{
-  pwbImuData imuData;
-
-  int ret = SpresenseIMU.initialize(SAMPLINGRATE, ADRANGE, GDRANGE, FIFO_DEPTH);
+  ret = SpresenseIMU.initialize(SAMPLINGRATE, ADRANGE, GDRANGE, FIFO_DEPTH);
   if (!ret)
     {
       SpresenseIMU.end();
       return;
     }
 
+  SpresenseIMU.setBusArbiter(&bus);
+
   ret = SpresenseIMU.start();
   if (!ret)
     {
@@ -76,41 +91,51 @@ void loop()
       SpresenseIMU.end();
       return;
     }
+}
 
-  if (!ret)
+
+/****************************************************************************
+ * Loop
+ ****************************************************************************/
+void loop()
+{
+  static int count = 0;
+  pwbImuData imuData;
+
+  if (!SpresenseIMU.get(imuData))
     {
-      SpresenseIMU.end();
+      Serial.println("[ERROR] get() failed");
       return;
     }
+  imuData.print();
+  count++;
 
-  int count = 0;
-  while (count < RESET_INTERVAL)
+  if (count % BMI_INTERVAL == 0)
     {
-      if (SpresenseIMU.get(imuData))
-        {
-          imuData.print();
-          count++;
-        }
-      else
+      bmi.done = false;
+      if (!bus.schedule(readBmi160, &bmi))
         {
-          Serial.println("[ERROR] get() failed, restarting IMU...");
-          break;
+          Serial.println("[ERROR] bus queue full");
         }
     }
-  ret = SpresenseIMU.stop();
 
-  float ax, ay, az;   //Accelerometer values for BMI160
-  // read accelerometer measurements from BMI160
-  BMI160.readAccelerometerScaled(ax, ay, az);
-
-  // display tab-separated accelerometer x/y/z values
-  Serial.print("a:\t");
-  Serial.print(ax);
-  Serial.print("\t");
-  Serial.print(ay);
-  Serial.print("\t");
-  Serial.print(az);
-  Serial.println();
+  if (bmi.done)
+    {
+      bmi.done = false;
+
+      // display tab-separated accelerometer x/y/z values
+      Serial.print("a:\t");
+      Serial.print(bmi.ax);
+      Serial.print("\t");
+      Serial.print(bmi.ay);
+      Serial.print("\t");
+      Serial.print(bmi.az);
+      Serial.println();
+    }
 
+  if (count % STATS_INTERVAL == 0)
+    {
+      SpresenseIMU.stats().print();
+      bus.stats().print();
+    }
 }
-
@@ -19,11 +19,18 @@
  
 #include <MP.h>
 #include <Adafruit_BMP280.h>
+#include "ImuBusArbiter.h"
 
 Adafruit_BMP280 bmp; // use I2C interface
 
-#define MSG_REQ_BMP   1
-#define MSG_RET_BMP   2
+#define MAINCORE_ID   0
+#define MSGID_READY   1       // to the MainCore: BMP280 initialized
+#define BMP_INTERVAL  (1000)  // ms
+
+// The bus belongs to the MainCore, which keeps the IMU running; it is
+// borrowed for each measurement.
+ImuMpTransport transport(MAINCORE_ID);
+ImuBusTokenClient<> token(transport);
 
 // ------------------------------------------------------
 // Setup
@@ -33,6 +40,10 @@ void setup()
   Serial.begin(115200);
   while (!Serial);
 
+  MP.begin();
+
+  // The MainCore holds the IMU back (and its I2C interrupt off) until
+  // MSGID_READY, so the bus is ours for the initialization.
   unsigned status = bmp.begin(0x76);
   if (!status) {
     Serial.println(F("Could not find a valid BMP280 sensor, check wiring or "
@@ -52,45 +63,39 @@ void setup()
                   Adafruit_BMP280::FILTER_X16,      /* Filtering. */
                   Adafruit_BMP280::STANDBY_MS_500); /* Standby time. */
 
-  up_disable_irq(CXD56_IRQ_SCU_I2C0);
-
-  MP.begin();
-  MP.RecvTimeout(3000);
-
+  token.begin();
+  MP.Send(MSGID_READY, (uint32_t)0, MAINCORE_ID);
 }
 
 // ------------------------------------------------------
-// Loop (wait for main → measure → return)
+// Loop (borrow the bus → measure → return it)
 // ------------------------------------------------------
 void loop()
 {
-  int8_t msgid;
-  uint32_t dummy;
-
-  if (MP.Recv(&msgid, &dummy) >= 0 && msgid == MSG_REQ_BMP) {
-
-    up_enable_irq(CXD56_IRQ_SCU_I2C0);
-
-    Serial.print(F("[Sub] Temperature = "));
-    Serial.print(bmp.readTemperature());
-    Serial.println(" *C");
+  if (!token.acquire(3000)) {
+    Serial.println("[Sub] bus grant timeout");
+    return;
+  }
 
-    Serial.print(F("[Sub] Pressure = "));
-    Serial.print(bmp.readPressure());
-    Serial.println(" Pa");
+  // Keep the bus only as long as the transfers take: the IMU read on the
+  // MainCore waits for the release.
+  float temperature = bmp.readTemperature();
+  float pressure    = bmp.readPressure();
+  float altitude    = bmp.readAltitude(1013.25); /* Adjusted to local forecast! */
 
-    Serial.print(F("[Sub] Approx altitude = "));
-    Serial.print(bmp.readAltitude(1013.25)); /* Adjusted to local forecast! */
-    Serial.println(" m");
-    Serial.flush();
+  token.release();
 
-    float hpa = bmp.readTemperature();
+  Serial.print(F("[Sub] Temperature = "));
+  Serial.print(temperature);
+  Serial.println(" *C");
 
-    up_disable_irq(CXD56_IRQ_SCU_I2C0);
-    MP.Send(MSG_RET_BMP, hpa);
+  Serial.print(F("[Sub] Pressure = "));
+  Serial.print(pressure);
+  Serial.println(" Pa");
 
-  } else {
-    Serial.println("[Sub] recv timeout");
-  }
+  Serial.print(F("[Sub] Approx altitude = "));
+  Serial.print(altitude);
+  Serial.println(" m");
 
+  delay(BMP_INTERVAL);
 }
@@ -18,19 +18,25 @@
  */
 
 #include "SpresenseIMU.h"
+#include "ImuDecimator.h"
 #include <math.h>
 
 /****************************************************************************
  * Pre-processor Definitions
  ****************************************************************************/
 // IMU設定
-#define SAMPLINGRATE (120)    // Hz
+#define SAMPLINGRATE (960)    // Hz
 #define ADRANGE       (4)    // G
 #define GDRANGE (    500)    // dps
-#define FIFO_DEPTH    (1)    // FIFO
+#define FIFO_DEPTH    (4)    // FIFO
+
+#define DECIMATION   (24)    // 960Hz -> 40Hz (anti-alias FIR)
 
 #define RAD2DEG(x) ((x) * 180.0f / M_PI)
 
+ImuDecimator decimator;
+int tilt_tap;
+
 /****************************************************************************
  * Setup
  ****************************************************************************/
@@ -53,6 +59,9 @@ void setup(void)
       return;
     }
 
+  decimator.begin(SAMPLINGRATE, ADRANGE, GDRANGE);
+  tilt_tap = decimator.addTap(DECIMATION);
+
   ret = SpresenseIMU.start();
   if (!ret)
     {
@@ -68,15 +77,18 @@ void setup(void)
  ****************************************************************************/
 void loop()
 {
+  cxd5602pwbimu_data_t buf[FIFO_DEPTH];
+  size_t n = SpresenseIMU.read(buf, FIFO_DEPTH);
+  decimator.process(buf, n);
+
   pwbImuData imuData;
-  if (SpresenseIMU.getAverage(imuData,3)) {
+  while (decimator.read(tilt_tap, &imuData.data, 1)) {
 //    imuData.printAccelerometer();
     float roll  = RAD2DEG(atan2f(imuData.data.ay, imuData.data.az));
     float pitch = RAD2DEG(atan2f(imuData.data.ax, sqrtf(imuData.data.ay*imuData.data.ay + imuData.data.az*imuData.data.az)));
 
     printf("Pitch = %.2f deg, Roll = %.2f deg\n", pitch, roll);
 
-  }  
+  }
 
 }
-
@@ -0,0 +1,121 @@
+/*
+ *  vibration.ino - Vibration features (bands, peaks, tones) over USB Serial.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "SpresenseIMU.h"
+#include "ImuSpectrum.h"
+#include "ImuTelemetry.h"
+#include <USBSerial.h>
+
+USBSerial UsbSerial;
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+// IMU設定
+#define SAMPLINGRATE  (1920)
+#define ADRANGE       (4)    // G
+#define GDRANGE       (500)  // dps
+#define FIFO_DEPTH    (4)
+
+// 1024 samples (0.53 s, 1.875 Hz bins), 50 % overlap: 3.75 frames/s.
+// About 13 KB of heap; 2048 (26 KB) still fits a subcore.
+#define FRAME         (1024)
+#define HOP           (FRAME / 2)
+
+#define USBSERIAL_BAUDRATE (115200)
+
+ImuLogStreamAdapter<USBSerial> usb_stream(UsbSerial);
+ImuTelemetry telemetry;
+ImuSpectrum  spectrum;
+
+/****************************************************************************
+ * Setup
+ ****************************************************************************/
+void setup(void)
+{
+  int ret;
+
+  Serial.begin(115200);
+  UsbSerial.begin(USBSERIAL_BAUDRATE);
+
+  // Bands of a rotating machine and its bearing; tones at 1x and 2x of
+  // a 50 Hz shaft.
+  spectrum.addBand(2, 10);
+  spectrum.addBand(10, 100);
+  spectrum.addBand(100, 400);
+  spectrum.addBand(400, SAMPLINGRATE / 2);
+  spectrum.addTone(50);
+  spectrum.addTone(100);
+  spectrum.setPeaks(3, 0.01f);
+  if (!spectrum.begin(SAMPLINGRATE, FRAME, HOP, IMU_SPEC_ANORM))
+    {
+      printf("Spectrum begin error.\n");
+      return;
+    }
+  printf("spectrum: %lu bytes, %F Hz/bin\n", (unsigned long)spectrum.footprint(), spectrum.binHz());
+
+  telemetry.begin(usb_stream);
+
+  ret = SpresenseIMU.begin();
+  if (ret < 0)
+    {
+      printf("Spresense IMU begin.\n");
+      return;
+    }
+
+  ret = SpresenseIMU.initialize(SAMPLINGRATE, ADRANGE, GDRANGE, FIFO_DEPTH);
+  if (!ret)
+    {
+      SpresenseIMU.end();
+      return;
+    }
+
+  ret = SpresenseIMU.start();
+  if (!ret)
+    {
+      SpresenseIMU.finalize();
+      SpresenseIMU.end();
+      return;
+    }
+}
+
+/****************************************************************************
+ * Loop
+ ****************************************************************************/
+void loop()
+{
+  cxd5602pwbimu_data_t batch[FIFO_DEPTH * 4];
+
+  size_t n = SpresenseIMU.read(batch, FIFO_DEPTH * 4);
+  if (n == 0) return;
+
+  if (spectrum.process(batch, n) == 0) return;
+
+  // 1 + 4 bands + 3 peaks * 2 + 2 tones = 13 floats in a fixed layout
+  // (peaks not found are 0, 0), two records:
+  // 76 bytes per frame, under 300 B/s instead of 65 KB/s of samples.
+  float v[IMU_SPEC_MAX_PACKED];
+  int fields = spectrum.features().pack(v);
+  for (int k = 0; k < fields; k += IMU_TLM_MAX_FIELDS)
+    {
+      int m = fields - k;
+      telemetry.writeRecord(&v[k], m < IMU_TLM_MAX_FIELDS ? m : IMU_TLM_MAX_FIELDS);
+    }
+  telemetry.flush();
+}
@@ -25,6 +25,7 @@ class Quat {
 
 // Globals
 Serial serial;
+ImuTelemetryDecoder telemetry = new ImuTelemetryDecoder();
 ArrayList<Quat> quatLog = new ArrayList<>();
 ArrayList<PVector> eulerLog = new ArrayList<>(); // x=roll, y=pitch, z=yaw (degrees)
 
@@ -32,34 +33,17 @@ void setup() {
   size(800, 800);
   println("Opening port: " + PORT_NAME);
   serial = new Serial(this, PORT_NAME, BAUD);
-  serial.bufferUntil('\n');
   textFont(createFont("Courier",12));
 }
 
-// Parse incoming CSV line: timestamp,temp,q0,q1,q2,q3
-Quat parseLine(String line) {
-  String[] v = split(trim(line), ',');
+// Incoming telemetry record: timestamp,temp,q0,q1,q2,q3
+Quat parseRecord(float[] v) {
   if (v.length < 6) {
-    // invalid line
-    println("Invalid data (expected 6 fields):", line);
+    // invalid record
+    println("Invalid data (expected 6 fields):", v.length);
     return null;
   }
-  // parse safely
-  float ts = 0;
-  float temp = 0;
-  float q0 = 1, q1 = 0, q2 = 0, q3 = 0;
-  try {
-    ts   = float(v[0]);
-    temp = float(v[1]);
-    q0   = float(v[2]);
-    q1   = float(v[3]);
-    q2   = float(v[4]);
-    q3   = float(v[5]);
-  } catch (Exception e) {
-    println("Parse error:", e);
-    return null;
-  }
-  return new Quat(ts, temp, q0, q1, q2, q3);
+  return new Quat(v[0], v[1], v[2], v[3], v[4], v[5]);
 }
 
 // Convert quaternion (q0,q1,q2,q3) -> Euler (roll,pitch,yaw) in degrees
@@ -87,10 +71,9 @@ void draw() {
   background(240);
 
   // Read serial (non-blocking)
-  while (serial.available() > 0) {
-    String line = serial.readStringUntil('\n');
-    if (line == null) break;
-    Quat q = parseLine(line);
+  telemetry.feed(serial);
+  while (telemetry.available()) {
+    Quat q = parseRecord(telemetry.next());
     if (q == null) continue;
 
     // store quaternion and computed euler
@@ -0,0 +1,164 @@
+// ImuTelemetry decoder for Processing (frame format: src/ImuTelemetry.h)
+//
+//   ImuTelemetryDecoder telemetry = new ImuTelemetryDecoder();
+//
+//   telemetry.feed(serial);
+//   while (telemetry.available()) {
+//     float[] v = telemetry.next();
+//   }
+//
+// Sensor samples (RAW / Q16) come out in the order of the former CSV:
+//   timestamp [s], temp, ax, ay, az, gx, gy, gz
+// F32 records come out as sent (e.g. timestamp, temp, q0, q1, q2, q3).
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
+class ImuTelemetryDecoder {
+  static final int RAW = 1;
+  static final int Q16 = 2;
+  static final int F32 = 3;
+
+  static final int HEADER    = 8;
+  static final int MAX_FRAME = HEADER + 16 + 32 * 32 + 2;
+  static final int MAX_QUEUE = 4096;
+
+  byte[] buf = new byte[MAX_FRAME + MAX_FRAME / 254 + 2];
+  byte[] frame = new byte[MAX_FRAME];
+  int bufLen = 0;
+  boolean overflow = false;
+  int nextSeq = -1;
+
+  int frames = 0;
+  int crcErrors = 0;
+  int formatErrors = 0;
+  int lostFrames = 0;
+
+  ArrayList<float[]> records = new ArrayList<float[]>();
+
+  void feed(Serial port) {
+    while (port.available() > 0) {
+      feed(port.read());
+    }
+  }
+
+  void feed(int b) {
+    if (b != 0) {
+      if (bufLen < buf.length) buf[bufLen++] = (byte)b;
+      else overflow = true;
+      return;
+    }
+    if (bufLen > 0) {
+      if (overflow) formatErrors++;
+      else decodeFrame();
+    }
+    bufLen = 0;
+    overflow = false;
+  }
+
+  boolean available() {
+    return !records.isEmpty();
+  }
+
+  float[] next() {
+    return records.remove(0);
+  }
+
+  int cobsDecode() {
+    int i = 0, o = 0;
+    while (i < bufLen) {
+      int code = buf[i++] & 0xff;
+      if (i + code - 1 > bufLen) return 0;
+      for (int k = 1; k < code; k++) {
+        if (o >= frame.length) return 0;
+        frame[o++] = buf[i++];
+      }
+      if (code != 0xff && i < bufLen) {
+        if (o >= frame.length) return 0;
+        frame[o++] = 0;
+      }
+    }
+    return o;
+  }
+
+  // CRC-16/CCITT-FALSE
+  int crc16(int n) {
+    int crc = 0xffff;
+    for (int i = 0; i < n; i++) {
+      crc ^= (frame[i] & 0xff) << 8;
+      for (int k = 0; k < 8; k++) {
+        crc = ((crc & 0x8000) != 0) ? (crc << 1) ^ 0x1021 : crc << 1;
+        crc &= 0xffff;
+      }
+    }
+    return crc;
+  }
+
+  void add(float[] v) {
+    if (records.size() >= MAX_QUEUE) records.remove(0);
+    records.add(v);
+  }
+
+  void decodeFrame() {
+    int n = cobsDecode();
+    if (n < HEADER + 2) {
+      formatErrors++;
+      return;
+    }
+
+    int crc = (frame[n - 2] & 0xff) | ((frame[n - 1] & 0xff) << 8);
+    if (crc16(n - 2) != crc) {
+      crcErrors++;
+      return;
+    }
+
+    ByteBuffer p = ByteBuffer.wrap(frame, 0, n - 2).order(ByteOrder.LITTLE_ENDIAN);
+    int type   = p.get(0) & 0xff;
+    int count  = p.get(1) & 0xff;
+    int seq    = p.getShort(2) & 0xffff;
+    int fields = p.get(4) & 0xff;
+    int shift  = p.get(5) & 0xff;
+
+    int expect = -1;
+    if (type == RAW) expect = count * 32;
+    if (type == Q16) expect = 16 + count * 16;
+    if (type == F32) expect = count * fields * 4;
+    if (n - 2 - HEADER != expect) {
+      formatErrors++;
+      return;
+    }
+
+    if (nextSeq >= 0 && seq != nextSeq) lostFrames += (seq - nextSeq) & 0xffff;
+    nextSeq = (seq + 1) & 0xffff;
+    frames++;
+
+    p.position(HEADER);
+    if (type == RAW) {
+      for (int i = 0; i < count; i++) {
+        long  ts   = p.getInt() & 0xffffffffL;
+        float temp = p.getFloat();
+        float gx = p.getFloat(), gy = p.getFloat(), gz = p.getFloat();
+        float ax = p.getFloat(), ay = p.getFloat(), az = p.getFloat();
+        add(new float[] { ts / 19200000.0, temp, ax, ay, az, gx, gy, gz });
+      }
+    } else if (type == Q16) {
+      long  ts   = p.getInt() & 0xffffffffL;
+      float alsb = p.getFloat();
+      float glsb = p.getFloat();
+      float tlsb = p.getFloat();
+      for (int i = 0; i < count; i++) {
+        ts = (ts + ((long)(p.getShort() & 0xffff) << shift)) & 0xffffffffL;
+        float temp = p.getShort() * tlsb;
+        float gx = p.getShort() * glsb, gy = p.getShort() * glsb, gz = p.getShort() * glsb;
+        float ax = p.getShort() * alsb, ay = p.getShort() * alsb, az = p.getShort() * alsb;
+        add(new float[] { ts / 19200000.0, temp, ax, ay, az, gx, gy, gz });
+      }
+    } else {
+      for (int i = 0; i < count; i++) {
+        float[] v = new float[fields];
+        for (int k = 0; k < fields; k++) v[k] = p.getFloat();
+        add(v);
+      }
+    }
+  }
+}
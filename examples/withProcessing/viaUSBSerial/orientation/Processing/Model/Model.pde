@@ -1,6 +1,7 @@
 import processing.serial.*;
 
 Serial myPort;
+ImuTelemetryDecoder telemetry = new ImuTelemetryDecoder();
 
 class Quat {
   float w, x, y, z;
@@ -21,16 +22,14 @@ float temp = 0;
 void setup() {
   size(600, 600, P3D);
   myPort = new Serial(this, "COM80", 115200);
-  myPort.bufferUntil('\n');
   textFont(createFont("Courier", 12));
 }
 
-void parseLine(String line) {
-  String[] s = split(trim(line), ',');
+void parseRecord(float[] s) {
   if (s.length != 6) return;
-  timestamp = float(s[0]);
-  temp      = float(s[1]);
-  orientation = new Quat(float(s[2]), float(s[3]), float(s[4]), float(s[5]));
+  timestamp = s[0];
+  temp      = s[1];
+  orientation = new Quat(s[2], s[3], s[4], s[5]);
   orientation.normalize();
 }
 
@@ -60,9 +59,9 @@ void draw() {
   lights();
   translate(width/2, height/2, 0);
 
-  while (myPort.available() > 0) {
-    String line = myPort.readStringUntil('\n');
-    if (line != null) parseLine(line);
+  telemetry.feed(myPort);
+  while (telemetry.available()) {
+    parseRecord(telemetry.next());
   }
 
   applyRotationMatrix();
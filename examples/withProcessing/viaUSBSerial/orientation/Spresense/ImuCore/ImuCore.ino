@@ -18,12 +18,13 @@
  */
 #include <MP.h> 
 #include "SpresenseIMU.h"
+#include "ImuBlockChannel.h"
 
-//#define USE_MADGWICK
+//#define USE_AHRS
 
-#ifdef USE_MADGWICK
-#include <MadgwickAHRS.h>
-Madgwick MadgwickFilter;
+#ifdef USE_AHRS
+#include "SpresenseAhrs.h"
+SpresenseAhrs ahrs;
 #endif
 
 //#define SUBCORE_PRINT
@@ -54,8 +55,13 @@ enum error_no {
   SEND_ERROR
 };
 
+const int main_core = 0;
+
+ImuMpTransport transport(main_core);
+ImuBlockChannel<pwbQuaternionData, 2, 1> channel(transport);
+
 /* For Caribration */
-float gyroBias[3] = {0, 0, 0};
+float gyroBias[3] = {0, 0, 0};  // rad/s
 float trueRate = 0;
 
 /****************************************************************************
@@ -67,20 +73,15 @@ void calibrateGyroBias(int ms = 2000) {
   cxd5602pwbimu_data_t raw;
   double sum[3] = {0, 0, 0};
   int count = 0;
-  float first_ts = 0;
-  float last_ts = 0;
   unsigned long start = millis();
 
+  SpresenseIMU.resetStats();
+
   while (millis() - start < (unsigned)ms) {
     if (SpresenseIMU.get(raw)) {
-      sum[0] += raw.gx * 180 / PI;
-      sum[1] += raw.gy * 180 / PI;
-      sum[2] += raw.gz * 180 / PI;
-      if(count==0) {
-        first_ts = (raw.timestamp  / 19200000.0f);
-      }else{
-        last_ts = (raw.timestamp  / 19200000.0f);
-      }
+      sum[0] += raw.gx;
+      sum[1] += raw.gy;
+      sum[2] += raw.gz;
       count++;
     }
   }
@@ -89,10 +90,15 @@ void calibrateGyroBias(int ms = 2000) {
     gyroBias[0] = sum[0] / count;
     gyroBias[1] = sum[1] / count;
     gyroBias[2] = sum[2] / count;
-    trueRate = 1.0f / ( (last_ts - first_ts) / count);
   }
 
-  printf("Gyro Bias (deg/s): %f, %f, %f\n", gyroBias[0], gyroBias[1], gyroBias[2]);
+  // Rate measured from the timestamps, with gaps and jitter of the window
+  ImuStats stats = SpresenseIMU.stats();
+  trueRate = (stats.rate() > 0) ? stats.rate() : SAMPLINGRATE;
+  stats.print();
+
+  printf("Gyro Bias (deg/s): %f, %f, %f\n",
+         gyroBias[0] * 180 / PI, gyroBias[1] * 180 / PI, gyroBias[2] * 180 / PI);
   printf("Sampling Rate: %f\n", trueRate);
 }
 
@@ -102,6 +108,7 @@ void calibrateGyroBias(int ms = 2000) {
 void setup(void)
 {
   MP.begin(); 
+  channel.beginProducer();
 
   int ret;
   ret = SpresenseIMU.begin();
@@ -132,8 +139,9 @@ void setup(void)
   calibrateGyroBias(2000);
   ledOff(LED0); ledOff(LED1); ledOff(LED2); ledOff(LED3);
 
-#ifdef USE_MADGWICK
-  MadgwickFilter.begin(trueRate);
+#ifdef USE_AHRS
+  ahrs.begin(trueRate);
+  ahrs.setGyroBias(gyroBias[0], gyroBias[1], gyroBias[2]);
 #endif
 
 }
@@ -149,12 +157,8 @@ void loop()
 
   if (SpresenseIMU.get(raw)) {
 
-    float gx = raw.gx * 180/PI - gyroBias[0];
-    float gy = raw.gy * 180/PI - gyroBias[1];
-    float gz = raw.gz * 180/PI - gyroBias[2];
-
-#ifdef USE_MADGWICK
-    MadgwickFilter.updateIMU(gx, gy, gz, raw.ax, raw.ay, raw.az);
+#ifdef USE_AHRS
+    ahrs.update(raw);
 #endif
 
     if(count>0) {
@@ -162,34 +166,31 @@ void loop()
       return;
     }
 
-#ifdef USE_MADGWICK
-    data.timestamp = raw.timestamp / 19200000.0f;
-    data.temp = raw.temp;
-
-    data.q0 = MadgwickFilter.getQ0();
-    data.q1 = MadgwickFilter.getQ1();
-    data.q2 = MadgwickFilter.getQ2();
-    data.q3 = MadgwickFilter.getQ3();
+#ifdef USE_AHRS
+    data = ahrs.getQuaternion();
 #else
 
-    static float last_timestamp = 0;
+    static cxd5602pwbimu_data_t prev = raw;   // first sample: dt = 0
 
     pwbQuaternionData result;
-    SpresenseIMU.convQuaternion(result,raw,last_timestamp);
+    SpresenseIMU.convQuaternion(result,raw,prev);
     data = data * result;
 
-    last_timestamp = raw.timestamp / 19200000.0f;
+    prev = raw;
 
 #endif
 
-    int8_t msgid = 10;
-    int ret = MP.Send(msgid, (void*)MP.Virt2Phys(&data));
-    if (ret < 0) {
-      errorLoop(SEND_ERROR);
+    // Skip this update if MainCore still holds both slots.
+    ImuSpan<pwbQuaternionData> block = channel.acquire(0);
+    if (!block.empty()) {
+      block[0] = data;
+      if (!channel.publish(block)) {
+        errorLoop(SEND_ERROR);
+      }
     }
 
 #ifdef SUBCORE_PRINT
-    printf("%4.2F,%2.2F,%F,%F,%F,%F\n", data.timestamp, data.temp, data.q0, data.q1, data.q2, data.q3);
+    printf("%4.2F,%2.2F,%F,%F,%F,%F\n", data.timestamp / IMU_TICKS_PER_SEC, data.temp, data.q0, data.q1, data.q2, data.q3);
 #endif
 
     count = SENDDECIMATION;
@@ -23,13 +23,21 @@
 
 #include <MP.h>
 #include "SpresenseIMU.h"
+#include "ImuBlockChannel.h"
+#include "ImuTelemetry.h"
 #include <USBSerial.h>
 
 USBSerial UsbSerial;
 const int usbserial_baurate = 921600;
 
+ImuLogStreamAdapter<USBSerial> usb_stream(UsbSerial);
+ImuTelemetry telemetry;
+
 const int imu_core = 1;
 
+ImuMpTransport transport(imu_core);
+ImuBlockChannel<pwbQuaternionData, 2, 1> channel(transport);
+
 void setup()
 {
   int ret = 0;
@@ -38,6 +46,7 @@ void setup()
   while (!Serial);
 
   UsbSerial.begin(usbserial_baurate);
+  telemetry.begin(usb_stream, 4);
   Serial.println("Done!");
 
   ret = MP.begin(imu_core);
@@ -48,23 +57,15 @@ void setup()
 
 void loop()
 {
-  int8_t   msgid = 0;
-  pwbQuaternionData* data;
-
-  int ret = MP.Recv(&msgid, &data, imu_core);
-  if (ret >= 0) {
-    printf("%4.2F,%2.2F,%F,%F,%F,%F\n", data->timestamp, data->temp, data->q0, data->q1, data->q2, data->q3);
-    UsbSerial.print(data->timestamp, 2);
-    UsbSerial.print(",");
-    UsbSerial.print(data->temp, 2);
-    UsbSerial.print(",");
-    UsbSerial.print(data->q0);
-    UsbSerial.print(",");
-    UsbSerial.print(data->q1);
-    UsbSerial.print(",");
-    UsbSerial.print(data->q2);
-    UsbSerial.print(",");
-    UsbSerial.println(data->q3);
+  ImuSpan<pwbQuaternionData> block = channel.receive();
+  if (!block.empty()) {
+    pwbQuaternionData* data = block.data;
+    printf("%4.2F,%2.2F,%F,%F,%F,%F\n", data->timestamp / IMU_TICKS_PER_SEC, data->temp, data->q0, data->q1, data->q2, data->q3);
+    for (size_t i = 0; i < block.size; i++) {
+      float record[6] = { data[i].timestamp / IMU_TICKS_PER_SEC, data[i].temp, data[i].q0, data[i].q1, data[i].q2, data[i].q3 };
+      telemetry.writeRecord(record, 6);
+    }
+    channel.release(block);
   }
 }
 
@@ -10,6 +10,7 @@ static final float SCALE = 200;           // 3Dスケール倍率
 // ===================
 
 Serial serial;
+ImuTelemetryDecoder telemetry = new ImuTelemetryDecoder();
 ArrayList<PVector> path = new ArrayList<>();
 PeasyCam cam;
 
@@ -17,7 +18,6 @@ void setup() {
   size(900, 700, P3D);
   cam = new PeasyCam(this, 500);
   serial = new Serial(this, PORT_NAME, BAUD);
-  serial.bufferUntil('\n');
 }
 
 void draw() {
@@ -26,11 +26,9 @@ void draw() {
   drawAxis(100);
 
   // === シリアル受信 ===
-  while (serial.available() > 0) {
-    String line = serial.readStringUntil('\n');
-     println(line);
-    if (line == null) break;
-    parseLine(line.trim());
+  telemetry.feed(serial);
+  while (telemetry.available()) {
+    parseRecord(telemetry.next());
   }
 
   // === 軌跡描画 ===
@@ -63,14 +61,13 @@ void draw() {
   hint(ENABLE_DEPTH_TEST);
 }
 
-void parseLine(String line) {
-  String[] v = split(line, ',');
+void parseRecord(float[] v) {
   if (v.length != 4) return;  // 4カラム以外は無視
 
-  float ts = float(v[0]);
-  float x  = float(v[1]);
-  float y  = float(v[2]);
-  float z  = float(v[3]);
+  float ts = v[0];
+  float x  = v[1];
+  float y  = v[2];
+  float z  = v[3];
 
   path.add(new PVector(x, y, z));
   if (path.size() > MAX_POINTS) path.remove(0);
@@ -19,6 +19,9 @@
 
 #include <MP.h> 
 #include "SpresenseIMU.h"
+#include "ImuBlockChannel.h"
+#include "ImuAdaptive.h"
+#include "ImuCalibration.h"
 #include "InternalData.h"
 
 //#define SUBCORE_PRINT
@@ -45,12 +48,26 @@ enum error_no {
   SEND_ERROR
 };
 
+#define BUFFER_SIZE 4
+
+ImuMpTransport transport(pos_core);
+ImuBlockChannel<OrientationData_t, BUFFER_SIZE, BLOCK_SIZE> channel(transport);
+
 /* For Caribration */
 float gyroBias[3] = {0, 0, 0};
 float trueGravity = 0.0;
 
+// Scale, misalignment and temperature bias from MainCore (MSGID_CALIBRATION).
+// With it, gyroBias only takes the turn-on residual and trueGravity stays
+// close to g instead of absorbing the accel errors.
+#define CALIBRATION_WAIT_MS (3000)
+ImuCalibration calibration;
+
 static pwbQuaternionData data;
 
+// ZUPT: |gyro| < 0.05 rad/s and ||acc| - g| < 0.05 m/s^2 for 16 samples.
+static ImuStaticDetector detector;
+
 /****************************************************************************
  * calibrate for GyroBias
  ****************************************************************************/
@@ -98,6 +115,7 @@ void calibrateAndInitOrientation(int ms = 2000)
     float az = sum_az / count;
 
     trueGravity = sqrt(ax * ax + ay * ay + az * az);
+    detector.setGravity(trueGravity);
 
     // Normalize accel to unit gravity vector
     ax /= trueGravity;
@@ -121,7 +139,7 @@ void calibrateAndInitOrientation(int ms = 2000)
   }
 
   // Send gravity magnitude to pos-core
-  int8_t msgid = 20;
+  int8_t msgid = MSGID_GRAVITY;
   int ret = MP.Send(msgid, &trueGravity, pos_core);
   if (ret < 0) errorLoop(SEND_ERROR);
 }
@@ -134,6 +152,17 @@ void setup(void)
   MP.begin(); 
 
   int ret;
+  int8_t msgid;
+  uint32_t addr;
+  MP.RecvTimeout(CALIBRATION_WAIT_MS);
+  if (MP.Recv(&msgid, &addr) >= 0 && msgid == MSGID_CALIBRATION && addr != 0) {
+    calibration = *(const ImuCalibration*)(uintptr_t)addr;
+    SpresenseIMU.setCalibration(&calibration);
+    printf("Calibration loaded (accel residual %f m/s^2)\n", calibration.data().accel_rms);
+  }
+  ret = channel.beginProducer();
+  if (!ret) errorLoop(BEGIN_ERROR);
+
   ret = SpresenseIMU.begin();
   if (ret < 0) errorLoop(BEGIN_ERROR);
 
@@ -155,26 +184,20 @@ void setup(void)
 /****************************************************************************
  * Loop
  ****************************************************************************/
-#define BUFFER_SIZE 4
-
 void loop()
 {
   cxd5602pwbimu_data_t raw;
-  static OrientationData_t OrientationDataBlock[BUFFER_SIZE][BLOCK_SIZE];
+  static ImuSpan<OrientationData_t> block;
+  static OrientationData_t scratch;
   static int block_idx = 0;
-  static int buffer_idx = 0;
-  static float last_timestamp = 0;
-
-  // ---- Static detection ----
-  static int static_counter = 0;
-  const float GYRO_THRESH = 0.05f;
-  const float ACC_THRESH  = 0.05f;
-  const int STATIC_CONFIRM_FRAMES = 16; 
+  static cxd5602pwbimu_data_t prev;
+  static bool has_prev = false;
 
   if (SpresenseIMU.get(raw)) {
 
-    if (last_timestamp == 0) {
-      last_timestamp = raw.timestamp / 19200000.0f;
+    if (!has_prev) {
+      prev = raw;
+      has_prev = true;
       return;
     }
 
@@ -183,43 +206,39 @@ void loop()
     raw.gy = raw.gy - gyroBias[1];
     raw.gz = raw.gz - gyroBias[2];
 
-    float t = raw.timestamp / 19200000.0f;
-    OrientationDataBlock[buffer_idx][block_idx].timestamp = t;
-    OrientationDataBlock[buffer_idx][block_idx].ax = raw.ax;
-    OrientationDataBlock[buffer_idx][block_idx].ay = raw.ay;
-    OrientationDataBlock[buffer_idx][block_idx].az = raw.az;
+    // Integration continues even while PosCore holds every block.
+    if (block_idx == 0) block = channel.acquire(0);
+    OrientationData_t& out = block.empty() ? scratch : block[block_idx];
+
+    out.timestamp = raw.timestamp;
+    out.ax = raw.ax;
+    out.ay = raw.ay;
+    out.az = raw.az;
 
     pwbQuaternionData result;
-    SpresenseIMU.convQuaternion(result,raw,last_timestamp);
+    SpresenseIMU.convQuaternion(result,raw,prev);   // dt は整数ティックの差分
     data = data * result;   // ← ここでちゃんと identity から積分が始まる
-    last_timestamp = t;
+    prev = raw;
     
     // ---- Static 判定 ----
-    float gyro_norm = sqrtf(raw.gx*raw.gx + raw.gy*raw.gy + raw.gz*raw.gz);
-    float acc_norm = sqrtf(raw.ax*raw.ax + raw.ay*raw.ay + raw.az*raw.az);
-    bool isStaticFrame = (gyro_norm < GYRO_THRESH) && (fabsf(acc_norm - trueGravity) < ACC_THRESH);
-
-    if (isStaticFrame) static_counter++; else static_counter = 0;
-    OrientationDataBlock[buffer_idx][block_idx].isStatic = (static_counter >= STATIC_CONFIRM_FRAMES);
+    out.isStatic = detector.update(raw);
 
-    OrientationDataBlock[buffer_idx][block_idx].q0 = data.q0;
-    OrientationDataBlock[buffer_idx][block_idx].q1 = data.q1;
-    OrientationDataBlock[buffer_idx][block_idx].q2 = data.q2;
-    OrientationDataBlock[buffer_idx][block_idx].q3 = data.q3;
+    out.q0 = data.q0;
+    out.q1 = data.q1;
+    out.q2 = data.q2;
+    out.q3 = data.q3;
 
 #ifdef SUBCORE_PRINT
-    printf("%4.2f,%f,%f,%f,%f,%d\n",
-      t,
+    // 64ビットに展開した時刻（折り返しなし）
+    printf("%.4f,%f,%f,%f,%f,%d\n",
+      ImuClock::toSeconds(SpresenseIMU.clock().ticksOf(raw.timestamp)),
       data.q0, data.q1, data.q2, data.q3,
-      OrientationDataBlock[buffer_idx][block_idx].isStatic ? 1 : 0
+      out.isStatic ? 1 : 0
     );
 #endif
 
     if (++block_idx >= BLOCK_SIZE) {
-      int8_t msgid = 10;
-      int ret = MP.Send(msgid, MP.Virt2Phys(OrientationDataBlock[buffer_idx]), pos_core);
-      if (ret < 0) errorLoop(SEND_ERROR);
-      buffer_idx = (buffer_idx + 1) % BUFFER_SIZE;
+      if (!block.empty() && !channel.publish(block)) errorLoop(SEND_ERROR);
       block_idx = 0;
     }
   }
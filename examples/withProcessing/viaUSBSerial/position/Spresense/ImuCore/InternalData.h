@@ -22,20 +22,23 @@
 
 #define BLOCK_SIZE 80  // Number of IMU frames per inter-core transfer block
 
+#define MSGID_GRAVITY      20  // ImuCore -> PosCore: float, gravity magnitude
+#define MSGID_CALIBRATION  21  // MainCore -> ImuCore: ImuCalibration*, NULL for none
+
 //-----------------------------------------------------------------------------
 // Orientation + acceleration data structure for inter-core sensor transfer
 // Used for attitude estimation and inertial navigation (INS)
 //-----------------------------------------------------------------------------
 struct OrientationData_t {
 
-  float timestamp;        // IMU timestamp [seconds]
+  uint32_t timestamp;     // IMU timestamp [19.2 MHz ticks, wraps every ~224 s]
   float q0, q1, q2, q3;   // Attitude quaternion 
   float ax, ay, az;       // Acceleration
   bool  isStatic;         // Static state flag (for ZUPT or motion detection)
 
   // Constructor (default initializer)
   OrientationData_t()
-    : timestamp(0.0f),
+    : timestamp(0),
       q0(1.0f), q1(0.0f), q2(0.0f), q3(0.0f), // Identity quaternion
       ax(0.0f), ay(0.0f), az(0.0f),           // Clear acceleration
       isStatic(false)                         // Default: not static
@@ -23,15 +23,24 @@
 
 #include <MP.h>
 #include "SpresenseIMU.h"
+#include "ImuTelemetry.h"
+#include "ImuCalibration.h"
 #include <USBSerial.h>
 #include "InternalData.h"
 
 USBSerial UsbSerial;
 const int usbserial_baurate = 921600;
 
+ImuLogStreamAdapter<USBSerial> usb_stream(UsbSerial);
+ImuTelemetry telemetry;
+
 const int imu_core = 1;
 const int pos_core = 2;
 
+// Written by the calibration example; ImuCore uses raw samples without it.
+#define CALIBRATION_PATH "/mnt/spif/imucal.dat"
+ImuCalibration calibration;
+
 void setup()
 {
   int ret = 0;
@@ -40,6 +49,7 @@ void setup()
   while (!Serial);
 
   UsbSerial.begin(usbserial_baurate);
+  telemetry.begin(usb_stream, 1);           // poses are already decimated
   Serial.println("Done!");
 
   ret = MP.begin(imu_core);
@@ -47,6 +57,13 @@ void setup()
     MPLog("MP.begin(%d) error = %d\n", imu_core, ret);
   }
 
+  /* Subcores have no file system: hand the table over by address. */
+  bool loaded = calibration.load(CALIBRATION_PATH);
+  ret = MP.Send(MSGID_CALIBRATION, loaded ? &calibration : NULL, imu_core);
+  if (ret < 0) {
+    MPLog("MP.Send(%d) error = %d\n", MSGID_CALIBRATION, ret);
+  }
+
   ret = MP.begin(pos_core);
   if (ret < 0) {
     MPLog("MP.begin(%d) error = %d\n", imu_core, ret);
@@ -63,13 +80,8 @@ void loop()
   int ret = MP.Recv(&msgid, &data, pos_core);
   if (ret >= 0) {
     printf("%4.2F,%F,%F,%F\n", data->timestamp, data->x, data->y, data->z);
-    UsbSerial.print(data->timestamp, 2);
-    UsbSerial.print(",");
-    UsbSerial.print(data->x);
-    UsbSerial.print(",");
-    UsbSerial.print(data->y);
-    UsbSerial.print(",");
-    UsbSerial.println(data->z);
+    float record[4] = { data->timestamp, data->x, data->y, data->z };
+    telemetry.writeRecord(record, 4);
   }
 }
 
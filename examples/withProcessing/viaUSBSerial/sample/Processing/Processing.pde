@@ -2,6 +2,7 @@ import processing.serial.*;
 import java.util.ArrayList;
 
 Serial myPort;
+ImuTelemetryDecoder telemetry = new ImuTelemetryDecoder();
 
 class SensorData {
   float timestamp;
@@ -44,17 +45,16 @@ void setup() {
 
 }
 
-SensorData parseSensorData(String str) {
-  String[] values = split(str, ',');
+SensorData parseSensorData(float[] values) {
   if (values.length == 8) {
-    float timestamp = float(values[0]);
-    float temp = float(values[1]);
-    float ax = float(values[2]);
-    float ay = float(values[3]);
-    float az = float(values[4]);
-    float gx = float(values[5]);
-    float gy = float(values[6]);
-    float gz = float(values[7]);
+    float timestamp = values[0];
+    float temp = values[1];
+    float ax = values[2];
+    float ay = values[3];
+    float az = values[4];
+    float gx = values[5];
+    float gy = values[6];
+    float gz = values[7];
 
     if (Float.isNaN(ax)) ax = 0;
     if (Float.isNaN(ay)) ay = 0;
@@ -152,17 +152,17 @@ void draw_graph() {
 void draw() {
   background(200);
 
-  if (myPort.available() > 0) {
-    String str = myPort.readStringUntil('\n');  // sŃf[^ǂݍ
-    if (str != null) {
-      SensorData data = parseSensorData(str);
-        print_data(data);
-       
-        if (sensorDataList.size() >= 120) {
-          sensorDataList.remove(0);
-        }
-        sensorDataList.add(data);
-      draw_graph();
+  telemetry.feed(myPort);
+  if (telemetry.available()) {
+    SensorData data = null;
+    while (telemetry.available()) {
+      data = parseSensorData(telemetry.next());
+      if (sensorDataList.size() >= 120) {
+        sensorDataList.remove(0);
+      }
+      sensorDataList.add(data);
     }
+    print_data(data);
   }
+  draw_graph();
 }
@@ -18,6 +18,7 @@
  */
 #include <MP.h> 
 #include "SpresenseIMU.h"
+#include "ImuBlockChannel.h"
 
 //#define SUBCORE_PRINT
 
@@ -45,12 +46,18 @@ enum error_no {
   SEND_ERROR
 };
 
+const int main_core = 0;
+
+ImuMpTransport transport(main_core);
+ImuBlockChannel<cxd5602pwbimu_data_t, 4, 1> channel(transport);
+
 /****************************************************************************
  * Setup
  ****************************************************************************/
 void setup(void)
 {
   MP.begin(); 
+  channel.beginProducer();
 
   int ret;
   ret = SpresenseIMU.begin();
@@ -86,12 +93,13 @@ void loop()
   if (SpresenseIMU.get(data)) {
 
 #ifndef SUBCORE_PRINT
-    int8_t msgid = 10;
-    int ret = MP.Send(msgid, (void*)MP.Virt2Phys(&data));
-    if (ret < 0) {
+    // A slot is reused only after MainCore has released it.
+    ImuSpan<cxd5602pwbimu_data_t> block = channel.acquire(0);
+    if (block.empty()) return;
+    block[0] = data;
+    if (!channel.publish(block)) {
       errorLoop(SEND_ERROR);
     }
-    usleep(10*1000);
 #else
     float timestamp = data.timestamp / 19200000.0f;
     printf("%4.2F,%4.2F,%F,%F,%F,%F,%F,%F\n", timestamp, data.temp, data.ax, data.ay, data.az, data.gx, data.gy, data.gz);
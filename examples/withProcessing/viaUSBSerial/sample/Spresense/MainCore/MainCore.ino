@@ -23,13 +23,21 @@
 
 #include <MP.h>
 #include "SpresenseIMU.h"
+#include "ImuBlockChannel.h"
+#include "ImuTelemetry.h"
 #include <USBSerial.h>
 
 USBSerial UsbSerial;
 const int usbserial_baurate = 921600;
 
+ImuLogStreamAdapter<USBSerial> usb_stream(UsbSerial);
+ImuTelemetry telemetry;
+
 const int imu_core = 1;
 
+ImuMpTransport transport(imu_core);
+ImuBlockChannel<cxd5602pwbimu_data_t, 4, 1> channel(transport);
+
 void setup()
 {
   int ret = 0;
@@ -38,6 +46,7 @@ void setup()
   while (!Serial);
 
   UsbSerial.begin(usbserial_baurate);
+  telemetry.begin(usb_stream, 8, true);     // 8 samples per frame, int16
   Serial.println("Done!");
 
   ret = MP.begin(imu_core);
@@ -48,28 +57,10 @@ void setup()
 
 void loop()
 {
-  int8_t   msgid = 0;
-  cxd5602pwbimu_data_t* data;
-
-  int ret = MP.Recv(&msgid, &data, imu_core);
-  if (ret >= 0) {
-    float timestamp = data->timestamp / 19200000.0f;
-//    printf("%4.2F,%4.2F,%F,%F,%F,%F,%F,%F\n", timestamp, data->temp, data->ax, data->ay, data->az, data->gx, data->gy, data->gz);
-    UsbSerial.print(timestamp, 2);
-    UsbSerial.print(",");
-    UsbSerial.print(data->temp, 2);
-    UsbSerial.print(",");
-    UsbSerial.print(data->ax);
-    UsbSerial.print(",");
-    UsbSerial.print(data->ay);
-    UsbSerial.print(",");
-    UsbSerial.print(data->az);
-    UsbSerial.print(",");
-    UsbSerial.print(data->gx);
-    UsbSerial.print(",");
-    UsbSerial.print(data->gy);
-    UsbSerial.print(",");
-    UsbSerial.println(data->gz);
+  ImuSpan<cxd5602pwbimu_data_t> block = channel.receive();
+  if (!block.empty()) {
+    telemetry.write(block.data, block.size);
+    channel.release(block);
   }
 }
 
@@ -0,0 +1,296 @@
+/*
+ *  GyroCompass.cpp - Incremental gyrocompass calibration.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "GyroCompass.h"
+
+#include <math.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+// About 3 % of the horizontal earth rate at mid latitudes.
+#define DEFAULT_STDERR       (2.0e-6)
+#define DEFAULT_MIN_SAMPLES  (120)
+#define DEFAULT_MAX_SAMPLES  (1800)
+
+/****************************************************************************
+ * constructor / reset
+ ****************************************************************************/
+template<typename T>
+GyroCompassT<T>::GyroCompassT()
+  : tol(DEFAULT_STDERR), min_n(DEFAULT_MIN_SAMPLES), max_n(DEFAULT_MAX_SAMPLES)
+{
+  beginPose();
+}
+
+template<typename T>
+void GyroCompassT<T>::reset()
+{
+  clearPoses();
+  beginPose();
+}
+
+template<typename T>
+void GyroCompassT<T>::setConvergence(double stderr_rad_s, uint32_t min_samples, uint32_t max_samples)
+{
+  tol   = stderr_rad_s;
+  min_n = (min_samples < 2) ? 2 : min_samples;
+  max_n = (max_samples < min_n) ? min_n : max_samples;
+}
+
+/****************************************************************************
+ * pose accumulation
+ ****************************************************************************/
+template<typename T>
+void GyroCompassT<T>::beginPose()
+{
+  pose_n = 0;
+  blk_n  = 0;
+  for (int i = 0; i < 3; i++)
+    {
+      ref[i]   = T();
+      blk_s[i] = blk_ss[i] = Acc();
+      sum[i]   = sumsq[i] = 0;
+    }
+}
+
+template<typename T>
+void GyroCompassT<T>::addSample(const pwbImuDataT<T>& s)
+{
+  typedef ImuNumeric<T> N;
+
+  /* Offsets from the first sample keep the squares small. */
+  if (pose_n == 0)
+    {
+      ref[0] = s.gx;
+      ref[1] = s.gy;
+      ref[2] = s.gz;
+    }
+
+  T d0 = s.gx - ref[0];
+  T d1 = s.gy - ref[1];
+  T d2 = s.gz - ref[2];
+
+  blk_s[0] += N::acc(d0);  blk_ss[0] += N::accSq(d0);
+  blk_s[1] += N::acc(d1);  blk_ss[1] += N::accSq(d1);
+  blk_s[2] += N::acc(d2);  blk_ss[2] += N::accSq(d2);
+
+  pose_n++;
+  if (++blk_n == GYRO_COMPASS_BLOCK) fold();
+}
+
+template<typename T>
+void GyroCompassT<T>::addSample(const cxd5602pwbimu_data_t* s, size_t n)
+{
+  for (size_t i = 0; i < n; i++) addSample(s[i]);
+}
+
+template<typename T>
+void GyroCompassT<T>::fold()
+{
+  for (int i = 0; i < 3; i++)
+    {
+      sum[i]   += ImuNumeric<T>::sumOf(blk_s[i]);
+      sumsq[i] += ImuNumeric<T>::sumSqOf(blk_ss[i]);
+      blk_s[i]  = blk_ss[i] = Acc();
+    }
+  blk_n = 0;
+}
+
+template<typename T>
+void GyroCompassT<T>::moments(double s[3], double ss[3]) const
+{
+  for (int i = 0; i < 3; i++)
+    {
+      s[i]  = sum[i]   + ImuNumeric<T>::sumOf(blk_s[i]);
+      ss[i] = sumsq[i] + ImuNumeric<T>::sumSqOf(blk_ss[i]);
+    }
+}
+
+template<typename T>
+double GyroCompassT<T>::poseStdErr() const
+{
+  if (pose_n < 2) return HUGE_VAL;
+
+  double s[3], ss[3];
+  moments(s, ss);
+
+  /* var(mean) = M2 / (n - 1) / n, M2 = sum d^2 - (sum d)^2 / n */
+  double n  = pose_n;
+  double vx = (ss[0] - s[0] * s[0] / n) / ((n - 1) * n);
+  double vy = (ss[1] - s[1] * s[1] / n) / ((n - 1) * n);
+  double v  = (vx > vy) ? vx : vy;
+
+  return (v > 0) ? sqrt(v) : 0;
+}
+
+template<typename T>
+bool GyroCompassT<T>::poseConverged() const
+{
+  if (pose_n >= max_n) return true;
+  if (pose_n <  min_n) return false;
+  return poseStdErr() <= tol;
+}
+
+template<typename T>
+pwbGyroData GyroCompassT<T>::poseMean() const
+{
+  pwbGyroData m;
+  if (pose_n == 0) return m;
+
+  double s[3], ss[3];
+  moments(s, ss);
+
+  m.x = ImuNumeric<T>::toDouble(ref[0]) + s[0] / pose_n;
+  m.y = ImuNumeric<T>::toDouble(ref[1]) + s[1] / pose_n;
+  m.z = ImuNumeric<T>::toDouble(ref[2]) + s[2] / pose_n;
+  return m;
+}
+
+template<typename T>
+bool GyroCompassT<T>::endPose(pwbGyroData* mean_out)
+{
+  if (pose_n == 0) return false;
+
+  pwbGyroData m = poseMean();
+  if (mean_out) *mean_out = m;
+  addPose(m);
+  beginPose();
+
+  return true;
+}
+
+template class GyroCompassT<float>;
+template class GyroCompassT<double>;
+template class GyroCompassT<ImuQ16>;
+
+/****************************************************************************
+ * fit: constructor / clear
+ ****************************************************************************/
+GyroCompassFit::GyroCompassFit()
+{
+  clearPoses();
+}
+
+void GyroCompassFit::clearPoses()
+{
+  num_poses = 0;
+  ref_x = ref_y = 0;
+  for (int i = 0; i < NUM_MOMENTS; i++) mom[i].clear();
+}
+
+/****************************************************************************
+ * circle fit moments
+ ****************************************************************************/
+void GyroCompassFit::addPose(const pwbGyroData& m)
+{
+  if (num_poses == 0)
+    {
+      ref_x = m.x;
+      ref_y = m.y;
+    }
+
+  double u = m.x - ref_x;
+  double v = m.y - ref_y;
+  double w = u * u + v * v;
+
+  mom[SX].add(u);
+  mom[SY].add(v);
+  mom[SZ].add(m.z);
+  mom[SXX].add(u * u);
+  mom[SYY].add(v * v);
+  mom[SXY].add(u * v);
+  mom[SXW].add(u * w);
+  mom[SYW].add(v * w);
+  mom[SW].add(w);
+  mom[SWW].add(w * w);
+
+  num_poses++;
+}
+
+bool GyroCompassFit::fit(pwbGyroData* bias_out, double* radius_out, double* residual_out) const
+{
+  if (num_poses < 3) return false;
+
+  double n   = num_poses;
+  double sx  = mom[SX].s,  sy  = mom[SY].s;
+  double sxx = mom[SXX].s, syy = mom[SYY].s, sxy = mom[SXY].s;
+  double sxw = mom[SXW].s, syw = mom[SYW].s;
+  double sw  = mom[SW].s,  sww = mom[SWW].s;
+
+  /* Normal equations for (D, E, F), Gaussian elimination with pivoting. */
+  double a[3][4] = {
+    { sxx, sxy, sx, -sxw },
+    { sxy, syy, sy, -syw },
+    { sx,  sy,  n,  -sw  }
+  };
+  double scale = sxx + syy + n;
+
+  for (int c = 0; c < 3; c++)
+    {
+      int p = c;
+      for (int r = c + 1; r < 3; r++)
+        {
+          if (fabs(a[r][c]) > fabs(a[p][c])) p = r;
+        }
+      if (fabs(a[p][c]) <= 1e-12 * scale) return false;
+      if (p != c)
+        {
+          for (int k = 0; k < 4; k++)
+            {
+              double t = a[c][k]; a[c][k] = a[p][k]; a[p][k] = t;
+            }
+        }
+      for (int r = c + 1; r < 3; r++)
+        {
+          double f = a[r][c] / a[c][c];
+          for (int k = c; k < 4; k++) a[r][k] -= f * a[c][k];
+        }
+    }
+
+  double F = a[2][3] / a[2][2];
+  double E = (a[1][3] - a[1][2] * F) / a[1][1];
+  double D = (a[0][3] - a[0][1] * E - a[0][2] * F) / a[0][0];
+
+  double cx = -D / 2;
+  double cy = -E / 2;
+  double r2 = cx * cx + cy * cy - F;
+  if (r2 <= 0) return false;
+
+  if (bias_out)
+    {
+      bias_out->x = cx + ref_x;
+      bias_out->y = cy + ref_y;
+      bias_out->z = mom[SZ].s / n;
+    }
+  if (radius_out) *radius_out = sqrt(r2);
+
+  if (residual_out)
+    {
+      /* sum (w + D u + E v + F)^2 expanded in the moments; divided by
+       * 2r it approximates the RMS distance of the poses to the circle. */
+      double ss = sww + D * D * sxx + E * E * syy + F * F * n
+                + 2 * (D * sxw + E * syw + F * sw + D * E * sxy + D * F * sx + E * F * sy);
+      if (ss < 0) ss = 0;
+      *residual_out = sqrt(ss / n) / (2 * sqrt(r2));
+    }
+
+  return true;
+}
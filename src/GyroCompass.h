@@ -0,0 +1,141 @@
+/*
+ *  GyroCompass.h - Incremental gyrocompass calibration.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _GYRO_COMPASS_H_
+#define _GYRO_COMPASS_H_
+
+#include "SpresenseIMU.h"
+#include "ImuSpan.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+// Samples summed in the policy type before they are folded into double.
+#define GYRO_COMPASS_BLOCK  (256)
+
+/**************************************************************************
+ * GyroCompass
+ *
+ *  The board is held still in several poses rotated about Z. The mean
+ *  gyro (x, y) of each pose lies on a circle whose center is the bias
+ *  and whose radius is the horizontal earth rate.
+ *
+ *  Pose (GyroCompassT<T>): samples relative to the first one of the pose
+ *  are summed, with their squares, in the numeric policy T (ImuNumeric.h)
+ *  for GYRO_COMPASS_BLOCK samples, then folded into double sums. The
+ *  per-sample path therefore has no double arithmetic with T = float
+ *  (GyroCompass) or ImuQ16. The pose has converged when the standard
+ *  error of the x and y means is below the tolerance, so a quiet board
+ *  finishes sooner than a noisy one.
+ *
+ *  Fit (GyroCompassFit): each pose mean only updates Kahan-summed
+ *  moments (relative to the first pose, for conditioning), so any number
+ *  of poses can be used and fit() is available at any time. It solves the
+ *  algebraic circle fit x^2 + y^2 + D x + E y + F = 0 from the moments,
+ *  in double, once per call.
+ **************************************************************************/
+
+class GyroCompassFit {
+
+public:
+  GyroCompassFit();
+
+  // Drop all poses.
+  void clearPoses();
+
+  // Add an averaged pose.
+  void addPose(const pwbGyroData& mean);
+
+  int poses() const { return num_poses; }
+
+  // bias_out: circle center (x, y) and the mean z of all poses.
+  // Returns false with fewer than 3 poses or a degenerate layout.
+  bool fit(pwbGyroData* bias_out, double* radius_out = NULL, double* residual_out = NULL) const;
+
+private:
+  struct KahanSum {
+    double s, c;
+    void clear() { s = c = 0; }
+    void add(double v) {
+      double y = v - c;
+      double t = s + y;
+      c = (t - s) - y;
+      s = t;
+    }
+  };
+
+  enum { SX = 0, SY, SZ, SXX, SYY, SXY, SXW, SYW, SW, SWW, NUM_MOMENTS };
+
+  int      num_poses;
+  double   ref_x, ref_y;
+  KahanSum mom[NUM_MOMENTS];
+};
+
+template<typename T>
+class GyroCompassT : public GyroCompassFit {
+
+public:
+  GyroCompassT();
+
+  // Drop all poses and the current pose.
+  void reset();
+
+  // Pose termination: standard error (rad/s) of the x / y means, and
+  // the sample count limits.
+  void setConvergence(double stderr_rad_s, uint32_t min_samples, uint32_t max_samples);
+
+  /* Current pose */
+
+  void beginPose();
+  void addSample(const pwbImuDataT<T>& s);
+  void addSample(const cxd5602pwbimu_data_t& s) { if (!imuIsMarker(s)) addSample(pwbImuDataT<T>(s)); }
+  void addSample(const cxd5602pwbimu_data_t* s, size_t n);
+  void addSample(ImuSpan<cxd5602pwbimu_data_t> span) { addSample(span.data, span.size); }
+
+  uint32_t poseSamples() const { return pose_n; }
+  double   poseStdErr() const;             // max of x / y, rad/s
+  bool     poseConverged() const;          // stderr reached, or max_samples
+  pwbGyroData poseMean() const;
+
+  // Add the current pose mean to the fit. false if it has no samples.
+  bool endPose(pwbGyroData* mean_out = NULL);
+
+private:
+  typedef typename ImuNumeric<T>::Acc Acc;
+
+  void fold();
+  void moments(double s[3], double ss[3]) const;
+
+  double   tol;
+  uint32_t min_n;
+  uint32_t max_n;
+
+  uint32_t pose_n;
+  T        ref[3];
+  Acc      blk_s[3];
+  Acc      blk_ss[3];
+  uint32_t blk_n;
+  double   sum[3];
+  double   sumsq[3];
+};
+
+typedef GyroCompassT<float> GyroCompass;
+
+#endif // _GYRO_COMPASS_H_
@@ -0,0 +1,323 @@
+/*
+ *  ImuAdaptive.cpp - Motion-triggered adaptive sampling rate.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "ImuAdaptive.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/****************************************************************************
+ * ImuStaticDetector
+ ****************************************************************************/
+ImuStaticDetector::ImuStaticDetector()
+  : gravity(IMU_GRAVITY)
+{
+  setThresholds(IMU_STATIC_GYRO, IMU_STATIC_ACCEL);
+  setConfirm(IMU_STATIC_CONFIRM);
+  reset();
+}
+
+void ImuStaticDetector::setThresholds(float gyro, float accel, float hysteresis)
+{
+  if (hysteresis < 1.0f) hysteresis = 1.0f;
+  gyro_quiet2 = gyro * gyro;
+  gyro_move2  = gyro_quiet2 * hysteresis * hysteresis;
+  accel_quiet = accel;
+  accel_move  = accel * hysteresis;
+}
+
+void ImuStaticDetector::setConfirm(int samples, int moving)
+{
+  confirm = (samples > 0) ? samples : 1;
+  motion  = (moving > 0) ? moving : 1;
+}
+
+void ImuStaticDetector::reset(bool is_static)
+{
+  quiet_count = move_count = 0;
+  still = is_static;
+}
+
+bool ImuStaticDetector::update(const cxd5602pwbimu_data_t& s)
+{
+  if (imuIsMarker(s)) return still;
+
+  float g2 = s.gx * s.gx + s.gy * s.gy + s.gz * s.gz;
+  float da = fabsf(sqrtf(s.ax * s.ax + s.ay * s.ay + s.az * s.az) - gravity);
+
+  if (g2 < gyro_quiet2 && da < accel_quiet)
+    {
+      move_count = 0;
+      if (++quiet_count >= confirm) still = true;
+    }
+  else
+    {
+      quiet_count = 0;
+      if (g2 > gyro_move2 || da > accel_move)
+        {
+          if (++move_count >= motion) still = false;
+        }
+      else
+        {
+          move_count = 0;
+        }
+    }
+
+  return still;
+}
+
+/****************************************************************************
+ * ImuAdaptive
+ ****************************************************************************/
+ImuAdaptive::ImuAdaptive()
+  : imu(NULL), active_rate(960), active_fifo(4), idle_rate(15), idle_fifo(4),
+    hold(2.0f), heartbeat(0), heartbeat_phase(0), is_active(false),
+    ramp_pending(false), ramp_from(0), last_ticks(0), batch(NULL), batch_len(0)
+{
+}
+
+ImuAdaptive::~ImuAdaptive()
+{
+  end();
+}
+
+void ImuAdaptive::setActive(int rate, int nfifos)
+{
+  active_rate = rate;
+  active_fifo = nfifos;
+}
+
+void ImuAdaptive::setIdle(int rate, int nfifos, float hold_seconds, int every)
+{
+  idle_rate = rate;
+  idle_fifo = nfifos;
+  hold      = hold_seconds;
+  heartbeat = (every > 0) ? every : 0;
+}
+
+/****************************************************************************
+ * begin / end
+ ****************************************************************************/
+bool ImuAdaptive::begin(SpresenseImuClass& dev, size_t history_len)
+{
+  end();
+
+  imu = &dev;
+  if (imu->isStreaming())
+    {
+      printf("ERROR: adaptive sampling reads the IMU itself (stop streaming).\n");
+      return false;
+    }
+
+  batch_len = active_fifo;
+  if ((size_t)idle_fifo > batch_len) batch_len = idle_fifo;
+  if ((size_t)imu->fifoDepth() > batch_len) batch_len = imu->fifoDepth();
+
+  batch = (cxd5602pwbimu_data_t*)malloc(sizeof(cxd5602pwbimu_data_t) * batch_len);
+  if (batch == NULL ||
+      !history.allocate(history_len > 0 ? history_len : 1) ||
+      !out.allocate(history_len + 2 * batch_len + 2))
+    {
+      printf("ERROR: adaptive sampling buffer allocation failed.\n");
+      end();
+      return false;
+    }
+
+  stat = ImuAdaptiveStats();
+  ramp_pending    = false;
+  heartbeat_phase = 0;
+  last_ticks      = 0;
+
+  if (imu->sampleRate() != active_rate || imu->fifoDepth() != active_fifo)
+    {
+      if (imu->reconfigure(active_rate, imu->accelRange(), imu->gyroRange(), active_fifo) < 0)
+        {
+          end();
+          return false;
+        }
+    }
+
+  is_active = true;
+  det.setConfirm((int)(hold * active_rate), det.motionSamples());
+  det.reset(false);
+
+  return true;
+}
+
+void ImuAdaptive::end()
+{
+  free(batch);
+  batch     = NULL;
+  batch_len = 0;
+  history.release();
+  out.release();
+}
+
+/****************************************************************************
+ * mode switch
+ ****************************************************************************/
+bool ImuAdaptive::switchTo(bool to_active)
+{
+  int rate   = to_active ? active_rate : idle_rate;
+  int nfifos = to_active ? active_fifo : idle_fifo;
+
+  if (imu->reconfigure(rate, imu->accelRange(), imu->gyroRange(), nfifos) < 0)
+    {
+      /* Back to the state being left: another full hold period (or the
+       * motion count) has to pass before the next attempt. */
+      stat.failures++;
+      ramp_pending = false;
+      det.reset(to_active);
+      return false;
+    }
+
+  is_active = to_active;
+  if (to_active)
+    {
+      stat.ramps_up++;
+      det.setConfirm((int)(hold * active_rate), det.motionSamples());
+    }
+  else
+    {
+      stat.ramps_down++;
+      heartbeat_phase = 0;
+    }
+
+  return true;
+}
+
+/****************************************************************************
+ * pre-trigger history
+ ****************************************************************************/
+void ImuAdaptive::flushHistory()
+{
+  uint32_t n = (uint32_t)history.size();
+  if (n > stat.history_max) stat.history_max = n;
+
+  cxd5602pwbimu_data_t s;
+  while (history.pop(s)) out.push(&s, 1);
+}
+
+/****************************************************************************
+ * one watermark
+ ****************************************************************************/
+bool ImuAdaptive::pump()
+{
+  size_t n = imu->read(batch, batch_len);
+  if (n == 0) return false;
+
+  uint64_t now = imu->clock().ticks();
+  if (last_ticks != 0)
+    {
+      if (is_active) stat.active_ticks += now - last_ticks;
+      else           stat.idle_ticks   += now - last_ticks;
+    }
+  last_ticks = now;
+
+  for (size_t i = 0; i < n; i++)
+    {
+      const cxd5602pwbimu_data_t& s = batch[i];
+
+      if (imuIsMarker(s))
+        {
+          out.push(&s, 1);
+          continue;
+        }
+
+      if (ramp_pending)
+        {
+          uint32_t ramp = (uint32_t)(imu->clock().ticksOf(s.timestamp) - ramp_from);
+          if (ramp > stat.ramp_ticks_max) stat.ramp_ticks_max = ramp;
+          ramp_pending = false;
+        }
+
+      bool still = det.update(s);
+
+      if (is_active)
+        {
+          out.push(&s, 1);
+          if (still)
+            {
+              out.push(&batch[i + 1], n - i - 1);
+              switchTo(false);
+              return true;
+            }
+          continue;
+        }
+
+      if (!still)
+        {
+          /* Motion: the history up to the end of this watermark goes first. */
+          for (size_t k = i; k < n; k++)
+            {
+              if (history.size() == history.capacity()) stat.suppressed += history.discard(1);
+              history.push(&batch[k], 1);
+            }
+          flushHistory();
+          ramp_from    = imu->clock().ticksOf(s.timestamp);
+          ramp_pending = true;
+          switchTo(true);
+          return true;
+        }
+
+      if (heartbeat != 0 && ++heartbeat_phase >= heartbeat)
+        {
+          /* The history restarts after each sample handed out. */
+          heartbeat_phase = 0;
+          stat.suppressed += history.discard(history.size());
+          out.push(&s, 1);
+          continue;
+        }
+
+      if (history.size() == history.capacity()) stat.suppressed += history.discard(1);
+      history.push(&s, 1);
+    }
+
+  return true;
+}
+
+/****************************************************************************
+ * read
+ ****************************************************************************/
+size_t ImuAdaptive::read(cxd5602pwbimu_data_t* dst, size_t max)
+{
+  if (batch == NULL || max == 0) return 0;
+
+  while (out.size() == 0)
+    {
+      if (!pump()) return 0;
+    }
+
+  return out.pop(dst, max);
+}
+
+/****************************************************************************
+ * ImuAdaptiveStats
+ ****************************************************************************/
+void ImuAdaptiveStats::print() const
+{
+  double idle   = ImuClock::toSeconds(idle_ticks);
+  double active = ImuClock::toSeconds(active_ticks);
+
+  printf("adaptive up %lu, down %lu, failures %lu, idle %.1f s, active %.1f s\n",
+         (unsigned long)ramps_up, (unsigned long)ramps_down, (unsigned long)failures, idle, active);
+  printf("ramp max %.1f ms, history max %lu, suppressed %lu\n",
+         ramp_ticks_max * (1000.0f / IMU_TICKS_PER_SEC),
+         (unsigned long)history_max, (unsigned long)suppressed);
+}
@@ -0,0 +1,154 @@
+/*
+ *  ImuAdaptive.h - Motion-triggered adaptive sampling rate.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _IMU_ADAPTIVE_H_
+#define _IMU_ADAPTIVE_H_
+
+#include "SpresenseIMU.h"
+#include "ImuRingBuffer.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+// Static detector defaults (as in the position example's ZUPT).
+#define IMU_STATIC_GYRO      (0.05f)     // rad/s
+#define IMU_STATIC_ACCEL     (0.05f)     // m/s^2 around gravity
+#define IMU_STATIC_CONFIRM   (16)        // static samples in a row
+
+#define IMU_ADAPT_HISTORY    (64)        // pre-trigger samples kept while idle
+
+/**************************************************************************
+ * ImuStaticDetector
+ *
+ *  A sample is quiet if |gyro| < gyro and ||acc| - gravity| < accel, and
+ *  moving if either exceeds `hysteresis` times its threshold. The state
+ *  turns static after `confirm` quiet samples in a row and back to moving
+ *  after `motion` moving samples in a row; samples in between keep it.
+ *  Markers (imuIsMarker()) are ignored.
+ **************************************************************************/
+
+class ImuStaticDetector {
+
+public:
+  ImuStaticDetector();
+
+  void setThresholds(float gyro, float accel, float hysteresis = 1.0f);
+  void setGravity(float g) { gravity = g; }
+  void setConfirm(int samples, int motion = 1);
+  int  confirmSamples() const { return confirm; }
+  int  motionSamples() const { return motion; }
+  void reset(bool is_static = false);
+
+  // Returns isStatic() after the sample.
+  bool update(const cxd5602pwbimu_data_t& s);
+  bool isStatic() const { return still; }
+
+private:
+  float gyro_quiet2, gyro_move2;
+  float accel_quiet, accel_move;
+  float gravity;
+  int   confirm, motion;
+  int   quiet_count, move_count;
+  bool  still;
+};
+
+/**************************************************************************
+ * ImuAdaptive
+ *
+ *  Runs the IMU at the active rate while it moves and at a low rate with
+ *  a deep FIFO (few wake-ups) once it has been static for `hold`
+ *  seconds, using SpresenseIMU.reconfigure().
+ *
+ *  While idle, samples are kept in a pre-trigger history instead of
+ *  being handed out (optionally every n-th one as a heartbeat). When
+ *  motion starts, read() returns the history first, so the onset is
+ *  there, then the marker and the samples at the active rate. The ramp
+ *  takes at most one idle watermark (idle nfifos / idle rate) plus the
+ *  reconfiguration blackout; stats() has the worst case measured.
+ *
+ *  read() is the only reader of the IMU (not streaming) and blocks
+ *  while idle without heartbeat.
+ **************************************************************************/
+
+struct ImuAdaptiveStats {
+  uint32_t ramps_up;         // idle -> active
+  uint32_t ramps_down;       // active -> idle
+  uint32_t failures;         // reconfigure() errors
+  uint32_t ramp_ticks_max;   // first moving sample to the first active one
+  uint32_t history_max;      // most pre-trigger samples handed out at once
+  uint32_t suppressed;       // idle samples never handed out
+  uint64_t idle_ticks;       // time spent in each mode
+  uint64_t active_ticks;
+
+  ImuAdaptiveStats() { memset(this, 0, sizeof(*this)); }
+
+  void print() const;
+};
+
+class ImuAdaptive {
+
+public:
+  ImuAdaptive();
+  ~ImuAdaptive();
+
+  // Before begin(). Defaults: active 960 Hz / FIFO 4, idle 15 Hz / FIFO 4,
+  // 2 s hold, no heartbeat. The hold sets the detector's static confirm
+  // count at the active rate; its motion count is left as configured.
+  void setActive(int rate, int nfifos);
+  void setIdle(int rate, int nfifos, float hold_seconds, int heartbeat = 0);
+  ImuStaticDetector& detector() { return det; }
+
+  // `imu` must be initialized and started. Switches it to the active rate.
+  bool begin(SpresenseImuClass& imu = SpresenseIMU, size_t history = IMU_ADAPT_HISTORY);
+  void end();
+
+  size_t read(cxd5602pwbimu_data_t* dst, size_t max);
+
+  bool active() const { return is_active; }
+  ImuAdaptiveStats stats() const { return stat; }
+
+private:
+  bool pump();
+  bool switchTo(bool to_active);
+  void flushHistory();
+
+  SpresenseImuClass* imu;
+  ImuStaticDetector  det;
+
+  int   active_rate, active_fifo;
+  int   idle_rate, idle_fifo;
+  float hold;
+  int   heartbeat;
+  int   heartbeat_phase;
+
+  bool  is_active;
+  bool  ramp_pending;
+  uint64_t ramp_from;        // ticks of the sample that started the ramp
+  uint64_t last_ticks;
+
+  cxd5602pwbimu_data_t* batch;
+  size_t batch_len;
+  ImuRingBuffer<cxd5602pwbimu_data_t> history;
+  ImuRingBuffer<cxd5602pwbimu_data_t> out;
+
+  ImuAdaptiveStats stat;
+};
+
+#endif // _IMU_ADAPTIVE_H_
@@ -0,0 +1,245 @@
+/*
+ *  ImuAllan.cpp - Streaming overlapping Allan deviation.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "ImuAllan.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define MIN_TERMS        (4)        // levels with fewer are not used by noise()
+#define BI_FACTOR        (0.664f)   // sqrt(2 ln2 / pi)
+
+/****************************************************************************
+ * constructor / begin
+ ****************************************************************************/
+ImuAllan::ImuAllan()
+  : sample_rate(1)
+{
+  reset();
+}
+
+void ImuAllan::begin(float rate)
+{
+  sample_rate = (rate > 0) ? rate : 1;
+  reset();
+}
+
+void ImuAllan::reset()
+{
+  n_samples = 0;
+  memset(offset, 0, sizeof(offset));
+  memset(pending, 0, sizeof(pending));
+  memset(has_pending, 0, sizeof(has_pending));
+  memset(ring, 0, sizeof(ring));
+  memset(head, 0, sizeof(head));
+  memset(filled, 0, sizeof(filled));
+  memset(sum_sq, 0, sizeof(sum_sq));
+  memset(n_terms, 0, sizeof(n_terms));
+}
+
+/****************************************************************************
+ * add
+ ****************************************************************************/
+void ImuAllan::add(const cxd5602pwbimu_data_t& s)
+{
+  if (imuIsMarker(s)) return;
+
+  float v[IMU_ALLAN_AXES] = { s.gx, s.gy, s.gz, s.ax, s.ay, s.az };
+
+  /* Remove the first sample so block sums stay small in float. */
+  if (n_samples == 0)
+    {
+      for (int a = 0; a < IMU_ALLAN_AXES; a++) offset[a] = v[a];
+    }
+  for (int a = 0; a < IMU_ALLAN_AXES; a++) v[a] -= offset[a];
+
+  n_samples++;
+  feedStream(0, v);
+}
+
+void ImuAllan::add(const cxd5602pwbimu_data_t* s, size_t n)
+{
+  for (size_t i = 0; i < n; i++) add(s[i]);
+}
+
+/****************************************************************************
+ * block sum streams
+ ****************************************************************************/
+void ImuAllan::feedStream(int stream, const float v[IMU_ALLAN_AXES])
+{
+  float sum[IMU_ALLAN_AXES];
+
+  for (int j = stream; j < STREAMS; j++)
+    {
+      /* Stream 0 (single samples) serves every level with m <= OVERLAP,
+       * stream j > 0 (2^j samples) serves level j + OVERLAP_LOG2. */
+      if (j == 0)
+        {
+          for (int k = 0; k <= OVERLAP_LOG2 && k < IMU_ALLAN_LEVELS; k++) feedLevel(k, v);
+        }
+      else
+        {
+          feedLevel(j + OVERLAP_LOG2, v);
+        }
+
+      if (j + 1 >= STREAMS) return;
+
+      if (!has_pending[j + 1])
+        {
+          memcpy(pending[j + 1], v, sizeof(sum));
+          has_pending[j + 1] = true;
+          return;
+        }
+
+      for (int a = 0; a < IMU_ALLAN_AXES; a++) sum[a] = pending[j + 1][a] + v[a];
+      has_pending[j + 1] = false;
+      v = sum;
+    }
+}
+
+void ImuAllan::feedLevel(int k, const float v[IMU_ALLAN_AXES])
+{
+  int blocks = 1 << ((k < OVERLAP_LOG2) ? k : OVERLAP_LOG2);
+  int size   = 2 * blocks;
+
+  memcpy(ring[k][head[k]], v, sizeof(ring[k][0]));
+  head[k] = (head[k] + 1) % size;
+  if (filled[k] < size)
+    {
+      filled[k]++;
+      if (filled[k] < size) return;
+    }
+
+  /* Oldest entry is at head: [older cluster][newer cluster] */
+  float inv_m = 1.0f / (float)(1UL << k);
+
+  for (int a = 0; a < IMU_ALLAN_AXES; a++)
+    {
+      float older = 0, newer = 0;
+      int   idx   = head[k];
+
+      for (int b = 0; b < blocks; b++)
+        {
+          older += ring[k][idx][a];
+          if (++idx == size) idx = 0;
+        }
+      for (int b = 0; b < blocks; b++)
+        {
+          newer += ring[k][idx][a];
+          if (++idx == size) idx = 0;
+        }
+
+      double d = (double)((newer - older) * inv_m);
+      sum_sq[k][a] += d * d;
+    }
+
+  n_terms[k]++;
+}
+
+/****************************************************************************
+ * results
+ ****************************************************************************/
+int ImuAllan::levels() const
+{
+  int k = 0;
+  while (k < IMU_ALLAN_LEVELS && n_terms[k] > 0) k++;
+  return k;
+}
+
+double ImuAllan::adev(int level, int axis) const
+{
+  if (level < 0 || level >= IMU_ALLAN_LEVELS || n_terms[level] == 0) return 0;
+  return sqrt(sum_sq[level][axis] / (2.0 * n_terms[level]));
+}
+
+bool ImuAllan::noise(int axis, ImuAllanNoise& out) const
+{
+  float lt[IMU_ALLAN_LEVELS];
+  float ls[IMU_ALLAN_LEVELS];
+  int   n = 0;
+
+  for (int k = 0; k < IMU_ALLAN_LEVELS && n_terms[k] >= MIN_TERMS; k++)
+    {
+      double s = adev(k, axis);
+      if (s <= 0) break;
+      lt[n] = logf(tau(k));
+      ls[n] = logf((float)s);
+      n++;
+    }
+
+  memset(&out, 0, sizeof(out));
+  if (n < 2) return false;
+
+  /* Minimum of the curve */
+  int kmin = 0;
+  for (int k = 1; k < n; k++)
+    {
+      if (ls[k] < ls[kmin]) kmin = k;
+    }
+  out.bias_instability = expf(ls[kmin]) / BI_FACTOR;
+  out.tau_bias         = expf(lt[kmin]);
+
+  /* Segments closest to slope -1/2 and +1/2 */
+  int   iw = -1, ir = -1;
+  float ew = 1e9f, er = 1e9f;
+
+  for (int k = 0; k + 1 < n; k++)
+    {
+      float slope = (ls[k + 1] - ls[k]) / (lt[k + 1] - lt[k]);
+      if (fabsf(slope + 0.5f) < ew) { ew = fabsf(slope + 0.5f); iw = k; }
+      if (fabsf(slope - 0.5f) < er) { er = fabsf(slope - 0.5f); ir = k; }
+    }
+
+  if (iw >= 0)
+    {
+      float t = 0.5f * (lt[iw] + lt[iw + 1]);
+      float s = 0.5f * (ls[iw] + ls[iw + 1]);
+      out.random_walk = expf(s + 0.5f * t);          // sigma * sqrt(tau)
+    }
+
+  if (ir >= 0 && er < 0.25f)
+    {
+      float t = 0.5f * (lt[ir] + lt[ir + 1]);
+      float s = 0.5f * (ls[ir] + ls[ir + 1]);
+      out.rate_random_walk = expf(s) * sqrtf(3.0f / expf(t));
+    }
+
+  return true;
+}
+
+void ImuAllan::print() const
+{
+  int n = levels();
+
+  printf("tau[s],terms,gx,gy,gz,ax,ay,az\n");
+  for (int k = 0; k < n; k++)
+    {
+      printf("%.6f,%lu", tau(k), (unsigned long)n_terms[k]);
+      for (int a = 0; a < IMU_ALLAN_AXES; a++)
+        {
+          printf(",%.4e", adev(k, a));
+        }
+      printf("\n");
+    }
+}
@@ -0,0 +1,127 @@
+/*
+ *  ImuAllan.h - Streaming overlapping Allan deviation.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _IMU_ALLAN_H_
+#define _IMU_ALLAN_H_
+
+#include "SpresenseIMU.h"
+#include "ImuSpan.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+// Cluster sizes 1, 2, 4, ... 2^(LEVELS-1) samples. 24 levels cover
+// 2^23 samples, about 73 minutes at 1920 Hz (each level needs at least
+// two clusters before it reports).
+#ifndef IMU_ALLAN_LEVELS
+#define IMU_ALLAN_LEVELS    (24)
+#endif
+
+// Clusters start every m / OVERLAP samples (every sample while m <=
+// OVERLAP). Must be a power of two. 8 is within a few percent of the
+// fully overlapping estimator's confidence.
+#ifndef IMU_ALLAN_OVERLAP
+#define IMU_ALLAN_OVERLAP   (8)
+#endif
+
+#define IMU_ALLAN_AXES      (6)     // gx, gy, gz, ax, ay, az
+
+/**************************************************************************
+ * ImuAllan
+ *
+ *  Samples are assumed to be evenly spaced at the rate given to begin().
+ *  Block sums of 1, 2, 4, ... samples are built by pairing, and each
+ *  level keeps only the last 2 * OVERLAP block sums per axis, so memory
+ *  is O(levels) regardless of the capture length (about 11 KB with the
+ *  defaults) and the cost is about 50 float adds per sample and axis.
+ *
+ *  adev(level, axis) is available at any time. noise(axis) reads the
+ *  usual coefficients off the curve:
+ *    - angle / velocity random walk N : sigma * sqrt(tau) where the
+ *      log-log slope is closest to -1/2
+ *    - bias instability B            : minimum sigma / 0.664
+ *    - rate random walk K            : sigma * sqrt(3 / tau) where the
+ *      slope is closest to +1/2 (0 until the curve turns up)
+ *  Units for the gyro axes: rad/sqrt(s), rad/s, rad/s/sqrt(s); for the
+ *  accel axes: m/s/sqrt(s), m/s^2, m/s^2/sqrt(s).
+ **************************************************************************/
+
+struct ImuAllanNoise {
+  float random_walk;
+  float bias_instability;
+  float tau_bias;             // s, where the minimum is
+  float rate_random_walk;
+};
+
+class ImuAllan {
+
+public:
+  ImuAllan();
+
+  void begin(float rate);
+  void reset();
+
+  void add(const cxd5602pwbimu_data_t& s);
+  void add(const cxd5602pwbimu_data_t* s, size_t n);
+  void add(ImuSpan<cxd5602pwbimu_data_t> span) { add(span.data, span.size); }
+
+  uint64_t samples() const { return n_samples; }
+
+  // Number of leading levels that have at least one difference.
+  int levels() const;
+
+  float    tau(int level) const { return (float)(1UL << level) / sample_rate; }
+  uint32_t terms(int level) const { return n_terms[level]; }
+  double   adev(int level, int axis) const;
+
+  bool noise(int axis, ImuAllanNoise& out) const;
+
+  // One line per level: tau, terms and the six deviations.
+  void print() const;
+
+private:
+  enum {
+    OVERLAP_LOG2 = (IMU_ALLAN_OVERLAP >= 16) ? 4 : (IMU_ALLAN_OVERLAP >= 8) ? 3 :
+                   (IMU_ALLAN_OVERLAP >= 4) ? 2 : (IMU_ALLAN_OVERLAP >= 2) ? 1 : 0,
+    RING         = 2 * IMU_ALLAN_OVERLAP,
+    STREAMS      = (IMU_ALLAN_LEVELS > OVERLAP_LOG2) ? IMU_ALLAN_LEVELS - OVERLAP_LOG2 : 1
+  };
+
+  void feedStream(int stream, const float v[IMU_ALLAN_AXES]);
+  void feedLevel(int level, const float v[IMU_ALLAN_AXES]);
+
+  float    sample_rate;
+  uint64_t n_samples;
+  float    offset[IMU_ALLAN_AXES];
+
+  // Pairing of stream j-1 blocks into stream j
+  float    pending[STREAMS][IMU_ALLAN_AXES];
+  bool     has_pending[STREAMS];
+
+  // Last RING block sums per level
+  float    ring[IMU_ALLAN_LEVELS][RING][IMU_ALLAN_AXES];
+  uint8_t  head[IMU_ALLAN_LEVELS];
+  uint8_t  filled[IMU_ALLAN_LEVELS];
+
+  double   sum_sq[IMU_ALLAN_LEVELS][IMU_ALLAN_AXES];
+  uint32_t n_terms[IMU_ALLAN_LEVELS];
+};
+
+#endif // _IMU_ALLAN_H_
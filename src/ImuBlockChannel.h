@@ -0,0 +1,393 @@
+/*
+ *  ImuBlockChannel.h - Zero-copy block transport between cores.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _IMU_BLOCK_CHANNEL_H_
+#define _IMU_BLOCK_CHANNEL_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "ImuSpan.h"
+
+#ifdef ARDUINO_ARCH_SPRESENSE
+#include <MP.h>
+#endif
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+// Message ids used by the channel. Keep application ids clear of these.
+#define IMU_BLOCK_MSGID_READY    (0x40)   // producer -> consumer: block filled
+#define IMU_BLOCK_MSGID_RELEASE  (0x41)   // consumer -> producer: block free
+
+#define IMU_LOCAL_QUEUE_DEPTH    (16)
+
+/**************************************************************************
+ * Transports
+ *
+ *  A transport moves (msgid, value) pairs to one peer.
+ *    send()     : returns < 0 on failure
+ *    recv()     : timeout_ms < 0 blocks, 0 polls. Returns msgid or < 0
+ *    toShared() : address the peer can dereference
+ **************************************************************************/
+
+#ifdef ARDUINO_ARCH_SPRESENSE
+
+// Inter-core transport over MP. Note that MP.RecvTimeout() is global, so
+// it is set on every recv().
+class ImuMpTransport {
+
+public:
+  explicit ImuMpTransport(int remote_core) : remote(remote_core) {}
+
+  int send(int8_t msgid, uintptr_t value) {
+    return MP.Send(msgid, (uint32_t)value, remote);
+  }
+
+  int recv(int8_t* msgid, uintptr_t* value, int timeout_ms) {
+    uint32_t data;
+    MP.RecvTimeout(timeout_ms < 0  ? MP_RECV_BLOCKING :
+                   timeout_ms == 0 ? MP_RECV_POLLING  : (uint32_t)timeout_ms);
+    int ret = MP.Recv(msgid, &data, remote);
+    *value = data;
+    return ret;
+  }
+
+  uintptr_t toShared(void* ptr) { return (uintptr_t)MP.Virt2Phys(ptr); }
+
+private:
+  int remote;
+};
+
+#endif // ARDUINO_ARCH_SPRESENSE
+
+// Two queues connecting a pair of threads on the same core (or on a host
+// where MP is not available).
+class ImuLocalLink {
+
+public:
+  ImuLocalLink() {
+    for (int i = 0; i < 2; i++) {
+      pthread_mutex_init(&q[i].lock, NULL);
+      pthread_cond_init(&q[i].cond, NULL);
+      q[i].head = q[i].tail = 0;
+    }
+  }
+
+  ~ImuLocalLink() {
+    for (int i = 0; i < 2; i++) {
+      pthread_mutex_destroy(&q[i].lock);
+      pthread_cond_destroy(&q[i].cond);
+    }
+  }
+
+  int push(int side, int8_t msgid, uintptr_t value) {
+    Queue& d = q[side];
+    int ret = -ENOSPC;
+    pthread_mutex_lock(&d.lock);
+    if (d.head - d.tail < IMU_LOCAL_QUEUE_DEPTH) {
+      d.msg[d.head % IMU_LOCAL_QUEUE_DEPTH].id    = msgid;
+      d.msg[d.head % IMU_LOCAL_QUEUE_DEPTH].value = value;
+      d.head++;
+      ret = 0;
+      pthread_cond_signal(&d.cond);
+    }
+    pthread_mutex_unlock(&d.lock);
+    return ret;
+  }
+
+  int pop(int side, int8_t* msgid, uintptr_t* value, int timeout_ms) {
+    Queue& d = q[side];
+    struct timespec abstime;
+    if (timeout_ms > 0) {
+      clock_gettime(CLOCK_REALTIME, &abstime);
+      abstime.tv_sec  += timeout_ms / 1000;
+      abstime.tv_nsec += (timeout_ms % 1000) * 1000000L;
+      if (abstime.tv_nsec >= 1000000000L) {
+        abstime.tv_sec++;
+        abstime.tv_nsec -= 1000000000L;
+      }
+    }
+
+    int ret = 0;
+    pthread_mutex_lock(&d.lock);
+    while (d.head == d.tail && ret == 0) {
+      if (timeout_ms == 0) {
+        ret = ETIMEDOUT;
+      } else if (timeout_ms < 0) {
+        ret = pthread_cond_wait(&d.cond, &d.lock);
+      } else {
+        ret = pthread_cond_timedwait(&d.cond, &d.lock, &abstime);
+      }
+    }
+    if (d.head != d.tail) {
+      *msgid = d.msg[d.tail % IMU_LOCAL_QUEUE_DEPTH].id;
+      *value = d.msg[d.tail % IMU_LOCAL_QUEUE_DEPTH].value;
+      d.tail++;
+      ret = *msgid;
+    } else {
+      ret = -ETIMEDOUT;
+    }
+    pthread_mutex_unlock(&d.lock);
+    return ret;
+  }
+
+private:
+  struct Queue {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    struct { int8_t id; uintptr_t value; } msg[IMU_LOCAL_QUEUE_DEPTH];
+    unsigned head;
+    unsigned tail;
+  };
+
+  Queue q[2];
+};
+
+class ImuLocalTransport {
+
+public:
+  // Each end of a link uses a different side (0 or 1).
+  ImuLocalTransport(ImuLocalLink& l, int s) : link(l), side(s) {}
+
+  int send(int8_t msgid, uintptr_t value) { return link.push(1 - side, msgid, value); }
+  int recv(int8_t* msgid, uintptr_t* value, int timeout_ms) {
+    return link.pop(side, msgid, value, timeout_ms);
+  }
+
+  uintptr_t toShared(void* ptr) { return (uintptr_t)ptr; }
+
+private:
+  ImuLocalLink& link;
+  int side;
+};
+
+#ifdef ARDUINO_ARCH_SPRESENSE
+typedef ImuMpTransport    ImuDefaultTransport;
+#else
+typedef ImuLocalTransport ImuDefaultTransport;
+#endif
+
+/**************************************************************************
+ * Structures
+ **************************************************************************/
+
+struct ImuBlockChannelStats {
+  uint32_t published;     // blocks handed to the consumer
+  uint32_t received;      // blocks taken by the consumer
+  uint32_t released;      // blocks returned to the producer
+  uint32_t dropped;       // acquire() calls that found no free slot in time
+  uint32_t waits;         // acquire() calls that had to wait for a release
+  uint32_t wait_us_max;
+  uint64_t wait_us_total;
+
+  ImuBlockChannelStats() { memset(this, 0, sizeof(*this)); }
+};
+
+/**************************************************************************
+ * Class
+ **************************************************************************/
+
+// The producer owns a pool of `Slots` blocks of `BlockLen` elements. A
+// block is only reused after the consumer has released it, so a slow
+// consumer shows up as drops or producer wait time instead of overwritten
+// data. Messages the channel does not own are passed to the handler set
+// with setOtherHandler().
+template <typename T, int Slots, int BlockLen, class Transport = ImuDefaultTransport>
+class ImuBlockChannel {
+
+public:
+  typedef void (*OtherHandler)(int8_t msgid, uintptr_t value);
+
+  explicit ImuBlockChannel(Transport& t)
+    : transport(t), pool(NULL), owned(false), next(0), other(NULL) {}
+  ~ImuBlockChannel() { end(); }
+
+  /*
+   * Producer side
+   */
+  // `storage` (Slots * BlockLen elements) may be given to keep the pool out
+  // of the heap, e.g. a static array on a subcore.
+  bool beginProducer(T* storage = NULL) {
+    end();
+    owned = (storage == NULL);
+    pool  = owned ? new T[Slots * BlockLen] : storage;
+    if (pool == NULL) return false;
+    for (int i = 0; i < Slots; i++) {
+      state[i]  = SLOT_FREE;
+      shared[i] = transport.toShared(&pool[i * BlockLen]);
+    }
+    next = 0;
+    return true;
+  }
+
+  void end() {
+    if (owned) delete[] pool;
+    pool  = NULL;
+    owned = false;
+  }
+
+  // timeout_ms < 0 waits for a release, 0 never waits.
+  ImuSpan<T> acquire(int timeout_ms = 0) {
+    if (pool == NULL) return ImuSpan<T>();
+
+    collect(0);
+    int slot = findFree();
+    if (slot < 0 && timeout_ms != 0) {
+      uint64_t start = nowUs();
+      stats_.waits++;
+      while (slot < 0) {
+        int remain = -1;
+        if (timeout_ms > 0) {
+          remain = timeout_ms - (int)((nowUs() - start) / 1000);
+          if (remain <= 0) break;
+        }
+        if (!collect(remain)) break;
+        slot = findFree();
+      }
+      uint32_t waited = (uint32_t)(nowUs() - start);
+      stats_.wait_us_total += waited;
+      if (waited > stats_.wait_us_max) stats_.wait_us_max = waited;
+    }
+
+    if (slot < 0) {
+      stats_.dropped++;
+      return ImuSpan<T>();
+    }
+
+    state[slot] = SLOT_FILLING;
+    next = (slot + 1) % Slots;
+    return ImuSpan<T>(&pool[slot * BlockLen], BlockLen);
+  }
+
+  bool publish(const ImuSpan<T>& block) {
+    int slot = slotOf(block.data);
+    if (slot < 0 || state[slot] != SLOT_FILLING) return false;
+
+    state[slot] = SLOT_IN_FLIGHT;
+    if (transport.send(IMU_BLOCK_MSGID_READY, shared[slot]) < 0) {
+      state[slot] = SLOT_FREE;
+      return false;
+    }
+    stats_.published++;
+    return true;
+  }
+
+  // Give back an acquired block without publishing it.
+  void cancel(const ImuSpan<T>& block) {
+    int slot = slotOf(block.data);
+    if (slot >= 0 && state[slot] == SLOT_FILLING) state[slot] = SLOT_FREE;
+  }
+
+  /*
+   * Consumer side
+   */
+  ImuSpan<T> receive(int timeout_ms = -1) {
+    int8_t    msgid;
+    uintptr_t value;
+    while (transport.recv(&msgid, &value, timeout_ms) >= 0) {
+      if (msgid == IMU_BLOCK_MSGID_READY) {
+        stats_.received++;
+        return ImuSpan<T>((T*)value, BlockLen);
+      }
+      if (other) other(msgid, value);
+    }
+    return ImuSpan<T>();
+  }
+
+  bool release(const ImuSpan<T>& block) {
+    if (block.empty()) return false;
+    return (transport.send(IMU_BLOCK_MSGID_RELEASE, (uintptr_t)block.data) >= 0);
+  }
+
+  /*
+   * Common
+   */
+  void setOtherHandler(OtherHandler handler) { other = handler; }
+
+  const ImuBlockChannelStats& stats() const { return stats_; }
+
+  int inFlight() const {
+    int n = 0;
+    for (int i = 0; pool && i < Slots; i++) n += (state[i] == SLOT_IN_FLIGHT);
+    return n;
+  }
+
+private:
+  enum SlotState { SLOT_FREE = 0, SLOT_FILLING, SLOT_IN_FLIGHT };
+
+  static uint64_t nowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  }
+
+  int findFree() const {
+    for (int i = 0; i < Slots; i++) {
+      int slot = (next + i) % Slots;
+      if (state[slot] == SLOT_FREE) return slot;
+    }
+    return -1;
+  }
+
+  int slotOf(const T* ptr) const {
+    if (pool == NULL || ptr < pool) return -1;
+    size_t offset = ptr - pool;
+    if (offset % BlockLen != 0 || offset / BlockLen >= (size_t)Slots) return -1;
+    return offset / BlockLen;
+  }
+
+  // Handle incoming release messages. Returns false on timeout.
+  bool collect(int timeout_ms) {
+    int8_t    msgid;
+    uintptr_t value;
+    bool      got = false;
+    while (transport.recv(&msgid, &value, got ? 0 : timeout_ms) >= 0) {
+      got = true;
+      if (msgid != IMU_BLOCK_MSGID_RELEASE) {
+        if (other) other(msgid, value);
+        continue;
+      }
+      for (int i = 0; i < Slots; i++) {
+        if (shared[i] == value && state[i] == SLOT_IN_FLIGHT) {
+          state[i] = SLOT_FREE;
+          stats_.released++;
+          break;
+        }
+      }
+    }
+    return got;
+  }
+
+  Transport&   transport;
+  T*           pool;
+  bool         owned;
+  uintptr_t    shared[Slots];
+  uint8_t      state[Slots];
+  int          next;
+  OtherHandler other;
+  ImuBlockChannelStats stats_;
+};
+
+#endif // _IMU_BLOCK_CHANNEL_H_
@@ -0,0 +1,250 @@
+/*
+ *  ImuBusArbiter.cpp - Sharing the IMU I2C bus with other devices while sampling.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "ImuBusArbiter.h"
+
+#include <errno.h>
+#include <stdio.h>
+
+static uint64_t now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/****************************************************************************
+ * ImuBusArbiter
+ ****************************************************************************/
+ImuBusArbiter::ImuBusArbiter()
+  : held(false), qhead(0), qcount(0), remote(NULL)
+{
+  pthread_mutex_init(&m, NULL);
+  pthread_cond_init(&c, NULL);
+}
+
+ImuBusArbiter::~ImuBusArbiter()
+{
+  pthread_mutex_destroy(&m);
+  pthread_cond_destroy(&c);
+}
+
+/****************************************************************************
+ * take the bus (called with m held)
+ ****************************************************************************/
+bool ImuBusArbiter::acquire(int timeout_ms, uint32_t* waited_us)
+{
+  uint64_t start = now_us();
+
+  struct timespec abstime;
+  if (timeout_ms > 0)
+    {
+      clock_gettime(CLOCK_REALTIME, &abstime);
+      abstime.tv_sec  += timeout_ms / 1000;
+      abstime.tv_nsec += (timeout_ms % 1000) * 1000000L;
+      if (abstime.tv_nsec >= 1000000000L)
+        {
+          abstime.tv_sec++;
+          abstime.tv_nsec -= 1000000000L;
+        }
+    }
+
+  int ret = 0;
+  while (held && ret != ETIMEDOUT)
+    {
+      if (timeout_ms == 0) break;
+      ret = (timeout_ms < 0) ? pthread_cond_wait(&c, &m)
+                             : pthread_cond_timedwait(&c, &m, &abstime);
+    }
+
+  *waited_us = (uint32_t)(now_us() - start);
+  if (held) return false;
+
+  held = true;
+  return true;
+}
+
+/****************************************************************************
+ * lock / unlock from other threads
+ ****************************************************************************/
+bool ImuBusArbiter::lock(int timeout_ms)
+{
+  uint32_t waited;
+
+  pthread_mutex_lock(&m);
+  bool ok = acquire(timeout_ms, &waited);
+  if (ok)
+    {
+      stat.locks++;
+      if (waited > stat.lock_us_max) stat.lock_us_max = waited;
+    }
+  pthread_mutex_unlock(&m);
+
+  return ok;
+}
+
+void ImuBusArbiter::unlock()
+{
+  pthread_mutex_lock(&m);
+  held = false;
+  pthread_cond_signal(&c);
+  pthread_mutex_unlock(&m);
+}
+
+/****************************************************************************
+ * queue a transaction for the next gap
+ ****************************************************************************/
+bool ImuBusArbiter::schedule(ImuBusJob fn, void* arg)
+{
+  if (fn == NULL) return false;
+
+  pthread_mutex_lock(&m);
+
+  if (qcount == IMU_BUS_QUEUE)
+    {
+      stat.rejected++;
+      pthread_mutex_unlock(&m);
+      return false;
+    }
+
+  Job& j = queue[(qhead + qcount) % IMU_BUS_QUEUE];
+  j.fn        = fn;
+  j.arg       = arg;
+  j.queued_us = now_us();
+  qcount++;
+
+  pthread_mutex_unlock(&m);
+  return true;
+}
+
+/****************************************************************************
+ * around the IMU read
+ ****************************************************************************/
+void ImuBusArbiter::beginRead()
+{
+  uint32_t waited;
+
+  pthread_mutex_lock(&m);
+  acquire(-1, &waited);
+  if (waited > stat.imu_wait_us_max) stat.imu_wait_us_max = waited;
+  pthread_mutex_unlock(&m);
+}
+
+void ImuBusArbiter::endRead()
+{
+  unlock();
+}
+
+/****************************************************************************
+ * the gap after a watermark read
+ *
+ *  Runs on the IMU reading thread. Queued transactions first, then the
+ *  other core's token; whatever does not fit in budget_us waits for the
+ *  next gap (a started transaction is never cut short).
+ ****************************************************************************/
+void ImuBusArbiter::gap(uint32_t budget_us)
+{
+  uint32_t waited;
+  uint64_t start = now_us();
+
+  pthread_mutex_lock(&m);
+
+  if (qcount == 0 && remote == NULL)
+    {
+      pthread_mutex_unlock(&m);
+      return;
+    }
+
+  /* A thread in lock() has the bus; its transaction is this gap. */
+  if (!acquire(0, &waited))
+    {
+      pthread_mutex_unlock(&m);
+      return;
+    }
+
+  while (qcount != 0 && now_us() - start < budget_us)
+    {
+      Job j = queue[qhead];
+      qhead = (qhead + 1) % IMU_BUS_QUEUE;
+      qcount--;
+
+      uint64_t t = now_us();
+      uint32_t queued = (uint32_t)(t - j.queued_us);
+      pthread_mutex_unlock(&m);
+
+      j.fn(j.arg);
+
+      uint32_t us = (uint32_t)(now_us() - t);
+      pthread_mutex_lock(&m);
+      stat.jobs++;
+      stat.queue_us_total += queued;
+      if (queued > stat.queue_us_max) stat.queue_us_max = queued;
+      if (us > stat.job_us_max) stat.job_us_max = us;
+    }
+
+  if (remote != NULL && now_us() - start < budget_us)
+    {
+      pthread_mutex_unlock(&m);
+      int32_t us = remote->serve();
+      pthread_mutex_lock(&m);
+
+      if (us != 0)
+        {
+          uint32_t held_us = (us < 0) ? (uint32_t)-us : (uint32_t)us;
+          stat.grants++;
+          if (us < 0) stat.grant_timeouts++;
+          if (held_us > stat.grant_us_max) stat.grant_us_max = held_us;
+        }
+    }
+
+  if (now_us() - start > budget_us) stat.over_budget++;
+
+  held = false;
+  pthread_cond_signal(&c);
+  pthread_mutex_unlock(&m);
+}
+
+/****************************************************************************
+ * statistics
+ ****************************************************************************/
+void ImuBusStats::print() const
+{
+  printf("bus jobs %lu (rejected %lu), locks %lu, grants %lu (timeouts %lu), over budget %lu\n",
+         (unsigned long)jobs, (unsigned long)rejected, (unsigned long)locks,
+         (unsigned long)grants, (unsigned long)grant_timeouts, (unsigned long)over_budget);
+  printf("bus(us) job max %lu, queued mean %lu max %lu, lock wait max %lu, grant max %lu, imu wait max %lu\n",
+         (unsigned long)job_us_max, (unsigned long)(jobs ? queue_us_total / jobs : 0),
+         (unsigned long)queue_us_max, (unsigned long)lock_us_max,
+         (unsigned long)grant_us_max, (unsigned long)imu_wait_us_max);
+}
+
+ImuBusStats ImuBusArbiter::stats()
+{
+  pthread_mutex_lock(&m);
+  ImuBusStats s = stat;
+  pthread_mutex_unlock(&m);
+  return s;
+}
+
+void ImuBusArbiter::resetStats()
+{
+  pthread_mutex_lock(&m);
+  stat = ImuBusStats();
+  pthread_mutex_unlock(&m);
+}
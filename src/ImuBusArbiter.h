@@ -0,0 +1,355 @@
+/*
+ *  ImuBusArbiter.h - Sharing the IMU I2C bus with other devices while sampling.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _IMU_BUS_ARBITER_H_
+#define _IMU_BUS_ARBITER_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "ImuBlockChannel.h"
+
+#ifdef ARDUINO_ARCH_SPRESENSE
+#include <nuttx/arch.h>
+#include <arch/cxd56xx/irq.h>
+#endif
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+// Message ids of the cross-core bus token (next to the block channel's).
+#define IMU_BUS_MSGID_REQUEST   (0x42)   // client -> IMU core: bus wanted
+#define IMU_BUS_MSGID_GRANT     (0x43)   // IMU core -> client: bus is yours
+#define IMU_BUS_MSGID_RELEASE   (0x44)   // client -> IMU core: bus returned
+#define IMU_BUS_MSGID_CANCEL    (0x45)   // client -> IMU core: request given up
+
+#define IMU_BUS_QUEUE           (8)      // transactions waiting for a gap
+#define IMU_BUS_GRANT_TIMEOUT   (100)    // ms before a grant is taken back
+
+// The I2C interrupt follows the core that drives the bus.
+#ifdef ARDUINO_ARCH_SPRESENSE
+#define IMU_BUS_IRQ             (CXD56_IRQ_SCU_I2C0)
+inline void imuBusIrq(bool on) { if (on) up_enable_irq(IMU_BUS_IRQ); else up_disable_irq(IMU_BUS_IRQ); }
+#else
+inline void imuBusIrq(bool) {}
+#endif
+
+/**************************************************************************
+ * Structures
+ **************************************************************************/
+
+typedef void (*ImuBusJob)(void* arg);
+
+struct ImuBusStats {
+  uint32_t jobs;              // transactions run in a gap
+  uint32_t rejected;          // schedule() with a full queue
+  uint32_t over_budget;       // gaps that ran past the next watermark
+  uint32_t job_us_max;        // longest transaction
+  uint32_t queue_us_max;      // schedule() to the start of the transaction
+  uint64_t queue_us_total;
+  uint32_t locks;             // lock() from other threads
+  uint32_t lock_us_max;       // longest wait in lock()
+  uint32_t imu_wait_us_max;   // IMU read held back by another bus user
+  uint32_t grants;            // bus handed to another core
+  uint32_t grant_us_max;      // grant to release
+  uint32_t grant_timeouts;    // grants taken back after IMU_BUS_GRANT_TIMEOUT
+
+  ImuBusStats() { memset(this, 0, sizeof(*this)); }
+
+  void print() const;
+};
+
+/**************************************************************************
+ * ImuBusRemote
+ *
+ *  The IMU side of a cross-core token (ImuBusTokenServer). serve() runs
+ *  in a gap and hands the bus over if the other core asked for it.
+ *  Returns the grant time in us, 0 if there was no request, < 0 if the
+ *  grant had to be taken back.
+ **************************************************************************/
+
+class ImuBusRemote {
+
+public:
+  virtual ~ImuBusRemote() {}
+  virtual int32_t serve() = 0;
+};
+
+/**************************************************************************
+ * ImuBusArbiter
+ *
+ *  Lets other devices on the IMU's I2C bus be used while the IMU keeps
+ *  sampling, instead of stopping and re-initializing it around every
+ *  foreign transaction.
+ *
+ *  - lock() / unlock(): a mutex for threads of this core. The IMU read
+ *    takes it too, so a transaction never interleaves with a read.
+ *  - schedule(): the transaction is run by the IMU reading thread right
+ *    after a FIFO watermark has been read, the point where the IMU has
+ *    nothing to transfer for (FIFO depth) periods.
+ *  - setRemote(): another core gets the bus through an MP token in the
+ *    same gaps (ImuBusTokenServer / ImuBusTokenClient).
+ *
+ *  Attach with SpresenseIMU.setBusArbiter(). stats() shows the added
+ *  latency on both sides.
+ **************************************************************************/
+
+class ImuBusArbiter {
+
+public:
+  ImuBusArbiter();
+  ~ImuBusArbiter();
+
+  // timeout_ms < 0 waits, 0 never waits.
+  bool lock(int timeout_ms = -1);
+  void unlock();
+
+  // Run fn(arg) on the IMU thread in the next gap. false if the queue is full.
+  bool schedule(ImuBusJob fn, void* arg);
+
+  void setRemote(ImuBusRemote* r) { remote = r; }
+
+  ImuBusStats stats();
+  void resetStats();
+
+  // Called by the IMU read path.
+  void beginRead();
+  void endRead();
+  void gap(uint32_t budget_us);
+
+private:
+  bool acquire(int timeout_ms, uint32_t* waited_us);
+
+  pthread_mutex_t m;
+  pthread_cond_t  c;
+  bool            held;
+
+  struct Job { ImuBusJob fn; void* arg; uint64_t queued_us; };
+  Job             queue[IMU_BUS_QUEUE];
+  int             qhead;
+  int             qcount;
+
+  ImuBusRemote*   remote;
+  ImuBusStats     stat;
+};
+
+/**************************************************************************
+ * ImuBusTokenServer / ImuBusTokenClient
+ *
+ *  The bus as a token between the IMU core (server) and one other core
+ *  (client), over the block channel transports. The client asks, the
+ *  server grants in the next gap with its I2C interrupt disabled, and
+ *  waits for the release. The client must give the bus back before the
+ *  next watermark is due to keep the IMU on time; a client that keeps it
+ *  longer than IMU_BUS_GRANT_TIMEOUT loses it.
+ *
+ *  Every message carries the request's sequence number. A client that
+ *  gives up waiting sends a cancel: the server drops the request, or
+ *  ends a grant already sent, and the client drops the late grant.
+ *
+ *  If the same core pair also runs an ImuBlockChannel, the channel owns
+ *  the transport: call setExternalInput() on the server and pass the
+ *  token messages from the channel's other-handler to handle(). serve()
+ *  then never reads the transport, and the release has to arrive through
+ *  a thread other than the IMU reading thread (e.g. loop() with
+ *  streaming on).
+ **************************************************************************/
+
+template <class Transport = ImuDefaultTransport>
+class ImuBusTokenServer : public ImuBusRemote {
+
+public:
+  explicit ImuBusTokenServer(Transport& t)
+    : transport(t), external(false), requested(false), granted(false), ended(false),
+      req_seq(0), grant_seq(0) {
+    pthread_mutex_init(&m, NULL);
+    pthread_cond_init(&c, NULL);
+  }
+
+  ~ImuBusTokenServer() {
+    pthread_cond_destroy(&c);
+    pthread_mutex_destroy(&m);
+  }
+
+  void setExternalInput(bool on = true) { external = on; }
+
+  void handle(int8_t msgid, uintptr_t value) {
+    uint32_t seq = (uint32_t)value;
+    pthread_mutex_lock(&m);
+    if (msgid == IMU_BUS_MSGID_REQUEST) {
+      requested = true;
+      req_seq   = seq;
+    } else if (msgid == IMU_BUS_MSGID_RELEASE || msgid == IMU_BUS_MSGID_CANCEL) {
+      if (requested && req_seq == seq) requested = false;
+      if (granted && grant_seq == seq) {
+        ended = true;
+        pthread_cond_signal(&c);
+      }
+    }
+    pthread_mutex_unlock(&m);
+  }
+
+  int32_t serve() {
+    int8_t    msgid;
+    uintptr_t value;
+
+    if (!external) {
+      while (transport.recv(&msgid, &value, 0) >= 0) handle(msgid, value);
+    }
+
+    pthread_mutex_lock(&m);
+    if (!requested) {
+      pthread_mutex_unlock(&m);
+      return 0;
+    }
+    requested = false;
+    granted   = true;
+    ended     = false;
+    grant_seq = req_seq;
+    pthread_mutex_unlock(&m);
+
+    uint64_t start = nowUs();
+    imuBusIrq(false);
+    if (transport.send(IMU_BUS_MSGID_GRANT, grant_seq) < 0) {
+      pthread_mutex_lock(&m);
+      granted = false;
+      pthread_mutex_unlock(&m);
+      imuBusIrq(true);
+      return 0;
+    }
+
+    bool released = false;
+    while (!released) {
+      int remain = IMU_BUS_GRANT_TIMEOUT - (int)((nowUs() - start) / 1000);
+      if (remain <= 0) break;
+      if (external) {
+        released = waitEnded(remain);
+      } else {
+        if (transport.recv(&msgid, &value, remain) < 0) break;
+        handle(msgid, value);
+        pthread_mutex_lock(&m);
+        released = ended;
+        pthread_mutex_unlock(&m);
+      }
+    }
+
+    pthread_mutex_lock(&m);
+    granted = false;
+    pthread_mutex_unlock(&m);
+    imuBusIrq(true);
+
+    int32_t us = (int32_t)(nowUs() - start);
+    return released ? (us > 0 ? us : 1) : -us;
+  }
+
+private:
+  static uint64_t nowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  }
+
+  bool waitEnded(int timeout_ms) {
+    struct timespec abstime;
+    clock_gettime(CLOCK_REALTIME, &abstime);
+    abstime.tv_sec  += timeout_ms / 1000;
+    abstime.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (abstime.tv_nsec >= 1000000000L) { abstime.tv_sec++; abstime.tv_nsec -= 1000000000L; }
+
+    pthread_mutex_lock(&m);
+    int ret = 0;
+    while (!ended && ret != ETIMEDOUT) ret = pthread_cond_timedwait(&c, &m, &abstime);
+    bool done = ended;
+    pthread_mutex_unlock(&m);
+    return done;
+  }
+
+  Transport&      transport;
+  bool            external;
+  pthread_mutex_t m;
+  pthread_cond_t  c;
+  bool            requested;
+  bool            granted;
+  bool            ended;
+  uint32_t        req_seq;
+  uint32_t        grant_seq;
+};
+
+template <class Transport = ImuDefaultTransport>
+class ImuBusTokenClient {
+
+public:
+  explicit ImuBusTokenClient(Transport& t) : transport(t), owned(false), seq(0) {}
+
+  // The bus starts with the IMU core.
+  void begin() { imuBusIrq(false); }
+
+  // timeout_ms < 0 waits for the grant. On timeout the request is
+  // cancelled, so a late grant is neither used nor left holding the bus.
+  bool acquire(int timeout_ms = -1) {
+    if (owned) return true;
+    seq++;
+    if (transport.send(IMU_BUS_MSGID_REQUEST, seq) < 0) return false;
+
+    int8_t    msgid;
+    uintptr_t value;
+    uint64_t  start = nowUs();
+    for (;;) {
+      int remain = -1;
+      if (timeout_ms >= 0) {
+        remain = timeout_ms - (int)((nowUs() - start) / 1000);
+        if (remain < 0) remain = 0;
+      }
+      if (transport.recv(&msgid, &value, remain) < 0) break;
+      if (msgid == IMU_BUS_MSGID_GRANT && (uint32_t)value == seq) {
+        imuBusIrq(true);
+        owned = true;
+        return true;
+      }
+      if (remain == 0) break;
+    }
+
+    transport.send(IMU_BUS_MSGID_CANCEL, seq);
+    return false;
+  }
+
+  void release() {
+    if (!owned) return;
+    imuBusIrq(false);
+    owned = false;
+    transport.send(IMU_BUS_MSGID_RELEASE, seq);
+  }
+
+private:
+  static uint64_t nowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+  }
+
+  Transport& transport;
+  bool       owned;
+  uint32_t   seq;
+};
+
+#endif // _IMU_BUS_ARBITER_H_
@@ -0,0 +1,496 @@
+/*
+ *  ImuCalibration.cpp - Accelerometer / gyro scale, misalignment and bias calibration.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include "ImuCalibration.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define DEG2RAD (M_PI / 180.0)
+
+/****************************************************************************
+ * Private Functions
+ ****************************************************************************/
+
+static uint32_t fletcher32(const void* buf, size_t len)
+{
+  const uint8_t* p = (const uint8_t*)buf;
+  uint32_t a = 0xffff, b = 0xffff;
+
+  for (size_t i = 0; i + 1 < len; i += 2)
+    {
+      a = (a + (p[i] | (p[i + 1] << 8))) % 65535;
+      b = (b + a) % 65535;
+    }
+  return (b << 16) | a;
+}
+
+// Solve a x = b for the n x m matrix x (Gauss-Jordan, partial pivoting).
+// a is n x n and b n x m, both row major and overwritten; x ends up in b.
+static bool solve_linear(double* a, double* b, int n, int m)
+{
+  double scale = 0;
+  for (int i = 0; i < n * n; i++) if (fabs(a[i]) > scale) scale = fabs(a[i]);
+
+  for (int c = 0; c < n; c++)
+    {
+      int p = c;
+      for (int r = c + 1; r < n; r++) if (fabs(a[r * n + c]) > fabs(a[p * n + c])) p = r;
+      if (fabs(a[p * n + c]) <= scale * 1e-9) return false;
+
+      if (p != c)
+        {
+          for (int k = 0; k < n; k++) { double t = a[c * n + k]; a[c * n + k] = a[p * n + k]; a[p * n + k] = t; }
+          for (int k = 0; k < m; k++) { double t = b[c * m + k]; b[c * m + k] = b[p * m + k]; b[p * m + k] = t; }
+        }
+
+      double inv = 1.0 / a[c * n + c];
+      for (int k = 0; k < n; k++) a[c * n + k] *= inv;
+      for (int k = 0; k < m; k++) b[c * m + k] *= inv;
+
+      for (int r = 0; r < n; r++)
+        {
+          if (r == c || a[r * n + c] == 0) continue;
+          double f = a[r * n + c];
+          for (int k = 0; k < n; k++) a[r * n + k] -= f * a[c * n + k];
+          for (int k = 0; k < m; k++) b[r * m + k] -= f * b[c * m + k];
+        }
+    }
+  return true;
+}
+
+static int dominant_axis(const float v[3])
+{
+  int k = 0;
+  if (fabsf(v[1]) > fabsf(v[k])) k = 1;
+  if (fabsf(v[2]) > fabsf(v[k])) k = 2;
+  return k;
+}
+
+static int temp_bin(float temp)
+{
+  int k = (int)floorf((temp - IMU_CAL_TEMP_MIN) / IMU_CAL_TEMP_STEP);
+  if (k < 0) return 0;
+  if (k >= IMU_CAL_TEMP_BINS) return IMU_CAL_TEMP_BINS - 1;
+  return k;
+}
+
+/****************************************************************************
+ * ImuCalibration
+ ****************************************************************************/
+void ImuCalibration::reset()
+{
+  memset(&d, 0, sizeof(d));
+  memcpy(d.magic, IMU_CAL_MAGIC, 4);
+  d.version   = IMU_CAL_VERSION;
+  d.size      = sizeof(ImuCalibrationData);
+  d.accel_m[0] = d.accel_m[4] = d.accel_m[8] = 1.0f;
+  d.gyro_m[0]  = d.gyro_m[4]  = d.gyro_m[8]  = 1.0f;
+  d.temp_min  = IMU_CAL_TEMP_MIN;
+  d.temp_step = IMU_CAL_TEMP_STEP;
+}
+
+void ImuCalibration::setAccel(const float m[9], const float o[3])
+{
+  memcpy(d.accel_m, m, sizeof(d.accel_m));
+  memcpy(d.accel_o, o, sizeof(d.accel_o));
+}
+
+void ImuCalibration::setGyro(const float m[9], const float b[3])
+{
+  memcpy(d.gyro_m, m, sizeof(d.gyro_m));
+  for (int k = 0; k < IMU_CAL_TEMP_BINS; k++) setGyroBias(k, b);
+}
+
+void ImuCalibration::setGyroBias(int bin, const float b[3])
+{
+  if (bin < 0 || bin >= IMU_CAL_TEMP_BINS) return;
+  d.gyro_b[bin][0] = b[0];
+  d.gyro_b[bin][1] = b[1];
+  d.gyro_b[bin][2] = b[2];
+}
+
+/* Linear between the bin centers, held at the ends. */
+void ImuCalibration::gyroBias(float temp, float b[3]) const
+{
+  float u = (temp - d.temp_min) / d.temp_step - 0.5f;
+  int   k;
+  float f;
+
+  if (!(u > 0))                        { k = 0; f = 0; }
+  else if (u >= IMU_CAL_TEMP_BINS - 1) { k = IMU_CAL_TEMP_BINS - 2; f = 1; }
+  else                                 { k = (int)u; f = u - k; }
+
+  for (int i = 0; i < 3; i++) b[i] = d.gyro_b[k][i] + f * (d.gyro_b[k + 1][i] - d.gyro_b[k][i]);
+}
+
+/****************************************************************************
+ * Correction of n samples in place
+ ****************************************************************************/
+void ImuCalibration::apply(cxd5602pwbimu_data_t* s, size_t n) const
+{
+  const float* A = d.accel_m;
+  const float* G = d.gyro_m;
+  const float oa0 = d.accel_o[0], oa1 = d.accel_o[1], oa2 = d.accel_o[2];
+
+  size_t i = 0;
+  while (i < n)
+    {
+      if (imuIsMarker(s[i])) { i++; continue; }
+
+      /* gyro_m * (g - b) = gyro_m * g - (gyro_m * b) */
+      float b[3];
+      gyroBias(s[i].temp, b);
+      const float og0 = G[0] * b[0] + G[1] * b[1] + G[2] * b[2];
+      const float og1 = G[3] * b[0] + G[4] * b[1] + G[5] * b[2];
+      const float og2 = G[6] * b[0] + G[7] * b[1] + G[8] * b[2];
+
+      size_t end = (n - i > IMU_CAL_TEMP_INTERVAL) ? i + IMU_CAL_TEMP_INTERVAL : n;
+      for (; i < end; i++)
+        {
+          cxd5602pwbimu_data_t& x = s[i];
+          if (imuIsMarker(x)) break;
+
+          const float gx = x.gx, gy = x.gy, gz = x.gz;
+          const float ax = x.ax, ay = x.ay, az = x.az;
+
+          x.gx = G[0] * gx + G[1] * gy + G[2] * gz - og0;
+          x.gy = G[3] * gx + G[4] * gy + G[5] * gz - og1;
+          x.gz = G[6] * gx + G[7] * gy + G[8] * gz - og2;
+          x.ax = A[0] * ax + A[1] * ay + A[2] * az - oa0;
+          x.ay = A[3] * ax + A[4] * ay + A[5] * az - oa1;
+          x.az = A[6] * ax + A[7] * ay + A[8] * az - oa2;
+        }
+    }
+}
+
+/****************************************************************************
+ * Persistence
+ ****************************************************************************/
+bool ImuCalibration::save(const char* path) const
+{
+  ImuCalibrationData out = d;
+  out.checksum = fletcher32(&out, offsetof(ImuCalibrationData, checksum));
+
+  FILE* fp = fopen(path, "wb");
+  if (fp == NULL)
+    {
+      printf("ERROR: cannot create %s\n", path);
+      return false;
+    }
+
+  bool ret = (fwrite(&out, sizeof(out), 1, fp) == 1);
+  if (fclose(fp) != 0) ret = false;
+  if (!ret) printf("ERROR: write failed. %s\n", path);
+  return ret;
+}
+
+bool ImuCalibration::load(const char* path)
+{
+  ImuCalibrationData in;
+
+  FILE* fp = fopen(path, "rb");
+  if (fp == NULL)
+    {
+      printf("ERROR: cannot open %s\n", path);
+      return false;
+    }
+
+  size_t got = fread(&in, sizeof(in), 1, fp);
+  fclose(fp);
+
+  if (got != 1 || memcmp(in.magic, IMU_CAL_MAGIC, 4) != 0 ||
+      in.version != IMU_CAL_VERSION || in.size != sizeof(ImuCalibrationData))
+    {
+      printf("ERROR: %s is not a calibration file.\n", path);
+      return false;
+    }
+  if (in.checksum != fletcher32(&in, offsetof(ImuCalibrationData, checksum)))
+    {
+      printf("ERROR: checksum mismatch. %s\n", path);
+      return false;
+    }
+
+  d = in;
+  return true;
+}
+
+void ImuCalibration::print() const
+{
+  printf("accel M %9.6f %9.6f %9.6f  offset %9.5f m/s^2\n",
+         d.accel_m[0], d.accel_m[1], d.accel_m[2], d.accel_o[0]);
+  printf("        %9.6f %9.6f %9.6f         %9.5f\n",
+         d.accel_m[3], d.accel_m[4], d.accel_m[5], d.accel_o[1]);
+  printf("        %9.6f %9.6f %9.6f         %9.5f\n",
+         d.accel_m[6], d.accel_m[7], d.accel_m[8], d.accel_o[2]);
+  printf("gyro  M %9.6f %9.6f %9.6f\n", d.gyro_m[0], d.gyro_m[1], d.gyro_m[2]);
+  printf("        %9.6f %9.6f %9.6f\n", d.gyro_m[3], d.gyro_m[4], d.gyro_m[5]);
+  printf("        %9.6f %9.6f %9.6f\n", d.gyro_m[6], d.gyro_m[7], d.gyro_m[8]);
+  for (int k = 0; k < IMU_CAL_TEMP_BINS; k++)
+    {
+      printf("gyro bias %5.1f degC: %10.3e %10.3e %10.3e rad/s\n",
+             d.temp_min + (k + 0.5f) * d.temp_step,
+             d.gyro_b[k][0], d.gyro_b[k][1], d.gyro_b[k][2]);
+    }
+  printf("residual accel %.4f m/s^2, gyro %.5f rad\n", d.accel_rms, d.gyro_rms);
+}
+
+/****************************************************************************
+ * ImuCalibrator
+ ****************************************************************************/
+ImuCalibrator::ImuCalibrator()
+  : gravity(IMU_GRAVITY)
+{
+  reset();
+}
+
+void ImuCalibrator::reset()
+{
+  npose = nrot = 0;
+  memset(bin_sum, 0, sizeof(bin_sum));
+  memset(bin_count, 0, sizeof(bin_count));
+  beginPose();
+  beginRotation();
+}
+
+void ImuCalibrator::beginPose()
+{
+  pose_sum[0] = pose_sum[1] = pose_sum[2] = 0;
+  pose_count = 0;
+}
+
+void ImuCalibrator::addPose(const cxd5602pwbimu_data_t* s, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    {
+      if (imuIsMarker(s[i])) continue;
+
+      pose_sum[0] += s[i].ax;
+      pose_sum[1] += s[i].ay;
+      pose_sum[2] += s[i].az;
+      pose_count++;
+
+      int k = temp_bin(s[i].temp);
+      bin_sum[k][0] += s[i].gx;
+      bin_sum[k][1] += s[i].gy;
+      bin_sum[k][2] += s[i].gz;
+      bin_count[k]++;
+    }
+}
+
+bool ImuCalibrator::endPose()
+{
+  if (pose_count < IMU_CAL_POSE_SAMPLES || npose >= IMU_CAL_MAX_POSES)
+    {
+      printf("ERROR: pose rejected (%lu samples, %d poses).\n", (unsigned long)pose_count, npose);
+      return false;
+    }
+
+  for (int k = 0; k < 3; k++) pose[npose].accel[k] = (float)(pose_sum[k] / pose_count);
+  npose++;
+  beginPose();
+  return true;
+}
+
+/* Means of the bins with enough samples, linear in between. */
+void ImuCalibrator::table(ImuCalibration& c) const
+{
+  uint32_t need = IMU_CAL_BIN_SAMPLES;
+  uint32_t most = 0;
+  for (int k = 0; k < IMU_CAL_TEMP_BINS; k++) if (bin_count[k] > most) most = bin_count[k];
+  if (most == 0) return;
+  if (most < need) need = most;
+
+  int last = -1;
+  for (int k = 0; k < IMU_CAL_TEMP_BINS; k++)
+    {
+      if (bin_count[k] < need) continue;
+
+      float b[3];
+      for (int i = 0; i < 3; i++) b[i] = (float)(bin_sum[k][i] / bin_count[k]);
+      c.setGyroBias(k, b);
+
+      /* Fill the gap to the previous bin, or hold this one below it. */
+      const float* p = (last >= 0) ? c.data().gyro_b[last] : b;
+      for (int j = last + 1; j < k; j++)
+        {
+          float f = (last >= 0) ? (float)(j - last) / (k - last) : 0;
+          float v[3];
+          for (int i = 0; i < 3; i++) v[i] = p[i] + f * (b[i] - p[i]);
+          c.setGyroBias(j, v);
+        }
+      last = k;
+    }
+
+  for (int j = last + 1; j < IMU_CAL_TEMP_BINS; j++) c.setGyroBias(j, c.data().gyro_b[last]);
+}
+
+void ImuCalibrator::beginRotation()
+{
+  rot_sum[0] = rot_sum[1] = rot_sum[2] = 0;
+  rot_started = false;
+  rot_bias.reset();
+  table(rot_bias);
+}
+
+void ImuCalibrator::addRotation(const cxd5602pwbimu_data_t* s, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    {
+      if (imuIsMarker(s[i])) continue;
+
+      if (rot_started)
+        {
+          double dt = (uint32_t)(s[i].timestamp - rot_last) / (double)IMU_TICKS_PER_SEC;
+          float  b[3];
+          rot_bias.gyroBias(s[i].temp, b);
+          rot_sum[0] += (s[i].gx - b[0]) * dt;
+          rot_sum[1] += (s[i].gy - b[1]) * dt;
+          rot_sum[2] += (s[i].gz - b[2]) * dt;
+        }
+      rot_last    = s[i].timestamp;
+      rot_started = true;
+    }
+}
+
+bool ImuCalibrator::endRotation(float degrees)
+{
+  if (!rot_started || nrot >= IMU_CAL_MAX_ROTATIONS)
+    {
+      printf("ERROR: rotation rejected (%d rotations).\n", nrot);
+      return false;
+    }
+
+  Rotation& r = rot[nrot];
+  for (int k = 0; k < 3; k++) r.angle[k] = (float)rot_sum[k];
+
+  int a = dominant_axis(r.angle);
+  r.reference[0] = r.reference[1] = r.reference[2] = 0;
+  r.reference[a] = (r.angle[a] < 0 ? -degrees : degrees) * (float)DEG2RAD;
+
+  nrot++;
+  beginRotation();
+  return true;
+}
+
+/****************************************************************************
+ * Least squares
+ *
+ *  accel: [a 1] W = reference, W 4 x 3 -> accel_m = W[0..2]^T, offset -W[3]
+ *  gyro : angle W = reference,  W 3 x 3 -> gyro_m = W^T
+ ****************************************************************************/
+bool ImuCalibrator::solve(ImuCalibration& out)
+{
+  if (npose < 6)
+    {
+      printf("ERROR: %d poses, 6 needed.\n", npose);
+      return false;
+    }
+
+  ImuCalibration cal;
+
+  double ata[16] = {}, atb[12] = {};
+  float  ref[IMU_CAL_MAX_POSES][3];
+  for (int p = 0; p < npose; p++)
+    {
+      const float* a = pose[p].accel;
+      int k = dominant_axis(a);
+      ref[p][0] = ref[p][1] = ref[p][2] = 0;
+      ref[p][k] = (a[k] < 0) ? -gravity : gravity;
+
+      double x[4] = { a[0], a[1], a[2], 1.0 };
+      for (int i = 0; i < 4; i++)
+        {
+          for (int j = 0; j < 4; j++) ata[i * 4 + j] += x[i] * x[j];
+          for (int j = 0; j < 3; j++) atb[i * 3 + j] += x[i] * ref[p][j];
+        }
+    }
+
+  if (!solve_linear(ata, atb, 4, 3))
+    {
+      printf("ERROR: poses do not span three axes.\n");
+      return false;
+    }
+
+  float m[9], o[3];
+  for (int j = 0; j < 3; j++)
+    {
+      for (int k = 0; k < 3; k++) m[j * 3 + k] = (float)atb[k * 3 + j];
+      o[j] = (float)-atb[9 + j];
+    }
+  cal.setAccel(m, o);
+
+  double sq = 0;
+  for (int p = 0; p < npose; p++)
+    {
+      const float* a = pose[p].accel;
+      for (int j = 0; j < 3; j++)
+        {
+          double e = m[j * 3] * a[0] + m[j * 3 + 1] * a[1] + m[j * 3 + 2] * a[2] - o[j] - ref[p][j];
+          sq += e * e;
+        }
+    }
+  cal.data().accel_rms = (float)sqrt(sq / npose);
+
+  table(cal);
+
+  if (nrot >= 3)
+    {
+      double tta[9] = {}, ttb[9] = {};
+      for (int r = 0; r < nrot; r++)
+        {
+          for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+              {
+                tta[i * 3 + j] += (double)rot[r].angle[i] * rot[r].angle[j];
+                ttb[i * 3 + j] += (double)rot[r].angle[i] * rot[r].reference[j];
+              }
+        }
+
+      if (!solve_linear(tta, ttb, 3, 3))
+        {
+          printf("ERROR: rotations do not span three axes.\n");
+          return false;
+        }
+
+      for (int j = 0; j < 3; j++)
+        for (int k = 0; k < 3; k++) m[j * 3 + k] = (float)ttb[k * 3 + j];
+      memcpy(cal.data().gyro_m, m, sizeof(m));
+
+      sq = 0;
+      for (int r = 0; r < nrot; r++)
+        {
+          const float* t = rot[r].angle;
+          for (int j = 0; j < 3; j++)
+            {
+              double e = m[j * 3] * t[0] + m[j * 3 + 1] * t[1] + m[j * 3 + 2] * t[2] - rot[r].reference[j];
+              sq += e * e;
+            }
+        }
+      cal.data().gyro_rms = (float)sqrt(sq / nrot);
+    }
+
+  out = cal;
+  return true;
+}
@@ -0,0 +1,170 @@
+/*
+ *  ImuCalibration.h - Accelerometer / gyro scale, misalignment and bias calibration.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _IMU_CALIBRATION_H_
+#define _IMU_CALIBRATION_H_
+
+#include "SpresenseIMU.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define IMU_CAL_MAGIC          "SCAL"
+#define IMU_CAL_VERSION        (1)
+
+// Gyro bias table: bins of IMU_CAL_TEMP_STEP degC from IMU_CAL_TEMP_MIN.
+#define IMU_CAL_TEMP_BINS      (16)
+#define IMU_CAL_TEMP_MIN       (-10.0f)
+#define IMU_CAL_TEMP_STEP      (5.0f)
+#define IMU_CAL_BIN_SAMPLES    (256)   // fewer static samples: bin interpolated
+
+// apply() looks the bias up once per this many samples.
+#define IMU_CAL_TEMP_INTERVAL  (64)
+
+#define IMU_CAL_POSE_SAMPLES   (64)    // minimum per pose
+#define IMU_CAL_MAX_POSES      (24)
+#define IMU_CAL_MAX_ROTATIONS  (12)
+
+/**************************************************************************
+ * Structures
+ **************************************************************************/
+
+// What save() / load() store, little endian as on the board (no padding:
+// every field after the 8-byte header is 4 bytes).
+//   accel' = accel_m * accel - accel_o
+//   gyro'  = gyro_m * (gyro - gyro_b(temp))
+struct ImuCalibrationData {
+  char     magic[4];
+  uint16_t version;
+  uint16_t size;                      // sizeof(ImuCalibrationData)
+  float    accel_m[9];                // row major
+  float    accel_o[3];                // m/s^2
+  float    gyro_m[9];
+  float    gyro_b[IMU_CAL_TEMP_BINS][3];  // rad/s at the bin centers
+  float    temp_min;                  // lower edge of bin 0 (degC)
+  float    temp_step;
+  float    accel_rms;                 // fit residuals (m/s^2, rad)
+  float    gyro_rms;
+  uint32_t checksum;                  // Fletcher-32 of everything above
+};
+
+/**************************************************************************
+ * ImuCalibration
+ *
+ *  The correction applied to samples. apply() is one 3x3 product and a
+ *  subtraction per vector, with the offsets folded once per
+ *  IMU_CAL_TEMP_INTERVAL samples: the temperature moves over seconds,
+ *  not samples. The samples are corrected in place.
+ *
+ *  Attach it to the read path with SpresenseIMU.setCalibration(), or
+ *  call apply() on samples read elsewhere. Markers are left alone.
+ **************************************************************************/
+
+class ImuCalibration {
+
+public:
+  ImuCalibration() { reset(); }
+
+  // Identity matrices, no offsets.
+  void reset();
+
+  void setAccel(const float m[9], const float o[3]);
+  void setGyro(const float m[9], const float b[3]);      // same bias at every temperature
+  void setGyroBias(int bin, const float b[3]);
+  void gyroBias(float temp, float b[3]) const;
+
+  void apply(cxd5602pwbimu_data_t* s, size_t n) const;
+  void apply(ImuSpan<cxd5602pwbimu_data_t> span) const { apply(span.data, span.size); }
+
+  // Any stdio path: SPI flash (/mnt/spif/...) or SD (/mnt/sd0/...).
+  bool save(const char* path) const;
+  bool load(const char* path);
+
+  const ImuCalibrationData& data() const { return d; }
+  ImuCalibrationData& data() { return d; }
+  void print() const;
+
+private:
+  ImuCalibrationData d;
+};
+
+/**************************************************************************
+ * ImuCalibrator
+ *
+ *  Least-squares fit of an ImuCalibration from
+ *    - static poses (six or more, e.g. each face of a box on a table):
+ *      the mean accel of a pose is matched to +-gravity on its dominant
+ *      axis, which fits the accel matrix and offset (12 unknowns), and
+ *      every static sample's gyro goes into its temperature bin;
+ *    - rotations of a known angle (e.g. 360 degrees about each axis on
+ *      the table): the bias-free gyro integral is matched to the angle on
+ *      its dominant axis, which fits the gyro matrix (9 unknowns).
+ *      Without three rotations the gyro matrix stays identity.
+ *
+ *  Feed raw samples: detach any calibration from the read path first.
+ **************************************************************************/
+
+class ImuCalibrator {
+
+public:
+  ImuCalibrator();
+
+  void reset();
+  void setGravity(float g) { gravity = g; }   // IMU_GRAVITY by default
+
+  void beginPose();
+  void addPose(const cxd5602pwbimu_data_t* s, size_t n);
+  bool endPose();                   // false: too few samples or no room
+
+  // Rotations use the gyro bias of the poses recorded before them.
+  void beginRotation();
+  void addRotation(const cxd5602pwbimu_data_t* s, size_t n);
+  bool endRotation(float degrees);
+
+  int poses() const { return npose; }
+  int rotations() const { return nrot; }
+
+  bool solve(ImuCalibration& out);
+
+private:
+  struct Pose { float accel[3]; };
+  struct Rotation { float angle[3]; float reference[3]; };
+
+  void table(ImuCalibration& c) const;
+
+  float    gravity;
+
+  Pose     pose[IMU_CAL_MAX_POSES];
+  int      npose;
+  double   pose_sum[3];
+  uint32_t pose_count;
+
+  Rotation rot[IMU_CAL_MAX_ROTATIONS];
+  int      nrot;
+  double   rot_sum[3];
+  uint32_t rot_last;
+  bool     rot_started;
+  ImuCalibration rot_bias;          // bias table of the poses so far
+
+  double   bin_sum[IMU_CAL_TEMP_BINS][3];
+  uint32_t bin_count[IMU_CAL_TEMP_BINS];
+};
+
+#endif // _IMU_CALIBRATION_H_
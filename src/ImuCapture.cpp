@@ -0,0 +1,283 @@
+/*
+ *  ImuCapture.cpp - Event-triggered capture with pre- and post-trigger samples.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include "ImuCapture.h"
+
+#include <stdio.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define IMU_CAPTURE_CHUNK (32)   // history samples handed over per write()
+
+/****************************************************************************
+ * ImuCaptureStats
+ ****************************************************************************/
+void ImuCaptureStats::print() const
+{
+  printf("capture seen %lu, written %lu, events %lu, extended %lu, errors %lu\n",
+         (unsigned long)seen, (unsigned long)written, (unsigned long)events,
+         (unsigned long)extended, (unsigned long)errors);
+}
+
+/****************************************************************************
+ * ImuCaptureLog
+ ****************************************************************************/
+ImuCaptureLog::ImuCaptureLog(ImuRecorder& r, const ImuLogConfig& c, const char* pattern, uint32_t size)
+  : recorder(r), config(c), prealloc(size)
+{
+  snprintf(path_format, sizeof(path_format), "%s", pattern);
+}
+
+bool ImuCaptureLog::beginEvent(const ImuCaptureEvent& e)
+{
+  char path[IMU_CAPTURE_PATH_MAX];
+
+  snprintf(path, sizeof(path), path_format, (unsigned long)e.id);
+  if (!recorder.open(path, prealloc))
+    {
+      printf("ERROR: capture file %s\n", path);
+      return false;
+    }
+  if (!writer.begin(recorder, config))
+    {
+      recorder.close();
+      return false;
+    }
+  return true;
+}
+
+bool ImuCaptureLog::endEvent(const ImuCaptureEvent&)
+{
+  bool ret = writer.end();
+  return recorder.close() && ret;
+}
+
+/****************************************************************************
+ * ImuCaptureTelemetry
+ ****************************************************************************/
+bool ImuCaptureTelemetry::endEvent(const ImuCaptureEvent& e)
+{
+  float v[6] = { (float)e.id, (float)e.source, (float)e.pre, (float)e.post,
+                 e.peak_accel, e.peak_gyro };
+
+  bool ret = telemetry.flush();
+  return telemetry.writeRecord(v, 6) && telemetry.flush() && ret;
+}
+
+/****************************************************************************
+ * ImuCapture
+ ****************************************************************************/
+ImuCapture::ImuCapture()
+  : output(NULL), pre_len(0), post_len(1), max_post(1),
+    triggers(IMU_TRIG_SHOCK | IMU_TRIG_RATE | IMU_TRIG_EXTERNAL),
+    shock(0), rate2(0), gravity(IMU_GRAVITY), external(false),
+    in_event(false), opened(false), failed(false), remaining(0), limit(0)
+{
+}
+
+ImuCapture::~ImuCapture()
+{
+  end();
+}
+
+void ImuCapture::setWindow(uint32_t pre, uint32_t post, uint32_t max)
+{
+  pre_len  = pre;
+  post_len = (post > 0) ? post : 1;
+  max_post = (max > post_len) ? max : post_len;
+}
+
+bool ImuCapture::begin(ImuCaptureOutput& out)
+{
+  end();
+
+  if (pre_len > 0 && !history.allocate(pre_len))
+    {
+      printf("ERROR: capture history (%lu samples)\n", (unsigned long)pre_len);
+      return false;
+    }
+
+  output   = &out;
+  external = false;
+  event    = ImuCaptureEvent();
+  stat     = ImuCaptureStats();
+  return true;
+}
+
+void ImuCapture::end()
+{
+  if (in_event) finish();
+  history.release();
+  output = NULL;
+}
+
+/****************************************************************************
+ * Trigger check
+ *
+ *  The shock test compares |acc|^2 with (g -+ threshold)^2, so the common
+ *  path has no square root.
+ ****************************************************************************/
+int ImuCapture::check(const cxd5602pwbimu_data_t& s)
+{
+  if ((triggers & IMU_TRIG_EXTERNAL) && __atomic_exchange_n(&external, false, __ATOMIC_ACQUIRE))
+    {
+      return IMU_TRIG_EXTERNAL;
+    }
+
+  if ((triggers & IMU_TRIG_SHOCK) && shock > 0)
+    {
+      float a2 = s.ax * s.ax + s.ay * s.ay + s.az * s.az;
+      float hi = gravity + shock;
+      float lo = gravity - shock;
+      if (a2 > hi * hi || (lo > 0 && a2 < lo * lo)) return IMU_TRIG_SHOCK;
+    }
+
+  if ((triggers & IMU_TRIG_RATE) && rate2 > 0)
+    {
+      if (s.gx * s.gx + s.gy * s.gy + s.gz * s.gz > rate2) return IMU_TRIG_RATE;
+    }
+
+  return 0;
+}
+
+void ImuCapture::peak(const cxd5602pwbimu_data_t& s)
+{
+  float a = fabsf(sqrtf(s.ax * s.ax + s.ay * s.ay + s.az * s.az) - gravity);
+  float g = sqrtf(s.gx * s.gx + s.gy * s.gy + s.gz * s.gz);
+
+  if (a > event.peak_accel) event.peak_accel = a;
+  if (g > event.peak_gyro)  event.peak_gyro  = g;
+}
+
+void ImuCapture::emit(const cxd5602pwbimu_data_t* s, size_t n)
+{
+  if (n == 0 || !opened || failed) return;
+
+  if (output->write(s, n))
+    {
+      stat.written += n;
+    }
+  else
+    {
+      stat.errors++;
+      failed = true;
+    }
+}
+
+/****************************************************************************
+ * Event start: the history, then the sample that fired
+ ****************************************************************************/
+void ImuCapture::start(const cxd5602pwbimu_data_t& s, int source)
+{
+  in_event = true;
+  failed   = false;
+
+  event = ImuCaptureEvent();
+  event.id        = ++stat.events;
+  event.source    = source;
+  event.timestamp = s.timestamp;
+  event.pre       = history.size();
+
+  opened = output->beginEvent(event);
+  if (!opened) stat.errors++;
+
+  cxd5602pwbimu_data_t chunk[IMU_CAPTURE_CHUNK];
+  size_t n;
+  while ((n = history.pop(chunk, IMU_CAPTURE_CHUNK)) > 0)
+    {
+      for (size_t i = 0; i < n; i++) peak(chunk[i]);
+      emit(chunk, n);
+    }
+
+  remaining = post_len;
+  limit     = max_post;
+}
+
+void ImuCapture::finish()
+{
+  if (opened && !output->endEvent(event)) stat.errors++;
+  in_event = opened = false;
+}
+
+/****************************************************************************
+ * Processing
+ *
+ *  Samples inside a window are written in runs, one write() per
+ *  contiguous run of the caller's buffer.
+ ****************************************************************************/
+void ImuCapture::process(const cxd5602pwbimu_data_t* s, size_t n)
+{
+  if (output == NULL) return;
+
+  size_t run = 0;   // first sample of the pending run
+
+  for (size_t i = 0; i < n; i++)
+    {
+      if (imuIsMarker(s[i]))
+        {
+          if (in_event) emit(&s[run], i - run);
+          run = i + 1;
+          continue;
+        }
+
+      stat.seen++;
+      int source = check(s[i]);
+
+      if (!in_event)
+        {
+          if (source == 0)
+            {
+              if (pre_len > 0)
+                {
+                  if (history.size() >= pre_len) history.discard(1);
+                  history.push(s[i]);
+                }
+              continue;
+            }
+          start(s[i], source);
+          run = i;
+        }
+      else if (source != 0)
+        {
+          /* Extend to post_len samples from here, within max_post. */
+          uint32_t want = (post_len < limit) ? post_len : limit;
+          if (want > remaining)
+            {
+              remaining = want;
+              stat.extended++;
+            }
+        }
+
+      peak(s[i]);
+      event.post++;
+      limit--;
+
+      if (--remaining == 0)
+        {
+          emit(&s[run], i + 1 - run);
+          finish();
+          run = i + 1;
+        }
+    }
+
+  if (in_event) emit(&s[run], n - run);
+}
@@ -0,0 +1,182 @@
+/*
+ *  ImuCapture.h - Event-triggered capture with pre- and post-trigger samples.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _IMU_CAPTURE_H_
+#define _IMU_CAPTURE_H_
+
+#include "SpresenseIMU.h"
+#include "ImuRingBuffer.h"
+#include "ImuLog.h"
+#include "ImuRecorder.h"
+#include "ImuTelemetry.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+// Trigger sources (bit mask for setTriggers(), one of them in an event).
+#define IMU_TRIG_SHOCK      (1 << 0)   // ||acc| - gravity| above a threshold
+#define IMU_TRIG_RATE       (1 << 1)   // |gyro| above a threshold
+#define IMU_TRIG_EXTERNAL   (1 << 2)   // trigger(), e.g. from a GPIO interrupt
+
+#define IMU_CAPTURE_PATH_MAX (64)
+
+/**************************************************************************
+ * Structures
+ **************************************************************************/
+
+struct ImuCaptureEvent {
+  uint32_t id;               // 1, 2, ... since begin()
+  int      source;           // IMU_TRIG_*
+  uint32_t timestamp;        // sample that fired
+  uint32_t pre;              // samples before it (fewer right after begin()
+                             // or the previous event)
+  uint32_t post;             // samples from it on
+  float    peak_accel;       // largest ||acc| - gravity| in the window (m/s^2)
+  float    peak_gyro;        // largest |gyro| in the window (rad/s)
+
+  ImuCaptureEvent() { memset(this, 0, sizeof(*this)); }
+};
+
+struct ImuCaptureStats {
+  uint32_t seen;             // samples processed
+  uint32_t written;          // samples handed to the output
+  uint32_t events;
+  uint32_t extended;         // triggers inside a window (window extended)
+  uint32_t errors;           // output failures (the rest of the event is dropped)
+
+  ImuCaptureStats() { memset(this, 0, sizeof(*this)); }
+
+  void print() const;
+};
+
+/**************************************************************************
+ * ImuCaptureOutput
+ *
+ *  Where the samples of an event go. write() runs on the thread that
+ *  calls ImuCapture::process(), so it should only queue (ImuRecorder,
+ *  a serial write of one frame).
+ **************************************************************************/
+
+class ImuCaptureOutput {
+
+public:
+  virtual ~ImuCaptureOutput() {}
+
+  virtual bool beginEvent(const ImuCaptureEvent&) { return true; }
+  virtual bool write(const cxd5602pwbimu_data_t* s, size_t n) = 0;
+  virtual bool endEvent(const ImuCaptureEvent&) { return true; }
+};
+
+// One log file (ImuLog format) per event through an ImuRecorder.
+// `pattern` is a printf format for the event id, e.g. "/mnt/sd0/evt%03lu.dat".
+class ImuCaptureLog : public ImuCaptureOutput {
+
+public:
+  ImuCaptureLog(ImuRecorder& r, const ImuLogConfig& c, const char* pattern, uint32_t prealloc = 0);
+
+  bool beginEvent(const ImuCaptureEvent& e);
+  bool write(const cxd5602pwbimu_data_t* s, size_t n) { return writer.write(s, n); }
+  bool endEvent(const ImuCaptureEvent& e);
+
+private:
+  ImuRecorder& recorder;
+  ImuLogWriter writer;
+  ImuLogConfig config;
+  char         path_format[IMU_CAPTURE_PATH_MAX];
+  uint32_t     prealloc;
+};
+
+// Framed telemetry: the samples, then one IMU_TLM_F32 record per event
+// (id, source, pre, post, peak_accel, peak_gyro).
+class ImuCaptureTelemetry : public ImuCaptureOutput {
+
+public:
+  explicit ImuCaptureTelemetry(ImuTelemetry& t) : telemetry(t) {}
+
+  bool write(const cxd5602pwbimu_data_t* s, size_t n) { return telemetry.write(s, n); }
+  bool endEvent(const ImuCaptureEvent& e);
+
+private:
+  ImuTelemetry& telemetry;
+};
+
+/**************************************************************************
+ * ImuCapture
+ *
+ *  Keeps the last `pre` samples in RAM. When a trigger fires, an event
+ *  starts: the history, the sample that fired and the next `post`
+ *  samples go to the output. A trigger inside the window extends it, up
+ *  to `max_post` samples after the first one. Samples of an event are
+ *  never part of the next event's history, so windows do not overlap.
+ *
+ *  Feed it from the reading loop (or an ImuSubscriber). Markers from
+ *  reconfigure() are dropped. trigger() may be called from an interrupt
+ *  handler; it fires at the next sample processed.
+ **************************************************************************/
+
+class ImuCapture {
+
+public:
+  ImuCapture();
+  ~ImuCapture();
+
+  void setWindow(uint32_t pre, uint32_t post, uint32_t max_post = 0);
+  void setTriggers(int sources) { triggers = sources; }
+  void setShock(float accel) { shock = accel; }         // m/s^2 around gravity
+  void setRate(float gyro) { rate2 = gyro * gyro; }     // rad/s
+  void setGravity(float g) { gravity = g; }            // IMU_GRAVITY by default
+
+  bool begin(ImuCaptureOutput& out);
+  void end();
+
+  void process(const cxd5602pwbimu_data_t* s, size_t n);
+  void process(ImuSpan<cxd5602pwbimu_data_t> span) { process(span.data, span.size); }
+
+  void trigger() { __atomic_store_n(&external, true, __ATOMIC_RELEASE); }
+
+  bool capturing() const { return in_event; }
+  const ImuCaptureEvent& lastEvent() const { return event; }
+  ImuCaptureStats stats() const { return stat; }
+
+private:
+  int  check(const cxd5602pwbimu_data_t& s);
+  void start(const cxd5602pwbimu_data_t& s, int source);
+  void finish();
+  void peak(const cxd5602pwbimu_data_t& s);
+  void emit(const cxd5602pwbimu_data_t* s, size_t n);
+
+  ImuCaptureOutput* output;
+  ImuRingBuffer<cxd5602pwbimu_data_t> history;
+
+  uint32_t pre_len, post_len, max_post;
+  int      triggers;
+  float    shock, rate2, gravity;
+  volatile bool external;
+
+  bool     in_event;
+  bool     opened;           // beginEvent() succeeded
+  bool     failed;           // output failed during this event
+  uint32_t remaining;        // samples left in the window
+  uint32_t limit;            // samples the window may still be extended by
+  ImuCaptureEvent event;
+  ImuCaptureStats stat;
+};
+
+#endif // _IMU_CAPTURE_H_
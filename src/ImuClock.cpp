@@ -0,0 +1,99 @@
+/*
+ *  ImuClock.cpp - 64-bit time base for the 19.2 MHz sample timestamps.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "ImuClock.h"
+
+/****************************************************************************
+ * begin
+ ****************************************************************************/
+void ImuClock::begin(int rate)
+{
+  period_ticks = (rate > 0) ? (uint32_t)(IMU_TICKS_PER_SEC / rate) : 0;
+  reset();
+}
+
+/****************************************************************************
+ * bridge
+ ****************************************************************************/
+void ImuClock::bridge(int rate, uint32_t estimate)
+{
+  period_ticks    = (rate > 0) ? (uint32_t)(IMU_TICKS_PER_SEC / rate) : 0;
+  bridging        = has_last;
+  bridge_estimate = (estimate != 0) ? estimate : 1;
+}
+
+/****************************************************************************
+ * reset
+ ****************************************************************************/
+void ImuClock::reset()
+{
+  last          = 0;
+  last_raw      = 0;
+  last_delta    = 0;
+  has_last      = false;
+  bridging      = false;
+  bridge_estimate = 0;
+  gap_count     = 0;
+  dropped_count = 0;
+  stall_count   = 0;
+}
+
+/****************************************************************************
+ * unwrap
+ ****************************************************************************/
+uint64_t ImuClock::unwrap(uint32_t timestamp)
+{
+  if (!has_last)
+    {
+      last     = timestamp;
+      last_raw = timestamp;
+      has_last = true;
+      return last;
+    }
+
+  /* Unsigned difference handles the 32-bit wrap. */
+  uint32_t d = timestamp - last_raw;
+
+  if (bridging)
+    {
+      bridging = false;
+      if (d == 0 || (uint64_t)d > (uint64_t)bridge_estimate * 2 + period_ticks) d = bridge_estimate;
+      last      += d;
+      last_raw   = timestamp;
+      last_delta = d;
+      return last;
+    }
+
+  if (d == 0 || d > 0x80000000u)
+    {
+      stall_count++;
+      return last;
+    }
+
+  if (period_ticks != 0 && (uint64_t)d * 2 > (uint64_t)period_ticks * IMU_CLOCK_GAP_X2)
+    {
+      gap_count++;
+      dropped_count += (d + period_ticks / 2) / period_ticks - 1;
+    }
+
+  last      += d;
+  last_raw   = timestamp;
+  last_delta = d;
+  return last;
+}
@@ -0,0 +1,103 @@
+/*
+ *  ImuClock.h - 64-bit time base for the 19.2 MHz sample timestamps.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _IMU_CLOCK_H_
+#define _IMU_CLOCK_H_
+
+#include <stdint.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define IMU_TICKS_PER_SEC  (19200000)
+
+// A step longer than this many nominal periods (x2) counts as a gap;
+// 3 / 2 = 1.5 periods.
+#define IMU_CLOCK_GAP_X2   (3)
+
+/**************************************************************************
+ * ImuClock
+ *
+ *  The sample timestamp is a 32-bit count of a 19.2 MHz clock and wraps
+ *  every 223.7 s. unwrap() extends it to 64 bits, so the time base stays
+ *  exact for any run length (float seconds lose sub-millisecond
+ *  resolution after a few hours). Consecutive samples must be less than
+ *  one wrap apart.
+ *
+ *  With the nominal rate from begin(), a step longer than 1.5 periods is
+ *  counted as a gap, and the samples that should have been in it as
+ *  dropped. A timestamp that does not advance (a repeated or reordered
+ *  sample) is counted and leaves the clock where it was.
+ **************************************************************************/
+
+class ImuClock {
+
+public:
+  ImuClock() : period_ticks(0) { reset(); }
+
+  // Nominal sample rate in Hz (0: no gap detection).
+  void begin(int rate);
+  void reset();
+  void clearCounters() { gap_count = dropped_count = stall_count = 0; }
+
+  // New nominal rate without restarting the time base. The next step is
+  // not counted as a gap; if it goes backwards or is longer than twice
+  // `estimate` (ticks, e.g. from the wall clock) plus a period, the
+  // timestamp is taken as restarted and `estimate` is used instead.
+  void bridge(int rate, uint32_t estimate);
+
+  // 64-bit tick count of `timestamp`; updates delta() and the counters.
+  uint64_t unwrap(uint32_t timestamp);
+
+  // 64-bit ticks of a timestamp near the last one (within half a wrap),
+  // without advancing the clock.
+  uint64_t ticksOf(uint32_t timestamp) const {
+    return last + (int64_t)(int32_t)(timestamp - last_raw);
+  }
+
+  bool     started() const { return has_last; }
+  uint64_t ticks() const   { return last; }
+  uint32_t timestamp() const { return last_raw; }     // of the last sample
+  uint32_t delta() const   { return last_delta; }      // ticks since the previous sample
+  float    dt() const      { return toSeconds(last_delta); }
+  uint32_t period() const  { return period_ticks; }
+
+  uint32_t gaps() const    { return gap_count; }
+  uint32_t dropped() const { return dropped_count; }
+  uint32_t stalls() const  { return stall_count; }     // timestamps that did not advance
+
+  static float  toSeconds(uint32_t ticks) { return ticks * (1.0f / IMU_TICKS_PER_SEC); }
+  static double toSeconds(uint64_t ticks) { return ticks * (1.0 / IMU_TICKS_PER_SEC); }
+
+private:
+  uint32_t period_ticks;
+  uint64_t last;
+  uint32_t last_raw;
+  uint32_t last_delta;
+  bool     has_last;
+  bool     bridging;
+  uint32_t bridge_estimate;
+
+  uint32_t gap_count;
+  uint32_t dropped_count;
+  uint32_t stall_count;
+};
+
+#endif // _IMU_CLOCK_H_
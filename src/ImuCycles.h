@@ -0,0 +1,78 @@
+/*
+ *  ImuCycles.h - Cycle counter and double reference for the bench sketches.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _IMU_CYCLES_H_
+#define _IMU_CYCLES_H_
+
+#include "SpresenseIMU.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#ifdef ARDUINO_ARCH_SPRESENSE
+
+// Cortex-M4 DWT cycle counter
+#define DEMCR        (*(volatile uint32_t*)0xE000EDFC)
+#define DWT_CTRL     (*(volatile uint32_t*)0xE0001000)
+#define DWT_CYCCNT   (*(volatile uint32_t*)0xE0001004)
+
+// Start DWT_CYCCNT from 0.
+static inline void imuCyclesBegin()
+{
+  DEMCR    |= (1 << 24);   // TRCENA
+  DWT_CYCCNT = 0;
+  DWT_CTRL |= 1;           // CYCCNTENA
+}
+
+#endif // ARDUINO_ARCH_SPRESENSE
+
+/****************************************************************************
+ * Reference (double, exact exponential per sample)
+ ****************************************************************************/
+
+// Rotate r = (1, 0, 0, 0) by the gyro of n samples with a fixed dt.
+static inline void imuReferenceQuaternion(const cxd5602pwbimu_data_t* s, int n, double dt, double r[4])
+{
+  r[0] = 1; r[1] = r[2] = r[3] = 0;
+
+  for (int i = 0; i < n; i++) {
+    double vx = s[i].gx * dt / 2, vy = s[i].gy * dt / 2, vz = s[i].gz * dt / 2;
+    double a = sqrt(vx*vx + vy*vy + vz*vz);
+    double c = cos(a), k = (a > 0) ? sin(a) / a : 1;
+    vx *= k; vy *= k; vz *= k;
+    double t0 = r[0]*c  - r[1]*vx - r[2]*vy - r[3]*vz;
+    double t1 = r[0]*vx + r[1]*c  + r[2]*vz - r[3]*vy;
+    double t2 = r[0]*vy - r[1]*vz + r[2]*c  + r[3]*vx;
+    double t3 = r[0]*vz + r[1]*vy - r[2]*vx + r[3]*c;
+    r[0] = t0; r[1] = t1; r[2] = t2; r[3] = t3;
+  }
+}
+
+// Rotation angle (deg) between the reference r and q.
+static inline double imuErrorDeg(const double r[4], const pwbQuaternionData& q)
+{
+  double w = r[0]*q.q0 + r[1]*q.q1 + r[2]*q.q2 + r[3]*q.q3;
+  double x = r[0]*q.q1 - r[1]*q.q0 - r[2]*q.q3 + r[3]*q.q2;
+  double y = r[0]*q.q2 + r[1]*q.q3 - r[2]*q.q0 - r[3]*q.q1;
+  double z = r[0]*q.q3 - r[1]*q.q2 + r[2]*q.q1 - r[3]*q.q0;
+  return 2.0 * atan2(sqrt(x*x + y*y + z*z), fabs(w)) * 180.0 / M_PI;
+}
+
+#endif // _IMU_CYCLES_H_
@@ -0,0 +1,328 @@
+/*
+ *  ImuDecimator.cpp - Multi-rate decimation filter bank.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "ImuDecimator.h"
+#include "ImuKernels.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define TICKS_PER_SEC       (19200000.0f)
+#define DEG2RAD             ((float)M_PI / 180.0f)
+
+#define DEFAULT_FIR_TAPS    (8)       // per phase
+#define DEFAULT_CIC_ORDER   (3)
+#define FIR_CUTOFF          (0.45f)   // of the output Nyquist
+
+#define CIC_FULL_SCALE      ((1L << (IMU_DECIM_CIC_BITS - 1)) - 1)
+
+/****************************************************************************
+ * constructor / begin / end
+ ****************************************************************************/
+ImuDecimator::ImuDecimator()
+  : in_rate(0), accel_lsb(0), gyro_lsb(0), num_taps(0)
+{
+  memset(taps, 0, sizeof(taps));
+}
+
+ImuDecimator::~ImuDecimator()
+{
+  end();
+}
+
+bool ImuDecimator::begin(float rate, int adrange, int gdrange)
+{
+  end();
+
+  if (rate <= 0)
+    {
+      printf("ERROR: decimator rate %f.\n", rate);
+      return false;
+    }
+
+  in_rate   = rate;
+  accel_lsb = adrange * IMU_GRAVITY / CIC_FULL_SCALE;
+  gyro_lsb  = gdrange * DEG2RAD / CIC_FULL_SCALE;
+
+  return true;
+}
+
+void ImuDecimator::end()
+{
+  for (int i = 0; i < num_taps; i++)
+    {
+      free(taps[i].coef);
+      free(taps[i].line);
+    }
+  memset(taps, 0, sizeof(taps));
+  num_taps = 0;
+}
+
+/****************************************************************************
+ * addTap
+ ****************************************************************************/
+int ImuDecimator::addTap(int ratio, Type type, int source, int param)
+{
+  if (num_taps >= IMU_DECIM_MAX_TAPS || in_rate <= 0)
+    {
+      printf("ERROR: no more decimator taps.\n");
+      return -1;
+    }
+  if (ratio < 1 || source < IMU_DECIM_INPUT || source >= num_taps)
+    {
+      printf("ERROR: decimator ratio %d / source %d.\n", ratio, source);
+      return -1;
+    }
+
+  Tap& t = taps[num_taps];
+  memset(&t, 0, sizeof(t));
+  t.type   = type;
+  t.source = source;
+  t.ratio  = ratio;
+  t.rate   = ((source == IMU_DECIM_INPUT) ? in_rate : taps[source].rate) / ratio;
+
+  if (type == FIR)
+    {
+      int per_phase = (param > 0) ? param : DEFAULT_FIR_TAPS;
+
+      t.length = (ratio == 1) ? 1 : per_phase * ratio;
+      t.coef   = (float*)malloc(sizeof(float) * t.length);
+      t.line   = (cxd5602pwbimu_data_t*)malloc(sizeof(cxd5602pwbimu_data_t) * t.length);
+      if (t.coef == NULL || t.line == NULL)
+        {
+          printf("ERROR: decimator allocation failed.\n");
+          free(t.coef);
+          free(t.line);
+          return -1;
+        }
+
+      /* Blackman-windowed sinc, normalized to unity DC gain */
+      float  fc  = FIR_CUTOFF / ratio;     // cycles per input sample
+      float  mid = 0.5f * (t.length - 1);
+      double sum = 0;
+
+      for (int k = 0; k < t.length; k++)
+        {
+          float x = k - mid;
+          float h = (x == 0) ? 2 * fc : sinf(2 * (float)M_PI * fc * x) / ((float)M_PI * x);
+          if (t.length > 1)
+            {
+              float w = 2 * (float)M_PI * k / (t.length - 1);
+              h *= 0.42f - 0.5f * cosf(w) + 0.08f * cosf(2 * w);
+            }
+          t.coef[k] = h;
+          sum += h;
+        }
+      for (int k = 0; k < t.length; k++) t.coef[k] = (float)(t.coef[k] / sum);
+    }
+  else
+    {
+      int order = (param > 0) ? param : DEFAULT_CIC_ORDER;
+      int bits  = 0;
+
+      while ((1L << bits) < ratio) bits++;
+      if (order > IMU_DECIM_CIC_ORDER || IMU_DECIM_CIC_BITS + order * bits > 32)
+        {
+          printf("ERROR: CIC order %d x ratio %d exceeds 32 bits.\n", order, ratio);
+          return -1;
+        }
+      t.order = order;
+    }
+
+  return num_taps++;
+}
+
+/****************************************************************************
+ * process
+ ****************************************************************************/
+void ImuDecimator::process(const cxd5602pwbimu_data_t* s, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    {
+      if (!imuIsMarker(s[i])) feed(IMU_DECIM_INPUT, s[i]);
+    }
+}
+
+void ImuDecimator::feed(int source, const cxd5602pwbimu_data_t& s)
+{
+  for (int i = source + 1; i < num_taps; i++)
+    {
+      Tap& t = taps[i];
+      if (t.source != source) continue;
+
+      cxd5602pwbimu_data_t out;
+      bool ready = (t.type == FIR) ? runFir(t, s, out) : runCic(t, s, out);
+
+      if (ready)
+        {
+          push(t, out);
+          feed(i, out);
+        }
+    }
+}
+
+bool ImuDecimator::runFir(Tap& t, const cxd5602pwbimu_data_t& s, cxd5602pwbimu_data_t& out)
+{
+  t.line[t.head] = s;
+  if (++t.head == t.length) t.head = 0;
+  if (t.filled < t.length) t.filled++;
+
+  if (++t.phase < t.ratio) return false;
+  t.phase = 0;
+  if (t.filled < t.length) return false;
+
+  /* Dot product over the window, oldest first (head), in two runs. */
+  float acc[6] = { 0, 0, 0, 0, 0, 0 };
+  const pwbImuDataT<float>* line = imuSamples(t.line);
+
+  imuFirDot(t.coef, line + t.head, t.length - t.head, acc);
+  imuFirDot(t.coef + (t.length - t.head), line, t.head, acc);
+
+  /* Timestamp of the window center */
+  int a = (t.head + (t.length - 1) / 2) % t.length;
+  int b = (t.head + t.length / 2) % t.length;
+  uint32_t ta = t.line[a].timestamp;
+
+  out.timestamp = ta + (t.line[b].timestamp - ta) / 2;
+  out.temp      = s.temp;
+  out.gx = acc[0]; out.gy = acc[1]; out.gz = acc[2];
+  out.ax = acc[3]; out.ay = acc[4]; out.az = acc[5];
+
+  return true;
+}
+
+static inline uint32_t quantize(float v, float lsb)
+{
+  float q = v / lsb;
+  if (q >  CIC_FULL_SCALE) q =  CIC_FULL_SCALE;
+  if (q < -CIC_FULL_SCALE) q = -CIC_FULL_SCALE;
+  return (uint32_t)(int32_t)lrintf(q);
+}
+
+bool ImuDecimator::runCic(Tap& t, const cxd5602pwbimu_data_t& s, cxd5602pwbimu_data_t& out)
+{
+  uint32_t x[6] = {
+    quantize(s.gx, gyro_lsb),  quantize(s.gy, gyro_lsb),  quantize(s.gz, gyro_lsb),
+    quantize(s.ax, accel_lsb), quantize(s.ay, accel_lsb), quantize(s.az, accel_lsb)
+  };
+
+  /* Integrators (wraparound is intended) */
+  for (int a = 0; a < 6; a++)
+    {
+      uint32_t v = x[a];
+      for (int j = 0; j < t.order; j++)
+        {
+          t.integ[j][a] += v;
+          v = t.integ[j][a];
+        }
+    }
+
+  if (++t.phase < t.ratio) return false;
+  t.phase = 0;
+
+  /* Combs at the output rate */
+  float y[6];
+  float gain = 1.0f;
+  for (int j = 0; j < t.order; j++) gain *= t.ratio;
+
+  for (int a = 0; a < 6; a++)
+    {
+      uint32_t v = t.integ[t.order - 1][a];
+      for (int j = 0; j < t.order; j++)
+        {
+          uint32_t d = v - t.comb[j][a];
+          t.comb[j][a] = v;
+          v = d;
+        }
+      y[a] = (float)(int32_t)v / gain;
+    }
+
+  /* Group delay order * (ratio - 1) / 2 input periods */
+  float period = TICKS_PER_SEC / (t.rate * t.ratio);
+  if (t.has_prev) period = (float)(s.timestamp - t.prev_out_ts) / t.ratio;
+  t.prev_out_ts = s.timestamp;
+
+  bool settled = t.has_prev && (++t.filled >= t.order);
+  t.has_prev = true;
+
+  out.timestamp = s.timestamp - (uint32_t)(period * t.order * (t.ratio - 1) * 0.5f);
+  out.temp      = s.temp;
+  out.gx = y[0] * gyro_lsb;  out.gy = y[1] * gyro_lsb;  out.gz = y[2] * gyro_lsb;
+  out.ax = y[3] * accel_lsb; out.ay = y[4] * accel_lsb; out.az = y[5] * accel_lsb;
+
+  /* The first `order` outputs still contain the start-up transient. */
+  return settled;
+}
+
+/****************************************************************************
+ * output queues
+ ****************************************************************************/
+void ImuDecimator::push(Tap& t, const cxd5602pwbimu_data_t& out)
+{
+  int tail = (t.q_head + t.q_count) % IMU_DECIM_QUEUE;
+
+  t.queue[tail] = out;
+  if (t.q_count < IMU_DECIM_QUEUE)
+    {
+      t.q_count++;
+    }
+  else
+    {
+      t.q_head = (t.q_head + 1) % IMU_DECIM_QUEUE;
+      t.q_dropped++;
+    }
+}
+
+size_t ImuDecimator::read(int tap, cxd5602pwbimu_data_t* dst, size_t max)
+{
+  if (tap < 0 || tap >= num_taps) return 0;
+
+  Tap&   t = taps[tap];
+  size_t n = 0;
+
+  while (n < max && t.q_count > 0)
+    {
+      dst[n++] = t.queue[t.q_head];
+      t.q_head = (t.q_head + 1) % IMU_DECIM_QUEUE;
+      t.q_count--;
+    }
+
+  return n;
+}
+
+size_t ImuDecimator::available(int tap) const
+{
+  return (tap >= 0 && tap < num_taps) ? taps[tap].q_count : 0;
+}
+
+uint32_t ImuDecimator::dropped(int tap) const
+{
+  return (tap >= 0 && tap < num_taps) ? taps[tap].q_dropped : 0;
+}
+
+float ImuDecimator::rate(int tap) const
+{
+  return (tap >= 0 && tap < num_taps) ? taps[tap].rate : 0;
+}
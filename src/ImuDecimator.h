@@ -0,0 +1,133 @@
+/*
+ *  ImuDecimator.h - Multi-rate decimation filter bank.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _IMU_DECIMATOR_H_
+#define _IMU_DECIMATOR_H_
+
+#include "SpresenseIMU.h"
+#include "ImuSpan.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define IMU_DECIM_MAX_TAPS   (4)
+#define IMU_DECIM_QUEUE      (8)      // decimated samples held per tap
+#define IMU_DECIM_INPUT      (-1)     // source: the sensor samples
+#define IMU_DECIM_CIC_ORDER  (4)      // maximum CIC order
+
+// Fixed-point CIC input resolution: axes are quantized to this many bits
+// of the configured range. The register needs bits + order * log2(ratio)
+// <= 32, which addTap() checks.
+#ifndef IMU_DECIM_CIC_BITS
+#define IMU_DECIM_CIC_BITS   (16)
+#endif
+
+/**************************************************************************
+ * ImuDecimator
+ *
+ *  One sensor stream feeds up to IMU_DECIM_MAX_TAPS outputs. Each tap
+ *  divides the rate of its source (the input or an earlier tap) by an
+ *  integer ratio, so 1920 Hz -> 120 Hz -> 15 Hz is two cheap stages
+ *  instead of one long filter.
+ *
+ *  FIR (float): Blackman-windowed sinc, taps_per_phase * ratio long,
+ *    cutoff at 0.45 of the output Nyquist, unity DC gain. Only every
+ *    ratio-th output is computed, so the cost is taps_per_phase MACs per
+ *    input sample and axis (the polyphase cost).
+ *  CIC (fixed point): `order` integrators at the input rate and combs at
+ *    the output rate in 32-bit wraparound arithmetic, no multiplies.
+ *    Droop in the passband is not compensated; use it ahead of a short
+ *    FIR stage for large ratios.
+ *
+ *  Output samples carry the timestamp of the middle of the filter window
+ *  (group delay removed) and the temperature of the newest input.
+ **************************************************************************/
+
+class ImuDecimator {
+
+public:
+  enum Type {
+    FIR = 0,
+    CIC
+  };
+
+  ImuDecimator();
+  ~ImuDecimator();
+
+  // Input rate (Hz); the ranges set the CIC fixed-point scale.
+  bool begin(float rate, int adrange = 4, int gdrange = 500);
+  void end();
+
+  // Returns the tap number, -1 on error. `param` is taps_per_phase for
+  // FIR (0: 8) and the order for CIC (0: 3).
+  int addTap(int ratio, Type type = FIR, int source = IMU_DECIM_INPUT, int param = 0);
+
+  void process(const cxd5602pwbimu_data_t& s) { if (!imuIsMarker(s)) feed(IMU_DECIM_INPUT, s); }
+  void process(const cxd5602pwbimu_data_t* s, size_t n);
+  void process(ImuSpan<cxd5602pwbimu_data_t> span) { process(span.data, span.size); }
+
+  // Decimated samples of a tap, oldest first.
+  size_t read(int tap, cxd5602pwbimu_data_t* dst, size_t max);
+  size_t available(int tap) const;
+  uint32_t dropped(int tap) const;        // overwritten because not read
+
+  float rate(int tap) const;
+
+private:
+  struct Tap {
+    Type     type;
+    int      source;
+    int      ratio;
+    float    rate;
+    int      phase;             // inputs since the last output
+
+    /* FIR */
+    int      length;
+    float*   coef;
+    cxd5602pwbimu_data_t* line; // delay line, `length` samples
+    int      head;
+    int      filled;
+
+    /* CIC */
+    int      order;
+    uint32_t integ[IMU_DECIM_CIC_ORDER][6];
+    uint32_t comb[IMU_DECIM_CIC_ORDER][6];
+    uint32_t prev_out_ts;
+    bool     has_prev;
+
+    cxd5602pwbimu_data_t queue[IMU_DECIM_QUEUE];
+    int      q_head;
+    int      q_count;
+    uint32_t q_dropped;
+  };
+
+  void feed(int source, const cxd5602pwbimu_data_t& s);
+  bool runFir(Tap& t, const cxd5602pwbimu_data_t& s, cxd5602pwbimu_data_t& out);
+  bool runCic(Tap& t, const cxd5602pwbimu_data_t& s, cxd5602pwbimu_data_t& out);
+  void push(Tap& t, const cxd5602pwbimu_data_t& out);
+
+  float in_rate;
+  float accel_lsb;
+  float gyro_lsb;
+  Tap   taps[IMU_DECIM_MAX_TAPS];
+  int   num_taps;
+};
+
+#endif // _IMU_DECIMATOR_H_
@@ -0,0 +1,172 @@
+/*
+ *  ImuDevice.h - Device backends for SpresenseImuClass.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _IMU_DEVICE_H_
+#define _IMU_DEVICE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#ifdef ARDUINO_ARCH_SPRESENSE
+#include <nuttx/sensors/cxd5602pwbimu.h>
+#else
+#include "ImuHostCompat.h"
+#include "ImuLog.h"
+#endif
+
+/**************************************************************************
+ * Interface
+ *
+ *  Every call returns 0 (or a positive count) on success and a negative
+ *  errno value on failure, like the underlying NuttX driver.
+ **************************************************************************/
+
+class ImuDevice {
+
+public:
+  virtual ~ImuDevice() {}
+
+  virtual int open() = 0;
+  virtual int close() = 0;
+
+  virtual int setRate(int hz) = 0;
+  virtual int setRange(int accel, int gyro) = 0;
+  virtual int setFifoThreshold(int nfifos) = 0;
+  virtual int enable(bool on) = 0;
+
+  // Wait for a FIFO watermark. Returns > 0 when data is ready, 0 on timeout.
+  virtual int poll(int timeout_ms) = 0;
+
+  // Returns the number of bytes read.
+  virtual ssize_t read(void* buf, size_t len) = 0;
+};
+
+/**************************************************************************
+ * NuttX driver (/dev/imu0)
+ **************************************************************************/
+
+#ifdef ARDUINO_ARCH_SPRESENSE
+
+class ImuNuttxDevice : public ImuDevice {
+
+public:
+  ImuNuttxDevice() : fd(-1) {}
+
+  int open();
+  int close();
+
+  int setRate(int hz);
+  int setRange(int accel, int gyro);
+  int setFifoThreshold(int nfifos);
+  int enable(bool on);
+
+  int poll(int timeout_ms);
+  ssize_t read(void* buf, size_t len);
+
+private:
+  int fd;
+};
+
+#else
+
+/**************************************************************************
+ * Host simulation
+ *
+ *  Synthesizes samples from an ImuHostSignal at the configured rate, or
+ *  replays a rawStored capture (imuNNN.dat, SIMU or legacy headerless)
+ *  with its recorded timing.
+ *  Watermarks are delivered like the driver: one read() returns exactly
+ *  the FIFO threshold. In real-time mode poll() sleeps until the
+ *  watermark is due; otherwise samples are produced as fast as consumed.
+ **************************************************************************/
+
+struct ImuHostSignal {
+  float gx, gy, gz;           // angular rate [rad/s]
+  float ax, ay, az;           // acceleration [m/s^2]
+  float gyro_bias[3];         // constant gyro bias [rad/s]
+  float gyro_noise;           // white noise sigma [rad/s]
+  float accel_noise;          // white noise sigma [m/s^2]
+  float temp;                 // [degC]
+
+  ImuHostSignal()
+    : gx(0), gy(0), gz(0), ax(0), ay(0), az(9.80665f),
+      gyro_noise(0), accel_noise(0), temp(25.0f)
+  {
+    gyro_bias[0] = gyro_bias[1] = gyro_bias[2] = 0;
+  }
+};
+
+class ImuHostDevice : public ImuDevice {
+
+public:
+  ImuHostDevice();
+  ~ImuHostDevice();
+
+  void setSignal(const ImuHostSignal& s) { signal = s; }
+  bool replay(const char* path, bool loop = false);
+  void setRealtime(bool on) { realtime = on; }
+
+  // Fired for every generated sample, e.g. to change the signal over time.
+  void setHook(void (*fn)(ImuHostDevice&, uint64_t index, void* arg), void* arg) {
+    hook = fn; hook_arg = arg;
+  }
+
+  int open();
+  int close();
+
+  int setRate(int hz);
+  int setRange(int accel, int gyro);
+  int setFifoThreshold(int nfifos);
+  int enable(bool on);
+
+  int poll(int timeout_ms);
+  ssize_t read(void* buf, size_t len);
+
+  uint64_t generated() const { return index; }
+
+private:
+  bool  next(cxd5602pwbimu_data_t& out, uint64_t& due_ticks);
+  float noise(float sigma);
+
+  ImuHostSignal signal;
+  ImuLogReader replay_log;
+  bool     replaying;
+  bool     replay_loop;
+  bool     realtime;
+  bool     opened;
+  bool     enabled;
+  int      rate;
+  int      nfifos;
+  uint64_t index;          // samples produced since enable
+  uint64_t start_ns;       // monotonic time of enable
+  uint64_t elapsed;        // 19.2 MHz ticks since the first sample
+  uint32_t ticks;          // counter value of the next synthesized sample
+  uint32_t prev_ts;        // previous replayed timestamp
+  uint32_t rng;
+  cxd5602pwbimu_data_t* pending;   // watermark prepared by poll()
+  int      pending_len;
+  void   (*hook)(ImuHostDevice&, uint64_t, void*);
+  void*    hook_arg;
+};
+
+#endif // ARDUINO_ARCH_SPRESENSE
+
+#endif // _IMU_DEVICE_H_
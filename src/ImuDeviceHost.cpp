@@ -0,0 +1,241 @@
+/*
+ *  ImuDeviceHost.cpp - Simulated /dev/imu0 for running the library on a host.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef ARDUINO_ARCH_SPRESENSE
+
+#include "ImuDevice.h"
+
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define TICKS_PER_SEC   (19200000ULL)
+#define MAX_NFIFOS      (4)
+
+static uint64_t now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/****************************************************************************
+ * constructor / destructor
+ ****************************************************************************/
+ImuHostDevice::ImuHostDevice()
+  : replaying(false), replay_loop(false), realtime(true), opened(false),
+    enabled(false), rate(15), nfifos(1), index(0), start_ns(0), elapsed(0),
+    ticks(0), prev_ts(0), rng(12345), pending(NULL), pending_len(0),
+    hook(NULL), hook_arg(NULL)
+{
+}
+
+ImuHostDevice::~ImuHostDevice()
+{
+  free(pending);
+}
+
+/****************************************************************************
+ * replay
+ ****************************************************************************/
+bool ImuHostDevice::replay(const char* path, bool loop)
+{
+  replay_loop = loop;
+  replaying   = replay_log.open(path);
+  return replaying;
+}
+
+/****************************************************************************
+ * open / close
+ ****************************************************************************/
+int ImuHostDevice::open()
+{
+  pending = (cxd5602pwbimu_data_t*)malloc(sizeof(cxd5602pwbimu_data_t) * MAX_NFIFOS);
+  if (pending == NULL) return -ENOMEM;
+  opened = true;
+  return 0;
+}
+
+int ImuHostDevice::close()
+{
+  if (!opened) return -EBADF;
+  free(pending);
+  pending = NULL;
+  opened  = false;
+  enabled = false;
+  return 0;
+}
+
+/****************************************************************************
+ * configuration
+ ****************************************************************************/
+int ImuHostDevice::setRate(int hz)
+{
+  if (!opened) return -EBADF;
+  if (enabled) return -EBUSY;
+  switch (hz)
+    {
+      case 15: case 30: case 60: case 120:
+      case 240: case 480: case 960: case 1920:
+        rate = hz;
+        return 0;
+      default:
+        return -EINVAL;
+    }
+}
+
+int ImuHostDevice::setRange(int accel, int gyro)
+{
+  if (!opened) return -EBADF;
+  if (enabled) return -EBUSY;
+  (void)accel;
+  (void)gyro;
+  return 0;
+}
+
+int ImuHostDevice::setFifoThreshold(int n)
+{
+  if (!opened) return -EBADF;
+  if (enabled) return -EBUSY;
+  if (n < 1 || n > MAX_NFIFOS) return -EINVAL;
+  nfifos = n;
+  return 0;
+}
+
+int ImuHostDevice::enable(bool on)
+{
+  if (!opened) return -EBADF;
+  enabled     = on;
+  pending_len = 0;
+  if (on)
+    {
+      index    = 0;
+      elapsed  = 0;
+      start_ns = now_ns();
+    }
+  return 0;
+}
+
+/****************************************************************************
+ * sample generation
+ ****************************************************************************/
+float ImuHostDevice::noise(float sigma)
+{
+  if (sigma == 0) return 0;
+
+  /* Box-Muller on a xorshift generator; deterministic for a given run. */
+  rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5;
+  float u1 = ((rng >> 8) + 1) / 16777217.0f;
+  rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5;
+  float u2 = (rng >> 8) / 16777216.0f;
+  return sigma * sqrtf(-2.0f * logf(u1)) * cosf(2.0f * (float)M_PI * u2);
+}
+
+bool ImuHostDevice::next(cxd5602pwbimu_data_t& out, uint64_t& due_ticks)
+{
+  if (replaying)
+    {
+      if (replay_log.read(&out, 1) != 1)
+        {
+          if (!replay_loop) return false;
+          replay_log.seek(0);
+          if (replay_log.read(&out, 1) != 1) return false;
+          prev_ts = out.timestamp;
+        }
+      if (index == 0) prev_ts = out.timestamp;
+      elapsed  += (uint32_t)(out.timestamp - prev_ts);
+      prev_ts   = out.timestamp;
+      due_ticks = elapsed;
+      index++;
+      return true;
+    }
+
+  if (hook) hook(*this, index, hook_arg);
+
+  out.timestamp = ticks;
+  out.temp = signal.temp;
+  out.gx   = signal.gx + signal.gyro_bias[0] + noise(signal.gyro_noise);
+  out.gy   = signal.gy + signal.gyro_bias[1] + noise(signal.gyro_noise);
+  out.gz   = signal.gz + signal.gyro_bias[2] + noise(signal.gyro_noise);
+  out.ax   = signal.ax + noise(signal.accel_noise);
+  out.ay   = signal.ay + noise(signal.accel_noise);
+  out.az   = signal.az + noise(signal.accel_noise);
+
+  uint32_t period = TICKS_PER_SEC / rate;
+  ticks    += period;
+  elapsed  += period;
+  due_ticks = elapsed;
+  index++;
+  return true;
+}
+
+/****************************************************************************
+ * poll / read
+ ****************************************************************************/
+int ImuHostDevice::poll(int timeout_ms)
+{
+  if (!opened) return -EBADF;
+  if (!enabled) return 0;
+
+  uint64_t due = 0;
+  while (pending_len < nfifos)
+    {
+      if (!next(pending[pending_len], due)) break;
+      pending_len++;
+    }
+  if (pending_len == 0) return 0;   // end of the replayed capture
+
+  if (realtime)
+    {
+      uint64_t due_ns   = start_ns + due * 1000000000ULL / TICKS_PER_SEC;
+      uint64_t limit_ns = now_ns() + (uint64_t)timeout_ms * 1000000ULL;
+      uint64_t wake_ns  = (due_ns < limit_ns) ? due_ns : limit_ns;
+
+      struct timespec ts;
+      ts.tv_sec  = wake_ns / 1000000000ULL;
+      ts.tv_nsec = wake_ns % 1000000000ULL;
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+
+      if (due_ns > limit_ns) return 0;
+    }
+
+  return 1;
+}
+
+ssize_t ImuHostDevice::read(void* buf, size_t len)
+{
+  if (!opened) return -EBADF;
+
+  size_t n = len / sizeof(cxd5602pwbimu_data_t);
+  if (n > (size_t)pending_len) n = pending_len;
+
+  memcpy(buf, pending, n * sizeof(cxd5602pwbimu_data_t));
+  memmove(pending, pending + n, (pending_len - n) * sizeof(cxd5602pwbimu_data_t));
+  pending_len -= n;
+
+  return n * sizeof(cxd5602pwbimu_data_t);
+}
+
+#endif // ARDUINO_ARCH_SPRESENSE
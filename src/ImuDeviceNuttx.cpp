@@ -0,0 +1,116 @@
+/*
+ *  ImuDeviceNuttx.cpp - CXD5602PWBIMU NuttX driver backend.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef ARDUINO_ARCH_SPRESENSE
+
+#include "ImuDevice.h"
+
+#include <arch/board/board.h>
+
+#include <nuttx/config.h>
+
+#include <sys/ioctl.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define CXD5602PWBIMU_DEVPATH      "/dev/imu0"
+
+/****************************************************************************
+ * open
+ ****************************************************************************/
+int ImuNuttxDevice::open()
+{
+  int ret = board_cxd5602pwbimu_initialize(5);
+  if (ret < 0)
+    {
+      return ret;
+    }
+
+  fd = ::open(CXD5602PWBIMU_DEVPATH, O_RDONLY);
+  if (fd < 0)
+    {
+      return -errno;
+    }
+
+  return 0;
+}
+
+/****************************************************************************
+ * close
+ ****************************************************************************/
+int ImuNuttxDevice::close()
+{
+  int ret = ::close(fd);
+  fd = -1;
+  return (ret < 0) ? -errno : 0;
+}
+
+/****************************************************************************
+ * configuration
+ ****************************************************************************/
+int ImuNuttxDevice::setRate(int hz)
+{
+  return ioctl(fd, SNIOC_SSAMPRATE, hz) ? -errno : 0;
+}
+
+int ImuNuttxDevice::setRange(int accel, int gyro)
+{
+  cxd5602pwbimu_range_t range;
+  range.accel = accel;
+  range.gyro  = gyro;
+  return ioctl(fd, SNIOC_SDRANGE, (unsigned long)(uintptr_t)&range) ? -errno : 0;
+}
+
+int ImuNuttxDevice::setFifoThreshold(int nfifos)
+{
+  return ioctl(fd, SNIOC_SFIFOTHRESH, nfifos) ? -errno : 0;
+}
+
+int ImuNuttxDevice::enable(bool on)
+{
+  return ioctl(fd, SNIOC_ENABLE, on ? 1 : 0) ? -errno : 0;
+}
+
+/****************************************************************************
+ * poll / read
+ ****************************************************************************/
+int ImuNuttxDevice::poll(int timeout_ms)
+{
+  struct pollfd fds;
+  fds.fd     = fd;
+  fds.events = POLLIN;
+
+  int ret = ::poll(&fds, 1, timeout_ms);
+  return (ret < 0) ? -errno : ret;
+}
+
+ssize_t ImuNuttxDevice::read(void* buf, size_t len)
+{
+  ssize_t ret = ::read(fd, buf, len);
+  return (ret < 0) ? -errno : ret;
+}
+
+#endif // ARDUINO_ARCH_SPRESENSE
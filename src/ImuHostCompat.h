@@ -0,0 +1,58 @@
+/*
+ *  ImuHostCompat.h - Definitions standing in for the Spresense SDK on a host.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _IMU_HOST_COMPAT_H_
+#define _IMU_HOST_COMPAT_H_
+
+#ifndef ARDUINO_ARCH_SPRESENSE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
+
+#ifndef PI
+#define PI 3.1415926535897932384626433832795
+#endif
+
+/**************************************************************************
+ * Structures (same layout as nuttx/sensors/cxd5602pwbimu.h)
+ **************************************************************************/
+
+typedef struct cxd5602pwbimu_data_s {
+  uint32_t timestamp;   // 19.2 MHz counter
+  float temp;
+  float gx;
+  float gy;
+  float gz;
+  float ax;
+  float ay;
+  float az;
+} cxd5602pwbimu_data_t;
+
+typedef struct cxd5602pwbimu_range_s {
+  int accel;
+  int gyro;
+} cxd5602pwbimu_range_t;
+
+#endif // ARDUINO_ARCH_SPRESENSE
+
+#endif // _IMU_HOST_COMPAT_H_
@@ -0,0 +1,198 @@
+/*
+ *  ImuKernels.h - Sample kernels templated on the numeric policy.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _IMU_KERNELS_H_
+#define _IMU_KERNELS_H_
+
+#include "SpresenseIMU.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define IMU_SMALL_ANGLE2     (1e-2f)  // (half angle)^2 below which the series is used
+#define IMU_RENORM_INTERVAL  (256)
+
+/**************************************************************************
+ * Kernels
+ *
+ *  T is float, double or ImuQ16 (ImuNumeric.h). Everything inside a loop
+ *  stays in T and its accumulator, so the float policy never calls the
+ *  soft double library on the Cortex-M4F and the Q16 policy never
+ *  touches the FPU, apart from the rare large-angle branch of the
+ *  quaternion update.
+ **************************************************************************/
+
+template<typename T>
+struct pwbQuaternionT {
+  T q0, q1, q2, q3;
+
+  pwbQuaternionT() : q0(ImuNumeric<T>::from(1.0f)), q1(), q2(), q3() {}
+
+  explicit pwbQuaternionT(const pwbQuaternionData& q)
+    : q0(ImuNumeric<T>::from(q.q0)), q1(ImuNumeric<T>::from(q.q1)),
+      q2(ImuNumeric<T>::from(q.q2)), q3(ImuNumeric<T>::from(q.q3)) {}
+
+  void to(pwbQuaternionData& q) const {
+    q.q0 = ImuNumeric<T>::toFloat(q0);
+    q.q1 = ImuNumeric<T>::toFloat(q1);
+    q.q2 = ImuNumeric<T>::toFloat(q2);
+    q.q3 = ImuNumeric<T>::toFloat(q3);
+  }
+};
+
+/****************************************************************************
+ * Average of n samples (timestamp of the last one)
+ ****************************************************************************/
+template<typename T>
+bool imuAverage(const pwbImuDataT<T>* in, size_t n, pwbImuDataT<T>& out)
+{
+  typedef ImuNumeric<T> N;
+  typename N::Acc s[7] = {};
+
+  if (n == 0) return false;
+
+  for (size_t i = 0; i < n; i++)
+    {
+      s[0] += N::acc(in[i].temp);
+      s[1] += N::acc(in[i].gx);
+      s[2] += N::acc(in[i].gy);
+      s[3] += N::acc(in[i].gz);
+      s[4] += N::acc(in[i].ax);
+      s[5] += N::acc(in[i].ay);
+      s[6] += N::acc(in[i].az);
+    }
+
+  out.timestamp = in[n - 1].timestamp;
+  out.temp = N::mean(s[0], n);
+  out.gx   = N::mean(s[1], n);
+  out.gy   = N::mean(s[2], n);
+  out.gz   = N::mean(s[3], n);
+  out.ax   = N::mean(s[4], n);
+  out.ay   = N::mean(s[5], n);
+  out.az   = N::mean(s[6], n);
+
+  return true;
+}
+
+/****************************************************************************
+ * Quaternion update: q = q * exp(w dt / 2) per sample
+ *
+ *   exp(w dt / 2) = (c, w s dt / 2), and q * (c, u) = q c + (q * (0, u)),
+ *   so the increment is (q * (0, w s)) dt / 2. It is formed in the
+ *   accumulator: in Q16.16 the half angle at 1920 Hz is only a few dozen
+ *   counts, and rounding it (or the increment) per sample drifts by
+ *   about a degree per minute. The rounding error of the new state is
+ *   fed back into the next step (residual(), zero for float / double).
+ ****************************************************************************/
+template<typename T>
+void imuIntegrateGyro(const pwbImuDataT<T>* in, size_t n, pwbQuaternionT<T>& q, float dt)
+{
+  typedef ImuNumeric<T> N;
+  typedef typename N::Acc A;
+
+  const typename N::Scale h  = N::scale(0.5f * dt);
+  const typename N::Scale h2 = N::scale(0.25f * dt * dt);
+  const T one    = N::from(1.0f);
+  const T k2     = N::from(0.5f);
+  const T k6     = N::from(1.0f / 6.0f);
+  const T k24    = N::from(1.0f / 24.0f);
+  const T k120   = N::from(1.0f / 120.0f);
+  const T small2 = N::from(IMU_SMALL_ANGLE2);
+  const T three2 = N::from(1.5f);
+
+  T q0 = q.q0, q1 = q.q1, q2 = q.q2, q3 = q.q3;
+  A e0 = A(), e1 = A(), e2 = A(), e3 = A();
+
+  for (size_t i = 0; i < n; i++)
+    {
+      T gx = in[i].gx;
+      T gy = in[i].gy;
+      T gz = in[i].gz;
+
+      /* Squared half angle and the exact rotation (c, v * s). */
+      T a2 = N::mul(N::fromProd(N::prod(gx, gx) + N::prod(gy, gy) + N::prod(gz, gz)), h2);
+      T c, s;
+
+      if (a2 < small2)
+        {
+          /* Truncation error < a^6/720, below float epsilon for |a| < 0.1. */
+          c = one - a2 * (k2 - a2 * k24);
+          s = one - a2 * (k6 - a2 * k120);
+          gx = gx * s; gy = gy * s; gz = gz * s;
+        }
+      else
+        {
+          float a = sqrtf(N::toFloat(a2));
+          c = N::from(cosf(a));
+          s = N::from(sinf(a) / a);
+          gx = gx * s; gy = gy * s; gz = gz * s;
+        }
+
+      /* q * (0, w s), scaled by dt / 2 in the accumulator */
+      A d0 = N::mulAcc(N::fromProd(- N::prod(q1, gx) - N::prod(q2, gy) - N::prod(q3, gz)), h);
+      A d1 = N::mulAcc(N::fromProd(  N::prod(q0, gx) + N::prod(q2, gz) - N::prod(q3, gy)), h);
+      A d2 = N::mulAcc(N::fromProd(  N::prod(q0, gy) - N::prod(q1, gz) + N::prod(q3, gx)), h);
+      A d3 = N::mulAcc(N::fromProd(  N::prod(q0, gz) + N::prod(q1, gy) - N::prod(q2, gx)), h);
+
+      A r0 = N::prod(q0, c) + d0 - e0;
+      A r1 = N::prod(q1, c) + d1 - e1;
+      A r2 = N::prod(q2, c) + d2 - e2;
+      A r3 = N::prod(q3, c) + d3 - e3;
+
+      q0 = N::fromProd(r0); e0 = N::residual(r0, q0);
+      q1 = N::fromProd(r1); e1 = N::residual(r1, q1);
+      q2 = N::fromProd(r2); e2 = N::residual(r2, q2);
+      q3 = N::fromProd(r3); e3 = N::residual(r3, q3);
+
+      if ((i % IMU_RENORM_INTERVAL) == IMU_RENORM_INTERVAL - 1)
+        {
+          T k = three2 - k2 * N::fromProd(N::prod(q0, q0) + N::prod(q1, q1) + N::prod(q2, q2) + N::prod(q3, q3));
+          q0 = q0 * k; q1 = q1 * k; q2 = q2 * k; q3 = q3 * k;
+        }
+    }
+
+  /* First-order renormalization; the norm only drifts by rounding. */
+  T k = three2 - k2 * N::fromProd(N::prod(q0, q0) + N::prod(q1, q1) + N::prod(q2, q2) + N::prod(q3, q3));
+  q.q0 = q0 * k;
+  q.q1 = q1 * k;
+  q.q2 = q2 * k;
+  q.q3 = q3 * k;
+}
+
+/****************************************************************************
+ * FIR dot product over n samples (the 6 axes, gx..az)
+ ****************************************************************************/
+template<typename T>
+void imuFirDot(const T* h, const pwbImuDataT<T>* x, int n, typename ImuNumeric<T>::Acc acc[6])
+{
+  typedef ImuNumeric<T> N;
+
+  for (int k = 0; k < n; k++)
+    {
+      acc[0] += N::prod(h[k], x[k].gx);
+      acc[1] += N::prod(h[k], x[k].gy);
+      acc[2] += N::prod(h[k], x[k].gz);
+      acc[3] += N::prod(h[k], x[k].ax);
+      acc[4] += N::prod(h[k], x[k].ay);
+      acc[5] += N::prod(h[k], x[k].az);
+    }
+}
+
+#endif // _IMU_KERNELS_H_
@@ -0,0 +1,464 @@
+/*
+ *  ImuLog.cpp - Indexed binary log format for IMU captures.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "ImuLog.h"
+#include "SpresenseIMU.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define DEG2RAD     ((float)M_PI / 180.0f)
+#define TEMP_LSB    (0.01f)
+
+static_assert(sizeof(ImuLogHeader)      == 64, "ImuLogHeader layout");
+static_assert(sizeof(ImuLogBlockHeader) == 16, "ImuLogBlockHeader layout");
+static_assert(sizeof(ImuLogPacked16)    == 16, "ImuLogPacked16 layout");
+static_assert(sizeof(ImuLogIndexEntry)  == 16, "ImuLogIndexEntry layout");
+static_assert(sizeof(ImuLogTrailer)     == 16, "ImuLogTrailer layout");
+
+static int16_t quantize(float v, float lsb)
+{
+  float q = v / lsb;
+  if (q >  32767.0f) return  32767;
+  if (q < -32767.0f) return -32767;
+  return (int16_t)lrintf(q);
+}
+
+static size_t payload_size(int encoding, uint32_t count)
+{
+  if (count == 0) return 0;
+  if (encoding == IMU_LOG_PACKED16)
+    {
+      return sizeof(cxd5602pwbimu_data_t) + (count - 1) * sizeof(ImuLogPacked16);
+    }
+  return count * sizeof(cxd5602pwbimu_data_t);
+}
+
+/****************************************************************************
+ * Writer
+ ****************************************************************************/
+ImuLogWriter::ImuLogWriter()
+  : stream(NULL), block(NULL), block_len(0), block_count(0), prev_ts(0),
+    ticks(0), period(0), index(NULL), entries(0), max_entries(0), blocks(0), stride(1),
+    offset(0), total(0)
+{
+}
+
+ImuLogWriter::~ImuLogWriter()
+{
+  free(block);
+  free(index);
+}
+
+bool ImuLogWriter::put(const void* buf, size_t len)
+{
+  if (stream->write(buf, len) != len)
+    {
+      printf("ERROR: log write failed.\n");
+      return false;
+    }
+  offset += len;
+  return true;
+}
+
+bool ImuLogWriter::begin(ImuLogStream& out, const ImuLogConfig& config)
+{
+  free(block);
+  free(index);
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, IMU_LOG_MAGIC, 4);
+  header.version         = IMU_LOG_VERSION;
+  header.header_size     = sizeof(ImuLogHeader);
+  header.sample_size     = sizeof(cxd5602pwbimu_data_t);
+  header.encoding        = config.encoding;
+  header.rate            = config.rate;
+  header.adrange         = config.adrange;
+  header.gdrange         = config.gdrange;
+  header.nfifos          = config.nfifos;
+  header.block_samples   = config.block_samples;
+  header.gyro_bias[0]    = config.gyro_bias[0];
+  header.gyro_bias[1]    = config.gyro_bias[1];
+  header.gyro_bias[2]    = config.gyro_bias[2];
+  header.accel_lsb       = config.adrange * IMU_GRAVITY / 32767.0f;
+  header.gyro_lsb        = config.gdrange * DEG2RAD / 32767.0f;
+  header.temp_lsb        = TEMP_LSB;
+
+  stream      = &out;
+  period      = IMU_LOG_TICKS_PER_SEC / (config.rate > 0 ? config.rate : 1);
+  block_len   = 0;
+  block_count = 0;
+  ticks       = 0;
+  entries     = 0;
+  blocks      = 0;
+  stride      = 1;
+  offset      = 0;
+  total       = 0;
+  max_entries = config.max_blocks > 0 ? config.max_blocks : 1;
+
+  block = (uint8_t*)malloc(sizeof(ImuLogBlockHeader) +
+                           payload_size(config.encoding, config.block_samples));
+  index = (ImuLogIndexEntry*)malloc(sizeof(ImuLogIndexEntry) * max_entries);
+  if (block == NULL || index == NULL)
+    {
+      printf("ERROR: log buffer allocation failed.\n");
+      return false;
+    }
+
+  return put(&header, sizeof(header));
+}
+
+bool ImuLogWriter::packable(const cxd5602pwbimu_data_t& s) const
+{
+  int32_t dt = (int32_t)((uint32_t)(s.timestamp - prev_ts) - period);
+  if (dt < -32768 || dt > 32767) return false;
+  return fabsf(s.temp) < 32767.0f * TEMP_LSB;
+}
+
+void ImuLogWriter::pack(const cxd5602pwbimu_data_t& s, ImuLogPacked16& out) const
+{
+  out.dt   = (int16_t)((uint32_t)(s.timestamp - prev_ts) - period);
+  out.temp = quantize(s.temp, header.temp_lsb);
+  out.gx   = quantize(s.gx, header.gyro_lsb);
+  out.gy   = quantize(s.gy, header.gyro_lsb);
+  out.gz   = quantize(s.gz, header.gyro_lsb);
+  out.ax   = quantize(s.ax, header.accel_lsb);
+  out.ay   = quantize(s.ay, header.accel_lsb);
+  out.az   = quantize(s.az, header.accel_lsb);
+}
+
+bool ImuLogWriter::write(const cxd5602pwbimu_data_t* samples, size_t n)
+{
+  if (stream == NULL) return false;
+
+  for (size_t i = 0; i < n; i++)
+    {
+      const cxd5602pwbimu_data_t& s = samples[i];
+
+      if (total > 0)
+        {
+          ticks += (uint32_t)(s.timestamp - prev_ts);
+        }
+
+      if (block_count > 0 && header.encoding == IMU_LOG_PACKED16 && !packable(s))
+        {
+          if (!flushBlock()) return false;
+        }
+
+      if (block_count == 0)
+        {
+          /* Every block starts with a raw sample; every stride-th one
+           * gets an index entry. A full index keeps every other entry
+           * and doubles the stride. */
+          if (blocks % stride == 0)
+            {
+              if (entries >= max_entries)
+                {
+                  for (uint32_t k = 1; 2 * k < entries; k++) index[k] = index[2 * k];
+                  entries = (entries + 1) / 2;
+                  stride *= 2;
+                }
+              if (blocks % stride == 0)
+                {
+                  index[entries].ticks  = ticks;
+                  index[entries].offset = offset;
+                  index[entries].sample = total;
+                  entries++;
+                }
+            }
+          blocks++;
+
+          ImuLogBlockHeader* bh = (ImuLogBlockHeader*)block;
+          bh->sync            = IMU_LOG_BLOCK_SYNC;
+          bh->first_timestamp = s.timestamp;
+          bh->encoding        = header.encoding;
+          memcpy(block + sizeof(ImuLogBlockHeader), &s, sizeof(s));
+          block_len = sizeof(ImuLogBlockHeader) + sizeof(s);
+        }
+      else if (header.encoding == IMU_LOG_PACKED16)
+        {
+          pack(s, *(ImuLogPacked16*)(block + block_len));
+          block_len += sizeof(ImuLogPacked16);
+        }
+      else
+        {
+          memcpy(block + block_len, &s, sizeof(s));
+          block_len += sizeof(s);
+        }
+
+      prev_ts = s.timestamp;
+      block_count++;
+      total++;
+
+      if (block_count >= header.block_samples)
+        {
+          if (!flushBlock()) return false;
+        }
+    }
+
+  return true;
+}
+
+bool ImuLogWriter::flushBlock()
+{
+  if (block_count == 0) return true;
+
+  ImuLogBlockHeader* bh = (ImuLogBlockHeader*)block;
+  bh->count         = block_count;
+  bh->payload_bytes = block_len - sizeof(ImuLogBlockHeader);
+
+  block_count = 0;
+  return put(block, block_len);
+}
+
+bool ImuLogWriter::end()
+{
+  if (stream == NULL) return false;
+
+  bool ok = flushBlock();
+
+  ImuLogTrailer trailer;
+  trailer.sync          = IMU_LOG_TRAILER_SYNC;
+  trailer.entries       = entries;
+  trailer.index_offset  = offset;
+  trailer.total_samples = total;
+
+  ok = ok && put(index, sizeof(ImuLogIndexEntry) * entries);
+  ok = ok && put(&trailer, sizeof(trailer));
+
+  stream = NULL;
+  return ok;
+}
+
+/****************************************************************************
+ * Reader
+ ****************************************************************************/
+ImuLogReader::ImuLogReader()
+  : fp(NULL), legacy(false), index(NULL), entries(0), samples(NULL),
+    count(0), pos(0), payload(NULL), period(0)
+{
+  memset(&header, 0, sizeof(header));
+}
+
+ImuLogReader::~ImuLogReader()
+{
+  close();
+}
+
+void ImuLogReader::close()
+{
+  if (fp) fclose(fp);
+  fp = NULL;
+  free(index);
+  free(samples);
+  free(payload);
+  index   = NULL;
+  samples = NULL;
+  payload = NULL;
+  entries = count = pos = 0;
+}
+
+bool ImuLogReader::open(const char* path)
+{
+  close();
+
+  fp = fopen(path, "rb");
+  if (fp == NULL)
+    {
+      printf("ERROR: log %s open failure.\n", path);
+      return false;
+    }
+
+  legacy = (fread(&header, sizeof(header), 1, fp) != 1) ||
+           (memcmp(header.magic, IMU_LOG_MAGIC, 4) != 0);
+
+  if (legacy)
+    {
+      memset(&header, 0, sizeof(header));
+      header.sample_size   = sizeof(cxd5602pwbimu_data_t);
+      header.block_samples = 256;
+      fseek(fp, 0, SEEK_SET);
+    }
+  else
+    {
+      period = IMU_LOG_TICKS_PER_SEC / (header.rate ? header.rate : 1);
+
+      /* The header goes out before the first sample: take the start
+       * from the first block. */
+      ImuLogBlockHeader first;
+      fseek(fp, header.header_size, SEEK_SET);
+      if (fread(&first, sizeof(first), 1, fp) == 1 && first.sync == IMU_LOG_BLOCK_SYNC)
+        {
+          header.start_timestamp = first.first_timestamp;
+        }
+      fseek(fp, header.header_size, SEEK_SET);
+    }
+
+  samples = (cxd5602pwbimu_data_t*)malloc(sizeof(cxd5602pwbimu_data_t) * header.block_samples);
+  payload = (uint8_t*)malloc(payload_size(IMU_LOG_RAW, header.block_samples));
+  if (samples == NULL || payload == NULL) return false;
+
+  if (!legacy)
+    {
+      long body = ftell(fp);
+      ImuLogTrailer trailer;
+      if (fseek(fp, -(long)sizeof(trailer), SEEK_END) == 0 &&
+          fread(&trailer, sizeof(trailer), 1, fp) == 1 &&
+          trailer.sync == IMU_LOG_TRAILER_SYNC)
+        {
+          index = (ImuLogIndexEntry*)malloc(sizeof(ImuLogIndexEntry) * trailer.entries);
+          if (index && fseek(fp, trailer.index_offset, SEEK_SET) == 0 &&
+              fread(index, sizeof(ImuLogIndexEntry), trailer.entries, fp) == trailer.entries)
+            {
+              entries = trailer.entries;
+            }
+        }
+      fseek(fp, body, SEEK_SET);
+    }
+
+  return true;
+}
+
+void ImuLogReader::unpack(const ImuLogPacked16& in, cxd5602pwbimu_data_t& out)
+{
+  out.timestamp = out.timestamp + period + in.dt;
+  out.temp = in.temp * header.temp_lsb;
+  out.gx   = in.gx * header.gyro_lsb;
+  out.gy   = in.gy * header.gyro_lsb;
+  out.gz   = in.gz * header.gyro_lsb;
+  out.ax   = in.ax * header.accel_lsb;
+  out.ay   = in.ay * header.accel_lsb;
+  out.az   = in.az * header.accel_lsb;
+}
+
+bool ImuLogReader::loadBlock()
+{
+  count = pos = 0;
+
+  if (legacy)
+    {
+      count = fread(samples, sizeof(cxd5602pwbimu_data_t), header.block_samples, fp);
+      return count > 0;
+    }
+
+  ImuLogBlockHeader bh;
+  if (fread(&bh, sizeof(bh), 1, fp) != 1 || bh.sync != IMU_LOG_BLOCK_SYNC) return false;
+  if (bh.count == 0 || bh.count > header.block_samples) return false;
+  if (bh.payload_bytes != payload_size(bh.encoding, bh.count)) return false;
+  if (fread(payload, 1, bh.payload_bytes, fp) != bh.payload_bytes) return false;
+
+  memcpy(&samples[0], payload, sizeof(cxd5602pwbimu_data_t));
+  if (bh.encoding == IMU_LOG_PACKED16)
+    {
+      const ImuLogPacked16* p =
+        (const ImuLogPacked16*)(payload + sizeof(cxd5602pwbimu_data_t));
+      for (uint32_t i = 1; i < bh.count; i++)
+        {
+          samples[i].timestamp = samples[i - 1].timestamp;
+          unpack(p[i - 1], samples[i]);
+        }
+    }
+  else
+    {
+      memcpy(&samples[1], payload + sizeof(cxd5602pwbimu_data_t),
+             (bh.count - 1) * sizeof(cxd5602pwbimu_data_t));
+    }
+
+  count = bh.count;
+  return true;
+}
+
+size_t ImuLogReader::read(cxd5602pwbimu_data_t* dst, size_t max)
+{
+  size_t n = 0;
+  if (fp == NULL) return 0;
+
+  while (n < max)
+    {
+      if (pos >= count && !loadBlock()) break;
+      while (pos < count && n < max) dst[n++] = samples[pos++];
+    }
+
+  return n;
+}
+
+bool ImuLogReader::seek(double seconds)
+{
+  if (fp == NULL) return false;
+
+  uint64_t target = (uint64_t)(seconds * IMU_LOG_TICKS_PER_SEC);
+  uint64_t ticks  = 0;      // unwrapped time of last_ts
+  uint32_t last_ts = 0;
+  bool     have_last = false;
+
+  fseek(fp, legacy ? 0 : header.header_size, SEEK_SET);
+  count = pos = 0;
+
+  if (entries > 0)
+    {
+      /* Last indexed block starting at or before the target. */
+      uint32_t lo = 0, hi = entries;
+      while (hi - lo > 1)
+        {
+          uint32_t mid = (lo + hi) / 2;
+          if (index[mid].ticks <= target) lo = mid; else hi = mid;
+        }
+      fseek(fp, index[lo].offset, SEEK_SET);
+      ticks = index[lo].ticks;
+    }
+  else if (!legacy)
+    {
+      /* No index (unclosed file): hop over the block headers. */
+      ImuLogBlockHeader bh;
+      long     at    = ftell(fp);
+      uint64_t t     = 0;
+      uint32_t first = 0;
+      bool     found = false;
+      while (fread(&bh, sizeof(bh), 1, fp) == 1 && bh.sync == IMU_LOG_BLOCK_SYNC)
+        {
+          if (found) t += (uint32_t)(bh.first_timestamp - first);
+          if (found && t > target) break;
+          ticks = t;
+          first = bh.first_timestamp;
+          found = true;
+          at    = ftell(fp) - sizeof(bh);
+          fseek(fp, bh.payload_bytes, SEEK_CUR);
+        }
+      fseek(fp, at, SEEK_SET);
+    }
+
+  /* Step through the samples from there. */
+  while (loadBlock())
+    {
+      for (pos = 0; pos < count; pos++)
+        {
+          if (have_last) ticks += (uint32_t)(samples[pos].timestamp - last_ts);
+          last_ts   = samples[pos].timestamp;
+          have_last = true;
+          if (ticks >= target) return true;
+        }
+    }
+
+  return false;
+}
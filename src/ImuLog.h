@@ -0,0 +1,248 @@
+/*
+ *  ImuLog.h - Indexed binary log format for IMU captures.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _IMU_LOG_H_
+#define _IMU_LOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef ARDUINO_ARCH_SPRESENSE
+#include <nuttx/sensors/cxd5602pwbimu.h>
+#else
+#include "ImuHostCompat.h"
+#endif
+
+/****************************************************************************
+ * File layout (little endian)
+ *
+ *   ImuLogHeader                          64 bytes
+ *   { ImuLogBlockHeader + payload } ...   one block per `block_samples`
+ *   ImuLogIndexEntry[entries]             one per block, or per 2^k blocks
+ *   ImuLogTrailer                         16 bytes
+ *
+ * Payload encodings:
+ *   IMU_LOG_RAW      : count * cxd5602pwbimu_data_t
+ *   IMU_LOG_PACKED16 : first sample raw, then (count - 1) * ImuLogPacked16.
+ *                      dt is stored as the deviation from the nominal
+ *                      period; a block is closed early when it does not
+ *                      fit. Axes are int16 scaled to the configured range.
+ *
+ * The index and trailer are written on close. A file cut short by a power
+ * loss can still be read by walking the block headers. When a recording
+ * outgrows `max_blocks`, every other entry is dropped and the stride
+ * between indexed blocks doubles, so the index still covers the whole
+ * file and a seek steps over at most stride - 1 blocks.
+ ****************************************************************************/
+
+#define IMU_LOG_MAGIC          "SIMU"
+#define IMU_LOG_VERSION        (1)
+#define IMU_LOG_BLOCK_SYNC     (0x4B4C4253)   // "SBLK"
+#define IMU_LOG_TRAILER_SYNC   (0x58444953)   // "SIDX"
+
+#define IMU_LOG_RAW            (0)
+#define IMU_LOG_PACKED16       (1)
+
+#define IMU_LOG_TICKS_PER_SEC  (19200000)
+
+/**************************************************************************
+ * Structures
+ **************************************************************************/
+
+struct __attribute__((packed)) ImuLogHeader {
+  char     magic[4];
+  uint16_t version;
+  uint16_t header_size;
+  uint16_t sample_size;       // sizeof(cxd5602pwbimu_data_t)
+  uint8_t  encoding;
+  uint8_t  reserved0;
+  uint16_t rate;              // Hz
+  uint16_t adrange;           // G
+  uint16_t gdrange;           // dps
+  uint16_t nfifos;
+  uint32_t block_samples;
+  float    gyro_bias[3];      // rad/s, already estimated by the recorder
+  float    accel_lsb;         // m/s^2 per count (packed16)
+  float    gyro_lsb;          // rad/s per count (packed16)
+  float    temp_lsb;          // degC per count  (packed16)
+  uint32_t start_timestamp;   // 0 in the file (written before the first
+                              // sample); ImuLogReader::info() fills it in
+                              // from the first block header
+  uint8_t  reserved1[12];
+};
+
+struct __attribute__((packed)) ImuLogBlockHeader {
+  uint32_t sync;
+  uint32_t first_timestamp;
+  uint16_t count;
+  uint16_t encoding;
+  uint32_t payload_bytes;
+};
+
+struct __attribute__((packed)) ImuLogPacked16 {
+  int16_t dt;                 // ticks minus the nominal period
+  int16_t temp;
+  int16_t gx, gy, gz;
+  int16_t ax, ay, az;
+};
+
+struct __attribute__((packed)) ImuLogIndexEntry {
+  uint64_t ticks;             // unwrapped ticks of the first sample since start
+  uint32_t offset;            // file offset of the block header
+  uint32_t sample;            // index of the first sample
+};
+
+struct __attribute__((packed)) ImuLogTrailer {
+  uint32_t sync;
+  uint32_t entries;
+  uint32_t index_offset;
+  uint32_t total_samples;
+};
+
+struct ImuLogConfig {
+  int      rate;
+  int      adrange;
+  int      gdrange;
+  int      nfifos;
+  int      encoding;
+  uint32_t block_samples;
+  uint32_t max_blocks;        // index capacity held in RAM
+  float    gyro_bias[3];
+
+  ImuLogConfig()
+    : rate(1920), adrange(4), gdrange(500), nfifos(1),
+      encoding(IMU_LOG_RAW), block_samples(480), max_blocks(1024)
+  {
+    gyro_bias[0] = gyro_bias[1] = gyro_bias[2] = 0;
+  }
+};
+
+/**************************************************************************
+ * Output stream
+ **************************************************************************/
+
+class ImuLogStream {
+
+public:
+  virtual ~ImuLogStream() {}
+  virtual size_t write(const void* buf, size_t len) = 0;
+};
+
+// stdio / NuttX file.
+class ImuLogFileStream : public ImuLogStream {
+
+public:
+  explicit ImuLogFileStream(FILE* f) : fp(f) {}
+  size_t write(const void* buf, size_t len) { return fwrite(buf, 1, len, fp); }
+
+private:
+  FILE* fp;
+};
+
+// Any object with write(const uint8_t*, size_t), e.g. the SDHCI File.
+template <class F>
+class ImuLogStreamAdapter : public ImuLogStream {
+
+public:
+  explicit ImuLogStreamAdapter(F& f) : file(f) {}
+  size_t write(const void* buf, size_t len) { return file.write((const uint8_t*)buf, len); }
+
+private:
+  F& file;
+};
+
+/**************************************************************************
+ * Writer
+ **************************************************************************/
+
+class ImuLogWriter {
+
+public:
+  ImuLogWriter();
+  ~ImuLogWriter();
+
+  bool begin(ImuLogStream& out, const ImuLogConfig& config);
+  bool write(const cxd5602pwbimu_data_t* samples, size_t n);
+  bool end();
+
+  uint32_t bytesWritten() const { return offset; }
+  uint32_t samplesWritten() const { return total; }
+
+private:
+  bool flushBlock();
+  bool put(const void* buf, size_t len);
+  bool packable(const cxd5602pwbimu_data_t& s) const;
+  void pack(const cxd5602pwbimu_data_t& s, ImuLogPacked16& out) const;
+
+  ImuLogStream*     stream;
+  ImuLogHeader      header;
+  uint8_t*          block;       // block header + payload being built
+  size_t            block_len;
+  uint32_t          block_count;
+  uint32_t          prev_ts;
+  uint64_t          ticks;       // unwrapped time of the last sample
+  uint32_t          period;      // nominal ticks between samples
+  ImuLogIndexEntry* index;
+  uint32_t          entries;
+  uint32_t          max_entries;
+  uint32_t          blocks;      // blocks started
+  uint32_t          stride;      // index every stride-th block (power of 2)
+  uint32_t          offset;
+  uint32_t          total;
+};
+
+/**************************************************************************
+ * Reader
+ **************************************************************************/
+
+class ImuLogReader {
+
+public:
+  ImuLogReader();
+  ~ImuLogReader();
+
+  // Also accepts legacy headerless captures (bare cxd5602pwbimu_data_t).
+  bool open(const char* path);
+  void close();
+
+  bool isLegacy() const { return legacy; }
+  const ImuLogHeader& info() const { return header; }
+
+  // Position at the first sample at or after `seconds` from the start.
+  bool seek(double seconds);
+  size_t read(cxd5602pwbimu_data_t* dst, size_t max);
+
+private:
+  bool loadBlock();
+  void unpack(const ImuLogPacked16& in, cxd5602pwbimu_data_t& out);
+
+  FILE*             fp;
+  bool              legacy;
+  ImuLogHeader      header;
+  ImuLogIndexEntry* index;
+  uint32_t          entries;
+  cxd5602pwbimu_data_t* samples;   // decoded current block
+  uint32_t          count;
+  uint32_t          pos;
+  uint8_t*          payload;
+  uint32_t          period;
+};
+
+#endif // _IMU_LOG_H_
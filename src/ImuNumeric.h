@@ -0,0 +1,275 @@
+/*
+ *  ImuNumeric.h - Numeric policies (float / double / Q16.16) for samples.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _IMU_NUMERIC_H_
+#define _IMU_NUMERIC_H_
+
+#ifdef ARDUINO_ARCH_SPRESENSE
+#include <Arduino.h>
+#include <nuttx/sensors/cxd5602pwbimu.h>
+#else
+#include "ImuHostCompat.h"
+#endif
+#include <stdint.h>
+#include <math.h>
+
+/**************************************************************************
+ * ImuQ16 (Q16.16 fixed point)
+ *
+ *  Range +-32768, resolution 1.5e-5. Products and quotients go through
+ *  64 bits and are rounded; nothing saturates except a division by
+ *  zero, which gives the largest value of the dividend's sign (0 for 0).
+ *  The Cortex-M4F has a single precision FPU only, so this is the policy for cores or builds
+ *  that keep the FPU off, and for data stored as integers.
+ **************************************************************************/
+
+class ImuQ16 {
+
+public:
+  ImuQ16() : v(0) {}
+  explicit ImuQ16(float f) : v((int32_t)lrintf(f * 65536.0f)) {}
+  explicit ImuQ16(int i) : v(i * 65536) {}
+
+  static ImuQ16 fromRaw(int32_t r) { ImuQ16 q; q.v = r; return q; }
+  int32_t raw() const { return v; }
+  float toFloat() const { return v * (1.0f / 65536.0f); }
+
+  ImuQ16 operator-() const { return fromRaw(-v); }
+
+  ImuQ16& operator+=(ImuQ16 o) { v += o.v; return *this; }
+  ImuQ16& operator-=(ImuQ16 o) { v -= o.v; return *this; }
+  ImuQ16& operator*=(ImuQ16 o) { v = (int32_t)(((int64_t)v * o.v + 0x8000) >> 16); return *this; }
+  ImuQ16& operator/=(ImuQ16 o) { v = o.v ? (int32_t)(((int64_t)v * 65536) / o.v) : divZero(v); return *this; }
+  ImuQ16& operator/=(int i)    { v = i ? v / i : divZero(v); return *this; }
+
+  friend ImuQ16 operator+(ImuQ16 a, ImuQ16 b) { return a += b; }
+  friend ImuQ16 operator-(ImuQ16 a, ImuQ16 b) { return a -= b; }
+  friend ImuQ16 operator*(ImuQ16 a, ImuQ16 b) { return a *= b; }
+  friend ImuQ16 operator/(ImuQ16 a, ImuQ16 b) { return a /= b; }
+
+  friend bool operator<(ImuQ16 a, ImuQ16 b)  { return a.v <  b.v; }
+  friend bool operator>(ImuQ16 a, ImuQ16 b)  { return a.v >  b.v; }
+  friend bool operator<=(ImuQ16 a, ImuQ16 b) { return a.v <= b.v; }
+  friend bool operator>=(ImuQ16 a, ImuQ16 b) { return a.v >= b.v; }
+  friend bool operator==(ImuQ16 a, ImuQ16 b) { return a.v == b.v; }
+  friend bool operator!=(ImuQ16 a, ImuQ16 b) { return a.v != b.v; }
+
+private:
+  static int32_t divZero(int32_t n) { return n > 0 ? INT32_MAX : n < 0 ? INT32_MIN : 0; }
+
+  int32_t v;
+};
+
+/**************************************************************************
+ * ImuNumeric<T>
+ *
+ *  What the kernels need from a number type:
+ *    from / toFloat / toDouble : conversions (toDouble is for printing
+ *                                and for once-per-result folding)
+ *    Acc                       : accumulator for sums and products.
+ *                                Q16 uses int64 so that sums of many
+ *                                samples and squares of small values
+ *                                keep their resolution.
+ *    acc / accSq / prod        : value, square, product as Acc
+ *    fromAcc / fromProd        : back to T (a sum, or a sum of products)
+ *    sumOf / sumSqOf           : Acc holding acc() / accSq() terms as double
+ *    Scale / scale / mul       : multiplication by a constant known only at
+ *                                run time (dt / 2, ...) at full precision;
+ *                                scale() is called once per batch
+ *    mulAcc                    : the same, result as Acc (a small increment
+ *                                that keeps its sub-LSB bits)
+ *    residual                  : rounding error of fromProd(a) as Acc, for
+ *                                error feedback; a constant 0 for float and
+ *                                double so that it compiles away
+ **************************************************************************/
+
+template<typename T> struct ImuNumeric;
+
+template<> struct ImuNumeric<float> {
+  typedef float Acc;
+
+  static const char* name() { return "float"; }
+
+  static float  from(float f)        { return f; }
+  static float  toFloat(float v)     { return v; }
+  static double toDouble(float v)    { return v; }
+  static float  sqrt(float v)        { return sqrtf(v); }
+
+  static Acc    acc(float v)         { return v; }
+  static Acc    accSq(float v)       { return v * v; }
+  static Acc    prod(float a, float b) { return a * b; }
+  static float  fromAcc(Acc a)       { return a; }
+  static float  fromProd(Acc a)      { return a; }
+  static float  mean(Acc a, int n)   { return a / n; }
+  static double sumOf(Acc a)         { return a; }
+  static double sumSqOf(Acc a)       { return a; }
+
+  typedef float Scale;
+  static Scale  scale(float k)       { return k; }
+  static float  mul(float v, Scale k) { return v * k; }
+  static Acc    mulAcc(float v, Scale k) { return v * k; }
+  static Acc    residual(Acc, float) { return 0.0f; }
+};
+
+template<> struct ImuNumeric<double> {
+  typedef double Acc;
+
+  static const char* name() { return "double"; }
+
+  static double from(float f)        { return f; }
+  static float  toFloat(double v)    { return (float)v; }
+  static double toDouble(double v)   { return v; }
+  static double sqrt(double v)       { return ::sqrt(v); }
+
+  static Acc    acc(double v)        { return v; }
+  static Acc    accSq(double v)      { return v * v; }
+  static Acc    prod(double a, double b) { return a * b; }
+  static double fromAcc(Acc a)       { return a; }
+  static double fromProd(Acc a)      { return a; }
+  static double mean(Acc a, int n)   { return a / n; }
+  static double sumOf(Acc a)         { return a; }
+  static double sumSqOf(Acc a)       { return a; }
+
+  typedef double Scale;
+  static Scale  scale(float k)       { return k; }
+  static double mul(double v, Scale k) { return v * k; }
+  static Acc    mulAcc(double v, Scale k) { return v * k; }
+  static Acc    residual(Acc, double) { return 0.0; }
+};
+
+template<> struct ImuNumeric<ImuQ16> {
+  typedef int64_t Acc;                 // Q32.32 for products and squares
+
+  static const char* name() { return "Q16.16"; }
+
+  static ImuQ16 from(float f)        { return ImuQ16(f); }
+  static float  toFloat(ImuQ16 v)    { return v.toFloat(); }
+  static double toDouble(ImuQ16 v)   { return v.raw() * (1.0 / 65536.0); }
+
+  static ImuQ16 sqrt(ImuQ16 v)
+  {
+    /* Integer square root of raw << 16 (bit by bit, 24 iterations). */
+    if (v.raw() <= 0) return ImuQ16();
+    uint64_t x = (uint64_t)v.raw() << 16;
+    uint64_t r = 0;
+    uint64_t b = (uint64_t)1 << 46;
+    while (b > x) b >>= 2;
+    while (b != 0)
+      {
+        if (x >= r + b) { x -= r + b; r = (r >> 1) + b; }
+        else            { r >>= 1; }
+        b >>= 2;
+      }
+    return ImuQ16::fromRaw((int32_t)r);
+  }
+
+  static Acc    acc(ImuQ16 v)        { return v.raw(); }
+  static Acc    accSq(ImuQ16 v)      { return (int64_t)v.raw() * v.raw(); }
+  static Acc    prod(ImuQ16 a, ImuQ16 b) { return (int64_t)a.raw() * b.raw(); }
+  static ImuQ16 fromAcc(Acc a)       { return ImuQ16::fromRaw((int32_t)a); }
+  static ImuQ16 fromProd(Acc a)      { return ImuQ16::fromRaw((int32_t)((a + 0x8000) >> 16)); }
+  static ImuQ16 mean(Acc a, int n)   { return ImuQ16::fromRaw((int32_t)((a + (a < 0 ? -n / 2 : n / 2)) / n)); }
+  static double sumOf(Acc a)         { return a * (1.0 / 65536.0); }
+  static double sumSqOf(Acc a)       { return a * (1.0 / 4294967296.0); }
+
+  // k = m * 2^-shift with m normalized to 30 bits: dt / 2 at 1920 Hz is
+  // only 17 counts in Q16.16, a 0.4 % scale error if it were rounded.
+  struct Scale { int32_t m; int shift; };
+
+  static Scale scale(float k)
+  {
+    int   e;
+    float f = frexpf(k, &e);
+    Scale s;
+    s.m     = (int32_t)lrintf(f * 1073741824.0f);
+    s.shift = 30 - e;
+    return s;
+  }
+
+  static ImuQ16 mul(ImuQ16 v, Scale s)
+  {
+    int64_t p = (int64_t)v.raw() * s.m;
+    if (s.shift <= 0) return ImuQ16::fromRaw((int32_t)(p << -s.shift));
+    if (s.shift >= 63) return ImuQ16();
+    return ImuQ16::fromRaw((int32_t)((p + ((int64_t)1 << (s.shift - 1))) >> s.shift));
+  }
+
+  static Acc mulAcc(ImuQ16 v, Scale s)
+  {
+    int64_t p = (int64_t)v.raw() * s.m;
+    int     k = s.shift - 16;
+    if (k <= 0) return p << -k;
+    if (k >= 63) return 0;
+    return (p + ((int64_t)1 << (k - 1))) >> k;
+  }
+
+  // fromProd(a) - a, in Acc units
+  static Acc residual(Acc a, ImuQ16 r) { return ((int64_t)r.raw() << 16) - a; }
+};
+
+/**************************************************************************
+ * pwbImuDataT<T>
+ *
+ *  A sample with the axes in the policy type. pwbImuDataT<float> has the
+ *  driver layout, so driver buffers can be used in place (imuSamples()).
+ **************************************************************************/
+
+template<typename T>
+struct pwbImuDataT {
+  uint32_t timestamp;
+  T temp;
+  T gx, gy, gz;
+  T ax, ay, az;
+
+  pwbImuDataT() : timestamp(0), temp(), gx(), gy(), gz(), ax(), ay(), az() {}
+
+  explicit pwbImuDataT(const cxd5602pwbimu_data_t& s)
+    : timestamp(s.timestamp), temp(ImuNumeric<T>::from(s.temp)),
+      gx(ImuNumeric<T>::from(s.gx)), gy(ImuNumeric<T>::from(s.gy)), gz(ImuNumeric<T>::from(s.gz)),
+      ax(ImuNumeric<T>::from(s.ax)), ay(ImuNumeric<T>::from(s.ay)), az(ImuNumeric<T>::from(s.az)) {}
+
+  cxd5602pwbimu_data_t toRaw() const {
+    cxd5602pwbimu_data_t s;
+    s.timestamp = timestamp;
+    s.temp = ImuNumeric<T>::toFloat(temp);
+    s.gx = ImuNumeric<T>::toFloat(gx);
+    s.gy = ImuNumeric<T>::toFloat(gy);
+    s.gz = ImuNumeric<T>::toFloat(gz);
+    s.ax = ImuNumeric<T>::toFloat(ax);
+    s.ay = ImuNumeric<T>::toFloat(ay);
+    s.az = ImuNumeric<T>::toFloat(az);
+    return s;
+  }
+};
+
+static_assert(sizeof(pwbImuDataT<float>) == sizeof(cxd5602pwbimu_data_t),
+              "pwbImuDataT<float> must stay layout compatible with the driver data");
+
+inline const pwbImuDataT<float>* imuSamples(const cxd5602pwbimu_data_t* s)
+{
+  return reinterpret_cast<const pwbImuDataT<float>*>(s);
+}
+
+template<typename T>
+void imuConvert(const cxd5602pwbimu_data_t* in, size_t n, pwbImuDataT<T>* out)
+{
+  for (size_t i = 0; i < n; i++) out[i] = pwbImuDataT<T>(in[i]);
+}
+
+#endif // _IMU_NUMERIC_H_
@@ -0,0 +1,310 @@
+/*
+ *  ImuPublisher.cpp - Fan-out of the IMU sample stream to several subscribers.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "ImuPublisher.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/****************************************************************************
+ * ImuSink
+ ****************************************************************************/
+void ImuSink::offer(const cxd5602pwbimu_data_t* s, size_t n)
+{
+  size_t accepted;
+
+  if (decimation == 1)
+    {
+      accepted = deliver(s, n);
+      __atomic_fetch_add(&stat.delivered, (uint32_t)accepted, __ATOMIC_RELAXED);
+      if (accepted < n) countDropped(n - accepted);
+      return;
+    }
+
+  cxd5602pwbimu_data_t picked[IMU_PUB_BATCH];
+  size_t k = 0;
+
+  for (size_t i = 0; i < n; i++)
+    {
+      if (phase == 0) picked[k++] = s[i];
+      if (++phase == decimation) phase = 0;
+    }
+
+  if (k == 0) return;
+
+  accepted = deliver(picked, k);
+  __atomic_fetch_add(&stat.delivered, (uint32_t)accepted, __ATOMIC_RELAXED);
+  if (accepted < k) countDropped(k - accepted);
+}
+
+/****************************************************************************
+ * ImuSubscriber
+ ****************************************************************************/
+ImuSubscriber::ImuSubscriber()
+  : buf(NULL), cap(0), head(0), count(0), policy(IMU_OVERFLOW_DROP_OLDEST)
+{
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&cond, NULL);
+}
+
+ImuSubscriber::~ImuSubscriber()
+{
+  end();
+  pthread_mutex_destroy(&lock);
+  pthread_cond_destroy(&cond);
+}
+
+bool ImuSubscriber::begin(size_t capacity, int decim, ImuOverflow overflow)
+{
+  end();
+
+  if (capacity == 0) return false;
+
+  cxd5602pwbimu_data_t* p = (cxd5602pwbimu_data_t*)malloc(sizeof(cxd5602pwbimu_data_t) * capacity);
+  if (p == NULL)
+    {
+      printf("ERROR: Subscriber buffer allocation failed.\n");
+      return false;
+    }
+
+  pthread_mutex_lock(&lock);
+  buf    = p;
+  cap    = capacity;
+  head   = count = 0;
+  policy = overflow;
+  pthread_mutex_unlock(&lock);
+
+  setDecimation(decim);
+  return true;
+}
+
+void ImuSubscriber::end()
+{
+  pthread_mutex_lock(&lock);
+  free(buf);
+  buf  = NULL;
+  cap  = 0;
+  head = count = 0;
+  pthread_mutex_unlock(&lock);
+}
+
+size_t ImuSubscriber::deliver(const cxd5602pwbimu_data_t* s, size_t n)
+{
+  pthread_mutex_lock(&lock);
+
+  if (buf == NULL)
+    {
+      pthread_mutex_unlock(&lock);
+      return 0;
+    }
+
+  size_t take = n;
+  size_t room = cap - count;
+
+  if (take > room)
+    {
+      if (policy == IMU_OVERFLOW_DROP_NEWEST)
+        {
+          take = room;
+        }
+      else
+        {
+          /* Keep the newest `cap` samples: evict queued ones, and skip
+           * incoming ones that would not fit even in an empty queue. */
+          if (take > cap)
+            {
+              s   += take - cap;
+              take = cap;
+            }
+          size_t lost = take - room;
+          countDropped(lost);
+          count -= lost;
+        }
+    }
+
+  for (size_t i = 0; i < take; i++)
+    {
+      buf[head] = s[i];
+      head = (head + 1 == cap) ? 0 : head + 1;
+    }
+  count += take;
+
+  pthread_cond_signal(&cond);
+  pthread_mutex_unlock(&lock);
+
+  return take;
+}
+
+size_t ImuSubscriber::read(cxd5602pwbimu_data_t* dst, size_t max, int timeout_ms)
+{
+  struct timespec abstime;
+  if (timeout_ms > 0)
+    {
+      clock_gettime(CLOCK_REALTIME, &abstime);
+      abstime.tv_sec  += timeout_ms / 1000;
+      abstime.tv_nsec += (timeout_ms % 1000) * 1000000L;
+      if (abstime.tv_nsec >= 1000000000L)
+        {
+          abstime.tv_sec++;
+          abstime.tv_nsec -= 1000000000L;
+        }
+    }
+
+  pthread_mutex_lock(&lock);
+
+  int ret = 0;
+  while (count == 0 && buf != NULL && timeout_ms != 0 && ret == 0)
+    {
+      ret = (timeout_ms < 0) ? pthread_cond_wait(&cond, &lock)
+                             : pthread_cond_timedwait(&cond, &lock, &abstime);
+    }
+
+  size_t n    = (max < count) ? max : count;
+  size_t tail = (head + cap - count) % (cap ? cap : 1);
+  for (size_t i = 0; i < n; i++)
+    {
+      dst[i] = buf[tail];
+      tail = (tail + 1 == cap) ? 0 : tail + 1;
+    }
+  count -= n;
+
+  pthread_mutex_unlock(&lock);
+  return n;
+}
+
+size_t ImuSubscriber::available()
+{
+  pthread_mutex_lock(&lock);
+  size_t n = count;
+  pthread_mutex_unlock(&lock);
+  return n;
+}
+
+/****************************************************************************
+ * ImuPublisher
+ ****************************************************************************/
+ImuPublisher::ImuPublisher()
+  : imu(NULL), active(false), nsinks(0), samples(0)
+{
+  pthread_mutex_init(&lock, NULL);
+}
+
+ImuPublisher::~ImuPublisher()
+{
+  end();
+  pthread_mutex_destroy(&lock);
+}
+
+bool ImuPublisher::begin(SpresenseImuClass& device, int priority)
+{
+  if (active) return false;
+
+  imu     = &device;
+  samples = 0;
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  if (priority > 0)
+    {
+      struct sched_param param;
+      param.sched_priority = priority;
+      pthread_attr_setschedparam(&attr, &param);
+    }
+
+  active = true;
+
+  int ret = pthread_create(&tid, &attr, threadMain, this);
+  pthread_attr_destroy(&attr);
+  if (ret != 0)
+    {
+      printf("ERROR: Publisher thread creation failed. %d\n", ret);
+      active = false;
+      return false;
+    }
+
+  return true;
+}
+
+void ImuPublisher::end()
+{
+  if (!active) return;
+
+  /* The thread notices within one device timeout. */
+  active = false;
+  pthread_join(tid, NULL);
+}
+
+bool ImuPublisher::subscribe(ImuSink& sink)
+{
+  bool ok = false;
+
+  pthread_mutex_lock(&lock);
+  if (nsinks < IMU_PUB_MAX_SINKS)
+    {
+      sinks[nsinks++] = &sink;
+      ok = true;
+    }
+  pthread_mutex_unlock(&lock);
+
+  if (!ok) printf("ERROR: Too many subscribers (max %d).\n", IMU_PUB_MAX_SINKS);
+  return ok;
+}
+
+bool ImuPublisher::unsubscribe(ImuSink& sink)
+{
+  bool found = false;
+
+  /* Returns after any delivery to the sink in progress has finished. */
+  pthread_mutex_lock(&lock);
+  for (int i = 0; i < nsinks; i++)
+    {
+      if (sinks[i] == &sink)
+        {
+          sinks[i] = sinks[--nsinks];
+          found = true;
+          break;
+        }
+    }
+  pthread_mutex_unlock(&lock);
+
+  return found;
+}
+
+void* ImuPublisher::threadMain(void* arg)
+{
+  ImuPublisher* self = (ImuPublisher*)arg;
+  cxd5602pwbimu_data_t batch[IMU_PUB_BATCH];
+
+  while (self->active)
+    {
+      size_t n = self->imu->read(batch, IMU_PUB_BATCH);
+      if (n == 0) continue;
+
+      pthread_mutex_lock(&self->lock);
+      for (int i = 0; i < self->nsinks; i++) self->sinks[i]->offer(batch, n);
+      pthread_mutex_unlock(&self->lock);
+
+      __atomic_fetch_add(&self->samples, (uint32_t)n, __ATOMIC_RELAXED);
+    }
+
+  return NULL;
+}
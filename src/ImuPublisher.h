@@ -0,0 +1,201 @@
+/*
+ *  ImuPublisher.h - Fan-out of the IMU sample stream to several subscribers.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _IMU_PUBLISHER_H_
+#define _IMU_PUBLISHER_H_
+
+#include <pthread.h>
+
+#include "SpresenseIMU.h"
+#include "ImuBlockChannel.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define IMU_PUB_MAX_SINKS  (8)
+#define IMU_PUB_BATCH      (32)   // samples per device read at most
+
+enum ImuOverflow {
+  IMU_OVERFLOW_DROP_NEWEST = 0,   // keep what is queued, drop incoming samples
+  IMU_OVERFLOW_DROP_OLDEST,       // make room by dropping the oldest samples
+};
+
+/**************************************************************************
+ * ImuSink
+ *
+ *  Something the publisher delivers samples to. The publisher keeps
+ *  every `decimation`-th sample for the sink (a plain pick; put an
+ *  ImuDecimator in front for a filtered rate). deliver() runs on the
+ *  publisher thread and must not block.
+ **************************************************************************/
+
+struct ImuSinkStats {
+  uint32_t delivered;     // samples accepted
+  uint32_t dropped;       // samples lost to overflow
+};
+
+class ImuSink {
+
+public:
+  ImuSink() : decimation(1), phase(0) { memset(&stat, 0, sizeof(stat)); }
+  virtual ~ImuSink() {}
+
+  void setDecimation(int n) { decimation = (n > 0) ? n : 1; phase = 0; }
+  int  getDecimation() const { return decimation; }
+
+  ImuSinkStats stats() const {
+    ImuSinkStats s;
+    s.delivered = __atomic_load_n(&stat.delivered, __ATOMIC_RELAXED);
+    s.dropped   = __atomic_load_n(&stat.dropped, __ATOMIC_RELAXED);
+    return s;
+  }
+
+protected:
+  // Returns the number of samples accepted; the rest count as dropped.
+  virtual size_t deliver(const cxd5602pwbimu_data_t* s, size_t n) = 0;
+
+  void countDropped(size_t n) { __atomic_fetch_add(&stat.dropped, (uint32_t)n, __ATOMIC_RELAXED); }
+
+private:
+  friend class ImuPublisher;
+
+  void offer(const cxd5602pwbimu_data_t* s, size_t n);
+
+  int          decimation;
+  int          phase;
+  ImuSinkStats stat;
+};
+
+/**************************************************************************
+ * ImuSubscriber
+ *
+ *  A bounded queue for a consumer on the same core. Any thread may read;
+ *  read() can wait for samples.
+ **************************************************************************/
+
+class ImuSubscriber : public ImuSink {
+
+public:
+  ImuSubscriber();
+  ~ImuSubscriber();
+
+  bool begin(size_t capacity, int decimation = 1, ImuOverflow policy = IMU_OVERFLOW_DROP_OLDEST);
+  void end();
+
+  // timeout_ms < 0 waits for at least one sample, 0 never waits.
+  size_t read(cxd5602pwbimu_data_t* dst, size_t max, int timeout_ms = 0);
+  size_t available();
+
+protected:
+  size_t deliver(const cxd5602pwbimu_data_t* s, size_t n);
+
+private:
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+  cxd5602pwbimu_data_t* buf;
+  size_t      cap;
+  size_t      head;     // next write
+  size_t      count;
+  ImuOverflow policy;
+};
+
+/**************************************************************************
+ * ImuChannelSink
+ *
+ *  Packs samples into the blocks of an ImuBlockChannel producer, e.g. to
+ *  another subcore over MP. A block is published when full; when the
+ *  consumer holds every block the samples are dropped, so a slow core
+ *  never stalls the publisher. The channel is driven from the publisher
+ *  thread only (its MP receive handles the release messages).
+ **************************************************************************/
+
+template <int Slots, int BlockLen, class Transport = ImuDefaultTransport>
+class ImuChannelSink : public ImuSink {
+
+public:
+  typedef ImuBlockChannel<cxd5602pwbimu_data_t, Slots, BlockLen, Transport> Channel;
+
+  explicit ImuChannelSink(Channel& ch, int decimation = 1) : channel(ch), fill(0) {
+    setDecimation(decimation);
+  }
+
+protected:
+  size_t deliver(const cxd5602pwbimu_data_t* s, size_t n) {
+    size_t done = 0;
+    while (done < n) {
+      if (block.empty()) {
+        block = channel.acquire(0);
+        fill  = 0;
+        if (block.empty()) break;
+      }
+      while (done < n && fill < block.size) block[fill++] = s[done++];
+      if (fill == block.size) {
+        channel.publish(block);
+        block = ImuSpan<cxd5602pwbimu_data_t>();
+      }
+    }
+    return done;
+  }
+
+private:
+  Channel& channel;
+  ImuSpan<cxd5602pwbimu_data_t> block;
+  size_t   fill;
+};
+
+/**************************************************************************
+ * ImuPublisher
+ *
+ *  Owns the device reads: a thread takes each FIFO watermark from
+ *  SpresenseIMU once and offers it to every sink, each with its own
+ *  queue, overflow policy and decimation. Adding a consumer adds one copy
+ *  per sample, not a device read. SpresenseIMU must be initialized and
+ *  started; get()/read() are for the publisher only while it runs.
+ **************************************************************************/
+
+class ImuPublisher {
+
+public:
+  ImuPublisher();
+  ~ImuPublisher();
+
+  bool begin(SpresenseImuClass& imu = SpresenseIMU, int priority = 0);
+  void end();
+  bool running() const { return active; }
+
+  // Sinks can be added and removed while running.
+  bool subscribe(ImuSink& sink);
+  bool unsubscribe(ImuSink& sink);
+
+  uint32_t published() const { return __atomic_load_n(&samples, __ATOMIC_RELAXED); }
+
+private:
+  static void* threadMain(void*);
+
+  SpresenseImuClass* imu;
+  pthread_t       tid;
+  pthread_mutex_t lock;
+  volatile bool   active;
+  ImuSink*        sinks[IMU_PUB_MAX_SINKS];
+  int             nsinks;
+  uint32_t        samples;
+};
+
+#endif // _IMU_PUBLISHER_H_
@@ -0,0 +1,422 @@
+/*
+ *  ImuRecorder.cpp - Asynchronous buffered file writer for IMU captures.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "ImuRecorder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+static uint32_t now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+/****************************************************************************
+ * constructor / destructor
+ ****************************************************************************/
+ImuRecorder::ImuRecorder()
+  : running(false), nbufs(0), buf_size(0), free_bufs(0), cur(0), cur_len(0),
+    have_cur(false), job_head(0), job_count(0), busy(false), fd(-1),
+    file_len(0)
+{
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&cond, NULL);
+  memset(bufs, 0, sizeof(bufs));
+  memset(&stat, 0, sizeof(stat));
+}
+
+ImuRecorder::~ImuRecorder()
+{
+  end();
+  pthread_mutex_destroy(&lock);
+  pthread_cond_destroy(&cond);
+}
+
+/****************************************************************************
+ * begin / end
+ ****************************************************************************/
+bool ImuRecorder::begin(size_t buffer_size, int buffers, int priority)
+{
+  if (running) return false;
+
+  if (buffers < 2 || buffers > IMU_RECORDER_MAX_BUFS)
+    {
+      printf("ERROR: Recorder needs 2 to %d buffers.\n", IMU_RECORDER_MAX_BUFS);
+      return false;
+    }
+
+  buf_size = (buffer_size + IMU_RECORDER_SECTOR - 1) & ~(size_t)(IMU_RECORDER_SECTOR - 1);
+  nbufs    = buffers;
+
+  for (int i = 0; i < nbufs; i++)
+    {
+      bufs[i] = (uint8_t*)malloc(buf_size);
+      if (bufs[i] == NULL)
+        {
+          printf("ERROR: Recorder buffer allocation failed.\n");
+          end();
+          return false;
+        }
+    }
+
+  free_bufs = nbufs;
+  cur       = 0;
+  cur_len   = 0;
+  have_cur  = false;
+  job_head  = 0;
+  job_count = 0;
+  busy      = false;
+  resetStats();
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  if (priority > 0)
+    {
+      struct sched_param param;
+      param.sched_priority = priority;
+      pthread_attr_setschedparam(&attr, &param);
+    }
+
+  running = true;
+
+  int ret = pthread_create(&tid, &attr, writerThread, this);
+  pthread_attr_destroy(&attr);
+  if (ret != 0)
+    {
+      printf("ERROR: Recorder thread creation failed. %d\n", ret);
+      running = false;
+      end();
+      return false;
+    }
+
+  return true;
+}
+
+void ImuRecorder::end()
+{
+  if (running)
+    {
+      close();
+      flush();
+
+      pthread_mutex_lock(&lock);
+      running = false;
+      pthread_cond_broadcast(&cond);
+      pthread_mutex_unlock(&lock);
+      pthread_join(tid, NULL);
+    }
+
+  for (int i = 0; i < IMU_RECORDER_MAX_BUFS; i++)
+    {
+      free(bufs[i]);
+      bufs[i] = NULL;
+    }
+  nbufs = 0;
+}
+
+/****************************************************************************
+ * queue
+ ****************************************************************************/
+bool ImuRecorder::enqueue(const Job& job)
+{
+  pthread_mutex_lock(&lock);
+  while (job_count == IMU_RECORDER_MAX_JOBS && running)
+    {
+      pthread_cond_wait(&cond, &lock);
+    }
+
+  bool ok = running;
+  if (ok)
+    {
+      jobs[(job_head + job_count) % IMU_RECORDER_MAX_JOBS] = job;
+      job_count++;
+
+      if (job.op == JOB_WRITE)
+        {
+          uint32_t queued = nbufs - free_bufs;
+          if (queued > stat.queue_high) stat.queue_high = queued;
+        }
+      pthread_cond_broadcast(&cond);
+    }
+  pthread_mutex_unlock(&lock);
+
+  return ok;
+}
+
+bool ImuRecorder::acquire()
+{
+  pthread_mutex_lock(&lock);
+  if (free_bufs == 0)
+    {
+      uint32_t start = now_us();
+      while (free_bufs == 0 && running)
+        {
+          pthread_cond_wait(&cond, &lock);
+        }
+      uint32_t waited = now_us() - start;
+      stat.stalls++;
+      if (waited > stat.stall_us_max) stat.stall_us_max = waited;
+    }
+
+  bool ok = running;
+  if (ok) free_bufs--;
+  pthread_mutex_unlock(&lock);
+
+  have_cur = ok;
+  cur_len  = 0;
+  return ok;
+}
+
+bool ImuRecorder::submit()
+{
+  if (!have_cur || cur_len == 0) return true;
+
+  Job job;
+  job.op  = JOB_WRITE;
+  job.buf = cur;
+  job.len = cur_len;
+
+  have_cur = false;
+  cur_len  = 0;
+  cur      = (cur + 1) % nbufs;   // the writer finishes buffers in order
+
+  return enqueue(job);
+}
+
+/****************************************************************************
+ * producer API
+ ****************************************************************************/
+bool ImuRecorder::open(const char* path, uint32_t prealloc)
+{
+  if (strlen(path) >= IMU_RECORDER_PATH_MAX)
+    {
+      printf("ERROR: Recorder path too long. %s\n", path);
+      return false;
+    }
+
+  Job job;
+  job.op  = JOB_OPEN;
+  job.buf = 0;
+  job.len = prealloc;
+  strcpy(job.path, path);
+  return enqueue(job);
+}
+
+bool ImuRecorder::close()
+{
+  Job job;
+  job.op  = JOB_CLOSE;
+  job.buf = 0;
+  job.len = 0;
+  job.path[0] = '\0';
+  return submit() && enqueue(job);
+}
+
+bool ImuRecorder::rotate(const char* path, uint32_t prealloc)
+{
+  return close() && open(path, prealloc);
+}
+
+size_t ImuRecorder::write(const void* buf, size_t len)
+{
+  const uint8_t* src = (const uint8_t*)buf;
+  size_t done = 0;
+
+  if (!running || stat.error) return 0;
+
+  while (done < len)
+    {
+      if (!have_cur && !acquire()) break;
+
+      size_t n = buf_size - cur_len;
+      if (n > len - done) n = len - done;
+      memcpy(bufs[cur] + cur_len, src + done, n);
+      cur_len += n;
+      done    += n;
+
+      if (cur_len == buf_size && !submit()) break;
+    }
+
+  return done;
+}
+
+bool ImuRecorder::flush()
+{
+  pthread_mutex_lock(&lock);
+  while ((job_count > 0 || busy) && running)
+    {
+      pthread_cond_wait(&cond, &lock);
+    }
+  bool ok = (stat.error == 0);
+  pthread_mutex_unlock(&lock);
+  return ok;
+}
+
+/****************************************************************************
+ * statistics
+ ****************************************************************************/
+ImuRecorderStats ImuRecorder::stats()
+{
+  pthread_mutex_lock(&lock);
+  ImuRecorderStats s = stat;
+  pthread_mutex_unlock(&lock);
+  return s;
+}
+
+void ImuRecorder::resetStats()
+{
+  pthread_mutex_lock(&lock);
+  int error = stat.error;
+  memset(&stat, 0, sizeof(stat));
+  stat.error          = error;
+  stat.queue_capacity = nbufs;
+  pthread_mutex_unlock(&lock);
+}
+
+/****************************************************************************
+ * writer thread
+ ****************************************************************************/
+void ImuRecorder::execute(const Job& job)
+{
+  int      err   = 0;
+  uint32_t start = now_us();
+
+  switch (job.op)
+    {
+      case JOB_WRITE:
+        {
+          const uint8_t* p = bufs[job.buf];
+          size_t left = job.len;
+          while (left > 0 && err == 0)
+            {
+              ssize_t ret = (fd < 0) ? -1 : ::write(fd, p, left);
+              if (ret <= 0)
+                {
+                  err = (fd < 0) ? EBADF : (ret < 0 ? errno : ENOSPC);
+                  break;
+                }
+              p    += ret;
+              left -= ret;
+            }
+          file_len += job.len - left;
+
+          uint32_t elapsed = now_us() - start;
+          pthread_mutex_lock(&lock);
+          stat.writes++;
+          stat.bytes          += job.len - left;
+          stat.write_us_total += elapsed;
+          if (elapsed > stat.write_us_max) stat.write_us_max = elapsed;
+          pthread_mutex_unlock(&lock);
+        }
+        break;
+
+      case JOB_OPEN:
+        {
+          if (fd >= 0) ::close(fd);
+          fd = ::open(job.path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+          if (fd < 0)
+            {
+              err = errno;
+              break;
+            }
+
+          /* Allocate the clusters now rather than while recording. */
+          if (job.len > 0 && (ftruncate(fd, job.len) < 0 || lseek(fd, 0, SEEK_SET) < 0))
+            {
+              err = errno;
+            }
+          file_len = 0;
+
+          uint32_t elapsed = now_us() - start;
+          pthread_mutex_lock(&lock);
+          if (elapsed > stat.open_us_max) stat.open_us_max = elapsed;
+          pthread_mutex_unlock(&lock);
+        }
+        break;
+
+      case JOB_CLOSE:
+        {
+          if (fd < 0) break;
+
+          /* Drop the unused part of the preallocation. */
+          if (ftruncate(fd, file_len) < 0) err = errno;
+          if (::close(fd) < 0 && err == 0) err = errno;
+          fd = -1;
+
+          uint32_t elapsed = now_us() - start;
+          pthread_mutex_lock(&lock);
+          if (elapsed > stat.close_us_max) stat.close_us_max = elapsed;
+          pthread_mutex_unlock(&lock);
+        }
+        break;
+    }
+
+  if (err != 0)
+    {
+      printf("ERROR: Recorder %s failed. %d\n",
+             job.op == JOB_WRITE ? "write" : job.op == JOB_OPEN ? "open" : "close", err);
+      pthread_mutex_lock(&lock);
+      if (stat.error == 0) stat.error = err;
+      pthread_mutex_unlock(&lock);
+    }
+}
+
+void* ImuRecorder::writerThread(void* arg)
+{
+  ImuRecorder* self = (ImuRecorder*)arg;
+
+  pthread_mutex_lock(&self->lock);
+  while (true)
+    {
+      while (self->job_count == 0 && self->running)
+        {
+          pthread_cond_wait(&self->cond, &self->lock);
+        }
+      if (self->job_count == 0) break;
+
+      Job job = self->jobs[self->job_head];
+      self->busy = true;
+      pthread_mutex_unlock(&self->lock);
+
+      self->execute(job);
+
+      pthread_mutex_lock(&self->lock);
+      self->job_head = (self->job_head + 1) % IMU_RECORDER_MAX_JOBS;
+      self->job_count--;
+      self->busy = false;
+      if (job.op == JOB_WRITE) self->free_bufs++;
+      pthread_cond_broadcast(&self->cond);
+    }
+  pthread_mutex_unlock(&self->lock);
+
+  if (self->fd >= 0)
+    {
+      ::close(self->fd);
+      self->fd = -1;
+    }
+
+  return NULL;
+}
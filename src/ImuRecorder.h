@@ -0,0 +1,139 @@
+/*
+ *  ImuRecorder.h - Asynchronous buffered file writer for IMU captures.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _IMU_RECORDER_H_
+#define _IMU_RECORDER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "ImuLog.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define IMU_RECORDER_SECTOR     (512)
+#define IMU_RECORDER_MAX_BUFS   (8)
+#define IMU_RECORDER_MAX_JOBS   (IMU_RECORDER_MAX_BUFS + 8)
+#define IMU_RECORDER_PATH_MAX   (64)
+
+/**************************************************************************
+ * Statistics
+ **************************************************************************/
+
+struct ImuRecorderStats {
+  uint32_t writes;          // buffers handed to the file system
+  uint64_t bytes;
+  uint32_t write_us_max;    // worst single write()
+  uint64_t write_us_total;
+  uint32_t open_us_max;     // worst open + preallocation
+  uint32_t close_us_max;
+  uint32_t queue_high;      // most buffers waiting for the writer at once
+  uint32_t queue_capacity;  // buffers allocated
+  uint32_t stalls;          // producer had to wait for a free buffer
+  uint32_t stall_us_max;
+  int      error;           // first errno seen by the writer, 0 if none
+};
+
+/**************************************************************************
+ * ImuRecorder
+ *
+ *  Data written by the producer is copied into fixed-size buffers. Each
+ *  full buffer is queued to a writer thread, so a slow SD erase only
+ *  delays the thread while the producer keeps filling the next buffer.
+ *
+ *  Buffers are a multiple of the sector size; size them to the card's
+ *  cluster (typically 32 KB for SDHC) so every write but the last of a
+ *  file covers whole clusters. open() can preallocate the file so that
+ *  writes do not extend the FAT while recording; close() trims it back
+ *  to the written length. File operations are queued with the data and
+ *  run in order on the writer thread.
+ *
+ *  write() only blocks when every buffer is queued; that time is
+ *  reported as a stall.
+ **************************************************************************/
+
+class ImuRecorder : public ImuLogStream {
+
+public:
+  ImuRecorder();
+  ~ImuRecorder();
+
+  bool begin(size_t buffer_size = 32768, int buffers = 3, int priority = 0);
+  void end();
+
+  // Paths are file system paths, e.g. "/mnt/sd0/imu000.dat" on Spresense.
+  bool open(const char* path, uint32_t prealloc = 0);
+  bool close();
+  bool rotate(const char* path, uint32_t prealloc = 0);
+
+  size_t write(const void* buf, size_t len);
+
+  // Wait until everything queued so far is on the file system.
+  bool flush();
+
+  ImuRecorderStats stats();
+  void resetStats();
+
+private:
+  enum { JOB_WRITE, JOB_OPEN, JOB_CLOSE };
+
+  struct Job {
+    uint8_t  op;
+    uint8_t  buf;
+    uint32_t len;             // JOB_WRITE: bytes, JOB_OPEN: preallocation
+    char     path[IMU_RECORDER_PATH_MAX];
+  };
+
+  static void* writerThread(void* arg);
+  bool enqueue(const Job& job);
+  bool submit();
+  bool acquire();
+  void execute(const Job& job);
+
+  pthread_mutex_t  lock;
+  pthread_cond_t   cond;
+  pthread_t        tid;
+  bool             running;
+
+  uint8_t*         bufs[IMU_RECORDER_MAX_BUFS];
+  int              nbufs;
+  size_t           buf_size;
+  int              free_bufs;
+
+  // Producer side
+  int              cur;
+  size_t           cur_len;
+  bool             have_cur;
+
+  Job              jobs[IMU_RECORDER_MAX_JOBS];
+  int              job_head;
+  int              job_count;
+  bool             busy;      // writer is executing jobs[job_head]
+
+  // Writer side
+  int              fd;
+  uint32_t         file_len;
+
+  ImuRecorderStats stat;
+};
+
+#endif // _IMU_RECORDER_H_
@@ -0,0 +1,120 @@
+/*
+ *  ImuRingBuffer.h - Lock-free single-producer/single-consumer ring buffer.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _IMU_RING_BUFFER_H_
+#define _IMU_RING_BUFFER_H_
+
+#include <stddef.h>
+#include <stdlib.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+// Head and tail live on separate lines so producer and consumer never
+// write the same line.
+#define IMU_CACHE_LINE (32)
+
+/**************************************************************************
+ * Class
+ **************************************************************************/
+
+// One thread may push and one (other) thread may pop without any lock.
+// The capacity is rounded up to a power of two.
+template <typename T>
+class ImuRingBuffer {
+
+public:
+  ImuRingBuffer() : buf(NULL), mask(0), head(0), tail(0) {}
+  ~ImuRingBuffer() { release(); }
+
+  bool allocate(size_t capacity) {
+    release();
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+    buf = (T*)malloc(sizeof(T) * size);
+    if (buf == NULL) return false;
+    mask = size - 1;
+    head = tail = 0;
+    return true;
+  }
+
+  void release() {
+    free(buf);
+    buf  = NULL;
+    mask = 0;
+    head = tail = 0;
+  }
+
+  size_t capacity() const { return buf ? mask + 1 : 0; }
+
+  size_t size() const {
+    return __atomic_load_n(&head, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+  }
+
+  // Producer side. Returns the number of elements stored.
+  size_t push(const T* src, size_t n) {
+    size_t h = head;
+    size_t t = __atomic_load_n(&tail, __ATOMIC_ACQUIRE);
+    size_t room = capacity() - (h - t);
+    if (n > room) n = room;
+    for (size_t i = 0; i < n; i++) {
+      buf[(h + i) & mask] = src[i];
+    }
+    __atomic_store_n(&head, h + n, __ATOMIC_RELEASE);
+    return n;
+  }
+
+  bool push(const T& src) { return push(&src, 1) == 1; }
+
+  // Consumer side. Returns the number of elements taken.
+  size_t pop(T* dst, size_t n) {
+    size_t t = tail;
+    size_t h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    if (n > h - t) n = h - t;
+    for (size_t i = 0; i < n; i++) {
+      dst[i] = buf[(t + i) & mask];
+    }
+    __atomic_store_n(&tail, t + n, __ATOMIC_RELEASE);
+    return n;
+  }
+
+  bool pop(T& dst) { return pop(&dst, 1) == 1; }
+
+  // Consumer side. Drops the oldest `n` elements.
+  size_t discard(size_t n) {
+    size_t t = tail;
+    size_t h = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    if (n > h - t) n = h - t;
+    __atomic_store_n(&tail, t + n, __ATOMIC_RELEASE);
+    return n;
+  }
+
+private:
+  ImuRingBuffer(const ImuRingBuffer&);
+  ImuRingBuffer& operator=(const ImuRingBuffer&);
+
+  T*     buf;
+  size_t mask;
+  alignas(IMU_CACHE_LINE) size_t head;  // written by the producer only
+  alignas(IMU_CACHE_LINE) size_t tail;  // written by the consumer only
+};
+
+#endif // _IMU_RING_BUFFER_H_
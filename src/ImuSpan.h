@@ -0,0 +1,45 @@
+/*
+ *  ImuSpan.h - Pointer + length view over a block of samples.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _IMU_SPAN_H_
+#define _IMU_SPAN_H_
+
+#include <stddef.h>
+
+/**************************************************************************
+ * Structures
+ **************************************************************************/
+
+template <typename T>
+struct ImuSpan {
+  T*     data;
+  size_t size;
+
+  ImuSpan() : data(NULL), size(0) {}
+  ImuSpan(T* d, size_t n) : data(d), size(n) {}
+
+  bool empty() const { return (data == NULL) || (size == 0); }
+
+  T& operator[](size_t i) const { return data[i]; }
+
+  T* begin() const { return data; }
+  T* end()   const { return data + size; }
+};
+
+#endif // _IMU_SPAN_H_
@@ -0,0 +1,388 @@
+/*
+ *  ImuSpectrum.cpp - Streaming vibration spectrum (FFT, band energy, peaks, Goertzel).
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include "ImuSpectrum.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/****************************************************************************
+ * ImuSpectrumFeatures
+ ****************************************************************************/
+int ImuSpectrumFeatures::pack(float* v) const
+{
+  int n = 0;
+
+  v[n++] = rms;
+  for (int k = 0; k < bands; k++) v[n++] = band[k];
+  for (int k = 0; k < slots; k++) { v[n++] = peak[k].freq; v[n++] = peak[k].amp; }
+  for (int k = 0; k < tones; k++) v[n++] = tone[k];
+  return n;
+}
+
+void ImuSpectrumFeatures::print() const
+{
+  printf("frame %lu, rms %.4f", (unsigned long)frame, rms);
+  for (int k = 0; k < bands; k++) printf(", band%d %.4f", k, band[k]);
+  printf("\n");
+  for (int k = 0; k < peaks; k++)
+    {
+      printf("  peak %.2f Hz %.4f (%lu frames)\n", peak[k].freq, peak[k].amp, (unsigned long)peak[k].age);
+    }
+  for (int k = 0; k < tones; k++) printf("  tone%d %.4f\n", k, tone[k]);
+}
+
+/****************************************************************************
+ * ImuSpectrum
+ ****************************************************************************/
+ImuSpectrum::ImuSpectrum()
+  : sample_rate(0), frame_len(0), hop_len(0), chan(IMU_SPEC_ANORM),
+    filled(0), since(0), head(0),
+    ring(NULL), work(NULL), window(NULL), sine(NULL), spectrum(NULL),
+    window_sum(0), power_scale(0), nbands(0), ntones(0), npeaks(IMU_SPEC_MAX_PEAKS), peak_min(0)
+{
+}
+
+ImuSpectrum::~ImuSpectrum()
+{
+  end();
+}
+
+bool ImuSpectrum::addBand(float low, float high)
+{
+  if (nbands >= IMU_SPEC_MAX_BANDS || low < 0 || high <= low) return false;
+  band_lo[nbands] = low;
+  band_hi[nbands] = high;
+  nbands++;
+  return true;
+}
+
+bool ImuSpectrum::addTone(float freq)
+{
+  if (ntones >= IMU_SPEC_MAX_TONES || freq <= 0) return false;
+  tone_hz[ntones++] = freq;
+  return true;
+}
+
+void ImuSpectrum::setPeaks(int n, float min_amp)
+{
+  npeaks   = (n < 0) ? 0 : (n > IMU_SPEC_MAX_PEAKS) ? IMU_SPEC_MAX_PEAKS : n;
+  peak_min = min_amp;
+}
+
+size_t ImuSpectrum::footprint() const
+{
+  if (frame_len == 0) return 0;
+  return sizeof(float) * (frame_len + frame_len + frame_len / 2 + (frame_len / 4 + 1) + (frame_len / 2 + 1));
+}
+
+bool ImuSpectrum::begin(float rate, int frame, int hop, int channel)
+{
+  end();
+
+  if (frame < IMU_SPEC_MIN_FRAME || frame > IMU_SPEC_MAX_FRAME || (frame & (frame - 1)) != 0 ||
+      hop <= 0 || hop > frame || rate <= 0)
+    {
+      printf("ERROR: spectrum frame %d / hop %d not supported.\n", frame, hop);
+      return false;
+    }
+
+  sample_rate = rate;
+  frame_len   = frame;
+  hop_len     = hop;
+  chan        = channel;
+
+  ring     = (float*)malloc(sizeof(float) * frame);
+  work     = (float*)malloc(sizeof(float) * frame);
+  window   = (float*)malloc(sizeof(float) * (frame / 2));
+  sine     = (float*)malloc(sizeof(float) * (frame / 4 + 1));
+  spectrum = (float*)malloc(sizeof(float) * (frame / 2 + 1));
+  if (ring == NULL || work == NULL || window == NULL || sine == NULL || spectrum == NULL)
+    {
+      printf("ERROR: spectrum allocation failed (%lu bytes).\n", (unsigned long)footprint());
+      end();
+      return false;
+    }
+
+  /* Symmetric Hann; sums for the amplitude and power corrections. */
+  double sum = 0, sum2 = 0;
+  for (int i = 0; i < frame / 2; i++)
+    {
+      window[i] = (float)(0.5 - 0.5 * cos(2 * M_PI * i / (frame - 1)));
+      sum  += 2.0 * window[i];
+      sum2 += 2.0 * window[i] * window[i];
+    }
+  window_sum = (float)sum;
+
+  /* One-sided mean square per bin: 2 |X|^2 / (N sum(w^2)). */
+  power_scale = (float)(2.0 / (frame * sum2));
+
+  for (int k = 0; k <= frame / 4; k++) sine[k] = (float)sin(2 * M_PI * k / frame);
+
+  memset(spectrum, 0, sizeof(float) * (frame / 2 + 1));
+  filled = since = head = 0;
+  feat = ImuSpectrumFeatures();
+  feat.bands = nbands;
+  feat.slots = npeaks;
+  feat.tones = ntones;
+  return true;
+}
+
+void ImuSpectrum::end()
+{
+  free(ring);     ring     = NULL;
+  free(work);     work     = NULL;
+  free(window);   window   = NULL;
+  free(sine);     sine     = NULL;
+  free(spectrum); spectrum = NULL;
+  frame_len = 0;
+}
+
+float ImuSpectrum::pick(const cxd5602pwbimu_data_t& s) const
+{
+  switch (chan)
+    {
+      case IMU_SPEC_AX: return s.ax;
+      case IMU_SPEC_AY: return s.ay;
+      case IMU_SPEC_AZ: return s.az;
+      case IMU_SPEC_GX: return s.gx;
+      case IMU_SPEC_GY: return s.gy;
+      case IMU_SPEC_GZ: return s.gz;
+      default:          return sqrtf(s.ax * s.ax + s.ay * s.ay + s.az * s.az);
+    }
+}
+
+/****************************************************************************
+ * Streaming input
+ ****************************************************************************/
+int ImuSpectrum::process(const cxd5602pwbimu_data_t* s, size_t n)
+{
+  int frames = 0;
+
+  if (ring == NULL) return 0;
+
+  for (size_t i = 0; i < n; i++)
+    {
+      ImuReconfig c;
+      if (imuMarkerConfig(s[i], c))
+        {
+          /* Frames never mix rates. */
+          if (c.rate > 0 && c.rate != sample_rate)
+            {
+              sample_rate = c.rate;
+              filled = since = 0;
+            }
+          continue;
+        }
+
+      ring[head] = pick(s[i]);
+      head = (head + 1) & (frame_len - 1);
+      if (filled < frame_len) filled++;
+
+      if (++since >= hop_len && filled == frame_len)
+        {
+          since = 0;
+          analyze(s[i].timestamp);
+          frames++;
+        }
+    }
+  return frames;
+}
+
+/****************************************************************************
+ * Twiddle e^(-2 pi i k / N) = c - i s for 0 <= k <= N / 2
+ ****************************************************************************/
+void ImuSpectrum::twiddle(int k, float& c, float& s) const
+{
+  int q = frame_len / 4;
+
+  if (k <= q) { c =  sine[q - k]; s = sine[k]; }
+  else        { c = -sine[k - q]; s = sine[frame_len / 2 - k]; }
+}
+
+/****************************************************************************
+ * In-place radix-2 complex FFT of m = N / 2 points (interleaved re, im)
+ ****************************************************************************/
+void ImuSpectrum::fft(float* z, int m) const
+{
+  for (int i = 1, j = 0; i < m; i++)
+    {
+      int bit = m >> 1;
+      for (; j & bit; bit >>= 1) j ^= bit;
+      j ^= bit;
+      if (i < j)
+        {
+          float tr = z[2 * i], ti = z[2 * i + 1];
+          z[2 * i] = z[2 * j]; z[2 * i + 1] = z[2 * j + 1];
+          z[2 * j] = tr;       z[2 * j + 1] = ti;
+        }
+    }
+
+  for (int len = 2; len <= m; len <<= 1)
+    {
+      int half = len >> 1;
+      int step = 2 * (m / len);   // W_len^j = W_N^(j * step)
+      for (int j = 0; j < half; j++)
+        {
+          float c, s;
+          twiddle(j * step, c, s);
+          for (int i = j; i < m; i += len)
+            {
+              float* u = &z[2 * i];
+              float* v = &z[2 * (i + half)];
+              float vr = v[0] * c + v[1] * s;
+              float vi = v[1] * c - v[0] * s;
+              v[0] = u[0] - vr; v[1] = u[1] - vi;
+              u[0] += vr;       u[1] += vi;
+            }
+        }
+    }
+}
+
+/****************************************************************************
+ * One frame
+ ****************************************************************************/
+void ImuSpectrum::analyze(uint32_t timestamp)
+{
+  const int n = frame_len, m = n / 2;
+
+  /* Oldest first, mean removed, windowed. */
+  float mean = 0;
+  for (int i = 0; i < n; i++) mean += ring[i];
+  mean /= n;
+
+  for (int i = 0; i < n; i++)
+    {
+      float w = (i < m) ? window[i] : window[n - 1 - i];
+      work[i] = (ring[(head + i) & (n - 1)] - mean) * w;
+    }
+
+  /* Goertzel at the tones, before the FFT overwrites the frame. */
+  for (int k = 0; k < ntones; k++)
+    {
+      float coeff = 2 * cosf(2 * (float)M_PI * tone_hz[k] / sample_rate);
+      float s1 = 0, s2 = 0;
+      for (int i = 0; i < n; i++)
+        {
+          float s0 = work[i] + coeff * s1 - s2;
+          s2 = s1;
+          s1 = s0;
+        }
+      float p = s1 * s1 + s2 * s2 - coeff * s1 * s2;
+      feat.tone[k] = 2 * sqrtf(p > 0 ? p : 0) / window_sum;
+    }
+
+  /* Real FFT: N / 2 point complex FFT of the even / odd pairs, then split.
+   *   X[k] = E[k] + W^k O[k], E = (Z[k] + Z*[m-k]) / 2,
+   *                           O = -i (Z[k] - Z*[m-k]) / 2 */
+  fft(work, m);
+
+  spectrum[0] = (work[0] + work[1]) * (work[0] + work[1]) * power_scale * 0.5f;
+  spectrum[m] = (work[0] - work[1]) * (work[0] - work[1]) * power_scale * 0.5f;
+  for (int k = 1; k < m; k++)
+    {
+      float ar = work[2 * k],       ai = work[2 * k + 1];
+      float br = work[2 * (m - k)], bi = -work[2 * (m - k) + 1];
+      float er = 0.5f * (ar + br), ei = 0.5f * (ai + bi);
+      float orr = 0.5f * (ai - bi), oi = -0.5f * (ar - br);
+      float c, s;
+      twiddle(k, c, s);
+      float xr = er + c * orr + s * oi;
+      float xi = ei + c * oi - s * orr;
+      spectrum[k] = (xr * xr + xi * xi) * power_scale;
+    }
+
+  /* Bands and the total (DC excluded) */
+  const float bin = sample_rate / n;
+  float total = 0;
+  for (int k = 1; k <= m; k++) total += spectrum[k];
+  feat.rms = sqrtf(total);
+
+  for (int b = 0; b < nbands; b++)
+    {
+      int lo = (int)ceilf(band_lo[b] / bin);
+      int hi = (int)floorf(band_hi[b] / bin);
+      if (lo < 1) lo = 1;
+      if (hi > m) hi = m;
+      float e = 0;
+      for (int k = lo; k <= hi; k++) e += spectrum[k];
+      feat.band[b] = sqrtf(e);
+    }
+
+  findPeaks();
+
+  feat.timestamp = timestamp;
+  feat.frame++;
+}
+
+/****************************************************************************
+ * Peaks: strongest local maxima, parabolic interpolation on the magnitude,
+ * matched to the peaks of the previous frame
+ ****************************************************************************/
+void ImuSpectrum::findPeaks()
+{
+  const int   m   = frame_len / 2;
+  const float bin = sample_rate / frame_len;
+
+  ImuSpectrumPeak found[IMU_SPEC_MAX_PEAKS];
+  int nfound = 0;
+
+  for (int k = 2; k < m; k++)
+    {
+      float p = spectrum[k];
+      if (p <= spectrum[k - 1] || p < spectrum[k + 1]) continue;
+
+      float a = sqrtf(spectrum[k - 1]), b = sqrtf(p), c = sqrtf(spectrum[k + 1]);
+      float den = a - 2 * b + c;
+      float d   = (den < 0) ? 0.5f * (a - c) / den : 0;
+      float mag = b - 0.25f * (a - c) * d;
+
+      /* A sine of amplitude A puts A^2 / 2 / 1.5 in its peak bin (Hann:
+       * equivalent noise bandwidth 1.5 bins). */
+      float amp = mag * sqrtf(2.0f * 1.5f);
+      if (amp < peak_min) continue;
+
+      int pos = nfound;
+      while (pos > 0 && found[pos - 1].amp < amp) pos--;
+      if (pos >= npeaks) continue;
+      if (nfound < npeaks) nfound++;
+      for (int j = nfound - 1; j > pos; j--) found[j] = found[j - 1];
+      found[pos].freq = (k + d) * bin;
+      found[pos].amp  = amp;
+      found[pos].age  = 1;
+    }
+
+  for (int i = 0; i < nfound; i++)
+    {
+      for (int j = 0; j < feat.peaks; j++)
+        {
+          if (fabsf(found[i].freq - feat.peak[j].freq) <= 2 * bin)
+            {
+              found[i].age = feat.peak[j].age + 1;
+              break;
+            }
+        }
+    }
+
+  memset(feat.peak, 0, sizeof(feat.peak));
+  memcpy(feat.peak, found, sizeof(found[0]) * nfound);
+  feat.peaks = nfound;
+}
@@ -0,0 +1,158 @@
+/*
+ *  ImuSpectrum.h - Streaming vibration spectrum (FFT, band energy, peaks, Goertzel).
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _IMU_SPECTRUM_H_
+#define _IMU_SPECTRUM_H_
+
+#include "SpresenseIMU.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define IMU_SPEC_MIN_FRAME   (256)
+#define IMU_SPEC_MAX_FRAME   (2048)
+#define IMU_SPEC_MAX_BANDS   (8)
+#define IMU_SPEC_MAX_PEAKS   (4)
+#define IMU_SPEC_MAX_TONES   (4)
+
+// pack(): rms, bands, (freq, amp) per peak, tones
+#define IMU_SPEC_MAX_PACKED  (1 + IMU_SPEC_MAX_BANDS + 2 * IMU_SPEC_MAX_PEAKS + IMU_SPEC_MAX_TONES)
+
+// Channel analyzed by one ImuSpectrum.
+#define IMU_SPEC_AX          (0)
+#define IMU_SPEC_AY          (1)
+#define IMU_SPEC_AZ          (2)
+#define IMU_SPEC_ANORM       (3)   // |accel|, independent of the mounting
+#define IMU_SPEC_GX          (4)
+#define IMU_SPEC_GY          (5)
+#define IMU_SPEC_GZ          (6)
+
+/**************************************************************************
+ * Structures
+ **************************************************************************/
+
+struct ImuSpectrumPeak {
+  float    freq;             // Hz, interpolated between bins
+  float    amp;              // amplitude of a sine at freq
+  uint32_t age;              // consecutive frames with a peak within 2 bins
+};
+
+struct ImuSpectrumFeatures {
+  uint32_t timestamp;        // last sample of the frame
+  uint32_t frame;            // 1, 2, ... since begin()
+  float    rms;              // mean removed (m/s^2 or rad/s)
+  int      bands, tones;
+  int      peaks;            // found this frame, <= slots
+  int      slots;            // setPeaks(n): peak entries in pack()
+  float    band[IMU_SPEC_MAX_BANDS];      // RMS within each band
+  ImuSpectrumPeak peak[IMU_SPEC_MAX_PEAKS];  // strongest first, then zeros
+  float    tone[IMU_SPEC_MAX_TONES];      // amplitude at each tone
+
+  ImuSpectrumFeatures() { memset(this, 0, sizeof(*this)); }
+
+  // Flatten to floats for ImuTelemetry::writeRecord() (in chunks of
+  // IMU_TLM_MAX_FIELDS). Returns the count, at most IMU_SPEC_MAX_PACKED.
+  // The layout is fixed after begin(): rms, `bands` values, `slots`
+  // (freq, amp) pairs with (0, 0) for the peaks not found, `tones` values.
+  int pack(float* v) const;
+  void print() const;
+};
+
+/**************************************************************************
+ * ImuSpectrum
+ *
+ *  Hann-windowed real FFTs of `frame` samples of one channel, one every
+ *  `hop` samples (hop < frame overlaps the frames). Per frame:
+ *    - the RMS of each band (Parseval, corrected for the window power)
+ *    - the strongest local maxima, with parabolic interpolation, tracked
+ *      from frame to frame
+ *    - Goertzel amplitudes at a few known frequencies (exact frequency,
+ *      not the nearest bin), on the same windowed frame
+ *  The frame mean is removed first, so gravity does not leak into the low
+ *  bins.
+ *
+ *  Everything is allocated in begin(): footprint() bytes, about
+ *  13 * frame bytes (26 KB at 2048), which fits a subcore's
+ *  USER_HEAP_SIZE(64 * 1024) with room left. The FFT runs inside
+ *  process() when a frame completes; at 1024 samples that is a few
+ *  hundred us on the Cortex-M4F, well inside a 4-sample watermark at
+ *  1920 Hz.
+ *
+ *  A reconfigure() marker with another rate restarts the frame.
+ **************************************************************************/
+
+class ImuSpectrum {
+
+public:
+  ImuSpectrum();
+  ~ImuSpectrum();
+
+  // Before begin(); false when full or empty. Bands are clipped to
+  // 0 .. rate / 2 per frame.
+  bool addBand(float low, float high);
+  bool addTone(float freq);
+  void setPeaks(int n, float min_amp = 0);
+
+  // frame: power of two in IMU_SPEC_MIN_FRAME .. IMU_SPEC_MAX_FRAME,
+  // 0 < hop <= frame.
+  bool begin(float rate, int frame, int hop, int channel = IMU_SPEC_ANORM);
+  void end();
+
+  // Returns the number of frames completed (features() has the last).
+  int process(const cxd5602pwbimu_data_t* s, size_t n);
+  int process(ImuSpan<cxd5602pwbimu_data_t> span) { return process(span.data, span.size); }
+
+  const ImuSpectrumFeatures& features() const { return feat; }
+
+  // Mean square per bin of the last frame, frame / 2 + 1 values.
+  const float* power() const { return spectrum; }
+  float binHz() const { return sample_rate / frame_len; }
+  size_t footprint() const;
+
+private:
+  float pick(const cxd5602pwbimu_data_t& s) const;
+  void  twiddle(int k, float& c, float& s) const;
+  void  fft(float* z, int m) const;
+  void  analyze(uint32_t timestamp);
+  void  findPeaks();
+
+  float  sample_rate;
+  int    frame_len, hop_len, chan;
+  int    filled;            // valid samples in the ring (up to frame_len)
+  int    since;             // samples since the last frame
+  int    head;
+
+  float* ring;              // frame_len, input history
+  float* work;              // frame_len, windowed frame, then the FFT
+  float* window;            // frame_len / 2, symmetric half
+  float* sine;              // frame_len / 4 + 1, quarter wave
+  float* spectrum;          // frame_len / 2 + 1
+  float  window_sum;        // sum of w
+  float  power_scale;       // |X|^2 -> mean square
+
+  float  band_lo[IMU_SPEC_MAX_BANDS], band_hi[IMU_SPEC_MAX_BANDS];
+  float  tone_hz[IMU_SPEC_MAX_TONES];
+  int    nbands, ntones, npeaks;
+  float  peak_min;
+
+  ImuSpectrumFeatures feat;
+};
+
+#endif // _IMU_SPECTRUM_H_
@@ -0,0 +1,419 @@
+/*
+ *  ImuTelemetry.cpp - Framed binary telemetry for the serial links.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "ImuTelemetry.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define DEG2RAD     ((float)M_PI / 180.0f)
+#define TEMP_LSB    (0.01f)
+
+static_assert(sizeof(ImuTelemetryHeader)    == 8,  "ImuTelemetryHeader layout");
+static_assert(sizeof(ImuTelemetryQ16Header) == 16, "ImuTelemetryQ16Header layout");
+static_assert(sizeof(ImuTelemetryQ16)       == 16, "ImuTelemetryQ16 layout");
+
+static int16_t quantize(float v, float lsb)
+{
+  float q = v / lsb;
+  if (q >  32767.0f) return  32767;
+  if (q < -32767.0f) return -32767;
+  return (int16_t)lrintf(q);
+}
+
+/* CRC-16/CCITT-FALSE, nibble table */
+static uint16_t crc16(const uint8_t* p, size_t n)
+{
+  static const uint16_t table[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef
+  };
+  uint16_t crc = 0xffff;
+
+  while (n--)
+    {
+      uint8_t b = *p++;
+      crc = (crc << 4) ^ table[(crc >> 12) ^ (b >> 4)];
+      crc = (crc << 4) ^ table[(crc >> 12) ^ (b & 0x0f)];
+    }
+  return crc;
+}
+
+/* COBS: no zero bytes in the output, the frame ends with one. */
+static size_t cobs_encode(const uint8_t* in, size_t n, uint8_t* out)
+{
+  size_t  o    = 1;
+  size_t  code = 0;
+  uint8_t run  = 1;
+
+  for (size_t i = 0; i < n; i++)
+    {
+      if (in[i] != 0)
+        {
+          out[o++] = in[i];
+          run++;
+        }
+      if (in[i] == 0 || run == 0xff)
+        {
+          out[code] = run;
+          code = o++;
+          run  = 1;
+        }
+    }
+  out[code] = run;
+  out[o++]  = 0;
+
+  return o;
+}
+
+static size_t cobs_decode(const uint8_t* in, size_t n, uint8_t* out, size_t max)
+{
+  size_t i = 0, o = 0;
+
+  while (i < n)
+    {
+      uint8_t code = in[i++];
+      if (code == 0 || i + code - 1 > n) return 0;
+
+      for (uint8_t k = 1; k < code; k++)
+        {
+          if (o >= max) return 0;
+          out[o++] = in[i++];
+        }
+      if (code != 0xff && i < n)
+        {
+          if (o >= max) return 0;
+          out[o++] = 0;
+        }
+    }
+
+  return o;
+}
+
+/****************************************************************************
+ * Encoder
+ ****************************************************************************/
+ImuTelemetry::ImuTelemetry()
+  : stream(NULL), batch(8), quantize(false), accel_lsb(0), gyro_lsb(0),
+    type(0), fields(0), count(0), seq(0), sent(0), len(0)
+{
+}
+
+bool ImuTelemetry::begin(ImuLogStream& out, int n, bool q, int adrange, int gdrange)
+{
+  if (n < 1 || n > IMU_TLM_MAX_BATCH)
+    {
+      printf("ERROR: telemetry batch %d (1..%d).\n", n, IMU_TLM_MAX_BATCH);
+      return false;
+    }
+
+  stream    = &out;
+  batch     = n;
+  quantize  = q;
+  accel_lsb = adrange * IMU_GRAVITY / 32767.0f;
+  gyro_lsb  = gdrange * DEG2RAD / 32767.0f;
+  type      = 0;
+  count     = 0;
+  seq       = 0;
+  sent      = 0;
+
+  return true;
+}
+
+bool ImuTelemetry::open(int t, int f)
+{
+  if (count > 0 && (type != t || fields != f))
+    {
+      if (!sendFrame()) return false;
+    }
+  type   = t;
+  fields = f;
+  return true;
+}
+
+bool ImuTelemetry::write(const cxd5602pwbimu_data_t* s, size_t n)
+{
+  if (stream == NULL) return false;
+  if (!open(quantize ? IMU_TLM_Q16 : IMU_TLM_RAW, 0)) return false;
+
+  for (size_t i = 0; i < n; i++)
+    {
+      /* Markers pass through raw frames; int16 cannot hold them. */
+      if (quantize && imuIsMarker(s[i])) continue;
+      pending[count++] = s[i];
+      if (count >= batch && !sendFrame()) return false;
+    }
+  return true;
+}
+
+bool ImuTelemetry::writeRecord(const float* v, int f)
+{
+  if (stream == NULL || f < 1 || f > IMU_TLM_MAX_FIELDS) return false;
+  if (!open(IMU_TLM_F32, f)) return false;
+
+  memcpy(frame + sizeof(ImuTelemetryHeader) + count * f * sizeof(float), v, f * sizeof(float));
+  count++;
+
+  return (count >= batch) ? sendFrame() : true;
+}
+
+bool ImuTelemetry::flush()
+{
+  return (stream != NULL && count > 0) ? sendFrame() : true;
+}
+
+size_t ImuTelemetry::packSamples(uint8_t* payload)
+{
+  if (type == IMU_TLM_RAW)
+    {
+      memcpy(payload, pending, count * sizeof(cxd5602pwbimu_data_t));
+      return count * sizeof(cxd5602pwbimu_data_t);
+    }
+
+  /* Q16: pick the smallest shift that fits the largest step. */
+  uint32_t dt_max = 0;
+  for (int i = 1; i < count; i++)
+    {
+      uint32_t dt = pending[i].timestamp - pending[i - 1].timestamp;
+      if (dt > dt_max) dt_max = dt;
+    }
+
+  uint8_t shift = 0;
+  while ((dt_max >> shift) > 0xffff) shift++;
+  ((ImuTelemetryHeader*)frame)->dt_shift = shift;
+
+  ImuTelemetryQ16Header qh;
+  qh.timestamp = pending[0].timestamp;
+  qh.accel_lsb = accel_lsb;
+  qh.gyro_lsb  = gyro_lsb;
+  qh.temp_lsb  = TEMP_LSB;
+  memcpy(payload, &qh, sizeof(qh));
+
+  ImuTelemetryQ16* q = (ImuTelemetryQ16*)(payload + sizeof(qh));
+  uint32_t ts = pending[0].timestamp;   // as the decoder will rebuild it
+
+  for (int i = 0; i < count; i++)
+    {
+      const cxd5602pwbimu_data_t& s = pending[i];
+      uint32_t step = (i == 0) ? 0 : ((s.timestamp - ts) + ((1u << shift) >> 1)) >> shift;
+      if (step > 0xffff) step = 0xffff;
+      ts += step << shift;
+
+      q[i].dt   = step;
+      q[i].temp = ::quantize(s.temp, TEMP_LSB);
+      q[i].gx   = ::quantize(s.gx, gyro_lsb);
+      q[i].gy   = ::quantize(s.gy, gyro_lsb);
+      q[i].gz   = ::quantize(s.gz, gyro_lsb);
+      q[i].ax   = ::quantize(s.ax, accel_lsb);
+      q[i].ay   = ::quantize(s.ay, accel_lsb);
+      q[i].az   = ::quantize(s.az, accel_lsb);
+    }
+
+  return sizeof(qh) + count * sizeof(ImuTelemetryQ16);
+}
+
+bool ImuTelemetry::sendFrame()
+{
+  ImuTelemetryHeader* h = (ImuTelemetryHeader*)frame;
+  uint8_t* payload = frame + sizeof(ImuTelemetryHeader);
+
+  h->type     = type;
+  h->count    = count;
+  h->seq      = seq++;
+  h->fields   = fields;
+  h->dt_shift = 0;
+  h->reserved = 0;
+
+  size_t n = (type == IMU_TLM_F32) ? count * fields * sizeof(float) : packSamples(payload);
+  n += sizeof(ImuTelemetryHeader);
+
+  uint16_t crc = crc16(frame, n);
+  frame[n++] = crc & 0xff;
+  frame[n++] = crc >> 8;
+
+  size_t m = cobs_encode(frame, n, encoded);
+  count = 0;
+
+  if (stream->write(encoded, m) != m)
+    {
+      printf("ERROR: telemetry write failed.\n");
+      return false;
+    }
+  sent += m;
+  return true;
+}
+
+/****************************************************************************
+ * Frame accessors
+ ****************************************************************************/
+bool ImuTelemetryFrame::sample(int i, cxd5602pwbimu_data_t& out) const
+{
+  if (i < 0 || i >= header->count) return false;
+
+  if (header->type == IMU_TLM_RAW)
+    {
+      memcpy(&out, payload + i * sizeof(out), sizeof(out));
+      return true;
+    }
+  if (header->type != IMU_TLM_Q16) return false;
+
+  ImuTelemetryQ16Header qh;
+  ImuTelemetryQ16       q;
+  const uint8_t*        p = payload + sizeof(qh);
+
+  memcpy(&qh, payload, sizeof(qh));
+
+  uint32_t ts = qh.timestamp;
+  for (int k = 0; k <= i; k++)
+    {
+      memcpy(&q, p + k * sizeof(q), sizeof(q));
+      ts += (uint32_t)q.dt << header->dt_shift;
+    }
+
+  out.timestamp = ts;
+  out.temp = q.temp * qh.temp_lsb;
+  out.gx   = q.gx * qh.gyro_lsb;
+  out.gy   = q.gy * qh.gyro_lsb;
+  out.gz   = q.gz * qh.gyro_lsb;
+  out.ax   = q.ax * qh.accel_lsb;
+  out.ay   = q.ay * qh.accel_lsb;
+  out.az   = q.az * qh.accel_lsb;
+
+  return true;
+}
+
+bool ImuTelemetryFrame::record(int i, float* out) const
+{
+  if (header->type != IMU_TLM_F32 || i < 0 || i >= header->count) return false;
+
+  memcpy(out, payload + i * header->fields * sizeof(float), header->fields * sizeof(float));
+  return true;
+}
+
+/****************************************************************************
+ * Decoder
+ ****************************************************************************/
+ImuTelemetryDecoder::ImuTelemetryDecoder()
+  : handler(NULL), handler_arg(NULL)
+{
+  reset();
+}
+
+void ImuTelemetryDecoder::reset()
+{
+  buf_len  = 0;
+  overflow = false;
+  has_seq  = false;
+  next_seq = 0;
+  memset(&stat, 0, sizeof(stat));
+}
+
+int ImuTelemetryDecoder::feed(const uint8_t* data, size_t n)
+{
+  int frames = 0;
+
+  stat.bytes += n;
+
+  for (size_t i = 0; i < n; i++)
+    {
+      if (data[i] != 0)
+        {
+          if (buf_len < sizeof(buf)) buf[buf_len++] = data[i];
+          else                       overflow = true;
+          continue;
+        }
+
+      /* Delimiter: an empty frame is just resynchronization. */
+      if (buf_len > 0)
+        {
+          if (overflow)
+            {
+              stat.format_errors++;
+            }
+          else if (decodeFrame())
+            {
+              frames++;
+            }
+        }
+      buf_len  = 0;
+      overflow = false;
+    }
+
+  return frames;
+}
+
+bool ImuTelemetryDecoder::decodeFrame()
+{
+  size_t n = cobs_decode(buf, buf_len, frame, sizeof(frame));
+
+  if (n < sizeof(ImuTelemetryHeader) + 2)
+    {
+      stat.format_errors++;
+      return false;
+    }
+
+  uint16_t crc = frame[n - 2] | (frame[n - 1] << 8);
+  if (crc16(frame, n - 2) != crc)
+    {
+      stat.crc_errors++;
+      return false;
+    }
+
+  const ImuTelemetryHeader* h = (const ImuTelemetryHeader*)frame;
+  size_t payload = n - 2 - sizeof(ImuTelemetryHeader);
+  size_t expect;
+
+  switch (h->type)
+    {
+      case IMU_TLM_RAW: expect = h->count * sizeof(cxd5602pwbimu_data_t); break;
+      case IMU_TLM_Q16: expect = sizeof(ImuTelemetryQ16Header) + h->count * sizeof(ImuTelemetryQ16); break;
+      case IMU_TLM_F32: expect = h->count * h->fields * sizeof(float); break;
+      default:          expect = (size_t)-1; break;
+    }
+  if (payload != expect)
+    {
+      stat.format_errors++;
+      return false;
+    }
+
+  if (has_seq && h->seq != next_seq)
+    {
+      stat.lost_frames += (uint16_t)(h->seq - next_seq);
+    }
+  has_seq  = true;
+  next_seq = h->seq + 1;
+
+  stat.frames++;
+  stat.samples += h->count;
+
+  if (handler)
+    {
+      ImuTelemetryFrame f;
+      f.header  = h;
+      f.payload = frame + sizeof(ImuTelemetryHeader);
+      handler(f, handler_arg);
+    }
+
+  return true;
+}
@@ -0,0 +1,193 @@
+/*
+ *  ImuTelemetry.h - Framed binary telemetry for the serial links.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _IMU_TELEMETRY_H_
+#define _IMU_TELEMETRY_H_
+
+#include "SpresenseIMU.h"
+#include "ImuLog.h"
+
+/****************************************************************************
+ * Frame format (all little endian)
+ *
+ *   COBS( ImuTelemetryHeader | payload | crc16 ) 0x00
+ *
+ *   crc16   : CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF) of header and
+ *             payload
+ *   seq     : +1 per frame; a gap in the decoder means lost frames
+ *
+ * Payload by type:
+ *   IMU_TLM_RAW : count * cxd5602pwbimu_data_t (32 bytes)
+ *   IMU_TLM_Q16 : ImuTelemetryQ16Header, then count * ImuTelemetryQ16
+ *                 (16 bytes). dt is the timestamp step >> dt_shift.
+ *   IMU_TLM_F32 : count * fields floats (quaternions, positions, ...)
+ ****************************************************************************/
+
+#define IMU_TLM_RAW         (1)
+#define IMU_TLM_Q16         (2)
+#define IMU_TLM_F32         (3)
+
+#define IMU_TLM_MAX_BATCH   (32)
+#define IMU_TLM_MAX_FIELDS  (8)
+
+struct __attribute__((packed)) ImuTelemetryHeader {
+  uint8_t  type;
+  uint8_t  count;
+  uint16_t seq;
+  uint8_t  fields;            // floats per record (F32)
+  uint8_t  dt_shift;          // Q16
+  uint16_t reserved;
+};
+
+struct __attribute__((packed)) ImuTelemetryQ16Header {
+  uint32_t timestamp;         // first sample
+  float    accel_lsb;         // m/s^2 per count
+  float    gyro_lsb;          // rad/s per count
+  float    temp_lsb;          // degC per count
+};
+
+struct __attribute__((packed)) ImuTelemetryQ16 {
+  uint16_t dt;
+  int16_t  temp;
+  int16_t  gx, gy, gz;
+  int16_t  ax, ay, az;
+};
+
+#define IMU_TLM_MAX_PAYLOAD (sizeof(ImuTelemetryQ16Header) + \
+                             IMU_TLM_MAX_BATCH * sizeof(cxd5602pwbimu_data_t))
+#define IMU_TLM_MAX_FRAME   (sizeof(ImuTelemetryHeader) + IMU_TLM_MAX_PAYLOAD + 2)
+
+/**************************************************************************
+ * ImuTelemetry (encoder)
+ *
+ *  Samples are collected into a frame of `batch` samples and sent with a
+ *  single write() on the stream (e.g. ImuLogStreamAdapter<USBSerial>).
+ *  At 1920 Hz with a batch of 8 that is ~19 bytes per sample quantized
+ *  and ~34 bytes raw, against ~46 bytes of CSV text with two decimals.
+ **************************************************************************/
+
+class ImuTelemetry {
+
+public:
+  ImuTelemetry();
+
+  // quantize: int16 at the configured ranges (IMU_TLM_Q16), else raw.
+  bool begin(ImuLogStream& out, int batch = 8, bool quantize = false,
+             int adrange = 4, int gdrange = 500);
+
+  bool write(const cxd5602pwbimu_data_t* s, size_t n);
+  bool write(const cxd5602pwbimu_data_t& s) { return write(&s, 1); }
+
+  // One record of `fields` floats (IMU_TLM_F32).
+  bool writeRecord(const float* v, int fields);
+
+  // Send a partially filled frame now.
+  bool flush();
+
+  uint16_t sequence() const { return seq; }
+  uint32_t bytesSent() const { return sent; }
+
+private:
+  bool open(int type, int fields);
+  size_t packSamples(uint8_t* payload);
+  bool sendFrame();
+
+  ImuLogStream* stream;
+  int      batch;
+  bool     quantize;
+  float    accel_lsb;
+  float    gyro_lsb;
+
+  int      type;
+  int      fields;
+  int      count;
+  uint16_t seq;
+  uint32_t sent;
+
+  // Samples are kept until the frame is sent, so the Q16 step scale
+  // can be chosen per frame. F32 records go straight into `frame`.
+  cxd5602pwbimu_data_t pending[IMU_TLM_MAX_BATCH];
+
+  uint8_t  frame[IMU_TLM_MAX_FRAME];
+  size_t   len;
+  uint8_t  encoded[IMU_TLM_MAX_FRAME + IMU_TLM_MAX_FRAME / 254 + 2];
+};
+
+/**************************************************************************
+ * ImuTelemetryDecoder
+ *
+ *  feed() any chunk of received bytes. Complete, CRC-checked frames are
+ *  passed to the handler; samples and records are read from the frame
+ *  with sample() / record().
+ **************************************************************************/
+
+class ImuTelemetryDecoder;
+
+struct ImuTelemetryFrame {
+  const ImuTelemetryHeader* header;
+  const uint8_t*            payload;
+
+  int  type() const  { return header->type; }
+  int  count() const { return header->count; }
+  bool sample(int i, cxd5602pwbimu_data_t& out) const;
+  bool record(int i, float* out) const;
+};
+
+struct ImuTelemetryStats {
+  uint32_t frames;
+  uint32_t samples;
+  uint32_t crc_errors;
+  uint32_t format_errors;
+  uint32_t lost_frames;       // sequence gaps
+  uint32_t bytes;
+};
+
+class ImuTelemetryDecoder {
+
+public:
+  typedef void (*Handler)(const ImuTelemetryFrame& frame, void* arg);
+
+  ImuTelemetryDecoder();
+
+  void setHandler(Handler fn, void* arg = NULL) { handler = fn; handler_arg = arg; }
+  void reset();
+
+  // Returns the number of good frames completed by this chunk.
+  int feed(const uint8_t* data, size_t len);
+
+  const ImuTelemetryStats& stats() const { return stat; }
+
+private:
+  bool decodeFrame();
+
+  Handler  handler;
+  void*    handler_arg;
+
+  uint8_t  buf[IMU_TLM_MAX_FRAME + IMU_TLM_MAX_FRAME / 254 + 2];
+  size_t   buf_len;
+  bool     overflow;
+
+  uint8_t  frame[IMU_TLM_MAX_FRAME];
+  bool     has_seq;
+  uint16_t next_seq;
+
+  ImuTelemetryStats stat;
+};
+
+#endif // _IMU_TELEMETRY_H_
@@ -0,0 +1,181 @@
+/*
+ *  InsIntegrator.cpp - Strapdown position / velocity integration.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "InsIntegrator.h"
+
+#include <math.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define DEFAULT_RESIDUAL_ALPHA  (0.01f)
+#define MAX_DT                  (0.1f)    // longer gaps are not integrated
+
+/****************************************************************************
+ * constructor / begin
+ ****************************************************************************/
+InsIntegrator::InsIntegrator()
+  : gravity(9.80665f), align_seconds(2.0f), residual_alpha(DEFAULT_RESIDUAL_ALPHA)
+{
+  begin();
+}
+
+void InsIntegrator::begin(float g, float seconds)
+{
+  gravity       = g;
+  align_seconds = seconds;
+
+  m0 = 1; m1 = m2 = m3 = 0;
+  mount_angle  = 0;
+  is_aligned   = (seconds <= 0);
+  align_count  = 0;
+  align_elapsed = 0;
+  align_sum[0] = align_sum[1] = align_sum[2] = 0;
+
+  reset();
+}
+
+void InsIntegrator::reset()
+{
+  for (int i = 0; i < 3; i++)
+    {
+      pos[i]      = 0;
+      vel[i]      = 0;
+      prev_acc[i] = 0;
+      residual[i] = 0;
+    }
+  last_t     = 0;
+  last_ticks = 0;
+  has_time   = false;
+  has_prev   = false;
+}
+
+/****************************************************************************
+ * mount correction: rotate the mean world accel onto +Z
+ ****************************************************************************/
+void InsIntegrator::computeMount()
+{
+  float gx = align_sum[0] / align_count;
+  float gy = align_sum[1] / align_count;
+  float gz = align_sum[2] / align_count;
+  float n  = sqrtf(gx * gx + gy * gy + gz * gz);
+
+  is_aligned = true;
+  if (n <= 0) return;
+  gx /= n; gy /= n; gz /= n;
+
+  /* Axis u x e3 = (gy, -gx, 0), angle acos(gz). */
+  float s = sqrtf(gx * gx + gy * gy);
+  mount_angle = atan2f(s, gz);
+  if (s < 1e-6f) return;
+
+  float h  = 0.5f * mount_angle;
+  float sh = sinf(h) / s;
+  m0 = cosf(h);
+  m1 =  gy * sh;
+  m2 = -gx * sh;
+  m3 = 0;
+}
+
+/****************************************************************************
+ * dt from the sample timestamps (0 for the first sample and for gaps)
+ ****************************************************************************/
+float InsIntegrator::stepDt(float t)
+{
+  float dt = has_time ? (t - last_t) : 0;
+  last_t   = t;
+  has_time = true;
+  return (dt < 0 || dt > MAX_DT) ? 0 : dt;
+}
+
+float InsIntegrator::stepDt(uint32_t ticks)
+{
+  /* Unsigned difference handles the 32-bit wrap (every ~224 s). */
+  float dt   = has_time ? ImuClock::toSeconds((uint32_t)(ticks - last_ticks)) : 0;
+  last_ticks = ticks;
+  last_t     = ticks / (float)IMU_TICKS_PER_SEC;
+  has_time   = true;
+  return (dt > MAX_DT) ? 0 : dt;
+}
+
+/****************************************************************************
+ * step
+ ****************************************************************************/
+void InsIntegrator::step(float dt, float q0, float q1, float q2, float q3,
+                         float ax, float ay, float az, bool is_static)
+{
+  /* Fused mount * attitude quaternion (skipped while the mount is identity). */
+  if (m0 != 1.0f)
+    {
+      float w = m0 * q0 - m1 * q1 - m2 * q2 - m3 * q3;
+      float x = m0 * q1 + m1 * q0 + m2 * q3 - m3 * q2;
+      float y = m0 * q2 - m1 * q3 + m2 * q0 + m3 * q1;
+      float z = m0 * q3 + m1 * q2 - m2 * q1 + m3 * q0;
+      q0 = w; q1 = x; q2 = y; q3 = z;
+    }
+
+  /* Rotation matrix rows, then a_world = R a_body */
+  float x2 = q1 + q1, y2 = q2 + q2, z2 = q3 + q3;
+  float xx = q1 * x2, yy = q2 * y2, zz = q3 * z2;
+  float xy = q1 * y2, xz = q1 * z2, yz = q2 * z2;
+  float wx = q0 * x2, wy = q0 * y2, wz = q0 * z2;
+
+  float wax = (1 - yy - zz) * ax + (xy - wz) * ay + (xz + wy) * az;
+  float way = (xy + wz) * ax + (1 - xx - zz) * ay + (yz - wx) * az;
+  float waz = (xz - wy) * ax + (yz + wx) * ay + (1 - xx - yy) * az;
+
+  if (!is_aligned)
+    {
+      if (align_count > 0) align_elapsed += dt;
+      align_sum[0] += wax;
+      align_sum[1] += way;
+      align_sum[2] += waz;
+      align_count++;
+      if (align_elapsed >= align_seconds) computeMount();
+      return;
+    }
+
+  waz -= gravity;
+
+  if (!has_prev) dt = 0;
+  has_prev = true;
+
+  if (is_static)
+    {
+      /* ZUPT: hold velocity, learn what "zero" looks like. */
+      residual[0] += residual_alpha * (wax - residual[0]);
+      residual[1] += residual_alpha * (way - residual[1]);
+      residual[2] += residual_alpha * (waz - residual[2]);
+      vel[0] = vel[1] = vel[2] = 0;
+      prev_acc[0] = prev_acc[1] = prev_acc[2] = 0;
+      return;
+    }
+
+  float a[3] = { wax - residual[0], way - residual[1], waz - residual[2] };
+  float h = 0.5f * dt;
+
+  for (int i = 0; i < 3; i++)
+    {
+      float v = vel[i] + (prev_acc[i] + a[i]) * h;
+      pos[i] += (vel[i] + v) * h;
+      vel[i]  = v;
+      prev_acc[i] = a[i];
+    }
+}
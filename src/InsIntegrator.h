@@ -0,0 +1,115 @@
+/*
+ *  InsIntegrator.h - Strapdown position / velocity integration.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _INS_INTEGRATOR_H_
+#define _INS_INTEGRATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ImuClock.h"
+#include "ImuSpan.h"
+
+/**************************************************************************
+ * InsIntegrator
+ *
+ *  Input per sample (any struct with these members, e.g. the
+ *  OrientationData_t blocks of the position example):
+ *    timestamp, q0..q3 (body -> world), ax, ay, az (m/s^2, body),
+ *    isStatic (ZUPT flag)
+ *  The timestamp is either float seconds or the uint32_t 19.2 MHz count
+ *  of the sensor; with the count, dt is the exact integer difference and
+ *  the 32-bit wrap is handled.
+ *
+ *  Per sample the accel is rotated to the world frame with one 3x3
+ *  matrix built from the attitude, with the mount correction already
+ *  folded into the quaternion, then gravity is removed and velocity and
+ *  position are integrated with the trapezoidal rule. Each sample uses
+ *  its own attitude, so the rotation of the specific force within a
+ *  step (sculling) is accounted for to first order.
+ *
+ *  Alignment: for the first `align_seconds` after the first sample the
+ *  world-frame accel is averaged, and the mount rotation that takes it
+ *  onto +Z is computed. No integration happens before that.
+ *
+ *  ZUPT: while isStatic is set, velocity is held at zero and the
+ *  world-frame residual accel is tracked, then subtracted while moving.
+ **************************************************************************/
+
+class InsIntegrator {
+
+public:
+  InsIntegrator();
+
+  void begin(float gravity = 9.80665f, float align_seconds = 2.0f);
+
+  // Zero position and velocity, keep the mount alignment.
+  void reset();
+
+  void setGravity(float g) { gravity = g; }
+  void setResidualGain(float alpha) { residual_alpha = alpha; }
+
+  template <class T>
+  void update(const T* s, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+      step(stepDt(s[i].timestamp), s[i].q0, s[i].q1, s[i].q2, s[i].q3,
+           s[i].ax, s[i].ay, s[i].az, s[i].isStatic);
+    }
+  }
+
+  template <class T>
+  void update(ImuSpan<T> block) { update(block.data, block.size); }
+
+  bool aligned() const { return is_aligned; }
+  float mountAngle() const { return mount_angle; }   // rad
+
+  float timestamp() const { return last_t; }   // s (the count / 19.2 MHz for ticks)
+  void getPosition(float p[3]) const { p[0] = pos[0]; p[1] = pos[1]; p[2] = pos[2]; }
+  void getVelocity(float v[3]) const { v[0] = vel[0]; v[1] = vel[1]; v[2] = vel[2]; }
+
+private:
+  float stepDt(float t);
+  float stepDt(uint32_t ticks);
+  void step(float dt, float q0, float q1, float q2, float q3,
+            float ax, float ay, float az, bool is_static);
+  void computeMount();
+
+  float gravity;
+  float align_seconds;
+  float residual_alpha;
+
+  // Mount correction (world -> corrected world), as a quaternion
+  float m0, m1, m2, m3;
+  bool  is_aligned;
+  float mount_angle;
+  float align_elapsed;
+  float align_sum[3];
+  int   align_count;
+
+  float pos[3];
+  float vel[3];
+  float prev_acc[3];       // world-frame linear accel of the previous sample
+  float residual[3];       // world-frame accel seen while static
+  float    last_t;
+  uint32_t last_ticks;
+  bool     has_time;
+  bool     has_prev;
+};
+
+#endif // _INS_INTEGRATOR_H_
@@ -0,0 +1,311 @@
+/*
+ *  SpresenseAhrs.cpp - Madgwick / Mahony AHRS for the Spresense IMU.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "SpresenseAhrs.h"
+
+#include <string.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define TICKS_PER_SEC   (19200000.0f)
+#define RAD2DEG         (57.29578f)
+
+#define DEFAULT_BETA    (0.1f)
+#define DEFAULT_KP      (0.5f)
+#define DEFAULT_KI      (0.0f)
+
+static inline float invSqrt(float x)
+{
+#if IMU_AHRS_FAST_INVSQRT
+  /* Moroz et al. constants: one Newton step, max relative error 6.5e-4. */
+  int32_t i;
+  float   y;
+  memcpy(&i, &x, sizeof(i));
+  i = 0x5f1ffff9 - (i >> 1);
+  memcpy(&y, &i, sizeof(y));
+  return y * 0.703952253f * (2.38924456f - x * y * y);
+#else
+  return 1.0f / sqrtf(x);
+#endif
+}
+
+/****************************************************************************
+ * constructor / begin
+ ****************************************************************************/
+SpresenseAhrs::SpresenseAhrs(Algorithm algorithm)
+  : algo(algorithm), beta(DEFAULT_BETA),
+    two_kp(2 * DEFAULT_KP), two_ki(2 * DEFAULT_KI),
+    nominal_dt(1.0f / 60), max_dt(IMU_AHRS_MAX_GAP / 60.0f)
+{
+  bias[0] = bias[1] = bias[2] = 0;
+  reset();
+}
+
+void SpresenseAhrs::begin(float rate)
+{
+  nominal_dt = 1.0f / rate;
+  max_dt     = IMU_AHRS_MAX_GAP * nominal_dt;
+  reset();
+}
+
+void SpresenseAhrs::reset()
+{
+  q0 = 1; q1 = q2 = q3 = 0;
+  integral[0] = integral[1] = integral[2] = 0;
+  prev_ts      = 0;
+  has_prev     = false;
+  last_time    = 0;
+  last_temp    = 0;
+  angles_valid = false;
+}
+
+/****************************************************************************
+ * update
+ ****************************************************************************/
+float SpresenseAhrs::stepDt(uint32_t timestamp)
+{
+  float dt = nominal_dt;
+  if (has_prev)
+    {
+      /* Unsigned difference handles the 32-bit wrap (every ~224 s). */
+      float d = (uint32_t)(timestamp - prev_ts) / TICKS_PER_SEC;
+      if (d > 0 && d <= max_dt) dt = d;
+    }
+  prev_ts  = timestamp;
+  has_prev = true;
+  return dt;
+}
+
+void SpresenseAhrs::reconfigured(const cxd5602pwbimu_data_t& marker)
+{
+  ImuReconfig c;
+  if (imuMarkerConfig(marker, c) && c.rate > 0)
+    {
+      nominal_dt = 1.0f / c.rate;
+      max_dt     = IMU_AHRS_MAX_GAP * nominal_dt;
+    }
+  has_prev = false;
+}
+
+void SpresenseAhrs::update(const cxd5602pwbimu_data_t& s)
+{
+  update(&s, 1);
+}
+
+void SpresenseAhrs::update(const cxd5602pwbimu_data_t* s, size_t n)
+{
+  if (n == 0) return;
+
+  /* A reconfiguration marker splits the batch: no dt across it. */
+  for (size_t i = 0; i < n; i++)
+    {
+      if (imuIsMarker(s[i]))
+        {
+          update(s, i);
+          reconfigured(s[i]);
+          update(s + i + 1, n - i - 1);
+          return;
+        }
+    }
+
+  if (algo == MAHONY)
+    {
+      for (size_t i = 0; i < n; i++) mahony(s[i], stepDt(s[i].timestamp));
+    }
+  else
+    {
+      for (size_t i = 0; i < n; i++) madgwick(s[i], stepDt(s[i].timestamp));
+    }
+
+  last_time    = s[n - 1].timestamp;
+  last_temp    = s[n - 1].temp;
+  angles_valid = false;
+}
+
+/****************************************************************************
+ * Madgwick (gradient descent, IMU only)
+ ****************************************************************************/
+void SpresenseAhrs::madgwick(const cxd5602pwbimu_data_t& s, float dt)
+{
+  float gx = s.gx - bias[0];
+  float gy = s.gy - bias[1];
+  float gz = s.gz - bias[2];
+  float ax = s.ax, ay = s.ay, az = s.az;
+
+  /* Rate of change of quaternion from gyroscope */
+  float qDot1 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+  float qDot2 = 0.5f * ( q0 * gx + q2 * gz - q3 * gy);
+  float qDot3 = 0.5f * ( q0 * gy - q1 * gz + q3 * gx);
+  float qDot4 = 0.5f * ( q0 * gz + q1 * gy - q2 * gx);
+
+  float a2 = ax * ax + ay * ay + az * az;
+  if (a2 > 0.0f)
+    {
+      float recipNorm = invSqrt(a2);
+      ax *= recipNorm;
+      ay *= recipNorm;
+      az *= recipNorm;
+
+      float _2q0 = 2.0f * q0;
+      float _2q1 = 2.0f * q1;
+      float _2q2 = 2.0f * q2;
+      float _2q3 = 2.0f * q3;
+      float _4q0 = 4.0f * q0;
+      float _4q1 = 4.0f * q1;
+      float _4q2 = 4.0f * q2;
+      float _8q1 = 8.0f * q1;
+      float _8q2 = 8.0f * q2;
+      float q0q0 = q0 * q0;
+      float q1q1 = q1 * q1;
+      float q2q2 = q2 * q2;
+      float q3q3 = q3 * q3;
+
+      /* Gradient of the gravity direction error */
+      float s0 = _4q0 * q2q2 + _2q2 * ax + _4q0 * q1q1 - _2q1 * ay;
+      float s1 = _4q1 * q3q3 - _2q3 * ax + 4.0f * q0q0 * q1 - _2q0 * ay - _4q1 + _8q1 * q1q1 + _8q1 * q2q2 + _4q1 * az;
+      float s2 = 4.0f * q0q0 * q2 + _2q0 * ax + _4q2 * q3q3 - _2q3 * ay - _4q2 + _8q2 * q1q1 + _8q2 * q2q2 + _4q2 * az;
+      float s3 = 4.0f * q1q1 * q3 - _2q1 * ax + 4.0f * q2q2 * q3 - _2q2 * ay;
+
+      float sn = s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3;
+      if (sn > 0.0f)
+        {
+          recipNorm = invSqrt(sn);
+          qDot1 -= beta * s0 * recipNorm;
+          qDot2 -= beta * s1 * recipNorm;
+          qDot3 -= beta * s2 * recipNorm;
+          qDot4 -= beta * s3 * recipNorm;
+        }
+    }
+
+  q0 += qDot1 * dt;
+  q1 += qDot2 * dt;
+  q2 += qDot3 * dt;
+  q3 += qDot4 * dt;
+
+  float recipNorm = invSqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+  q0 *= recipNorm;
+  q1 *= recipNorm;
+  q2 *= recipNorm;
+  q3 *= recipNorm;
+}
+
+/****************************************************************************
+ * Mahony (complementary PI, IMU only)
+ ****************************************************************************/
+void SpresenseAhrs::mahony(const cxd5602pwbimu_data_t& s, float dt)
+{
+  float gx = s.gx - bias[0];
+  float gy = s.gy - bias[1];
+  float gz = s.gz - bias[2];
+  float ax = s.ax, ay = s.ay, az = s.az;
+
+  float a2 = ax * ax + ay * ay + az * az;
+  if (a2 > 0.0f)
+    {
+      float recipNorm = invSqrt(a2);
+      ax *= recipNorm;
+      ay *= recipNorm;
+      az *= recipNorm;
+
+      /* Estimated direction of gravity (half) */
+      float halfvx = q1 * q3 - q0 * q2;
+      float halfvy = q0 * q1 + q2 * q3;
+      float halfvz = q0 * q0 - 0.5f + q3 * q3;
+
+      /* Error is the cross product of measured and estimated gravity */
+      float halfex = ay * halfvz - az * halfvy;
+      float halfey = az * halfvx - ax * halfvz;
+      float halfez = ax * halfvy - ay * halfvx;
+
+      if (two_ki > 0.0f)
+        {
+          integral[0] += two_ki * halfex * dt;
+          integral[1] += two_ki * halfey * dt;
+          integral[2] += two_ki * halfez * dt;
+          gx += integral[0];
+          gy += integral[1];
+          gz += integral[2];
+        }
+      else
+        {
+          integral[0] = integral[1] = integral[2] = 0.0f;
+        }
+
+      gx += two_kp * halfex;
+      gy += two_kp * halfey;
+      gz += two_kp * halfez;
+    }
+
+  gx *= 0.5f * dt;
+  gy *= 0.5f * dt;
+  gz *= 0.5f * dt;
+
+  float qa = q0, qb = q1, qc = q2;
+  q0 += (-qb * gx - qc * gy - q3 * gz);
+  q1 += ( qa * gx + qc * gz - q3 * gy);
+  q2 += ( qa * gy - qb * gz + q3 * gx);
+  q3 += ( qa * gz + qb * gy - qc * gx);
+
+  float recipNorm = invSqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+  q0 *= recipNorm;
+  q1 *= recipNorm;
+  q2 *= recipNorm;
+  q3 *= recipNorm;
+}
+
+/****************************************************************************
+ * outputs
+ ****************************************************************************/
+pwbQuaternionData SpresenseAhrs::getQuaternion() const
+{
+  pwbQuaternionData q(q0, q1, q2, q3);
+  q.timestamp = last_time;
+  q.temp      = last_temp;
+  return q;
+}
+
+void SpresenseAhrs::computeAngles()
+{
+  roll  = atan2f(q0 * q1 + q2 * q3, 0.5f - q1 * q1 - q2 * q2);
+  // Rounding can push sinp just past +-1 near +-90 deg, where asinf() is NaN.
+  float sinp = -2.0f * (q1 * q3 - q0 * q2);
+  pitch = fabsf(sinp) >= 1 ? copysignf(M_PI/2, sinp) : asinf(sinp);
+  yaw   = atan2f(q1 * q2 + q0 * q3, 0.5f - q2 * q2 - q3 * q3);
+  angles_valid = true;
+}
+
+float SpresenseAhrs::getRoll()
+{
+  if (!angles_valid) computeAngles();
+  return roll * RAD2DEG;
+}
+
+float SpresenseAhrs::getPitch()
+{
+  if (!angles_valid) computeAngles();
+  return pitch * RAD2DEG;
+}
+
+float SpresenseAhrs::getYaw()
+{
+  if (!angles_valid) computeAngles();
+  return yaw * RAD2DEG + 180.0f;
+}
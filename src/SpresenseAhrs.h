@@ -0,0 +1,112 @@
+/*
+ *  SpresenseAhrs.h - Madgwick / Mahony AHRS for the Spresense IMU.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _SPRESENSE_AHRS_H_
+#define _SPRESENSE_AHRS_H_
+
+#include "SpresenseIMU.h"
+#include "ImuSpan.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+// 1: bit-trick inverse square root with one tuned Newton step (relative
+//    error < 1e-3, renormalized every sample). 0: 1.0f / sqrtf().
+#ifndef IMU_AHRS_FAST_INVSQRT
+#define IMU_AHRS_FAST_INVSQRT  (1)
+#endif
+
+// A timestamp gap longer than this many nominal periods (a stall or the
+// first sample) is integrated with the nominal period instead.
+#define IMU_AHRS_MAX_GAP       (4)
+
+/**************************************************************************
+ * SpresenseAhrs
+ *
+ *  Gyro in rad/s and accel in any unit (only the direction is used),
+ *  exactly as delivered in cxd5602pwbimu_data_t. dt comes from the
+ *  19.2 MHz timestamps of consecutive samples.
+ *
+ *  Euler getters follow the MadgwickAHRS library: degrees, with yaw
+ *  offset by +180 to the 0..360 range.
+ **************************************************************************/
+
+class SpresenseAhrs {
+
+public:
+  enum Algorithm {
+    MADGWICK = 0,
+    MAHONY
+  };
+
+  explicit SpresenseAhrs(Algorithm algorithm = MADGWICK);
+
+  // Nominal sampling rate (Hz), used for the first sample and after gaps.
+  void begin(float rate);
+  void reset();
+
+  void setAlgorithm(Algorithm a) { algo = a; }
+  void setBeta(float b) { beta = b; }                          // Madgwick gain
+  void setGains(float kp, float ki) { two_kp = 2 * kp; two_ki = 2 * ki; }  // Mahony
+  void setGyroBias(float bx, float by, float bz) { bias[0] = bx; bias[1] = by; bias[2] = bz; }
+
+  void update(const cxd5602pwbimu_data_t& s);
+  void update(const cxd5602pwbimu_data_t* s, size_t n);
+  void update(ImuSpan<cxd5602pwbimu_data_t> span) { update(span.data, span.size); }
+
+  float getQ0() const { return q0; }
+  float getQ1() const { return q1; }
+  float getQ2() const { return q2; }
+  float getQ3() const { return q3; }
+
+  // timestamp (ticks) and temp of the last sample.
+  pwbQuaternionData getQuaternion() const;
+
+  float getRoll();
+  float getPitch();
+  float getYaw();
+
+private:
+  float stepDt(uint32_t timestamp);
+  void reconfigured(const cxd5602pwbimu_data_t& marker);
+  void madgwick(const cxd5602pwbimu_data_t& s, float dt);
+  void mahony(const cxd5602pwbimu_data_t& s, float dt);
+  void computeAngles();
+
+  Algorithm algo;
+  float beta;
+  float two_kp, two_ki;
+  float bias[3];
+  float q0, q1, q2, q3;
+  float integral[3];        // Mahony integral feedback
+
+  float    nominal_dt;
+  float    max_dt;
+  uint32_t prev_ts;
+  bool     has_prev;
+
+  float last_time;
+  float last_temp;
+
+  bool  angles_valid;
+  float roll, pitch, yaw;
+};
+
+#endif // _SPRESENSE_AHRS_H_
@@ -0,0 +1,383 @@
+/*
+ *  SpresenseEskf.cpp - Error-state Kalman filter for attitude and gyro bias.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "SpresenseEskf.h"
+
+#include <string.h>
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define TICKS_PER_SEC        (19200000.0f)
+#define MAX_GAP              (4)
+
+#define DEFAULT_GYRO_NOISE   (1e-3f)    // rad/s/sqrt(Hz)
+#define DEFAULT_BIAS_WALK    (1e-4f)    // rad/s^2/sqrt(Hz)
+#define DEFAULT_ACCEL_NOISE  (0.1f)     // m/s^2
+#define DEFAULT_ACCEL_GATE   (0.5f)     // m/s^2
+#define DEFAULT_BIAS_SIGMA   (0.01f)    // rad/s
+#define INITIAL_ATT_SIGMA    (0.1f)     // rad, roll/pitch after alignment
+#define INITIAL_YAW_SIGMA    (3.1416f)  // rad, yaw is unknown
+
+#define SMALL_ANGLE2         (1e-2f)
+
+typedef float Mat3[3][3];
+
+/* M -= [p]x M : first-order rotation of the rows by -p */
+static inline void rotate_rows(Mat3 M, float px, float py, float pz)
+{
+  for (int c = 0; c < 3; c++)
+    {
+      float m0 = M[0][c], m1 = M[1][c], m2 = M[2][c];
+      M[0][c] = m0 + pz * m1 - py * m2;
+      M[1][c] = m1 - pz * m0 + px * m2;
+      M[2][c] = m2 + py * m0 - px * m1;
+    }
+}
+
+/* out = X * Y */
+static inline void mul3(Mat3 out, const Mat3 X, const Mat3 Y)
+{
+  for (int r = 0; r < 3; r++)
+    for (int c = 0; c < 3; c++)
+      out[r][c] = X[r][0] * Y[0][c] + X[r][1] * Y[1][c] + X[r][2] * Y[2][c];
+}
+
+/* out = X * Y^T */
+static inline void mul3t(Mat3 out, const Mat3 X, const Mat3 Y)
+{
+  for (int r = 0; r < 3; r++)
+    for (int c = 0; c < 3; c++)
+      out[r][c] = X[r][0] * Y[c][0] + X[r][1] * Y[c][1] + X[r][2] * Y[c][2];
+}
+
+/****************************************************************************
+ * constructor / begin
+ ****************************************************************************/
+SpresenseEskf::SpresenseEskf()
+  : gyro_noise(DEFAULT_GYRO_NOISE), bias_walk(DEFAULT_BIAS_WALK),
+    accel_noise(DEFAULT_ACCEL_NOISE), accel_gate(DEFAULT_ACCEL_GATE),
+    init_bias_sigma(DEFAULT_BIAS_SIGMA),
+    nominal_dt(1.0f / 60), max_dt(MAX_GAP / 60.0f)
+{
+  bias[0] = bias[1] = bias[2] = 0;
+  reset();
+}
+
+void SpresenseEskf::begin(float rate)
+{
+  nominal_dt = 1.0f / rate;
+  max_dt     = MAX_GAP * nominal_dt;
+  reset();
+}
+
+void SpresenseEskf::setInitialBias(float bx, float by, float bz, float sigma)
+{
+  bias[0] = bx;
+  bias[1] = by;
+  bias[2] = bz;
+  init_bias_sigma = sigma;
+  for (int i = 3; i < 6; i++) P[i][i] = sigma * sigma;
+}
+
+void SpresenseEskf::reset()
+{
+  q0 = 1; q1 = q2 = q3 = 0;
+
+  memset(P, 0, sizeof(P));
+  P[0][0] = P[1][1] = INITIAL_ATT_SIGMA * INITIAL_ATT_SIGMA;
+  P[2][2] = INITIAL_YAW_SIGMA * INITIAL_YAW_SIGMA;
+  for (int i = 3; i < 6; i++) P[i][i] = init_bias_sigma * init_bias_sigma;
+
+  prev_ts    = 0;
+  has_prev   = false;
+  aligned    = false;
+  last_time  = 0;
+  last_temp  = 0;
+  n_updates  = 0;
+  n_rejected = 0;
+}
+
+float SpresenseEskf::stepDt(uint32_t timestamp)
+{
+  float dt = nominal_dt;
+  if (has_prev)
+    {
+      float d = (uint32_t)(timestamp - prev_ts) / TICKS_PER_SEC;
+      if (d > 0 && d <= max_dt) dt = d;
+    }
+  prev_ts  = timestamp;
+  has_prev = true;
+  return dt;
+}
+
+void SpresenseEskf::reconfigured(const cxd5602pwbimu_data_t& marker)
+{
+  ImuReconfig c;
+  if (imuMarkerConfig(marker, c) && c.rate > 0)
+    {
+      nominal_dt = 1.0f / c.rate;
+      max_dt     = MAX_GAP * nominal_dt;
+    }
+  has_prev = false;
+}
+
+/* Roll and pitch from gravity, yaw zero. */
+void SpresenseEskf::align(float ax, float ay, float az)
+{
+  pwbQuaternionData q;
+  q.fromEuler(atan2f(ay, az), atan2f(-ax, sqrtf(ay * ay + az * az)), 0);
+  q0 = q.q0; q1 = q.q1; q2 = q.q2; q3 = q.q3;
+  aligned = true;
+}
+
+/****************************************************************************
+ * update
+ ****************************************************************************/
+void SpresenseEskf::update(const cxd5602pwbimu_data_t* s, size_t n)
+{
+  if (n == 0) return;
+
+  /* A reconfiguration marker splits the batch: no dt across it. */
+  for (size_t i = 0; i < n; i++)
+    {
+      if (imuIsMarker(s[i]))
+        {
+          update(s, i);
+          reconfigured(s[i]);
+          update(s + i + 1, n - i - 1);
+          return;
+        }
+    }
+
+  float sa[3] = {0, 0, 0};
+  for (size_t i = 0; i < n; i++)
+    {
+      sa[0] += s[i].ax;
+      sa[1] += s[i].ay;
+      sa[2] += s[i].az;
+    }
+  float inv_n = 1.0f / n;
+  sa[0] *= inv_n; sa[1] *= inv_n; sa[2] *= inv_n;
+
+  if (!aligned) align(sa[0], sa[1], sa[2]);
+
+  /* Burst transition: dtheta' = A dtheta + B db, starting from I and 0. */
+  Mat3 A = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+  Mat3 B = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+  float T = 0;
+
+  for (size_t i = 0; i < n; i++)
+    {
+      float dt = stepDt(s[i].timestamp);
+      float h  = 0.5f * dt;
+      float wx = s[i].gx - bias[0];
+      float wy = s[i].gy - bias[1];
+      float wz = s[i].gz - bias[2];
+
+      /* Nominal attitude: q = q * exp(w dt / 2) */
+      float vx = wx * h, vy = wy * h, vz = wz * h;
+      float a2 = vx * vx + vy * vy + vz * vz;
+      float c, k;
+      if (a2 < SMALL_ANGLE2)
+        {
+          c = 1.0f - a2 * (0.5f - a2 * (1.0f / 24.0f));
+          k = 1.0f - a2 * ((1.0f / 6.0f) - a2 * (1.0f / 120.0f));
+        }
+      else
+        {
+          float a = sqrtf(a2);
+          c = cosf(a);
+          k = sinf(a) / a;
+        }
+      vx *= k; vy *= k; vz *= k;
+
+      float r0 = q0 * c  - q1 * vx - q2 * vy - q3 * vz;
+      float r1 = q0 * vx + q1 * c  + q2 * vz - q3 * vy;
+      float r2 = q0 * vy - q1 * vz + q2 * c  + q3 * vx;
+      float r3 = q0 * vz + q1 * vy - q2 * vx + q3 * c;
+      q0 = r0; q1 = r1; q2 = r2; q3 = r3;
+
+      /* Error transition: F = [I - [w dt]x, -I dt; 0, I] */
+      float px = wx * dt, py = wy * dt, pz = wz * dt;
+      rotate_rows(A, px, py, pz);
+      rotate_rows(B, px, py, pz);
+      B[0][0] -= dt; B[1][1] -= dt; B[2][2] -= dt;
+      T += dt;
+    }
+
+  float qn = 1.0f / sqrtf(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+  q0 *= qn; q1 *= qn; q2 *= qn; q3 *= qn;
+
+  propagate(A, B, T);
+
+  float an = sqrtf(sa[0] * sa[0] + sa[1] * sa[1] + sa[2] * sa[2]);
+  if (fabsf(an - IMU_GRAVITY) <= accel_gate)
+    {
+      correct(sa[0] / an, sa[1] / an, sa[2] / an);
+      n_updates++;
+    }
+  else
+    {
+      n_rejected++;
+    }
+
+  last_time = s[n - 1].timestamp;
+  last_temp = s[n - 1].temp;
+}
+
+/****************************************************************************
+ * P = F P F^T + Q with F = [A B; 0 I]
+ ****************************************************************************/
+void SpresenseEskf::propagate(const Mat3 A, const Mat3 B, float T)
+{
+  Mat3 Ptt, Ptb, Pbb, X, Y, W;
+
+  for (int r = 0; r < 3; r++)
+    for (int c = 0; c < 3; c++)
+      {
+        Ptt[r][c] = P[r][c];
+        Ptb[r][c] = P[r][3 + c];
+        Pbb[r][c] = P[3 + r][3 + c];
+      }
+
+  /* X = A Ptt + B Ptb^T,  Y = A Ptb + B Pbb */
+  mul3(X, A, Ptt);
+  mul3t(W, B, Ptb);
+  for (int r = 0; r < 3; r++) for (int c = 0; c < 3; c++) X[r][c] += W[r][c];
+  mul3(Y, A, Ptb);
+  mul3(W, B, Pbb);
+  for (int r = 0; r < 3; r++) for (int c = 0; c < 3; c++) Y[r][c] += W[r][c];
+
+  /* Ptt' = X A^T + Y B^T */
+  mul3t(Ptt, X, A);
+  mul3t(W, Y, B);
+
+  float qt = gyro_noise * gyro_noise * T;
+  float qb = bias_walk * bias_walk * T;
+
+  for (int r = 0; r < 3; r++)
+    for (int c = 0; c < 3; c++)
+      {
+        float v = Ptt[r][c] + W[r][c];
+        P[r][c]         = v;
+        P[r][3 + c]     = Y[r][c];
+        P[3 + c][r]     = Y[r][c];
+      }
+  for (int i = 0; i < 3; i++)
+    {
+      P[i][i]         += qt;
+      P[3 + i][3 + i] += qb;
+    }
+
+  /* Keep the theta block symmetric against rounding. */
+  for (int r = 0; r < 3; r++)
+    for (int c = r + 1; c < 3; c++)
+      {
+        float v = 0.5f * (P[r][c] + P[c][r]);
+        P[r][c] = P[c][r] = v;
+      }
+}
+
+/****************************************************************************
+ * Gravity update: z = a/|a|, h = R^T e3, H = [[h]x 0]
+ ****************************************************************************/
+void SpresenseEskf::correct(float zx, float zy, float zz)
+{
+  float hx = 2.0f * (q1 * q3 - q0 * q2);
+  float hy = 2.0f * (q0 * q1 + q2 * q3);
+  float hz = q0 * q0 - q1 * q1 - q2 * q2 + q3 * q3;
+
+  float Hs[3][3] = {{0, -hz, hy}, {hz, 0, -hx}, {-hy, hx, 0}};
+
+  /* PHt = P H^T (6x3) = P[:,0:3] [h]x^T */
+  float PHt[6][3];
+  for (int r = 0; r < 6; r++)
+    for (int c = 0; c < 3; c++)
+      PHt[r][c] = P[r][0] * Hs[c][0] + P[r][1] * Hs[c][1] + P[r][2] * Hs[c][2];
+
+  /* S = H PHt + R */
+  float rn = accel_noise / IMU_GRAVITY;
+  Mat3 S;
+  for (int r = 0; r < 3; r++)
+    for (int c = 0; c < 3; c++)
+      S[r][c] = Hs[r][0] * PHt[0][c] + Hs[r][1] * PHt[1][c] + Hs[r][2] * PHt[2][c];
+  S[0][0] += rn * rn; S[1][1] += rn * rn; S[2][2] += rn * rn;
+
+  /* S^-1 by cofactors (S is symmetric positive definite). */
+  Mat3 Si;
+  Si[0][0] = S[1][1] * S[2][2] - S[1][2] * S[2][1];
+  Si[0][1] = S[0][2] * S[2][1] - S[0][1] * S[2][2];
+  Si[0][2] = S[0][1] * S[1][2] - S[0][2] * S[1][1];
+  Si[1][0] = S[1][2] * S[2][0] - S[1][0] * S[2][2];
+  Si[1][1] = S[0][0] * S[2][2] - S[0][2] * S[2][0];
+  Si[1][2] = S[0][2] * S[1][0] - S[0][0] * S[1][2];
+  Si[2][0] = S[1][0] * S[2][1] - S[1][1] * S[2][0];
+  Si[2][1] = S[0][1] * S[2][0] - S[0][0] * S[2][1];
+  Si[2][2] = S[0][0] * S[1][1] - S[0][1] * S[1][0];
+  float det = S[0][0] * Si[0][0] + S[0][1] * Si[1][0] + S[0][2] * Si[2][0];
+  if (det <= 0) return;
+  float idet = 1.0f / det;
+
+  /* K = PHt S^-1, dx = K (z - h) */
+  float yx = zx - hx, yy = zy - hy, yz = zz - hz;
+  float K[6][3];
+  float dx[6];
+  for (int r = 0; r < 6; r++)
+    {
+      for (int c = 0; c < 3; c++)
+        {
+          K[r][c] = (PHt[r][0] * Si[0][c] + PHt[r][1] * Si[1][c] + PHt[r][2] * Si[2][c]) * idet;
+        }
+      dx[r] = K[r][0] * yx + K[r][1] * yy + K[r][2] * yz;
+    }
+
+  /* P -= K S K^T = K PHt^T, upper triangle mirrored */
+  for (int r = 0; r < 6; r++)
+    for (int c = r; c < 6; c++)
+      {
+        float v = P[r][c] - (K[r][0] * PHt[c][0] + K[r][1] * PHt[c][1] + K[r][2] * PHt[c][2]);
+        P[r][c] = P[c][r] = v;
+      }
+
+  /* Inject: q = q * (1, dtheta / 2), b += db */
+  float ex = 0.5f * dx[0], ey = 0.5f * dx[1], ez = 0.5f * dx[2];
+  float r0 = q0      - q1 * ex - q2 * ey - q3 * ez;
+  float r1 = q0 * ex + q1      + q2 * ez - q3 * ey;
+  float r2 = q0 * ey - q1 * ez + q2      + q3 * ex;
+  float r3 = q0 * ez + q1 * ey - q2 * ex + q3;
+  float qn = 1.0f / sqrtf(r0 * r0 + r1 * r1 + r2 * r2 + r3 * r3);
+  q0 = r0 * qn; q1 = r1 * qn; q2 = r2 * qn; q3 = r3 * qn;
+
+  bias[0] += dx[3];
+  bias[1] += dx[4];
+  bias[2] += dx[5];
+}
+
+/****************************************************************************
+ * outputs
+ ****************************************************************************/
+pwbQuaternionData SpresenseEskf::getQuaternion() const
+{
+  pwbQuaternionData q(q0, q1, q2, q3);
+  q.timestamp = last_time;
+  q.temp      = last_temp;
+  return q;
+}
@@ -18,19 +18,15 @@
  */
 
 #include "SpresenseIMU.h"
+#include "GyroCompass.h"
+#include "ImuKernels.h"
+#include "ImuCalibration.h"
 
-#include <arch/board/board.h> 
-
-#include <nuttx/config.h>
-
-#include <sys/ioctl.h>
 #include <time.h>
 #include <inttypes.h>
-#include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
-#include <signal.h>
-#include <poll.h>
 #include <errno.h>
 
 
@@ -38,32 +34,42 @@
  * Pre-processor Definitions
  ****************************************************************************/
 
-#define CXD5602PWBIMU_DEVPATH      "/dev/imu0"
-
 #define itemsof(a) (sizeof(a)/sizeof(a[0]))
 
 const int device_timeout = 1000;
 
+static uint64_t now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/****************************************************************************
+ * default device
+ ****************************************************************************/
+ImuDevice* SpresenseImuClass::defaultDevice()
+{
+#ifdef ARDUINO_ARCH_SPRESENSE
+  static ImuNuttxDevice dev;
+#else
+  static ImuHostDevice dev;
+#endif
+  return &dev;
+}
+
 /****************************************************************************
  * begin
  ****************************************************************************/
 int SpresenseImuClass::begin()
 {
-  int ret;
-  ret = board_cxd5602pwbimu_initialize(5); 
+  int ret = device->open();
   if (ret < 0)
     {
-      printf("ERROR: Failed to initialize CXD5602PWBIMU.\n");
+      printf("ERROR: Failed to open CXD5602PWBIMU. %d\n", ret);
       return ret;
     }
 
-  fd = open(CXD5602PWBIMU_DEVPATH, O_RDONLY);
-  if (fd < 0)
-    {
-      printf("ERROR: Device %s open failure. %d\n", CXD5602PWBIMU_DEVPATH, errno);
-      return errno;
-    }
-
   return 0;
 
 }
@@ -73,12 +79,12 @@ int SpresenseImuClass::begin()
  ****************************************************************************/
 bool SpresenseImuClass::end()
 {
-  int ret = close(fd);
+  int ret = device->close();
   if (ret < 0)
-  {
-    printf("ERROR: close failed (errno=%d: %s)\n", errno, strerror(errno));
-    return false;
-  }
+    {
+      printf("ERROR: close failed (errno=%d: %s)\n", -ret, strerror(-ret));
+      return false;
+    }
 
   return true;
 
@@ -90,7 +96,6 @@ bool SpresenseImuClass::end()
 bool SpresenseImuClass::initialize(int rate, int adrange, int gdrange, int nfifos)
 {
   int ret;
-  cxd5602pwbimu_range_t range;
 
   /*
    * Set sampling rate. Available values (Hz) are below.
@@ -98,19 +103,17 @@ bool SpresenseImuClass::initialize(int rate, int adrange, int gdrange, int nfifo
    * 15 (default), 30, 60, 120, 240, 480, 960, 1920
    */
 
-  ret = ioctl(fd, SNIOC_SSAMPRATE, rate);
+  ret = device->setRate(rate);
   if (ret)
     {
-      printf("ERROR: Set sampling rate failed. %d\n", errno);
+      printf("ERROR: Set sampling rate failed. %d\n", ret);
       return false;
     }
 
-  range.accel = adrange;
-  range.gyro = gdrange;
-  ret = ioctl(fd, SNIOC_SDRANGE, (unsigned long)(uintptr_t)&range);
+  ret = device->setRange(adrange, gdrange);
   if (ret)
     {
-      printf("ERROR: Set dynamic range failed. %d\n", errno);
+      printf("ERROR: Set dynamic range failed. %d\n", ret);
       return false;
     }
 
@@ -119,14 +122,34 @@ bool SpresenseImuClass::initialize(int rate, int adrange, int gdrange, int nfifo
    * Increasing this value will reduce the frequency with which data is
    * received.
    */
-  fifo_depth = nfifos;
-  ret = ioctl(fd, SNIOC_SFIFOTHRESH, nfifos);
+  ret = device->setFifoThreshold(nfifos);
   if (ret)
     {
-      printf("ERROR: Set sampling rate failed. %d\n", errno);
+      printf("ERROR: Set FIFO threshold failed. %d\n", ret);
       return false;
     }
 
+  /*
+   * One read() returns a whole watermark of `nfifos` samples, so keep a
+   * staging buffer for callers that ask for fewer samples than that.
+   */
+  free(outbuf);
+  outbuf = (cxd5602pwbimu_data_t*)malloc(sizeof(cxd5602pwbimu_data_t) * nfifos);
+  if (outbuf == NULL)
+    {
+      printf("ERROR: FIFO buffer allocation failed.\n");
+      return false;
+    }
+
+  fifo_depth  = nfifos;
+  sample_rate = rate;
+  accel_range = adrange;
+  gyro_range  = gdrange;
+  outbuf_pos  = outbuf_len = 0;
+  marker_pending = bridge_pending = false;
+  sample_clock.begin(rate);
+  resetStats();
+
   return true;
 
 }
@@ -136,6 +159,12 @@ bool SpresenseImuClass::initialize(int rate, int adrange, int gdrange, int nfifo
  ****************************************************************************/
 void SpresenseImuClass::finalize()
 {
+  stopStreaming();
+  stream_ring.release();
+
+  free(outbuf);
+  outbuf = NULL;
+  outbuf_pos = outbuf_len = 0;
 }
 
 /****************************************************************************
@@ -145,12 +174,13 @@ bool SpresenseImuClass::start()
 {
 
   /*
-   * Start sensing, user can not change the all of configurations.
+   * Start sensing. From here on the configuration can only be changed
+   * with reconfigure().
    */
-  int ret = ioctl(fd, SNIOC_ENABLE, 1);
+  int ret = device->enable(true);
   if (ret)
     {
-      printf("ERROR: Enable failed. %d\n", errno);
+      printf("ERROR: Enable failed. %d\n", ret);
       return false;
     }
 
@@ -163,10 +193,10 @@ bool SpresenseImuClass::start()
  ****************************************************************************/
 bool SpresenseImuClass::stop()
 {
-  int ret = ioctl(fd, SNIOC_ENABLE, 0);
+  int ret = device->enable(false);
   if (ret)
     {
-      printf("ERROR: Disable failed. %d\n", errno);
+      printf("ERROR: Disable failed. %d\n", ret);
       return false;
     }
 
@@ -175,55 +205,567 @@ bool SpresenseImuClass::stop()
 }
 
 /****************************************************************************
- * get one sample
+ * reconfigure while running
  ****************************************************************************/
-bool SpresenseImuClass::get(cxd5602pwbimu_data_t& data)
+static bool valid_rate(int rate)
 {
-  struct pollfd fds;
-  fds.fd     = fd;
-  fds.events = POLLIN;
+  switch (rate)
+    {
+      case 15: case 30: case 60: case 120:
+      case 240: case 480: case 960: case 1920:
+        return true;
+      default:
+        return false;
+    }
+}
 
-  int ret = poll(&fds, 1, device_timeout);
-  if (ret <= 0)
+int32_t SpresenseImuClass::reconfigure(int rate, int adrange, int gdrange, int nfifos)
+{
+  if (!isStreaming())
     {
-      puts("Device timeout\n");
+      /* An older queued request would undo this one. */
+      pthread_mutex_lock(&stats_lock);
+      reconf_pending = false;
+      pthread_mutex_unlock(&stats_lock);
+
+      ImuReconfig c;
+      c.rate    = rate;
+      c.adrange = adrange;
+      c.gdrange = gdrange;
+      c.nfifos  = nfifos;
+      return applyConfig(c);
+    }
+
+  if (!requestReconfigure(rate, adrange, gdrange, nfifos)) return -EINVAL;
+
+  struct timespec abstime;
+  clock_gettime(CLOCK_REALTIME, &abstime);
+  abstime.tv_sec += 2 * device_timeout / 1000;
+
+  pthread_mutex_lock(&stats_lock);
+  uint32_t target = reconf_requests;
+  int      ret    = 0;
+  while ((int32_t)(reconf_applied - target) < 0 && ret != ETIMEDOUT)
+    {
+      ret = pthread_cond_timedwait(&reconf_cond, &stats_lock, &abstime);
+    }
+  int32_t result = (ret == ETIMEDOUT) ? -ETIMEDOUT : reconf_result;
+  pthread_mutex_unlock(&stats_lock);
+
+  if (result == -ETIMEDOUT) printf("ERROR: reconfiguration timeout.\n");
+  return result;
+}
+
+bool SpresenseImuClass::requestReconfigure(int rate, int adrange, int gdrange, int nfifos)
+{
+  if (!valid_rate(rate) || nfifos < 1)
+    {
+      printf("ERROR: invalid configuration. %d Hz, %d FIFO\n", rate, nfifos);
       return false;
     }
 
-  ret = read(fd,&data, sizeof(data)*fifo_depth);
-  if (ret != (int)sizeof(data)*fifo_depth) { return false; }
+  pthread_mutex_lock(&stats_lock);
+  reconf_request.rate    = rate;
+  reconf_request.adrange = adrange;
+  reconf_request.gdrange = gdrange;
+  reconf_request.nfifos  = nfifos;
+  reconf_pending = true;
+  reconf_requests++;
+  pthread_mutex_unlock(&stats_lock);
+
   return true;
 }
 
+ImuReconfig SpresenseImuClass::lastReconfig()
+{
+  pthread_mutex_lock(&stats_lock);
+  ImuReconfig c = reconf_last;
+  pthread_mutex_unlock(&stats_lock);
+  return c;
+}
+
 /****************************************************************************
- * get one sample
+ * apply a queued request (on the reading thread)
  ****************************************************************************/
-bool SpresenseImuClass::get(pwbImuData& data)
+bool SpresenseImuClass::applyPending()
+{
+  pthread_mutex_lock(&stats_lock);
+  if (!reconf_pending)
+    {
+      pthread_mutex_unlock(&stats_lock);
+      return false;
+    }
+  ImuReconfig c  = reconf_request;
+  uint32_t  seq  = reconf_requests;
+  reconf_pending = false;
+  pthread_mutex_unlock(&stats_lock);
+
+  int32_t r = applyConfig(c);
+
+  pthread_mutex_lock(&stats_lock);
+  reconf_result  = r;
+  reconf_applied = seq;
+  pthread_cond_broadcast(&reconf_cond);
+  pthread_mutex_unlock(&stats_lock);
+
+  return true;
+}
+
+/****************************************************************************
+ * apply a configuration
+ *
+ *  Everything that can fail without touching the sensor (checks, buffer
+ *  growth) is done before it is disabled; only the changed registers are
+ *  written inside the blackout.
+ ****************************************************************************/
+int32_t SpresenseImuClass::applyConfig(const ImuReconfig& c)
+{
+  if (!valid_rate(c.rate) || c.nfifos < 1)
+    {
+      printf("ERROR: invalid configuration. %d Hz, %d FIFO\n", c.rate, c.nfifos);
+      return -EINVAL;
+    }
+
+  if (isStreaming() && stream_ring.capacity() < (size_t)c.nfifos)
+    {
+      printf("ERROR: Streaming capacity must hold one FIFO watermark.\n");
+      return -EINVAL;
+    }
+
+  if (c.nfifos > fifo_depth)
+    {
+      /* realloc keeps samples still staged in outbuf. */
+      void* p = realloc(outbuf, sizeof(cxd5602pwbimu_data_t) * c.nfifos);
+      if (p == NULL)
+        {
+          printf("ERROR: FIFO buffer allocation failed.\n");
+          return -ENOMEM;
+        }
+      outbuf = (cxd5602pwbimu_data_t*)p;
+
+      if (isStreaming())
+        {
+          p = realloc(stream_batch, sizeof(cxd5602pwbimu_data_t) * c.nfifos);
+          if (p == NULL)
+            {
+              printf("ERROR: Streaming buffer allocation failed.\n");
+              return -ENOMEM;
+            }
+          stream_batch = (cxd5602pwbimu_data_t*)p;
+        }
+    }
+
+  bool rate_changed  = (c.rate != sample_rate);
+  bool range_changed = (c.adrange != accel_range || c.gdrange != gyro_range);
+  bool fifo_changed  = (c.nfifos != fifo_depth);
+
+  if (bus != NULL) bus->beginRead();
+
+  uint64_t t0  = now_us();
+  int      ret = device->enable(false);
+  if (ret == 0 && rate_changed)  ret = device->setRate(c.rate);
+  if (ret == 0 && range_changed) ret = device->setRange(c.adrange, c.gdrange);
+  if (ret == 0 && fifo_changed)  ret = device->setFifoThreshold(c.nfifos);
+  if (ret != 0)
+    {
+      /* Back to the configuration the readers still expect. */
+      device->setRate(sample_rate);
+      device->setRange(accel_range, gyro_range);
+      device->setFifoThreshold(fifo_depth);
+    }
+  int en = device->enable(true);
+  uint32_t blackout = (uint32_t)(now_us() - t0);
+
+  if (bus != NULL) bus->endRead();
+
+  if (ret != 0 || en != 0)
+    {
+      printf("ERROR: reconfiguration failed. %d %d\n", ret, en);
+      return (ret != 0) ? ret : en;
+    }
+
+  fifo_depth  = c.nfifos;
+  sample_rate = c.rate;
+  accel_range = c.adrange;
+  gyro_range  = c.gdrange;
+
+  /* Statistics (rate(), jitter) start over at the new rate. */
+  resetStats();
+
+  pthread_mutex_lock(&stats_lock);
+  ImuReconfig& last = reconf_last;
+  last.sequence++;
+  last.timestamp   = sample_clock.timestamp();
+  last.rate        = c.rate;
+  last.adrange     = c.adrange;
+  last.gdrange     = c.gdrange;
+  last.nfifos      = c.nfifos;
+  last.blackout_us = blackout;
+  last.gap         = 0;
+  bridge_pending   = sample_clock.started();
+  reconf_wake_us   = stats_wake_us;
+
+  if (reconf_markers)
+    {
+      marker.timestamp = last.timestamp;
+      marker.temp      = NAN;
+      marker.gx        = (float)last.rate;
+      marker.gy        = (float)last.adrange;
+      marker.gz        = (float)last.gdrange;
+      marker.ax        = (float)last.nfifos;
+      marker.ay        = (float)last.blackout_us;
+      marker.az        = (float)last.sequence;
+      marker_pending   = true;
+    }
+  pthread_mutex_unlock(&stats_lock);
+
+  /* While streaming, the marker goes into the ring right away. */
+  if (isStreaming() && marker_pending)
+    {
+      marker_pending = false;
+      if (stream_ring.push(&marker, 1) == 0)
+        {
+          __atomic_fetch_add(&stream_overruns, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+  return (int32_t)blackout;
+}
+
+/****************************************************************************
+ * marker contents
+ ****************************************************************************/
+bool imuMarkerConfig(const cxd5602pwbimu_data_t& s, ImuReconfig& c)
 {
-  struct pollfd fds;
-  fds.fd     = fd;
-  fds.events = POLLIN;
+  if (!imuIsMarker(s)) return false;
+
+  c = ImuReconfig();
+  c.timestamp   = s.timestamp;
+  c.rate        = (int)s.gx;
+  c.adrange     = (int)s.gy;
+  c.gdrange     = (int)s.gz;
+  c.nfifos      = (int)s.ax;
+  c.blackout_us = (uint32_t)s.ay;
+  c.sequence    = (uint32_t)s.az;
+  return true;
+}
 
-  int ret = poll(&fds, 1, device_timeout);
+/****************************************************************************
+ * wait for FIFO watermark
+ ****************************************************************************/
+bool SpresenseImuClass::wait()
+{
+  int ret = device->poll(device_timeout);
   if (ret <= 0)
     {
+      pthread_mutex_lock(&stats_lock);
+      stat.timeouts++;
+      pthread_mutex_unlock(&stats_lock);
       puts("Device timeout\n");
       return false;
     }
 
-  ret = read(fd,&data.data, sizeof(data)*fifo_depth);
-  if (ret != (int)sizeof(data)*fifo_depth) { return false; }
+  stats_wake_us = now_us();
+  return true;
+}
+
+/****************************************************************************
+ * drain one FIFO watermark
+ ****************************************************************************/
+size_t SpresenseImuClass::drain(cxd5602pwbimu_data_t* dst)
+{
+  const size_t watermark = sizeof(cxd5602pwbimu_data_t) * fifo_depth;
+
+  if (bus != NULL) bus->beginRead();
+  ssize_t ret = device->read(dst, watermark);
+  if (bus != NULL) bus->endRead();
+
+  /* A trailing partial sample is never handed out. */
+  size_t n = (ret > 0) ? ret / sizeof(cxd5602pwbimu_data_t) : 0;
+
+  account(dst, n, ret, watermark);
+
+  if (calibration != NULL) calibration->apply(dst, n);
+
+  /* The FIFO refills for fifo_depth periods: the bus is free until then. */
+  if (bus != NULL)
+    {
+      uint32_t window = (uint32_t)((uint64_t)fifo_depth * 1000000 / sample_rate);
+      uint32_t spent  = (uint32_t)(now_us() - stats_wake_us);
+      bus->gap((spent < window) ? window - spent : 0);
+    }
+
+  if (ret < 0)
+    {
+      printf("ERROR: read failed. %d\n", (int)ret);
+      return 0;
+    }
+
+  if ((size_t)ret != watermark)
+    {
+      printf("ERROR: short read. %d/%d\n", (int)ret, (int)watermark);
+    }
+
+  return n;
+}
+
+/****************************************************************************
+ * bus sharing
+ ****************************************************************************/
+bool SpresenseImuClass::setBusArbiter(ImuBusArbiter* arbiter)
+{
+  if (isStreaming())
+    {
+      printf("ERROR: bus arbiter cannot be changed while streaming.\n");
+      return false;
+    }
+
+  bus = arbiter;
+  return true;
+}
+
+/****************************************************************************
+ * calibration
+ ****************************************************************************/
+bool SpresenseImuClass::setCalibration(const ImuCalibration* cal)
+{
+  if (isStreaming())
+    {
+      printf("ERROR: calibration cannot be changed while streaming.\n");
+      return false;
+    }
+
+  calibration = cal;
   return true;
 }
 
+/****************************************************************************
+ * statistics of one device read
+ ****************************************************************************/
+void SpresenseImuClass::account(const cxd5602pwbimu_data_t* src, size_t n, ssize_t ret, size_t watermark)
+{
+  uint32_t latency = (uint32_t)(now_us() - stats_wake_us);
+  bool     dump    = false;
+
+  pthread_mutex_lock(&stats_lock);
+
+  /* First watermark after reconfigure(): carry the time base over. */
+  bool     bridged = false;
+  uint64_t from    = sample_clock.ticks();
+  if (bridge_pending && n > 0)
+    {
+      uint64_t period_us = 1000000 / sample_rate;
+      uint64_t span_us   = stats_wake_us - reconf_wake_us;
+      uint64_t skip_us   = (n - 1) * period_us;
+      uint64_t est_us    = (span_us > skip_us) ? span_us - skip_us : period_us;
+      sample_clock.bridge(sample_rate, (uint32_t)(est_us * (IMU_TICKS_PER_SEC / 1000000)));
+      bridge_pending = false;
+      bridged        = true;
+    }
+
+  stat.reads++;
+  if (ret < 0) stat.read_errors++;
+  else if ((size_t)ret != watermark) stat.short_reads++;
+
+  stat.latency_us_total += latency;
+  if (latency > stat.latency_us_max) stat.latency_us_max = latency;
+
+  const uint32_t period = sample_clock.period();
+
+  for (size_t i = 0; i < n; i++)
+    {
+      uint64_t before = sample_clock.ticks();
+      uint64_t t      = sample_clock.unwrap(src[i].timestamp);
+
+      if (!stats_started)
+        {
+          stats_first   = t;
+          stats_started = true;
+          continue;
+        }
+      if (t == before) continue;
+
+      uint32_t d = sample_clock.delta();
+      if (stat.delta_min == 0 || d < stat.delta_min) stat.delta_min = d;
+      if (d > stat.delta_max) stat.delta_max = d;
+
+      if (period != 0)
+        {
+          uint32_t err = (d > period) ? d - period : period - d;
+          uint32_t us  = (uint32_t)((uint64_t)err * 1000000 / IMU_TICKS_PER_SEC);
+          int      bin = (us == 0) ? 0 : 32 - __builtin_clz(us);
+          stat.jitter[(bin < IMU_STATS_JITTER_BINS) ? bin : IMU_STATS_JITTER_BINS - 1]++;
+        }
+    }
+
+  stat.samples += n;
+
+  if (bridged) reconf_last.gap = (uint32_t)(sample_clock.ticksOf(src[0].timestamp) - from);
+
+  if (stats_interval != 0 && stats_started && sample_clock.ticks() >= stats_next)
+    {
+      stats_next = sample_clock.ticks() + stats_interval;
+      dump = true;
+    }
+
+  pthread_mutex_unlock(&stats_lock);
+
+  if (dump) stats().print();
+}
+
+/****************************************************************************
+ * statistics snapshot
+ ****************************************************************************/
+ImuStats SpresenseImuClass::stats()
+{
+  pthread_mutex_lock(&stats_lock);
+  ImuStats s = stat;
+  s.overruns = overruns();
+  s.gaps     = sample_clock.gaps();
+  s.dropped  = sample_clock.dropped();
+  s.stalls   = sample_clock.stalls();
+  s.period   = sample_clock.period();
+  s.span     = stats_started ? sample_clock.ticks() - stats_first : 0;
+  pthread_mutex_unlock(&stats_lock);
+  return s;
+}
+
+void SpresenseImuClass::resetStats()
+{
+  pthread_mutex_lock(&stats_lock);
+  stat = ImuStats();
+  sample_clock.clearCounters();
+  stats_started = false;
+  stats_next    = 0;
+  pthread_mutex_unlock(&stats_lock);
+}
+
+void SpresenseImuClass::setStatsInterval(uint32_t seconds)
+{
+  pthread_mutex_lock(&stats_lock);
+  stats_interval = (uint64_t)seconds * IMU_TICKS_PER_SEC;
+  stats_next     = sample_clock.ticks() + stats_interval;
+  pthread_mutex_unlock(&stats_lock);
+}
+
+/****************************************************************************
+ * ImuStats
+ ****************************************************************************/
+float ImuStats::rate() const
+{
+  if (span == 0) return 0;
+
+  /* Periods covered: every advancing step, plus the samples lost in gaps. */
+  uint32_t steps = samples - 1 - stalls + dropped;
+  return (float)((double)steps * IMU_TICKS_PER_SEC / span);
+}
+
+void ImuStats::print() const
+{
+  printf("samples %lu, reads %lu, timeouts %lu, short %lu, errors %lu, overruns %lu\n",
+         (unsigned long)samples, (unsigned long)reads, (unsigned long)timeouts,
+         (unsigned long)short_reads, (unsigned long)read_errors, (unsigned long)overruns);
+  printf("rate %.3f Hz, gaps %lu, dropped %lu, stalls %lu, dt %.1f..%.1f us\n",
+         rate(), (unsigned long)gaps, (unsigned long)dropped, (unsigned long)stalls,
+         delta_min * (1e6f / IMU_TICKS_PER_SEC), delta_max * (1e6f / IMU_TICKS_PER_SEC));
+  printf("jitter(us)");
+  for (int k = 0; k < IMU_STATS_JITTER_BINS; k++)
+    {
+      if (k < IMU_STATS_JITTER_BINS - 1) printf(" <%d:%lu", 1 << k, (unsigned long)jitter[k]);
+      else                               printf(" >=%d:%lu", 1 << (k - 1), (unsigned long)jitter[k]);
+    }
+  printf("\nlatency(us) mean %lu, max %lu\n",
+         (unsigned long)(reads ? latency_us_total / reads : 0), (unsigned long)latency_us_max);
+}
+
+/****************************************************************************
+ * read samples of one FIFO watermark
+ ****************************************************************************/
+size_t SpresenseImuClass::read(cxd5602pwbimu_data_t* dst, size_t max)
+{
+  size_t count = 0;
+
+  if (max == 0) return 0;
+
+  if (isStreaming())
+    {
+      printf("ERROR: read is not available while streaming.\n");
+      return 0;
+    }
+
+  /* Samples left over from a previous watermark go out first. */
+  if (outbuf_pos < outbuf_len)
+    {
+      while (outbuf_pos < outbuf_len && count < max)
+        {
+          dst[count++] = outbuf[outbuf_pos++];
+        }
+      return count;
+    }
+
+  /* A queued change is applied between watermarks; its marker comes next. */
+  applyPending();
+  if (marker_pending)
+    {
+      marker_pending = false;
+      dst[0] = marker;
+      return 1;
+    }
+
+  if (!wait()) return 0;
+
+  if (max >= (size_t)fifo_depth)
+    {
+      return drain(dst);
+    }
+
+  outbuf_pos = 0;
+  outbuf_len = drain(outbuf);
+
+  while (outbuf_pos < outbuf_len && count < max)
+    {
+      dst[count++] = outbuf[outbuf_pos++];
+    }
+
+  return count;
+}
+
+size_t SpresenseImuClass::read(pwbImuData* dst, size_t max)
+{
+  static_assert(sizeof(pwbImuData) == sizeof(cxd5602pwbimu_data_t),
+                "pwbImuData must stay layout compatible with the driver data");
+
+  return read(reinterpret_cast<cxd5602pwbimu_data_t*>(dst), max);
+}
+
+/****************************************************************************
+ * get one sample
+ ****************************************************************************/
+bool SpresenseImuClass::get(cxd5602pwbimu_data_t& data)
+{
+  return (read(&data, 1) == 1);
+}
+
+/****************************************************************************
+ * get one sample
+ ****************************************************************************/
+bool SpresenseImuClass::get(pwbImuData& data)
+{
+  return (read(&data.data, 1) == 1);
+}
+
 /****************************************************************************
  * get samples
  ****************************************************************************/
 bool SpresenseImuClass::get(cxd5602pwbimu_data_t* ptr, int size)
 {
-  for(;size>0;size=size-fifo_depth,ptr++){
-    if(!get(*ptr)) return false;
-  }
+  while (size > 0)
+    {
+      size_t n = read(ptr, size);
+      if (n == 0) return false;
+      ptr  += n;
+      size -= n;
+    }
 
   return true;
 
@@ -234,14 +776,133 @@ bool SpresenseImuClass::get(cxd5602pwbimu_data_t* ptr, int size)
  ****************************************************************************/
 bool SpresenseImuClass::get(pwbImuData* ptr, int size)
 {
-  for(;size>0;size=size-fifo_depth,ptr++){
-    if(!get(*ptr)) return false;
-  }
+  while (size > 0)
+    {
+      size_t n = read(ptr, size);
+      if (n == 0) return false;
+      ptr  += n;
+      size -= n;
+    }
 
   return true;
 
 }
 
+/****************************************************************************
+ * streaming thread
+ ****************************************************************************/
+void* SpresenseImuClass::streamThread(void* arg)
+{
+  SpresenseImuClass* self = (SpresenseImuClass*)arg;
+
+  while (self->isStreaming())
+    {
+      self->applyPending();
+      if (!self->wait()) continue;
+
+      size_t n = self->drain(self->stream_batch);
+      size_t pushed = self->stream_ring.push(self->stream_batch, n);
+      if (pushed < n)
+        {
+          __atomic_fetch_add(&self->stream_overruns, n - pushed, __ATOMIC_RELAXED);
+        }
+    }
+
+  return NULL;
+}
+
+/****************************************************************************
+ * start streaming
+ ****************************************************************************/
+bool SpresenseImuClass::startStreaming(size_t capacity, int priority)
+{
+  if (isStreaming()) return false;
+
+  if (capacity < (size_t)fifo_depth)
+    {
+      printf("ERROR: Streaming capacity must hold one FIFO watermark.\n");
+      return false;
+    }
+
+  if (!stream_ring.allocate(capacity))
+    {
+      printf("ERROR: Streaming buffer allocation failed.\n");
+      return false;
+    }
+
+  stream_batch = (cxd5602pwbimu_data_t*)malloc(sizeof(cxd5602pwbimu_data_t) * fifo_depth);
+  if (stream_batch == NULL)
+    {
+      printf("ERROR: Streaming buffer allocation failed.\n");
+      stream_ring.release();
+      return false;
+    }
+
+  /* Samples staged by an earlier read() belong in front of the stream. */
+  if (outbuf_pos < outbuf_len)
+    {
+      stream_ring.push(&outbuf[outbuf_pos], outbuf_len - outbuf_pos);
+      outbuf_pos = outbuf_len = 0;
+    }
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  if (priority > 0)
+    {
+      struct sched_param param;
+      param.sched_priority = priority;
+      pthread_attr_setschedparam(&attr, &param);
+    }
+
+  stream_overruns = 0;
+  __atomic_store_n(&streaming, true, __ATOMIC_RELEASE);
+
+  int ret = pthread_create(&stream_tid, &attr, streamThread, this);
+  pthread_attr_destroy(&attr);
+  if (ret != 0)
+    {
+      printf("ERROR: Streaming thread creation failed. %d\n", ret);
+      __atomic_store_n(&streaming, false, __ATOMIC_RELEASE);
+      free(stream_batch);
+      stream_batch = NULL;
+      stream_ring.release();
+      return false;
+    }
+
+  return true;
+}
+
+/****************************************************************************
+ * stop streaming
+ ****************************************************************************/
+bool SpresenseImuClass::stopStreaming()
+{
+  if (!isStreaming()) return false;
+
+  /* The thread notices within one device timeout. */
+  __atomic_store_n(&streaming, false, __ATOMIC_RELEASE);
+  pthread_join(stream_tid, NULL);
+
+  /* Samples still in the ring stay poppable until finalize(). */
+  free(stream_batch);
+  stream_batch = NULL;
+
+  return true;
+}
+
+/****************************************************************************
+ * pop streamed samples
+ ****************************************************************************/
+bool SpresenseImuClass::tryPop(cxd5602pwbimu_data_t& data)
+{
+  return stream_ring.pop(data);
+}
+
+size_t SpresenseImuClass::popBatch(cxd5602pwbimu_data_t* dst, size_t max)
+{
+  return stream_ring.pop(dst, max);
+}
+
 /****************************************************************************
  * get verage
  ****************************************************************************/
@@ -254,6 +915,7 @@ bool SpresenseImuClass::getAverage(pwbImuData& data, int count)
 
   for(int i=0;i<count;i++){
     if(!get(tmp)) return false;
+    if(imuIsMarker(tmp)){ i--; continue; }
     data += tmp;
   }
 
@@ -268,24 +930,43 @@ bool SpresenseImuClass::getAverage(pwbImuData& data, int count)
  ****************************************************************************/
 void SpresenseImuClass::convQuaternion(pwbQuaternionData& data, const cxd5602pwbimu_data_t& raw, float prevTimestamp)
 {
+  convQuaternionDt(data, raw, (raw.timestamp / 19200000.0f) - prevTimestamp);
+}
 
-  double omega = sqrt(raw.gx*raw.gx + raw.gy*raw.gy + raw.gz*raw.gz);
-  float delta = (raw.timestamp / 19200000.0f) - prevTimestamp;
+void SpresenseImuClass::convQuaternion(pwbQuaternionData& data, const cxd5602pwbimu_data_t& raw, const cxd5602pwbimu_data_t& prev)
+{
+  /* Exact integer dt, unaffected by the 32-bit wrap. */
+  convQuaternionDt(data, raw, ImuClock::toSeconds((uint32_t)(raw.timestamp - prev.timestamp)));
+}
+
+void SpresenseImuClass::convQuaternionDt(pwbQuaternionData& data, const cxd5602pwbimu_data_t& raw, float delta)
+{
+
+  float omega = sqrtf(raw.gx*raw.gx + raw.gy*raw.gy + raw.gz*raw.gz);
 
   data.timestamp = raw.timestamp;
+
+  /* A marker carries the configuration, not a rate: no rotation. */
+  if (imuIsMarker(raw)) {
+    data.q0 = 1.0f;
+    data.q1 = data.q2 = data.q3 = 0.0f;
+    return;
+  }
+
   data.temp = raw.temp;
 
-  if (omega < 1e-12) {
-    data.q0 = 1.0;
-    data.q1 = data.q2 = data.q3 = 0.0;
+  if (omega < 1e-12f) {
+    data.q0 = 1.0f;
+    data.q1 = data.q2 = data.q3 = 0.0f;
     return;
   }
 
-  double theta = omega * delta;
-  double half  = theta * 0.5;
-  double s = sin(half) / omega;
+  /* Single precision: the M4F has no double FPU. */
+  float theta = omega * delta;
+  float half  = theta * 0.5f;
+  float s = sinf(half) / omega;
 
-  data.q0 = cos(half);
+  data.q0 = cosf(half);
   data.q1 = raw.gx * s;
   data.q2 = raw.gy * s;
   data.q3 = raw.gz * s;
@@ -295,85 +976,61 @@ void SpresenseImuClass::convQuaternion(pwbQuaternionData& data, const cxd5602pwb
 }
 
 /****************************************************************************
- * Calculate Earth`s rotation
+ * Integrate gyro batch
  ****************************************************************************/
-#define EARTH_RATE   (2.0 * M_PI / 86164.098903691)
-#define RAD2DEG      (180.0 / M_PI)
-
-#define SQUARED(v)  ((v) * (v))
-#define CUBE(v)     ((v) * (v) * (v))
-#define DET_MATRIX(m) m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) - \
-                      m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) + \
-                      m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0])
-
-int SpresenseImuClass::calcEarthsRotation(pwbGyroData* gavgs, int num, pwbGyroData *bias_out)
+void SpresenseImuClass::integrateGyro(const cxd5602pwbimu_data_t* in, size_t n, pwbQuaternionData& q)
 {
-  int i, r, c;
-  double f_mat[3][3] = {0};
-  double g_vec[3] = {0};
-  double t_vec[3];
-  double tmp_mat[3][3];
-  double workA, workB;
-  double x, y;
+  float  dt    = 1.0f / sample_rate;
+  size_t start = 0;
 
-  for (i = 0; i < num; i++)
+  /* After a marker the step follows its rate. */
+  for (size_t i = 0; i < n; i++)
     {
-      x = (double)gavgs[i].x;
-      y = (double)gavgs[i].y;
-
-      f_mat[0][2] += x;
-      f_mat[1][2] += y;
-      f_mat[0][0] += SQUARED(x);
-      f_mat[1][1] += SQUARED(y);
-      f_mat[0][1] += x * y;
-
-      g_vec[0] += CUBE(x) + x * SQUARED(y);
-      g_vec[1] += CUBE(y) + y * SQUARED(x);
-      g_vec[2] += SQUARED(x) + SQUARED(y);
+      ImuReconfig c;
+      if (!imuMarkerConfig(in[i], c)) continue;
+      integrateGyro(&in[start], i - start, q, dt);
+      if (c.rate > 0) dt = 1.0f / c.rate;
+      start = i + 1;
     }
+  integrateGyro(&in[start], n - start, q, dt);
+}
 
-  f_mat[1][0] = f_mat[0][1];
-  f_mat[2][0] = f_mat[0][2];
-  f_mat[2][1] = f_mat[1][2];
-  f_mat[2][2] = (double)num;
-
-  g_vec[0] = -g_vec[0];
-  g_vec[1] = -g_vec[1];
-  g_vec[2] = -g_vec[2];
-
-  workB = DET_MATRIX(f_mat);
+void SpresenseImuClass::integrateGyro(const cxd5602pwbimu_data_t* in, size_t n, pwbQuaternionData& q, float dt)
+{
+  size_t start = 0;
 
-  for (i = 0; i < 3; i++)
+  /* Runs between markers; a marker's gx is the rate, not rad/s. */
+  for (size_t i = 0; i <= n; i++)
     {
-      for (r = 0; r < 3; r++)
+      if (i < n && !imuIsMarker(in[i])) continue;
+      if (i > start)
         {
-          for (c = 0; c < 3; c++)
-            {
-              tmp_mat[r][c] = (c == i) ? g_vec[r] : f_mat[r][c];
-            }
+          pwbQuaternionT<float> r(q);
+          imuIntegrateGyro(imuSamples(&in[start]), i - start, r, dt);
+          r.to(q);
+          q.timestamp = in[i - 1].timestamp;
+          q.temp      = in[i - 1].temp;
         }
-
-      workA = DET_MATRIX(tmp_mat);
-      t_vec[i] = workA / workB;
+      start = i + 1;
     }
+}
 
-  workA = -t_vec[0] / 2;
-  workB = -t_vec[1] / 2;
-
-  bias_out->x = workA;
-  bias_out->y = workB;
+/****************************************************************************
+ * Calculate Earth`s rotation
+ ****************************************************************************/
+#define EARTH_RATE   (2.0 * M_PI / 86164.098903691)
+#define RAD2DEG      (180.0 / M_PI)
 
-  double residual = SQUARED(workA) + SQUARED(workB) - t_vec[2];
-  double zsum = 0.0;
+int SpresenseImuClass::calcEarthsRotation(pwbGyroData* gavgs, int num, pwbGyroData *bias_out)
+{
+  GyroCompass compass;
 
-  for (i = 0; i < num; i++)
+  for (int i = 0; i < num; i++)
     {
-      zsum += gavgs[i].z;
+      compass.addPose(gavgs[i]);
     }
 
-  bias_out->z = zsum / num;
-
-  return (residual > 0.0) ? 0 : -1;
+  return compass.fit(bias_out) ? 0 : -1;
 }
 
 /****************************************************************************
@@ -18,17 +18,88 @@
  */
 
 #ifndef _SPRESENSE_IMU_H_
-#define _SPRESENSE_IMU_H
+#define _SPRESENSE_IMU_H_
 
+#ifdef ARDUINO_ARCH_SPRESENSE
 #include <Arduino.h>
 #include <nuttx/sensors/cxd5602pwbimu.h>
+#else
+#include "ImuHostCompat.h"
+#endif
 #include <math.h>
+#include <pthread.h>
 
+#include "ImuClock.h"
+#include "ImuBusArbiter.h"
+#include "ImuDevice.h"
+#include "ImuNumeric.h"
+#include "ImuRingBuffer.h"
+
+
+/**************************************************************************
+ * Pre-processor Definitions
+ **************************************************************************/
+
+// Jitter histogram: bin k counts |dt - period| < 2^k us, the last bin the
+// rest (gaps included).
+#define IMU_STATS_JITTER_BINS  (8)
+
+// Standard gravity (m/s^2), the default of the detectors and calibration.
+#define IMU_GRAVITY            (9.80665f)
 
 /**************************************************************************
  * Structures
  **************************************************************************/
 
+struct ImuStats {
+  uint32_t samples;          // samples read from the device
+  uint32_t reads;            // device reads (one per FIFO watermark)
+  uint32_t timeouts;         // poll() without a watermark in time
+  uint32_t short_reads;      // reads shorter than one watermark
+  uint32_t read_errors;
+  uint32_t overruns;         // streaming ring full
+  uint32_t gaps;             // timestamp steps longer than 1.5 periods
+  uint32_t dropped;          // samples missing in those gaps
+  uint32_t stalls;           // timestamps that did not advance
+  uint32_t delta_min;        // ticks between consecutive samples
+  uint32_t delta_max;
+  uint64_t span;             // ticks from the first to the last sample
+  uint32_t period;           // nominal ticks per sample
+  uint32_t jitter[IMU_STATS_JITTER_BINS];
+  uint32_t latency_us_max;   // poll() wake-up to the end of the read
+  uint64_t latency_us_total;
+
+  ImuStats() { memset(this, 0, sizeof(*this)); }
+
+  // Sample rate measured from the timestamps (Hz).
+  float rate() const;
+  void print() const;
+};
+
+// A configuration change applied by reconfigure(). The same values go into
+// the sample stream as a marker (see imuIsMarker()).
+struct ImuReconfig {
+  uint32_t sequence;         // 1 for the first change since begin()
+  uint32_t timestamp;        // last sample before the change
+  int      rate;             // Hz
+  int      adrange;          // G
+  int      gdrange;          // dps
+  int      nfifos;
+  uint32_t blackout_us;      // time the sensor was disabled
+  uint32_t gap;              // ticks from the last sample before to the first
+                             // after (0 until that sample has been read)
+
+  ImuReconfig() { memset(this, 0, sizeof(*this)); }
+};
+
+// A marker is a sample with temp = NaN, emitted in front of the first
+// sample read with a new configuration. Consumers that keep a dt or a
+// filter state restart from it (SpresenseAhrs and SpresenseEskf take the
+// new nominal rate); ImuDecimator, ImuAllan, GyroCompass, convQuaternion()
+// and the quantized ImuTelemetry skip it.
+inline bool imuIsMarker(const cxd5602pwbimu_data_t& s) { return isnan(s.temp); }
+bool imuMarkerConfig(const cxd5602pwbimu_data_t& s, ImuReconfig& c);
+
 struct pwbImuData {
   cxd5602pwbimu_data_t data;
 
@@ -86,21 +157,24 @@ struct pwbImuData {
   }
 };
 
-struct pwbGyroData {
-  double x;
-  double y;
-  double z;
+// Gyro vector in a numeric policy (ImuNumeric.h). pwbGyroData keeps
+// double: it holds pose means for the gyrocompass fit, once per pose.
+template<typename T>
+struct pwbGyroDataT {
+  T x;
+  T y;
+  T z;
 
-  pwbGyroData() { memset(this, 0, sizeof(*this)); }
+  pwbGyroDataT() : x(), y(), z() {}
 
-  pwbGyroData& operator=(const pwbImuData& other){
-    x = other.data.gx;
-    y = other.data.gy;
-    z = other.data.gz;
+  pwbGyroDataT& operator=(const pwbImuData& other){
+    x = ImuNumeric<T>::from(other.data.gx);
+    y = ImuNumeric<T>::from(other.data.gy);
+    z = ImuNumeric<T>::from(other.data.gz);
     return *this;
   }
 
-  pwbGyroData& operator+=(const pwbGyroData& other){
+  pwbGyroDataT& operator+=(const pwbGyroDataT& other){
     x += other.x;
     y += other.y;
     z += other.z;
@@ -108,11 +182,13 @@ struct pwbGyroData {
   }
 
   void print(){
-    printf("%F,%F,%F\n", x, y, z);
+    printf("%F,%F,%F\n", ImuNumeric<T>::toDouble(x), ImuNumeric<T>::toDouble(y), ImuNumeric<T>::toDouble(z));
   }
 
 };
 
+typedef pwbGyroDataT<double> pwbGyroData;
+
 struct pwbEulerData {
   float roll;
   float pitch;
@@ -136,7 +212,7 @@ struct pwbEulerData {
 };
 
 struct pwbQuaternionData {
-  float timestamp;
+  float timestamp;  // 19.2 MHz ticks of the last sample (as raw.timestamp)
   float temp;
 
   float q0;
@@ -224,12 +300,28 @@ struct pwbQuaternionData {
  * Class
  **************************************************************************/
 
+class ImuCalibration;
+
 class SpresenseImuClass {
 
 public:
-  SpresenseImuClass(){}
+  SpresenseImuClass()
+    : device(defaultDevice()), fifo_depth(1), sample_rate(15), outbuf(NULL), outbuf_pos(0), outbuf_len(0),
+      streaming(false), stream_batch(NULL), stream_overruns(0),
+      stats_first(0), stats_started(false), stats_wake_us(0), stats_interval(0), stats_next(0),
+      bus(NULL), calibration(NULL), accel_range(4), gyro_range(500),
+      reconf_pending(false), reconf_requests(0), reconf_applied(0), reconf_result(0),
+      reconf_markers(true), marker_pending(false), bridge_pending(false), reconf_wake_us(0)
+  {
+    pthread_mutex_init(&stats_lock, NULL);
+    pthread_cond_init(&reconf_cond, NULL);
+  }
   ~SpresenseImuClass(){}
 
+  // Select the device backend. Must be called before begin().
+  void setDevice(ImuDevice* dev) { device = dev; }
+  ImuDevice* getDevice() const { return device; }
+
   int begin();
   bool end();
 
@@ -239,6 +331,23 @@ public:
   bool start();
   bool stop();
 
+  // Change rate, ranges and FIFO threshold while running. The sensor is
+  // disabled only for the register writes, right after a watermark read,
+  // so at most the samples of one partial FIFO are lost. Returns the
+  // blackout in us, < 0 on error (the previous configuration stays).
+  // Not streaming: applied now, from the thread that calls read().
+  // Streaming: applied by the streaming thread; waits for it.
+  int32_t reconfigure(int rate, int adrange, int gdrange, int nfifos);
+  // Queue a change for the reading thread without waiting (e.g. from
+  // another thread than an ImuPublisher's). The last request wins.
+  bool requestReconfigure(int rate, int adrange, int gdrange, int nfifos);
+  ImuReconfig lastReconfig();
+  // Emit markers into the samples read after a change (default on).
+  void setReconfigMarkers(bool on) { reconf_markers = on; }
+  int sampleRate() const { return sample_rate; }
+  int accelRange() const { return accel_range; }
+  int gyroRange() const { return gyro_range; }
+
   bool get(cxd5602pwbimu_data_t&);
   bool get(cxd5602pwbimu_data_t*, int);
 
@@ -246,16 +355,121 @@ public:
   bool get(pwbImuData*, int);
   bool getAverage(pwbImuData&, int);
 
+  // Read up to `max` samples of one FIFO watermark with a single read().
+  // Returns the number of samples stored in `dst`, 0 on timeout or error.
+  size_t read(cxd5602pwbimu_data_t* dst, size_t max);
+  size_t read(pwbImuData* dst, size_t max);
+
+  int fifoDepth() const { return fifo_depth; }
+
+  // Streaming mode: a background thread drains the device into a ring of
+  // `capacity` samples. get()/read() are unavailable while it runs.
+  bool startStreaming(size_t capacity, int priority = 0);
+  bool stopStreaming();
+  bool isStreaming() const { return __atomic_load_n(&streaming, __ATOMIC_ACQUIRE); }
+
+  bool   tryPop(cxd5602pwbimu_data_t&);
+  size_t popBatch(cxd5602pwbimu_data_t*, size_t);
+  size_t available() const { return stream_ring.size(); }
+  uint32_t overruns() const { return __atomic_load_n(&stream_overruns, __ATOMIC_RELAXED); }
+
+  // Time base of the samples read from the device (64-bit ticks, gaps and
+  // dropped samples against the rate from initialize()). Updated by
+  // read(), or by the streaming thread while streaming.
+  const ImuClock& clock() const { return sample_clock; }
+  uint32_t droppedSamples() const { return sample_clock.dropped(); }
+
+  // Counters of the read path, always on (a few operations per sample).
+  // A consistent snapshot, also while streaming.
+  ImuStats stats();
+  void resetStats();
+
+  // Print stats() every `seconds` of sample time from the reading thread
+  // (0: off).
+  void setStatsInterval(uint32_t seconds);
+
+  // Share the I2C bus with other devices without stopping the IMU: every
+  // device read takes the arbiter's bus, and the time after a watermark
+  // read runs its queued transactions (NULL to detach). Works for get()/read()
+  // and streaming alike, but can only be changed while not streaming.
+  bool setBusArbiter(ImuBusArbiter* arbiter);
+  ImuBusArbiter* busArbiter() const { return bus; }
+
+  // Correct every sample read from the device (ImuCalibration.h; NULL to
+  // detach). Applied right after the device read, so get()/read(),
+  // streaming and the statistics all see corrected samples. Like the bus
+  // arbiter, it can only be changed while not streaming.
+  bool setCalibration(const ImuCalibration* cal);
+  const ImuCalibration* getCalibration() const { return calibration; }
+
   void convQuaternion(pwbQuaternionData& data, const cxd5602pwbimu_data_t& raw, float prevTimestamp);
+  // dt from the integer tick difference to the previous sample (wrap-safe).
+  void convQuaternion(pwbQuaternionData& data, const cxd5602pwbimu_data_t& raw, const cxd5602pwbimu_data_t& prev);
+
+  // Rotate q by n gyro samples (q = q * dq per sample, same as
+  // convQuaternion + operator*) with a fixed step of 1 / rate from
+  // initialize(), or an explicit dt. Single precision, renormalized
+  // per batch. q.timestamp (ticks) and q.temp follow the last sample.
+  // Markers are skipped; after one, the fixed step follows its rate.
+  void integrateGyro(const cxd5602pwbimu_data_t* in, size_t n, pwbQuaternionData& q);
+  void integrateGyro(const cxd5602pwbimu_data_t* in, size_t n, pwbQuaternionData& q, float dt);
 
   int calcEarthsRotation(pwbGyroData* gavgs, int num, pwbGyroData *bias_out);
   double calcAngleFrX(pwbGyroData&, pwbGyroData&);
 
 private:
 
-  int fd;
+  bool   wait();
+  size_t drain(cxd5602pwbimu_data_t* dst);
+  void   account(const cxd5602pwbimu_data_t* src, size_t n, ssize_t ret, size_t watermark);
+  int32_t applyConfig(const ImuReconfig& c);
+  bool   applyPending();
+
+  void convQuaternionDt(pwbQuaternionData& data, const cxd5602pwbimu_data_t& raw, float delta);
+
+  static void* streamThread(void*);
+  static ImuDevice* defaultDevice();
+
+  ImuDevice* device;
   int fifo_depth;
-  cxd5602pwbimu_data_t* outbuf;
+  int sample_rate;
+  cxd5602pwbimu_data_t* outbuf;   // staging for callers smaller than a watermark
+  int outbuf_pos;
+  int outbuf_len;
+
+  bool          streaming;         // __atomic: polled by the streaming thread
+  pthread_t     stream_tid;
+  cxd5602pwbimu_data_t* stream_batch;
+  ImuRingBuffer<cxd5602pwbimu_data_t> stream_ring;
+  uint32_t      stream_overruns;   // samples dropped because the ring was full
+
+  ImuClock      sample_clock;      // unwrapped by drain()
+
+  pthread_mutex_t stats_lock;
+  ImuStats      stat;
+  uint64_t      stats_first;       // ticks of the first sample since resetStats()
+  bool          stats_started;
+  uint64_t      stats_wake_us;     // when poll() returned
+  uint64_t      stats_interval;    // ticks between dumps, 0 for none
+  uint64_t      stats_next;
+
+  ImuBusArbiter* bus;
+  const ImuCalibration* calibration;
+
+  int           accel_range;
+  int           gyro_range;
+  pthread_cond_t reconf_cond;      // with stats_lock
+  ImuReconfig   reconf_request;
+  bool          reconf_pending;
+  uint32_t      reconf_requests;
+  uint32_t      reconf_applied;    // requests covered by the last apply
+  int32_t       reconf_result;
+  ImuReconfig   reconf_last;
+  bool          reconf_markers;
+  bool          marker_pending;    // read() hands out `marker` next
+  cxd5602pwbimu_data_t marker;
+  bool          bridge_pending;    // the next watermark follows a change
+  uint64_t      reconf_wake_us;    // wake-up of the last watermark before it
 
 };
 
@@ -265,4 +479,4 @@ private:
 
 extern class SpresenseImuClass SpresenseIMU;
 
-#endif // _SPRESENSE_IMU_H
+#endif // _SPRESENSE_IMU_H_
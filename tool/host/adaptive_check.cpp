@@ -0,0 +1,125 @@
+/*
+ *  adaptive_check.cpp - ImuAdaptive retry pacing when reconfigure() fails.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// Build and run on Linux:
+//
+//   g++ -O2 -I../../src adaptive_check.cpp ../../src/*.cpp -o adaptive_check -lpthread
+//
+//   ./adaptive_check [-s seconds] [-h hold]
+//
+//     -s  length of the static trace (s)             default 10
+//     -h  hold before dropping to the idle rate (s)  default 0.5
+//
+// The device refuses the idle rate, so every ramp down fails. A failed
+// ramp must wait for another full hold period: the check passes when the
+// attempts are one per hold period (the exit status is 1 otherwise).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "SpresenseIMU.h"
+#include "ImuAdaptive.h"
+
+#define ACTIVE_RATE  (960)
+#define IDLE_RATE    (15)
+#define NFIFOS       (4)
+
+/* Host device that cannot switch to the idle rate */
+class FailingDevice : public ImuHostDevice {
+
+public:
+  FailingDevice() : attempts(0) {}
+
+  int setRate(int hz)
+  {
+    if (hz == IDLE_RATE)
+      {
+        attempts++;
+        return -EIO;
+      }
+    return ImuHostDevice::setRate(hz);
+  }
+
+  int attempts;
+};
+
+int main(int argc, char** argv)
+{
+  double seconds = 10;
+  double hold    = 0.5;
+  int    opt;
+
+  while ((opt = getopt(argc, argv, "s:h:")) != -1)
+    {
+      switch (opt)
+        {
+          case 's': seconds = atof(optarg); break;
+          case 'h': hold    = atof(optarg); break;
+          default:
+            fprintf(stderr, "usage: %s [-s seconds] [-h hold]\n", argv[0]);
+            return 1;
+        }
+    }
+
+  if (hold * ACTIVE_RATE < 1 || seconds < 2 * hold)
+    {
+      fprintf(stderr, "hold must be at least one sample and half the trace\n");
+      return 1;
+    }
+
+  FailingDevice device;
+  device.setRealtime(false);
+
+  SpresenseIMU.setDevice(&device);
+  if (SpresenseIMU.begin() < 0) return 1;
+  if (!SpresenseIMU.initialize(ACTIVE_RATE, 4, 500, NFIFOS)) return 1;
+  if (!SpresenseIMU.start()) return 1;
+
+  ImuAdaptive adaptive;
+  adaptive.setActive(ACTIVE_RATE, NFIFOS);
+  adaptive.setIdle(IDLE_RATE, NFIFOS, (float)hold);
+  if (!adaptive.begin(SpresenseIMU)) return 1;
+
+  /* Static and noise free: quiet from the first sample. */
+  size_t total = (size_t)(seconds * ACTIVE_RATE);
+  size_t n     = 0;
+  cxd5602pwbimu_data_t buf[32];
+  while (n < total)
+    {
+      size_t r = adaptive.read(buf, 32);
+      if (r == 0) break;
+      for (size_t i = 0; i < r; i++) if (!imuIsMarker(buf[i])) n++;
+    }
+
+  adaptive.end();
+  SpresenseIMU.finalize();
+  SpresenseIMU.end();
+
+  ImuAdaptiveStats st = adaptive.stats();
+  int expected = (int)(n / (size_t)(hold * ACTIVE_RATE));
+  bool ok = (device.attempts >= expected - 1 && device.attempts <= expected + 1 &&
+             (int)st.failures == device.attempts && st.ramps_down == 0);
+
+  printf("%lu samples, hold %.2f s: %d attempts, %lu failures (expected %d)  %s\n",
+         (unsigned long)n, hold, device.attempts, (unsigned long)st.failures, expected,
+         ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,176 @@
+/*
+ *  block_channel_bench.cpp - Host throughput benchmark of ImuBlockChannel.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Build and run on Linux (MP is replaced by two threads):
+ *
+ *   g++ -O2 -I../../src block_channel_bench.cpp -o block_channel_bench -lpthread
+ *   ./block_channel_bench [blocks] [consumer_us_per_block] [acquire_timeout_ms]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "ImuBlockChannel.h"
+
+/****************************************************************************
+ * Pre-processor Definitions
+ ****************************************************************************/
+
+#define SLOTS      (4)
+#define BLOCK_LEN  (480)     // 1920 Hz / 4, as in rawStored
+#define MSGID_DONE (1)
+
+struct Sample {              // same 32 byte layout as cxd5602pwbimu_data_t
+  uint32_t timestamp;
+  float temp, gx, gy, gz, ax, ay, az;
+};
+
+typedef ImuBlockChannel<Sample, SLOTS, BLOCK_LEN, ImuLocalTransport> Channel;
+
+static int  g_blocks      = 20000;
+static int  g_work_us     = 0;
+static int  g_timeout_ms  = -1;
+static bool g_done        = false;
+static uint32_t g_checksum = 0;
+
+static uint64_t now_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void busy_wait_us(int us)
+{
+  uint64_t end = now_us() + us;
+  while (now_us() < end);
+}
+
+/****************************************************************************
+ * Producer
+ ****************************************************************************/
+static void* producer(void* arg)
+{
+  Channel* ch = (Channel*)arg;
+  uint32_t ts = 0;
+
+  for (int b = 0; b < g_blocks; b++)
+    {
+      ImuSpan<Sample> block = ch->acquire(g_timeout_ms);
+      if (block.empty()) continue;
+
+      for (size_t i = 0; i < block.size; i++)
+        {
+          block[i].timestamp = ts;
+          block[i].gx = block[i].gy = block[i].gz = 0.0f;
+          block[i].ax = block[i].ay = 0.0f;
+          block[i].az = 9.8f;
+          ts += 10000;
+        }
+
+      while (!ch->publish(block)) usleep(10);
+    }
+
+  return NULL;
+}
+
+/****************************************************************************
+ * Consumer
+ ****************************************************************************/
+static void on_other(int8_t msgid, uintptr_t)
+{
+  if (msgid == MSGID_DONE) g_done = true;
+}
+
+static void* consumer(void* arg)
+{
+  Channel* ch = (Channel*)arg;
+
+  while (!g_done)
+    {
+      ImuSpan<Sample> block = ch->receive(100);
+      if (block.empty()) continue;
+
+      for (size_t i = 0; i < block.size; i++)
+        {
+          g_checksum += block[i].timestamp;
+        }
+      if (g_work_us) busy_wait_us(g_work_us);
+
+      ch->release(block);
+    }
+
+  return NULL;
+}
+
+/****************************************************************************
+ * Main
+ ****************************************************************************/
+int main(int argc, char** argv)
+{
+  if (argc > 1) g_blocks     = atoi(argv[1]);
+  if (argc > 2) g_work_us    = atoi(argv[2]);
+  if (argc > 3) g_timeout_ms = atoi(argv[3]);
+
+  ImuLocalLink      link;
+  ImuLocalTransport prod_side(link, 0);
+  ImuLocalTransport cons_side(link, 1);
+  Channel prod(prod_side);
+  Channel cons(cons_side);
+
+  if (!prod.beginProducer())
+    {
+      printf("ERROR: pool allocation failed\n");
+      return 1;
+    }
+  cons.setOtherHandler(on_other);
+
+  pthread_t pt, ct;
+  uint64_t start = now_us();
+  pthread_create(&ct, NULL, consumer, &cons);
+  pthread_create(&pt, NULL, producer, &prod);
+  pthread_join(pt, NULL);
+
+  prod_side.send(MSGID_DONE, 0);
+  pthread_join(ct, NULL);
+  uint64_t elapsed = now_us() - start;
+
+  const ImuBlockChannelStats& ps = prod.stats();
+  const ImuBlockChannelStats& cs = cons.stats();
+  double seconds = elapsed / 1e6;
+  double samples = (double)ps.published * BLOCK_LEN;
+
+  printf("blocks      : %d requested, %u published, %u received, %u dropped\n",
+         g_blocks, ps.published, cs.received, ps.dropped);
+  printf("throughput  : %.0f blocks/s, %.1f Msamples/s, %.1f MB/s\n",
+         ps.published / seconds, samples / seconds / 1e6,
+         samples * sizeof(Sample) / seconds / 1e6);
+  printf("realtime    : %.0fx of 1920 Hz\n", samples / seconds / 1920.0);
+  printf("producer    : %u waits, max %u us, avg %.1f us\n",
+         ps.waits, ps.wait_us_max,
+         ps.waits ? (double)ps.wait_us_total / ps.waits : 0.0);
+  printf("checksum    : %08x\n", g_checksum);
+
+  return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ *  imu_allan.cpp - Allan deviation of recorded IMU logs.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// Build and run on Linux:
+//
+//   g++ -O2 -I../../src imu_allan.cpp ../../src/*.cpp -o imu_allan -lpthread
+//
+//   ./imu_allan [-r rate] imu000.dat [imu001.dat ...] > allan.csv
+//
+//     -r  sampling rate (Hz)   default: from the log header (1920 for
+//                              legacy captures)
+//
+// Files are processed in order as one continuous capture (the rotated
+// files of the rawStored sample). The same ImuAllan engine runs on the
+// board in examples/evalSample.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "ImuAllan.h"
+#include "ImuLog.h"
+
+int main(int argc, char** argv)
+{
+  int rate = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "r:")) != -1)
+    {
+      switch (opt)
+        {
+          case 'r': rate = atoi(optarg); break;
+          default:
+            fprintf(stderr, "usage: %s [-r rate] file [file ...]\n", argv[0]);
+            return 1;
+        }
+    }
+  if (optind >= argc)
+    {
+      fprintf(stderr, "usage: %s [-r rate] file [file ...]\n", argv[0]);
+      return 1;
+    }
+
+  static ImuAllan allan;
+  cxd5602pwbimu_data_t buf[256];
+
+  for (int f = optind; f < argc; f++)
+    {
+      ImuLogReader log;
+      if (!log.open(argv[f]))
+        {
+          fprintf(stderr, "cannot open %s\n", argv[f]);
+          return 1;
+        }
+
+      if (f == optind)
+        {
+          if (rate <= 0) rate = log.isLegacy() ? 1920 : log.info().rate;
+          allan.begin(rate);
+        }
+
+      size_t n;
+      while ((n = log.read(buf, 256)) > 0) allan.add(buf, n);
+
+      fprintf(stderr, "%s: total %llu samples\n", argv[f], (unsigned long long)allan.samples());
+    }
+
+  allan.print();
+
+  static const char* axis[IMU_ALLAN_AXES] = { "gx", "gy", "gz", "ax", "ay", "az" };
+
+  for (int a = 0; a < IMU_ALLAN_AXES; a++)
+    {
+      ImuAllanNoise n;
+      if (allan.noise(a, n))
+        {
+          fprintf(stderr, "%s: RW=%.3e BI=%.3e (tau=%.1f s) RRW=%.3e\n",
+                  axis[a], n.random_walk, n.bias_instability, n.tau_bias, n.rate_random_walk);
+        }
+    }
+
+  return 0;
+}
@@ -0,0 +1,219 @@
+/*
+ *  imu_bench.cpp - Per-call and per-sample cost of the hot paths.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// Build and run on Linux:
+//
+//   g++ -O2 -I../../src imu_bench.cpp ../../src/*.cpp -o imu_bench -lpthread
+//
+//   ./imu_bench [-r rate] [-f nfifos] [-s seconds]
+//
+// The read path (get / read / getAverage) runs against ImuHostDevice
+// without real-time pacing, so it measures the library and the simulated
+// driver, not the wait for samples. The compute functions run over the
+// same samples held in memory. examples/hotPathBench prints the same
+// table in cycles on the board; imu_golden checks accuracy.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "SpresenseIMU.h"
+
+#define BATCH        (64)
+#define POSES        (8)
+
+static uint64_t now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static volatile float sink;
+
+static void row(const char* name, uint64_t ns, size_t calls, size_t samples)
+{
+  printf("%-28s %12.1f %12.1f\n", name, (double)ns / calls, (double)ns / samples);
+}
+
+/****************************************************************************
+ * Read path
+ ****************************************************************************/
+static bool open_imu(ImuHostDevice& device, int rate, int nfifos)
+{
+  ImuHostSignal signal;
+  signal.gx = 0.3f;
+  signal.gyro_noise  = 0.001f;
+  signal.accel_noise = 0.01f;
+  device.setSignal(signal);
+  device.setRealtime(false);
+
+  SpresenseIMU.setDevice(&device);
+  if (SpresenseIMU.begin() < 0) return false;
+  if (!SpresenseIMU.initialize(rate, 4, 500, nfifos)) return false;
+  return SpresenseIMU.start();
+}
+
+static void close_imu()
+{
+  SpresenseIMU.stop();
+  SpresenseIMU.finalize();
+  SpresenseIMU.end();
+}
+
+int main(int argc, char** argv)
+{
+  int    rate    = 1920;
+  int    nfifos  = 4;
+  double seconds = 30;
+  int    opt;
+
+  while ((opt = getopt(argc, argv, "r:f:s:")) != -1)
+    {
+      switch (opt)
+        {
+          case 'r': rate    = atoi(optarg); break;
+          case 'f': nfifos  = atoi(optarg); break;
+          case 's': seconds = atof(optarg); break;
+          default:
+            fprintf(stderr, "usage: %s [-r rate] [-f nfifos] [-s seconds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+  if (nfifos < 1 || nfifos > 4)
+    {
+      fprintf(stderr, "nfifos must be 1 to 4\n");
+      return 1;
+    }
+
+  size_t n = (size_t)(seconds * rate) / BATCH * BATCH;
+  cxd5602pwbimu_data_t* raw = (cxd5602pwbimu_data_t*)calloc(n, sizeof(*raw));
+  if (raw == NULL || n == 0) return 1;
+
+  ImuHostDevice device;
+  if (!open_imu(device, rate, nfifos)) return 1;
+
+  printf("%zu samples at %d Hz, FIFO %d\n", n, rate, nfifos);
+  printf("%-28s %12s %12s\n", "function", "ns/call", "ns/sample");
+
+  /* get(), one sample per call: also fills raw[] for the compute rows */
+  uint64_t t = now_ns();
+  for (size_t i = 0; i < n; i++)
+    {
+      if (!SpresenseIMU.get(raw[i])) return 1;
+    }
+  row("get(sample)", now_ns() - t, n, n);
+
+  cxd5602pwbimu_data_t buf[BATCH];
+  t = now_ns();
+  for (size_t i = 0; i < n; i += BATCH)
+    {
+      if (!SpresenseIMU.get(buf, BATCH)) return 1;
+    }
+  row("get(buf, 64)", now_ns() - t, n / BATCH, n);
+
+  t = now_ns();
+  size_t got = 0, calls = 0;
+  while (got < n)
+    {
+      size_t k = SpresenseIMU.read(buf, BATCH);
+      if (k == 0) return 1;
+      got += k;
+      calls++;
+    }
+  row("read(buf, 64)", now_ns() - t, calls, got);
+
+  t = now_ns();
+  for (size_t i = 0; i < n; i += BATCH)
+    {
+      pwbImuData avg;
+      if (!SpresenseIMU.getAverage(avg, BATCH)) return 1;
+      sink = avg.data.gx;
+    }
+  row("getAverage(64)", now_ns() - t, n / BATCH, n);
+
+  ImuStats stats = SpresenseIMU.stats();
+  close_imu();
+
+  /* Compute functions over the samples read above */
+  pwbQuaternionData q;
+  t = now_ns();
+  for (size_t i = 1; i < n; i++)
+    {
+      pwbQuaternionData d;
+      SpresenseIMU.convQuaternion(d, raw[i], raw[i - 1]);
+      sink = d.q1;
+    }
+  row("convQuaternion", now_ns() - t, n - 1, n - 1);
+
+  pwbQuaternionData d;
+  SpresenseIMU.convQuaternion(d, raw[1], raw[0]);
+  t = now_ns();
+  for (size_t i = 0; i < n; i++) q = q * d;
+  sink = q.q0;
+  row("pwbQuaternionData::operator*", now_ns() - t, n, n);
+
+  t = now_ns();
+  for (size_t i = 0; i < n; i++)
+    {
+      q.q1 = raw[i].gx * 0.1f;   // a different input every call
+      pwbEulerData e = q.toEuler();
+      sink = e.yaw;
+    }
+  row("pwbQuaternionData::toEuler", now_ns() - t, n, n);
+
+  pwbQuaternionData b;
+  t = now_ns();
+  for (size_t i = 0; i < n; i += nfifos)
+    {
+      size_t k = n - i < (size_t)nfifos ? n - i : nfifos;
+      SpresenseIMU.integrateGyro(&raw[i], k, b);
+    }
+  sink = b.q0;
+  row("integrateGyro(FIFO)", now_ns() - t, (n + nfifos - 1) / nfifos, n);
+
+  /* Circle fit of POSES pose means: horizontal earth rate plus a bias */
+  pwbGyroData poses[POSES];
+  const float horizontal = 6.0e-5f, vertical = 4.0e-5f;
+  size_t fits = n / BATCH;
+  t = now_ns();
+  for (size_t k = 0; k < fits; k++)
+    {
+      for (int p = 0; p < POSES; p++)
+        {
+          float a = 2 * (float)M_PI * p / POSES;
+          poses[p].x = 1e-4f + horizontal * cosf(a) + raw[k].gx * 1e-6f;
+          poses[p].y = -2e-4f - horizontal * sinf(a);
+          poses[p].z = 3e-4f + vertical;
+        }
+      pwbGyroData bias;
+      SpresenseIMU.calcEarthsRotation(poses, POSES, &bias);
+      sink = bias.x;
+    }
+  row("calcEarthsRotation(8 poses)", now_ns() - t, fits, fits * POSES);
+
+  printf("(ns on this host; calcEarthsRotation per sample = per pose)\n");
+  stats.print();
+
+  free(raw);
+  return 0;
+}
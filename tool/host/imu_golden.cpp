@@ -0,0 +1,445 @@
+/*
+ *  imu_golden.cpp - Golden-trace regression check of the orientation and position pipelines.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// Build and run on Linux:
+//
+//   g++ -O2 -I../../src imu_golden.cpp ../../src/*.cpp -o imu_golden -lpthread
+//
+//   ./imu_golden [-r rate] [-s seconds] [-e deg] [-p m] [-t samples/s]
+//                [-w golden.csv | -g golden.csv] [imuNNN.dat]
+//
+//     -r  sampling rate of the synthetic trace (Hz)   default 1920, >= 10
+//     -s  length of the synthetic trace (s)           default 20
+//     -e  max orientation error (deg)                 default 1.0
+//     -p  max position error (m)                      default 0.5
+//     -t  min throughput of each pipeline (samples/s) default 0 (off)
+//     -w  write the outputs as the golden file of the capture (a
+//         capture file is required)
+//     -g  compare against a golden file written with -w
+//
+// The samples go through SpresenseIMU.read() on ImuHostDevice without
+// pacing, then through the same pipelines as the examples:
+//   ahrs  : SpresenseAhrs (Madgwick), gyro bias from the first 2 s
+//   gyro  : integrateGyro() per FIFO watermark, same bias
+//   ins   : convQuaternion() + ImuStaticDetector + InsIntegrator (position)
+//
+// Without a capture the trace is synthesized: 3 s still, then turns about
+// X, Y and Z with still periods in between, on the spot. The errors are
+// against the true attitude and zero displacement. With a capture (an
+// ImuLog file from rawStored or capture), the errors are against its
+// golden file. Every 0.1 s of samples is compared. The exit status is 1
+// when a threshold is exceeded, so a script can run it after a change.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "SpresenseIMU.h"
+#include "SpresenseAhrs.h"
+#include "InsIntegrator.h"
+#include "ImuAdaptive.h"
+
+#define BATCH          (64)
+#define ALIGN_SECONDS  (2)
+#define CHECKS_PER_SEC (10)
+#define GOLDEN_FIELDS  (11)   // ahrs q0..q3, gyro q0..q3, x y z
+
+static uint64_t now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double angle_deg(const double r[4], const pwbQuaternionData& q)
+{
+  double w =  r[0]*q.q0 + r[1]*q.q1 + r[2]*q.q2 + r[3]*q.q3;
+  double x =  r[0]*q.q1 - r[1]*q.q0 - r[2]*q.q3 + r[3]*q.q2;
+  double y =  r[0]*q.q2 + r[1]*q.q3 - r[2]*q.q0 - r[3]*q.q1;
+  double z =  r[0]*q.q3 - r[1]*q.q2 + r[2]*q.q1 - r[3]*q.q0;
+  return 2.0 * atan2(sqrt(x*x + y*y + z*z), fabs(w)) * 180.0 / M_PI;
+}
+
+/****************************************************************************
+ * Synthetic trace with its true attitude
+ ****************************************************************************/
+struct Truth {
+  int      rate;
+  double   q[4];
+  double*  trace;     // q per sample
+  size_t   length;
+};
+
+static void rate_of(double t, double w[3])
+{
+  /* Smooth turns: 90 deg about X, -120 about Y, 180 about Z. */
+  static const struct { double start, len, deg; int axis; } turn[] = {
+    { 3.0, 2.0,   90, 0 },
+    { 7.0, 2.0, -120, 1 },
+    { 11.0, 3.0, 180, 2 },
+  };
+  w[0] = w[1] = w[2] = 0;
+  for (size_t k = 0; k < sizeof(turn) / sizeof(turn[0]); k++)
+    {
+      double u = (t - turn[k].start) / turn[k].len;
+      if (u < 0 || u > 1) continue;
+      /* Raised cosine, integrates to deg over the turn. */
+      w[turn[k].axis] = turn[k].deg * M_PI / 180.0 / turn[k].len * (1 - cos(2 * M_PI * u));
+    }
+}
+
+static void truth_hook(ImuHostDevice& device, uint64_t index, void* arg)
+{
+  Truth* truth = (Truth*)arg;
+  double dt = 1.0 / truth->rate;
+  double w[3];
+  rate_of(index * dt, w);
+
+  if (index > 0)
+    {
+      double* r = truth->q;
+      double vx = w[0] * dt / 2, vy = w[1] * dt / 2, vz = w[2] * dt / 2;
+      double a = sqrt(vx*vx + vy*vy + vz*vz);
+      double c = cos(a), s = (a > 0) ? sin(a) / a : 1;
+      vx *= s; vy *= s; vz *= s;
+      double t0 = r[0]*c  - r[1]*vx - r[2]*vy - r[3]*vz;
+      double t1 = r[0]*vx + r[1]*c  + r[2]*vz - r[3]*vy;
+      double t2 = r[0]*vy - r[1]*vz + r[2]*c  + r[3]*vx;
+      double t3 = r[0]*vz + r[1]*vy - r[2]*vx + r[3]*c;
+      r[0] = t0; r[1] = t1; r[2] = t2; r[3] = t3;
+    }
+  if (index < truth->length) memcpy(&truth->trace[index * 4], truth->q, sizeof(truth->q));
+
+  /* Gravity in the body frame: the third row of R(q)^T times g. */
+  const double* q = truth->q;
+  ImuHostSignal signal;
+  signal.gx = w[0]; signal.gy = w[1]; signal.gz = w[2];
+  signal.ax = IMU_GRAVITY * 2 * (q[1]*q[3] - q[0]*q[2]);
+  signal.ay = IMU_GRAVITY * 2 * (q[2]*q[3] + q[0]*q[1]);
+  signal.az = IMU_GRAVITY * (q[0]*q[0] - q[1]*q[1] - q[2]*q[2] + q[3]*q[3]);
+  signal.gyro_bias[0] = 2e-3f;
+  signal.gyro_bias[1] = -1e-3f;
+  signal.gyro_bias[2] = 5e-4f;
+  signal.gyro_noise  = 2e-3f;
+  signal.accel_noise = 0.02f;
+  device.setSignal(signal);
+}
+
+/****************************************************************************
+ * Pipelines
+ ****************************************************************************/
+struct PoseSample {
+  uint32_t timestamp;
+  float q0, q1, q2, q3;
+  float ax, ay, az;
+  bool  isStatic;
+};
+
+struct Pipelines {
+  SpresenseAhrs     ahrs;
+  pwbQuaternionData gyro;
+  pwbQuaternionData ins_q;
+  InsIntegrator     ins;
+  ImuStaticDetector detector;
+  cxd5602pwbimu_data_t prev;
+  float    bias[3];
+  uint64_t ns[3];
+
+  void begin(int rate, const double gsum[3], const double asum[3], size_t n, const cxd5602pwbimu_data_t& last)
+  {
+    for (int k = 0; k < 3; k++) bias[k] = (float)(gsum[k] / n);
+    float g = (float)(sqrt(asum[0]*asum[0] + asum[1]*asum[1] + asum[2]*asum[2]) / n);
+
+    ahrs.begin(rate);
+    ahrs.setGyroBias(bias[0], bias[1], bias[2]);
+    detector.setGravity(g);
+    ins.begin(g, 0.5f);
+    prev = last;
+    ns[0] = ns[1] = ns[2] = 0;
+  }
+
+  void update(cxd5602pwbimu_data_t* s, size_t n, int nfifos)
+  {
+    uint64_t t = now_ns();
+    ahrs.update(s, n);
+    ns[0] += now_ns() - t;
+
+    t = now_ns();
+    cxd5602pwbimu_data_t c[BATCH];
+    for (size_t i = 0; i < n; i++)
+      {
+        c[i] = s[i];
+        c[i].gx -= bias[0]; c[i].gy -= bias[1]; c[i].gz -= bias[2];
+      }
+    for (size_t i = 0; i < n; i += nfifos)
+      {
+        size_t k = (n - i < (size_t)nfifos) ? n - i : nfifos;
+        SpresenseIMU.integrateGyro(&c[i], k, gyro);
+      }
+    ns[1] += now_ns() - t;
+
+    t = now_ns();
+    PoseSample p[BATCH];
+    for (size_t i = 0; i < n; i++)
+      {
+        pwbQuaternionData d;
+        SpresenseIMU.convQuaternion(d, c[i], prev);
+        ins_q = ins_q * d;
+        prev  = c[i];
+        p[i].timestamp = c[i].timestamp;
+        p[i].q0 = ins_q.q0; p[i].q1 = ins_q.q1; p[i].q2 = ins_q.q2; p[i].q3 = ins_q.q3;
+        p[i].ax = c[i].ax;  p[i].ay = c[i].ay;  p[i].az = c[i].az;
+        p[i].isStatic = detector.update(c[i]);
+      }
+    ins.update(p, n);
+    ns[2] += now_ns() - t;
+  }
+
+  void output(float v[GOLDEN_FIELDS]) const
+  {
+    pwbQuaternionData a = ahrs.getQuaternion();
+    v[0] = a.q0;    v[1] = a.q1;    v[2] = a.q2;    v[3] = a.q3;
+    v[4] = gyro.q0; v[5] = gyro.q1; v[6] = gyro.q2; v[7] = gyro.q3;
+    ins.getPosition(&v[8]);
+  }
+};
+
+/****************************************************************************
+ * Main
+ ****************************************************************************/
+int main(int argc, char** argv)
+{
+  int         rate      = 1920;
+  int         nfifos    = 4;
+  double      seconds   = 20;
+  double      max_deg   = 1.0;
+  double      max_pos   = 0.5;
+  double      min_rate  = 0;
+  const char* write_to  = NULL;
+  const char* golden_in = NULL;
+  int         opt;
+
+  while ((opt = getopt(argc, argv, "r:s:e:p:t:w:g:")) != -1)
+    {
+      switch (opt)
+        {
+          case 'r': rate      = atoi(optarg); break;
+          case 's': seconds   = atof(optarg); break;
+          case 'e': max_deg   = atof(optarg); break;
+          case 'p': max_pos   = atof(optarg); break;
+          case 't': min_rate  = atof(optarg); break;
+          case 'w': write_to  = optarg;       break;
+          case 'g': golden_in = optarg;       break;
+          default:
+            fprintf(stderr, "usage: %s [-r rate] [-s seconds] [-e deg] [-p m] [-t samples/s] "
+                            "[-w golden.csv | -g golden.csv] [file]\n", argv[0]);
+            return 1;
+        }
+    }
+
+  const char* capture = (optind < argc) ? argv[optind] : NULL;
+
+  if (rate < CHECKS_PER_SEC)
+    {
+      fprintf(stderr, "rate must be at least %d Hz\n", CHECKS_PER_SEC);
+      return 1;
+    }
+  if (write_to != NULL && golden_in != NULL)
+    {
+      fprintf(stderr, "-w and -g are exclusive\n");
+      return 1;
+    }
+  if (write_to != NULL && capture == NULL)
+    {
+      /* The synthetic trace is checked against its own truth. */
+      fprintf(stderr, "-w needs a capture file\n");
+      return 1;
+    }
+
+  ImuHostDevice device;
+  device.setRealtime(false);
+
+  Truth truth;
+  memset(&truth, 0, sizeof(truth));
+  if (capture != NULL)
+    {
+      ImuLogReader log;
+      if (!log.open(capture)) return 1;
+      if (!log.isLegacy())
+        {
+          rate   = log.info().rate;
+          nfifos = log.info().nfifos;
+        }
+      log.close();
+      if (rate < CHECKS_PER_SEC)
+        {
+          fprintf(stderr, "%s: rate %d Hz is too low\n", capture, rate);
+          return 1;
+        }
+      if (!device.replay(capture)) return 1;
+    }
+  else
+    {
+      truth.rate   = rate;
+      truth.q[0]   = 1;
+      truth.length = (size_t)(seconds * rate);
+      truth.trace  = (double*)calloc(truth.length, 4 * sizeof(double));
+      if (truth.trace == NULL) return 1;
+      device.setHook(truth_hook, &truth);
+    }
+
+  FILE* golden = NULL;
+  if (write_to != NULL && (golden = fopen(write_to, "w")) == NULL)
+    {
+      fprintf(stderr, "cannot create %s\n", write_to);
+      return 1;
+    }
+  if (golden_in != NULL && (golden = fopen(golden_in, "r")) == NULL)
+    {
+      fprintf(stderr, "cannot open %s\n", golden_in);
+      return 1;
+    }
+
+  SpresenseIMU.setDevice(&device);
+  if (SpresenseIMU.begin() < 0) return 1;
+  if (!SpresenseIMU.initialize(rate, 4, 500, nfifos)) return 1;
+  if (!SpresenseIMU.start()) return 1;
+
+  Pipelines* pipe = new Pipelines;
+  cxd5602pwbimu_data_t buf[BATCH];
+  size_t   total   = 0;
+  size_t   align   = (size_t)ALIGN_SECONDS * rate;
+  size_t   every   = rate / CHECKS_PER_SEC;
+  size_t   checks  = 0;
+  double   gsum[3] = {}, asum[3] = {};
+  double   err_deg[2] = {}, err_pos = 0;
+  uint64_t read_ns = 0;
+  bool     ok = true;
+
+  while (truth.trace == NULL || total < truth.length)
+    {
+      uint64_t t = now_ns();
+      size_t n = SpresenseIMU.read(buf, BATCH);
+      read_ns += now_ns() - t;
+      if (n == 0) break;
+
+      size_t i = 0;
+      for (; i < n && total < align; i++, total++)
+        {
+          gsum[0] += buf[i].gx; gsum[1] += buf[i].gy; gsum[2] += buf[i].gz;
+          asum[0] += buf[i].ax; asum[1] += buf[i].ay; asum[2] += buf[i].az;
+          if (total == align - 1) pipe->begin(rate, gsum, asum, align, buf[i]);
+        }
+
+      /* Split at the check points. */
+      while (i < n)
+        {
+          size_t k = every - (total % every);
+          if (k > n - i) k = n - i;
+          pipe->update(&buf[i], k, nfifos);
+          i += k;
+          total += k;
+          if (total % every != 0) continue;
+
+          float v[GOLDEN_FIELDS];
+          pipe->output(v);
+          double e[2], p;
+          checks++;
+
+          if (truth.trace != NULL)
+            {
+              const double* r = &truth.trace[(total - 1) * 4];
+              pwbQuaternionData a(v[0], v[1], v[2], v[3]), g(v[4], v[5], v[6], v[7]);
+              e[0] = angle_deg(r, a);
+              e[1] = angle_deg(r, g);
+              p = sqrt(v[8]*v[8] + v[9]*v[9] + v[10]*v[10]);
+            }
+          else if (golden_in != NULL)
+            {
+              unsigned long index;
+              double ref[GOLDEN_FIELDS];
+              int got = fscanf(golden, "%lu,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf\n", &index,
+                               &ref[0], &ref[1], &ref[2], &ref[3], &ref[4], &ref[5],
+                               &ref[6], &ref[7], &ref[8], &ref[9], &ref[10]);
+              if (got != GOLDEN_FIELDS + 1 || index != total)
+                {
+                  fprintf(stderr, "golden file does not match the capture at sample %zu\n", total);
+                  return 1;
+                }
+              pwbQuaternionData a(v[0], v[1], v[2], v[3]), g(v[4], v[5], v[6], v[7]);
+              e[0] = angle_deg(&ref[0], a);
+              e[1] = angle_deg(&ref[4], g);
+              p = sqrt((v[8] - ref[8]) * (v[8] - ref[8]) + (v[9] - ref[9]) * (v[9] - ref[9]) +
+                       (v[10] - ref[10]) * (v[10] - ref[10]));
+            }
+          else
+            {
+              e[0] = e[1] = p = 0;
+              if (golden != NULL)
+                {
+                  fprintf(golden, "%zu", total);
+                  for (int f = 0; f < GOLDEN_FIELDS; f++) fprintf(golden, ",%.9g", v[f]);
+                  fprintf(golden, "\n");
+                }
+            }
+
+          if (e[0] > err_deg[0]) err_deg[0] = e[0];
+          if (e[1] > err_deg[1]) err_deg[1] = e[1];
+          if (p > err_pos) err_pos = p;
+        }
+    }
+
+  SpresenseIMU.stop();
+  SpresenseIMU.finalize();
+  SpresenseIMU.end();
+  if (golden != NULL) fclose(golden);
+
+  size_t run = (total > align) ? total - align : 0;
+  if (run == 0 || checks == 0)
+    {
+      fprintf(stderr, "trace too short (%zu samples)\n", total);
+      return 1;
+    }
+
+  printf("%s: %zu samples at %d Hz, FIFO %d, %zu checks\n",
+         capture ? capture : "synthetic", total, rate, nfifos, checks);
+  printf("%-6s %12s %14s\n", "stage", "max error", "samples/s");
+  printf("%-6s %12s %14.0f\n", "read", "", total * 1e9 / read_ns);
+
+  static const char* name[3] = { "ahrs", "gyro", "ins" };
+  bool checked = (truth.trace != NULL) || (golden_in != NULL);
+  for (int k = 0; k < 3; k++)
+    {
+      double throughput = run * 1e9 / (pipe->ns[k] ? pipe->ns[k] : 1);
+      double err  = (k < 2) ? err_deg[k] : err_pos;
+      double max  = (k < 2) ? max_deg : max_pos;
+      bool   pass = (!checked || err <= max) && throughput >= min_rate;
+      printf("%-6s %9.4f %-2s %14.0f  %s\n", name[k], err, (k < 2) ? "dg" : "m",
+             throughput, pass ? "PASS" : "FAIL");
+      if (!pass) ok = false;
+    }
+  if (!checked) printf("(no reference: errors not checked%s)\n", write_to ? ", golden file written" : "");
+
+  delete pipe;
+  free(truth.trace);
+  return ok ? 0 : 1;
+}
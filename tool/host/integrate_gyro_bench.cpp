@@ -0,0 +1,144 @@
+/*
+ *  integrate_gyro_bench.cpp - Accuracy and speed of integrateGyro() against
+ *                             convQuaternion() + operator*.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// Build and run on Linux:
+//
+//   g++ -O2 -I../../src integrate_gyro_bench.cpp ../../src/*.cpp -o integrate_gyro_bench -lpthread
+//
+//   ./integrate_gyro_bench [-r rate] [-s seconds] [-b batch]
+//
+// The gyro signal is a slow tumble plus a 5 Hz wobble. The reference is the
+// same per-sample exponential update in double precision. The same
+// comparison runs on the board in examples/integrateGyroBench.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "SpresenseIMU.h"
+
+static uint64_t now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void gyro(double t, cxd5602pwbimu_data_t& s)
+{
+  s.gx = 0.8 + 1.5 * sin(2 * M_PI * 5.0 * t);
+  s.gy = -0.4 + 1.5 * cos(2 * M_PI * 5.0 * t);
+  s.gz = 2.0 * sin(2 * M_PI * 0.2 * t);
+}
+
+static double error_deg(const double r[4], const pwbQuaternionData& q)
+{
+  /* Angle of conj(r) * q, robust for tiny errors. */
+  double w =  r[0]*q.q0 + r[1]*q.q1 + r[2]*q.q2 + r[3]*q.q3;
+  double x =  r[0]*q.q1 - r[1]*q.q0 - r[2]*q.q3 + r[3]*q.q2;
+  double y =  r[0]*q.q2 + r[1]*q.q3 - r[2]*q.q0 - r[3]*q.q1;
+  double z =  r[0]*q.q3 - r[1]*q.q2 + r[2]*q.q1 - r[3]*q.q0;
+  return 2.0 * atan2(sqrt(x*x + y*y + z*z), fabs(w)) * 180.0 / M_PI;
+}
+
+int main(int argc, char** argv)
+{
+  int    rate    = 1920;
+  double seconds = 60;
+  int    batch   = 4;
+  int    opt;
+
+  while ((opt = getopt(argc, argv, "r:s:b:")) != -1)
+    {
+      switch (opt)
+        {
+          case 'r': rate    = atoi(optarg); break;
+          case 's': seconds = atof(optarg); break;
+          case 'b': batch   = atoi(optarg); break;
+          default:
+            fprintf(stderr, "usage: %s [-r rate] [-s seconds] [-b batch]\n", argv[0]);
+            return 1;
+        }
+    }
+
+  size_t n = (size_t)(seconds * rate);
+  uint32_t period = 19200000 / rate;
+  double dt = 1.0 / rate;
+
+  cxd5602pwbimu_data_t* in = (cxd5602pwbimu_data_t*)calloc(n, sizeof(*in));
+  if (in == NULL) return 1;
+  for (size_t i = 0; i < n; i++)
+    {
+      in[i].timestamp = (uint32_t)(i + 1) * period;
+      in[i].temp = 25;
+      gyro(i * dt, in[i]);
+    }
+
+  /* Reference: double precision, exact exponential per sample. */
+  double r[4] = {1, 0, 0, 0};
+  for (size_t i = 0; i < n; i++)
+    {
+      double vx = in[i].gx * dt / 2, vy = in[i].gy * dt / 2, vz = in[i].gz * dt / 2;
+      double a = sqrt(vx*vx + vy*vy + vz*vz);
+      double c = cos(a), s = (a > 0) ? sin(a) / a : 1;
+      vx *= s; vy *= s; vz *= s;
+      double t0 = r[0]*c  - r[1]*vx - r[2]*vy - r[3]*vz;
+      double t1 = r[0]*vx + r[1]*c  + r[2]*vz - r[3]*vy;
+      double t2 = r[0]*vy - r[1]*vz + r[2]*c  + r[3]*vx;
+      double t3 = r[0]*vz + r[1]*vy - r[2]*vx + r[3]*c;
+      r[0] = t0; r[1] = t1; r[2] = t2; r[3] = t3;
+    }
+
+  /* Per-sample path used by the examples. */
+  pwbQuaternionData a;
+  cxd5602pwbimu_data_t last = in[0];
+  last.timestamp -= 19200000 / rate;
+  uint64_t t = now_ns();
+  for (size_t i = 0; i < n; i++)
+    {
+      pwbQuaternionData d;
+      SpresenseIMU.convQuaternion(d, in[i], last);
+      a = a * d;
+      last = in[i];
+    }
+  double conv_ns = (double)(now_ns() - t) / n;
+
+  /* Batch kernel with the nominal step. */
+  pwbQuaternionData b;
+  t = now_ns();
+  for (size_t i = 0; i < n; i += batch)
+    {
+      size_t m = (n - i < (size_t)batch) ? n - i : batch;
+      SpresenseIMU.integrateGyro(&in[i], m, b, (float)dt);
+    }
+  double batch_ns = (double)(now_ns() - t) / n;
+
+  printf("samples %zu at %d Hz (%.0f s), batch %d\n", n, rate, seconds, batch);
+  printf("%-28s %10s %12s %12s\n", "path", "ns/sample", "error(deg)", "|q|-1");
+  printf("%-28s %10.1f %12.6f %12.2e\n", "convQuaternion + operator*", conv_ns, error_deg(r, a),
+         sqrt((double)a.q0*a.q0 + a.q1*a.q1 + a.q2*a.q2 + a.q3*a.q3) - 1);
+  printf("%-28s %10.1f %12.6f %12.2e\n", "integrateGyro", batch_ns, error_deg(r, b),
+         sqrt((double)b.q0*b.q0 + b.q1*b.q1 + b.q2*b.q2 + b.q3*b.q3) - 1);
+
+  free(in);
+  return 0;
+}
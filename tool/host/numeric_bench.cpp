@@ -0,0 +1,249 @@
+/*
+ *  numeric_bench.cpp - Kernels under the float / double / Q16.16 policies.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// Build and run on Linux:
+//
+//   g++ -O2 -I../../src numeric_bench.cpp ../../src/*.cpp -o numeric_bench -lpthread
+//
+//   ./numeric_bench [-r rate] [-s seconds]
+//
+// Accuracy of each policy against a double reference, and ns/sample on
+// the host. A PC has a double FPU, so the cost of soft double only shows
+// on the board: examples/numericBench prints the same table in cycles.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "SpresenseIMU.h"
+#include "ImuKernels.h"
+#include "GyroCompass.h"
+
+#define AVERAGE_BLOCK  (64)
+#define FIR_RATIO      (8)
+#define FIR_TAPS       (8 * FIR_RATIO)
+#define QUAT_BATCH     (4)
+
+static uint64_t now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+struct Reference {
+  double  q[4];
+  double* avg;        // az mean per block
+  double* fir;        // gx per output
+  double  mean[3];    // gyro mean of all samples
+  float   coef[FIR_TAPS];
+};
+
+struct Result {
+  double ns[4];
+  double err[4];
+};
+
+static double noise(double amplitude)
+{
+  return amplitude * (rand() / (double)RAND_MAX - 0.5);
+}
+
+static double error_deg(const double r[4], const pwbQuaternionData& q)
+{
+  double w =  r[0]*q.q0 + r[1]*q.q1 + r[2]*q.q2 + r[3]*q.q3;
+  double x =  r[0]*q.q1 - r[1]*q.q0 - r[2]*q.q3 + r[3]*q.q2;
+  double y =  r[0]*q.q2 + r[1]*q.q3 - r[2]*q.q0 - r[3]*q.q1;
+  double z =  r[0]*q.q3 - r[1]*q.q2 + r[2]*q.q1 - r[3]*q.q0;
+  return 2.0 * atan2(sqrt(x*x + y*y + z*z), fabs(w)) * 180.0 / M_PI;
+}
+
+template<typename T>
+static Result run(const cxd5602pwbimu_data_t* raw, size_t n, float dt, const Reference& ref)
+{
+  typedef ImuNumeric<T> N;
+  Result res;
+
+  pwbImuDataT<T>* s = new pwbImuDataT<T>[n];
+  imuConvert(raw, n, s);
+
+  /* Average */
+  size_t blocks = n / AVERAGE_BLOCK;
+  pwbImuDataT<T>* avg = new pwbImuDataT<T>[blocks];
+  uint64_t t = now_ns();
+  for (size_t b = 0; b < blocks; b++) imuAverage(&s[b * AVERAGE_BLOCK], AVERAGE_BLOCK, avg[b]);
+  res.ns[0] = (double)(now_ns() - t) / (blocks * AVERAGE_BLOCK);
+  res.err[0] = 0;
+  for (size_t b = 0; b < blocks; b++)
+    {
+      double e = fabs(N::toDouble(avg[b].az) - ref.avg[b]);
+      if (e > res.err[0]) res.err[0] = e;
+    }
+  delete[] avg;
+
+  /* Quaternion update */
+  pwbQuaternionT<T> q;
+  t = now_ns();
+  for (size_t i = 0; i + QUAT_BATCH <= n; i += QUAT_BATCH) imuIntegrateGyro(&s[i], QUAT_BATCH, q, dt);
+  res.ns[1] = (double)(now_ns() - t) / n;
+  pwbQuaternionData qf;
+  q.to(qf);
+  res.err[1] = error_deg(ref.q, qf);
+
+  /* FIR, one output per FIR_RATIO inputs */
+  T coef[FIR_TAPS];
+  for (int k = 0; k < FIR_TAPS; k++) coef[k] = N::from(ref.coef[k]);
+  size_t outs = 0;
+  res.err[2] = 0;
+  t = now_ns();
+  for (size_t i = 0; i + FIR_TAPS <= n; i += FIR_RATIO, outs++)
+    {
+      typename N::Acc acc[6] = {};
+      imuFirDot(coef, &s[i], FIR_TAPS, acc);
+      double e = fabs(N::toDouble(N::fromProd(acc[0])) - ref.fir[outs]);
+      if (e > res.err[2]) res.err[2] = e;
+    }
+  res.ns[2] = (double)(now_ns() - t) / (outs * FIR_RATIO);
+
+  /* Gyrocompass pose accumulation */
+  GyroCompassT<T> gc;
+  gc.setConvergence(0, n, n);
+  t = now_ns();
+  for (size_t i = 0; i < n; i++) gc.addSample(s[i]);
+  res.ns[3] = (double)(now_ns() - t) / n;
+  pwbGyroData m = gc.poseMean();
+  res.err[3] = fabs(m.x - ref.mean[0]);
+  if (fabs(m.y - ref.mean[1]) > res.err[3]) res.err[3] = fabs(m.y - ref.mean[1]);
+
+  delete[] s;
+  return res;
+}
+
+static void print(const char* name, const Result& r)
+{
+  printf("%-8s", name);
+  for (int k = 0; k < 4; k++) printf(" %9.1f %10.2e", r.ns[k], r.err[k]);
+  printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+  int    rate    = 1920;
+  double seconds = 60;
+  int    opt;
+
+  while ((opt = getopt(argc, argv, "r:s:")) != -1)
+    {
+      switch (opt)
+        {
+          case 'r': rate    = atoi(optarg); break;
+          case 's': seconds = atof(optarg); break;
+          default:
+            fprintf(stderr, "usage: %s [-r rate] [-s seconds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+  size_t n = (size_t)(seconds * rate);
+  double dt = 1.0 / rate;
+
+  /* Tumbling gyro as in integrate_gyro_bench, with sensor noise. */
+  cxd5602pwbimu_data_t* raw = (cxd5602pwbimu_data_t*)calloc(n, sizeof(*raw));
+  if (raw == NULL) return 1;
+  srand(1);
+  for (size_t i = 0; i < n; i++)
+    {
+      double ti = i * dt;
+      raw[i].timestamp = (uint32_t)((i + 1) * (19200000 / rate));
+      raw[i].temp = 25;
+      raw[i].gx = 0.8 + 1.5 * sin(2 * M_PI * 5.0 * ti) + noise(2e-3);
+      raw[i].gy = -0.4 + 1.5 * cos(2 * M_PI * 5.0 * ti) + noise(2e-3);
+      raw[i].gz = 2.0 * sin(2 * M_PI * 0.2 * ti) + noise(2e-3);
+      raw[i].ax = 0.2 * sin(2 * M_PI * 3.0 * ti);
+      raw[i].ay = 0.05;
+      raw[i].az = 9.8 + noise(0.02);
+    }
+
+  /* Double references */
+  Reference ref;
+
+  size_t blocks = n / AVERAGE_BLOCK;
+  ref.avg = new double[blocks];
+  for (size_t b = 0; b < blocks; b++)
+    {
+      double sum = 0;
+      for (int i = 0; i < AVERAGE_BLOCK; i++) sum += raw[b * AVERAGE_BLOCK + i].az;
+      ref.avg[b] = sum / AVERAGE_BLOCK;
+    }
+
+  ref.q[0] = 1; ref.q[1] = ref.q[2] = ref.q[3] = 0;
+  for (size_t i = 0; i < n / QUAT_BATCH * QUAT_BATCH; i++)
+    {
+      double vx = raw[i].gx * dt / 2, vy = raw[i].gy * dt / 2, vz = raw[i].gz * dt / 2;
+      double a = sqrt(vx*vx + vy*vy + vz*vz);
+      double c = cos(a), s = (a > 0) ? sin(a) / a : 1;
+      double* r = ref.q;
+      vx *= s; vy *= s; vz *= s;
+      double t0 = r[0]*c  - r[1]*vx - r[2]*vy - r[3]*vz;
+      double t1 = r[0]*vx + r[1]*c  + r[2]*vz - r[3]*vy;
+      double t2 = r[0]*vy - r[1]*vz + r[2]*c  + r[3]*vx;
+      double t3 = r[0]*vz + r[1]*vy - r[2]*vx + r[3]*c;
+      r[0] = t0; r[1] = t1; r[2] = t2; r[3] = t3;
+    }
+
+  double sum = 0;
+  for (int k = 0; k < FIR_TAPS; k++)
+    {
+      double x = k - 0.5 * (FIR_TAPS - 1);
+      double fc = 0.45 / FIR_RATIO;
+      double h = (x == 0) ? 2 * fc : sin(2 * M_PI * fc * x) / (M_PI * x);
+      double w = 2 * M_PI * k / (FIR_TAPS - 1);
+      ref.coef[k] = (float)(h * (0.42 - 0.5 * cos(w) + 0.08 * cos(2 * w)));
+      sum += ref.coef[k];
+    }
+  for (int k = 0; k < FIR_TAPS; k++) ref.coef[k] = (float)(ref.coef[k] / sum);
+
+  ref.fir = new double[n / FIR_RATIO + 1];
+  size_t outs = 0;
+  for (size_t i = 0; i + FIR_TAPS <= n; i += FIR_RATIO)
+    {
+      double acc = 0;
+      for (int k = 0; k < FIR_TAPS; k++) acc += (double)ref.coef[k] * raw[i + k].gx;
+      ref.fir[outs++] = acc;
+    }
+
+  double m[3] = { 0, 0, 0 };
+  for (size_t i = 0; i < n; i++) { m[0] += raw[i].gx; m[1] += raw[i].gy; m[2] += raw[i].gz; }
+  for (int k = 0; k < 3; k++) ref.mean[k] = m[k] / n;
+
+  printf("samples %zu at %d Hz (%.0f s)\n", n, rate, seconds);
+  printf("%-8s %9s %10s %9s %10s %9s %10s %9s %10s\n", "policy",
+         "average", "|az| err", "quat", "err(deg)", "fir", "|gx| err", "compass", "|mean| err");
+  print("float",  run<float>(raw, n, (float)dt, ref));
+  print("double", run<double>(raw, n, (float)dt, ref));
+  print("Q16.16", run<ImuQ16>(raw, n, (float)dt, ref));
+  printf("(ns/sample on this host, error against the double reference)\n");
+
+  delete[] ref.avg;
+  delete[] ref.fir;
+  free(raw);
+  return 0;
+}
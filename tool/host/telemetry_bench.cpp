@@ -0,0 +1,232 @@
+/*
+ *  telemetry_bench.cpp - Size and speed of the binary telemetry against
+ *                        the CSV text of the Processing samples.
+ *  Author Interested-In-Spresense
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+// Build and run on Linux:
+//
+//   g++ -O2 -I../../src telemetry_bench.cpp ../../src/*.cpp -o telemetry_bench -lpthread
+//
+//   ./telemetry_bench [-n samples] [-b batch] [-e error_rate]
+//   ./telemetry_bench -f capture.bin > out.csv
+//
+//     -n  synthetic samples (1920 Hz)     default 1000000
+//     -b  samples per frame               default 8
+//     -e  probability of corrupting a byte on the "link" (decoder test)
+//     -f  decode a raw capture of the serial port to CSV instead
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "ImuTelemetry.h"
+
+static uint64_t now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+class VectorStream : public ImuLogStream {
+public:
+  std::vector<uint8_t> data;
+  size_t write(const void* buf, size_t len) {
+    data.insert(data.end(), (const uint8_t*)buf, (const uint8_t*)buf + len);
+    return len;
+  }
+};
+
+struct Check {
+  const std::vector<cxd5602pwbimu_data_t>* ref;
+  size_t next;
+  double max_err;
+};
+
+static void on_frame(const ImuTelemetryFrame& f, void* arg)
+{
+  Check* c = (Check*)arg;
+  for (int i = 0; i < f.count(); i++)
+    {
+      cxd5602pwbimu_data_t s;
+      f.sample(i, s);
+
+      /* Resynchronize on the timestamp after lost frames. */
+      while (c->next < c->ref->size() && (*c->ref)[c->next].timestamp != s.timestamp) c->next++;
+      if (c->next >= c->ref->size()) return;
+
+      const cxd5602pwbimu_data_t& r = (*c->ref)[c->next++];
+      double e = fabs(r.gx - s.gx);
+      if (fabs(r.az - s.az) > e) e = fabs(r.az - s.az);
+      if (e > c->max_err) c->max_err = e;
+    }
+}
+
+static void print_frame(const ImuTelemetryFrame& f, void*)
+{
+  for (int i = 0; i < f.count(); i++)
+    {
+      cxd5602pwbimu_data_t s;
+      float r[IMU_TLM_MAX_FIELDS];
+
+      if (f.sample(i, s))
+        {
+          printf("%.6f,%.2f,%f,%f,%f,%f,%f,%f\n", s.timestamp / 19200000.0, s.temp,
+                 s.ax, s.ay, s.az, s.gx, s.gy, s.gz);
+        }
+      else if (f.record(i, r))
+        {
+          for (int k = 0; k < f.header->fields; k++) printf(k ? ",%f" : "%f", r[k]);
+          printf("\n");
+        }
+    }
+}
+
+static int decode_file(const char* path)
+{
+  FILE* fp = fopen(path, "rb");
+  if (fp == NULL)
+    {
+      fprintf(stderr, "cannot open %s\n", path);
+      return 1;
+    }
+
+  ImuTelemetryDecoder dec;
+  dec.setHandler(print_frame);
+
+  uint8_t buf[4096];
+  size_t  n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) dec.feed(buf, n);
+  fclose(fp);
+
+  const ImuTelemetryStats& st = dec.stats();
+  fprintf(stderr, "frames %lu, samples %lu, crc errors %lu, format errors %lu, lost frames %lu\n",
+          (unsigned long)st.frames, (unsigned long)st.samples, (unsigned long)st.crc_errors,
+          (unsigned long)st.format_errors, (unsigned long)st.lost_frames);
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  long   samples = 1000000;
+  int    batch   = 8;
+  double error   = 0;
+  int    opt;
+
+  while ((opt = getopt(argc, argv, "n:b:e:f:")) != -1)
+    {
+      switch (opt)
+        {
+          case 'n': samples = atol(optarg); break;
+          case 'b': batch   = atoi(optarg); break;
+          case 'e': error   = atof(optarg); break;
+          case 'f': return decode_file(optarg);
+          default:
+            fprintf(stderr, "usage: %s [-n samples] [-b batch] [-e error_rate] | -f capture.bin\n", argv[0]);
+            return 1;
+        }
+    }
+
+  std::vector<cxd5602pwbimu_data_t> ref(samples);
+  srand(1);
+  for (long i = 0; i < samples; i++)
+    {
+      double t = i / 1920.0;
+      cxd5602pwbimu_data_t& s = ref[i];
+      s.timestamp = (uint32_t)(i * 10000u + (rand() % 21) - 10);
+      s.temp = 30.0f + 0.001f * (i % 1000);
+      s.gx = 0.5f * sinf(2 * M_PI * 1.3 * t);
+      s.gy = 0.01f * (rand() / (float)RAND_MAX - 0.5f);
+      s.gz = -0.2f;
+      s.ax = 0.3f * cosf(2 * M_PI * 0.7 * t);
+      s.ay = 0.05f;
+      s.az = 9.8f + 0.02f * (rand() / (float)RAND_MAX - 0.5f);
+    }
+
+  /* CSV as sent by UsbSerial.print(value) (2 decimals) */
+  {
+    char     line[128];
+    size_t   bytes = 0;
+    uint64_t t0    = now_ns();
+    for (long i = 0; i < samples; i++)
+      {
+        const cxd5602pwbimu_data_t& s = ref[i];
+        bytes += snprintf(line, sizeof(line), "%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f\r\n",
+                          s.timestamp / 19200000.0f, s.temp, s.ax, s.ay, s.az, s.gx, s.gy, s.gz);
+      }
+    double ns = (double)(now_ns() - t0) / samples;
+    printf("csv     : %6.1f bytes/sample  %6.1f ns/sample  %7.0f kbit/s at 1920 Hz\n",
+           (double)bytes / samples, ns, bytes * 8.0 / samples * 1920 / 1000);
+  }
+
+  for (int q = 0; q < 2; q++)
+    {
+      VectorStream out;
+      ImuTelemetry tlm;
+      tlm.begin(out, batch, q != 0);
+
+      uint64_t t0 = now_ns();
+      tlm.write(&ref[0], samples);
+      tlm.flush();
+      double enc_ns = (double)(now_ns() - t0) / samples;
+
+      /* Link errors */
+      size_t corrupted = 0;
+      if (error > 0)
+        {
+          for (size_t i = 0; i < out.data.size(); i++)
+            {
+              if (rand() < error * RAND_MAX)
+                {
+                  out.data[i] ^= 1 << (rand() % 8);
+                  corrupted++;
+                }
+            }
+        }
+
+      Check chk = { &ref, 0, 0 };
+      ImuTelemetryDecoder dec;
+      dec.setHandler(on_frame, &chk);
+
+      t0 = now_ns();
+      for (size_t i = 0; i < out.data.size(); i += 512)
+        {
+          size_t n = out.data.size() - i;
+          dec.feed(&out.data[i], n < 512 ? n : 512);
+        }
+      double dec_ns = (double)(now_ns() - t0) / samples;
+
+      const ImuTelemetryStats& st = dec.stats();
+      printf("%s : %6.1f bytes/sample  %6.1f ns/sample  %7.0f kbit/s  decode %5.1f ns/sample  max err %.2e\n",
+             q ? "q16    " : "raw    ", (double)out.data.size() / samples, enc_ns,
+             out.data.size() * 8.0 / samples * 1920 / 1000, dec_ns, chk.max_err);
+      if (error > 0)
+        {
+          printf("          corrupted bytes %zu: crc errors %lu, format errors %lu, lost frames %lu, samples %lu/%ld\n",
+                 corrupted, (unsigned long)st.crc_errors, (unsigned long)st.format_errors,
+                 (unsigned long)st.lost_frames, (unsigned long)st.samples, samples);
+        }
+    }
+
+  return 0;
+}
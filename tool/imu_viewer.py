@@ -1,43 +1,127 @@
 import struct
 import sys
+import argparse
 
-# コマンドライン引数からファイル名を取得
-if len(sys.argv) != 2:
-    print("使用法: python script.py <ファイル名>")
-    sys.exit(1)
-
-file_path = sys.argv[1]
-
-try:
-    # バイナリファイルを読み込む
-    with open(file_path, "rb") as f:
-        while True:
-            # バイナリデータを読み込む
-            data = f.read(4 + 4 * 7)  # 4バイト (uint32_t) + 4バイト * 7 (float)
-            
-            # ファイルの終端に達した場合はループを終了
-            if len(data) == 0:
+# ImuLog.h と同じレイアウト
+TICKS_PER_SEC = 19200000.0
+MAGIC = b"SIMU"
+BLOCK_SYNC = 0x4B4C4253
+TRAILER_SYNC = 0x58444953
+RAW, PACKED16 = 0, 1
+
+HEADER = struct.Struct("<4sHHHBBHHHHI3ffffI12x")  # 64 bytes
+BLOCK = struct.Struct("<IIHHI")                   # 16 bytes
+SAMPLE = struct.Struct("<I7f")                    # 32 bytes
+PACKED = struct.Struct("<h7h")                    # 16 bytes
+INDEX = struct.Struct("<QII")                     # 16 bytes
+TRAILER = struct.Struct("<IIII")                  # 16 bytes
+
+
+class ImuLog:
+    """SIMU 形式 (ImuLogWriter) と従来のヘッダなし .dat の両方を読む"""
+
+    def __init__(self, data):
+        self.data = data
+        self.index = []
+        self.legacy = data[:4] != MAGIC
+        if self.legacy:
+            self.rate = None
+            self.body = 0
+            return
+
+        h = HEADER.unpack_from(data, 0)
+        (_, self.version, header_size, _, self.encoding, _, self.rate,
+         self.adrange, self.gdrange, self.nfifos, self.block_samples) = h[:11]
+        self.gyro_bias = h[11:14]
+        self.accel_lsb, self.gyro_lsb, self.temp_lsb = h[14:17]
+        self.period = int(TICKS_PER_SEC) // max(self.rate, 1)
+        self.body = header_size
+
+        # 末尾のインデックス (正常に close されたファイルのみ)
+        if len(data) >= self.body + TRAILER.size:
+            sync, entries, offset, _ = TRAILER.unpack_from(data, len(data) - TRAILER.size)
+            if sync == TRAILER_SYNC:
+                self.index = [INDEX.unpack_from(data, offset + i * INDEX.size)
+                              for i in range(entries)]
+
+    def blocks(self, offset):
+        """offset 以降のブロックを (samples) として返す"""
+        if self.legacy:
+            n = (len(self.data) - offset) // SAMPLE.size
+            yield list(SAMPLE.iter_unpack(self.data[offset:offset + n * SAMPLE.size]))
+            return
+
+        while offset + BLOCK.size <= len(self.data):
+            sync, _, count, encoding, nbytes = BLOCK.unpack_from(self.data, offset)
+            if sync != BLOCK_SYNC or offset + BLOCK.size + nbytes > len(self.data):
+                break   # 電源断などで途中までのブロック
+            p = offset + BLOCK.size
+            first = SAMPLE.unpack_from(self.data, p)
+            out = [first]
+            if encoding == PACKED16:
+                ts = first[0]
+                for dt, t, gx, gy, gz, ax, ay, az in PACKED.iter_unpack(
+                        self.data[p + SAMPLE.size:p + nbytes]):
+                    ts = (ts + self.period + dt) & 0xFFFFFFFF
+                    out.append((ts, t * self.temp_lsb,
+                                gx * self.gyro_lsb, gy * self.gyro_lsb, gz * self.gyro_lsb,
+                                ax * self.accel_lsb, ay * self.accel_lsb, az * self.accel_lsb))
+            else:
+                out.extend(SAMPLE.iter_unpack(self.data[p + SAMPLE.size:p + nbytes]))
+            yield out
+            offset = p + nbytes
+
+    def samples(self, start=0.0, end=None):
+        """(開始からの秒数, sample) を返す。インデックスで start 付近へ直接移動する"""
+        offset, ticks = self.body, 0
+        target = int(start * TICKS_PER_SEC)
+        for t, off, _ in self.index:
+            if t > target:
                 break
+            offset, ticks = off, t
+
+        last = None
+        for block in self.blocks(offset):
+            for s in block:
+                if last is not None:
+                    ticks += (s[0] - last) & 0xFFFFFFFF
+                last = s[0]
+                sec = ticks / TICKS_PER_SEC
+                if end is not None and sec > end:
+                    return
+                if ticks >= target:
+                    yield sec, s
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Spresense IMU ログを CSV で表示")
+    parser.add_argument("file")
+    parser.add_argument("-s", "--start", type=float, default=0.0, help="開始時刻 [s]")
+    parser.add_argument("-e", "--end", type=float, default=None, help="終了時刻 [s]")
+    parser.add_argument("-i", "--info", action="store_true", help="ヘッダ情報のみ表示")
+    args = parser.parse_args()
+
+    try:
+        with open(args.file, "rb") as f:
+            log = ImuLog(f.read())
+    except FileNotFoundError:
+        print(f"エラー: ファイル '{args.file}' が見つかりません。")
+        sys.exit(1)
+
+    if args.info:
+        if log.legacy:
+            print("format : legacy (ヘッダなし)")
+        else:
+            print(f"format : SIMU v{log.version} {'packed16' if log.encoding == PACKED16 else 'raw'}")
+            print(f"rate   : {log.rate} Hz, accel {log.adrange} G, gyro {log.gdrange} dps, fifo {log.nfifos}")
+            print(f"bias   : {log.gyro_bias[0]:.6f},{log.gyro_bias[1]:.6f},{log.gyro_bias[2]:.6f}")
+            print(f"index  : {len(log.index)} entries")
+        return
+
+    out = sys.stdout
+    for sec, (ts, temp, gx, gy, gz, ax, ay, az) in log.samples(args.start, args.end):
+        out.write(f"{sec:4.6f},{temp:4.2f},{gx:4.2f},{gy:4.2f},{gz:4.2f},{ax:4.2f},{ay:4.2f},{az:4.2f}\n")
+
 
-            # 必要なデータが読み込まれているか確認
-            if len(data) != 4 + 4 * 7:
-                raise ValueError("ファイルのデータ長が予想と一致しません")
-
-            # バイナリデータを指定された型にアンパック
-            unpacked_data = struct.unpack('I 7f', data)
-            
-            timestamp = unpacked_data[0]
-            temp = unpacked_data[1]
-            gx, gy, gz = unpacked_data[2:5]
-            ax, ay, az = unpacked_data[5:8]
-
-            # timestampを19200000.0で割る
-            timestamp = timestamp / 19200000.0
-
-            # printf 形式で出力
-            print(f"{timestamp:4.6f},{temp:4.2f},{gx:4.2f},{gy:4.2f},{gz:4.2f},{ax:4.2f},{ay:4.2f},{az:4.2f}")
-        
-except FileNotFoundError:
-    print(f"エラー: ファイル '{file_path}' が見つかりません。")
-except ValueError as e:
-    print(f"エラー: {e}")
+if __name__ == "__main__":
+    main()